@@ -128,7 +128,7 @@ api_epg_grid
   int i;
   epg_query_result_t eqr;
   const char *ch, *tag, *title, *lang/*, *genre*/;
-  uint32_t start, limit, end;
+  uint32_t start, limit;
   htsmsg_t *l = NULL, *e;
   int min_duration;
   int max_duration;
@@ -152,14 +152,12 @@ api_epg_grid
 
   /* Query the EPG */
   pthread_mutex_lock(&global_lock); 
-  epg_query(&eqr, ch, tag, NULL, /*genre,*/ title, lang, min_duration, max_duration);
-  epg_query_sort(&eqr);
+  epg_query_paged(&eqr, ch, tag, NULL, /*genre,*/ title, lang,
+                  min_duration, max_duration, start, limit);
   // TODO: optional sorting
 
   /* Build response */
-  start = MIN(eqr.eqr_entries, start);
-  end   = MIN(eqr.eqr_entries, start + limit);
-  for (i = start; i < end; i++) {
+  for (i = 0; i < eqr.eqr_entries; i++) {
     if (!(e = api_epg_entry(eqr.eqr_array[i], lang))) continue;
     if (!l) l = htsmsg_create_list();
     htsmsg_add_msg(l, NULL, e);
@@ -167,8 +165,10 @@ api_epg_grid
 
   pthread_mutex_unlock(&global_lock);
 
+  epg_query_free(&eqr);
+
   /* Build response */
-  htsmsg_add_u32(*resp, "totalCount", eqr.eqr_entries);
+  htsmsg_add_u32(*resp, "totalCount", eqr.eqr_total);
   if (l)
     htsmsg_add_msg(*resp, "events", l);
 
@@ -26,6 +26,8 @@
 #include "api.h"
 #include "tcp.h"
 #include "input.h"
+#include "streaming.h"
+#include "muxer/muxer_io.h"
 
 static int
 api_status_inputs
@@ -90,12 +92,41 @@ api_status_connections
   return 0;
 }
 
+static int
+api_status_timers
+  ( void *opaque, const char *op, htsmsg_t *args, htsmsg_t **resp )
+{
+  pthread_mutex_lock(&global_lock);
+  *resp = gtimer_stats();
+  pthread_mutex_unlock(&global_lock);
+  return 0;
+}
+
+static int
+api_status_queues
+  ( void *opaque, const char *op, htsmsg_t *args, htsmsg_t **resp )
+{
+  *resp = streaming_queue_stats();
+  return 0;
+}
+
+static int
+api_status_diskio
+  ( void *opaque, const char *op, htsmsg_t *args, htsmsg_t **resp )
+{
+  *resp = muxer_io_stats();
+  return 0;
+}
+
 void api_status_init ( void )
 {
   static api_hook_t ah[] = {
     { "status/connections",   ACCESS_ADMIN, api_status_connections, NULL },
     { "status/subscriptions", ACCESS_ADMIN, api_status_subscriptions, NULL },
     { "status/inputs",        ACCESS_ADMIN, api_status_inputs, NULL },
+    { "status/timers",        ACCESS_ADMIN, api_status_timers, NULL },
+    { "status/queues",        ACCESS_ADMIN, api_status_queues, NULL },
+    { "status/diskio",        ACCESS_ADMIN, api_status_diskio, NULL },
     { NULL },
   };
 
@@ -30,6 +30,18 @@ atomic_exchange(volatile int *ptr, int new)
   return  __sync_lock_test_and_set(ptr, new);
 }
 
+static inline int
+atomic_cas(volatile int *ptr, int old, int new)
+{
+  return __sync_bool_compare_and_swap(ptr, old, new);
+}
+
+static inline void
+atomic_barrier(void)
+{
+  __sync_synchronize();
+}
+
 static inline uint64_t
 atomic_add_u64(volatile uint64_t *ptr, uint64_t incr)
 {
@@ -750,6 +750,18 @@ _config_set_str ( const char *fld, const char *val )
   return 0;
 }
 
+static int
+_config_set_u32 ( const char *fld, uint32_t val )
+{
+  uint32_t u32;
+  if (htsmsg_get_u32(config, fld, &u32) || u32 != val) {
+    htsmsg_delete_field(config, fld);
+    htsmsg_add_u32(config, fld, val);
+    return 1;
+  }
+  return 0;
+}
+
 const char *config_get_language ( void )
 {
   return htsmsg_get_str(config, "language");
@@ -769,3 +781,17 @@ int config_set_muxconfpath ( const char *path )
 {
   return _config_set_str("muxconfpath", path);
 }
+
+int config_get_descrambler_threads ( void )
+{
+  return htsmsg_get_u32_or_default(config, "descrambler_threads", 0);
+}
+
+int config_set_descrambler_threads ( int threads )
+{
+  if (threads < 0)
+    threads = 0;
+  if (threads > 64)
+    threads = 64;
+  return _config_set_u32("descrambler_threads", threads);
+}
@@ -37,4 +37,8 @@ const char *config_get_language    ( void );
 int         config_set_language    ( const char *str )
   __attribute__((warn_unused_result));
 
+int         config_get_descrambler_threads ( void );
+int         config_set_descrambler_threads ( int threads )
+  __attribute__((warn_unused_result));
+
 #endif /* __TVH_CONFIG__H__ */
@@ -0,0 +1,181 @@
+/*
+ *  CRC-32/MPEG-2 using carry-less multiplication (PCLMULQDQ)
+ *  Copyright (C) 2014 Tvheadend
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The CRC is not reflected, so the data is treated as one big polynomial
+ * with the first bit of the first byte as the highest coefficient. 16 byte
+ * blocks are loaded big endian into 128 bit accumulators A = H*x^64 + L,
+ * which are moved D bits forward as
+ *
+ *   A * x^D = H * (x^(D+64) mod P) + L * (x^D mod P)
+ *
+ * Two carry-less multiplies of a 64 bit half by a 32 bit constant, the
+ * result stays below 96 bits. Four accumulators are folded over 64 bytes
+ * to hide the multiply latency. The final 128 bit value is reduced to 64
+ * bits the same way, the last 32 bits go through the table code.
+ */
+
+#include <string.h>
+
+#include "tvheadend.h"
+
+#if defined(__x86_64__)
+
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <wmmintrin.h>
+
+#define CRC32_POLY 0x04c11db7
+
+static uint32_t k_fold512[2]; // x^576, x^512 mod P
+static uint32_t k_fold128[2]; // x^192, x^128 mod P
+static uint32_t k_final[2];   // x^96, x^64 mod P
+
+/*
+ * x^n mod P
+ */
+static uint32_t
+crc32_xpow ( int n )
+{
+  uint32_t r = 1;
+  while (n--)
+    r = (r << 1) ^ ((r & 0x80000000) ? CRC32_POLY : 0);
+  return r;
+}
+
+static inline __m128i
+crc32_load ( const uint8_t *p )
+{
+  uint64_t hi, lo;
+  memcpy(&hi, p, 8);
+  memcpy(&lo, p + 8, 8);
+  return _mm_set_epi64x(__builtin_bswap64(hi), __builtin_bswap64(lo));
+}
+
+static inline __m128i
+crc32_fold ( __m128i a, __m128i k )
+{
+  return _mm_xor_si128(_mm_clmulepi64_si128(a, k, 0x11),
+                       _mm_clmulepi64_si128(a, k, 0x00));
+}
+
+static inline uint64_t
+crc32_clmul64 ( uint64_t a, uint32_t b )
+{
+  return (uint64_t)_mm_cvtsi128_si64(
+    _mm_clmulepi64_si128(_mm_cvtsi64_si128(a), _mm_cvtsi32_si128(b), 0x00));
+}
+
+uint32_t
+tvh_crc32_pclmul ( const uint8_t *data, size_t datalen, uint32_t crc )
+{
+  __m128i a0, a1, a2, a3, k, t;
+  uint64_t h, l, tl, th;
+  uint8_t b[4];
+  uint32_t c;
+
+  if (datalen < 64)
+    return tvh_crc32_sb8(data, datalen, crc);
+
+  /* Initial value is XORed into the first 32 bits */
+  a0 = _mm_xor_si128(crc32_load(data),
+                     _mm_set_epi64x((uint64_t)crc << 32, 0));
+  a1 = crc32_load(data + 16);
+  a2 = crc32_load(data + 32);
+  a3 = crc32_load(data + 48);
+  data    += 64;
+  datalen -= 64;
+
+  /* Fold by 512 bits */
+  k = _mm_set_epi64x(k_fold512[0], k_fold512[1]);
+  while (datalen >= 64) {
+    a0 = _mm_xor_si128(crc32_fold(a0, k), crc32_load(data));
+    a1 = _mm_xor_si128(crc32_fold(a1, k), crc32_load(data + 16));
+    a2 = _mm_xor_si128(crc32_fold(a2, k), crc32_load(data + 32));
+    a3 = _mm_xor_si128(crc32_fold(a3, k), crc32_load(data + 48));
+    data    += 64;
+    datalen -= 64;
+  }
+
+  /* Combine, then fold by 128 bits */
+  k  = _mm_set_epi64x(k_fold128[0], k_fold128[1]);
+  a0 = _mm_xor_si128(crc32_fold(a0, k), a1);
+  a0 = _mm_xor_si128(crc32_fold(a0, k), a2);
+  a0 = _mm_xor_si128(crc32_fold(a0, k), a3);
+  while (datalen >= 16) {
+    a0 = _mm_xor_si128(crc32_fold(a0, k), crc32_load(data));
+    data    += 16;
+    datalen -= 16;
+  }
+
+  /* A * x^32 = H * (x^96 mod P) + L * x^32, below 96 bits */
+  h  = (uint64_t)_mm_cvtsi128_si64(_mm_unpackhi_epi64(a0, a0));
+  l  = (uint64_t)_mm_cvtsi128_si64(a0);
+  t  = _mm_clmulepi64_si128(_mm_cvtsi64_si128(h),
+                            _mm_cvtsi32_si128(k_final[0]), 0x00);
+  tl = (uint64_t)_mm_cvtsi128_si64(t) ^ (l << 32);
+  th = (uint64_t)_mm_cvtsi128_si64(_mm_unpackhi_epi64(t, t)) ^ (l >> 32);
+
+  /* 96 -> 64 bits */
+  tl ^= crc32_clmul64(th, k_final[1]);
+
+  /* 64 -> 32 bits, (high 32 bits) * x^32 mod P is a zero init CRC */
+  b[0] = tl >> 56;
+  b[1] = tl >> 48;
+  b[2] = tl >> 40;
+  b[3] = tl >> 32;
+  c = tvh_crc32_sb8(b, 4, 0) ^ (uint32_t)tl;
+
+  /* Tail */
+  return datalen ? tvh_crc32_sb8(data, datalen, c) : c;
+}
+
+int
+tvh_crc32_pclmul_init ( void )
+{
+  unsigned int eax, ebx, ecx, edx;
+
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    return 0;
+  if (!(ecx & bit_PCLMUL) || !(edx & bit_SSE2))
+    return 0;
+
+  k_fold512[0] = crc32_xpow(576);
+  k_fold512[1] = crc32_xpow(512);
+  k_fold128[0] = crc32_xpow(192);
+  k_fold128[1] = crc32_xpow(128);
+  k_final[0]   = crc32_xpow(96);
+  k_final[1]   = crc32_xpow(64);
+  return 1;
+}
+
+#else /* !__x86_64__ */
+
+uint32_t
+tvh_crc32_pclmul ( const uint8_t *data, size_t datalen, uint32_t crc )
+{
+  return tvh_crc32_sb8(data, datalen, crc);
+}
+
+int
+tvh_crc32_pclmul_init ( void )
+{
+  return 0;
+}
+
+#endif
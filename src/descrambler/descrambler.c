@@ -23,6 +23,7 @@
 #include "ffdecsa/FFdecsa.h"
 #include "input.h"
 #include "tvhcsa.h"
+#include "config.h"
 
 struct caid_tab {
   const char *name;
@@ -90,6 +91,9 @@ descrambler_init ( void )
 #if (ENABLE_CWC || ENABLE_CAPMT) && !ENABLE_DVBCSA
   ffdecsa_init();
 #endif
+#if ENABLE_TVHCSA
+  tvhcsa_pool_init(config_get_descrambler_threads());
+#endif
 }
 
 void
@@ -101,6 +105,19 @@ descrambler_done ( void )
 #if ENABLE_CWC
   cwc_done();
 #endif
+#if ENABLE_TVHCSA
+  tvhcsa_pool_done();
+#endif
+}
+
+void
+descrambler_benchmark ( void )
+{
+#if (ENABLE_CWC || ENABLE_CAPMT) && !ENABLE_DVBCSA
+  ffdecsa_benchmark();
+#else
+  tvhlog(LOG_INFO, "CSA", "no built-in descrambling kernels (libdvbcsa)");
+#endif
 }
 
 /*
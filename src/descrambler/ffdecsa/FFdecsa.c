@@ -51,6 +51,7 @@
 #define PARALLEL_128_2MMX    1284
 #define PARALLEL_128_SSE     1285
 #define PARALLEL_128_SSE2    1286
+#define PARALLEL_256_AVX2    2560
 
 #include "parallel_generic.h"
 //// conditionals
@@ -87,6 +88,9 @@
 #elif PARALLEL_MODE==PARALLEL_128_SSE2
 #include "parallel_128_sse2.h"
 #define FUNC(x) (x ## _128sse2)
+#elif PARALLEL_MODE==PARALLEL_256_AVX2
+#include "parallel_256_avx2.h"
+#define FUNC(x) (x ## _256avx2)
 #else
 #error "unknown/undefined parallel mode"
 #endif
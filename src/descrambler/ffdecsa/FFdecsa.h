@@ -61,4 +61,7 @@ int decrypt_packets(void *keys, unsigned char **cluster);
 
 void ffdecsa_init(void);
 
+// -- print the speed of all kernels usable on this CPU
+void ffdecsa_benchmark(void);
+
 #endif
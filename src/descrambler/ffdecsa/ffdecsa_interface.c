@@ -22,6 +22,8 @@
 #include "tvheadend.h"
 #include "FFdecsa.h"
 
+#include <time.h>
+
 
 
 typedef struct {
@@ -67,8 +69,42 @@ MAKEFUNCS(64mmx);
 MAKEFUNCS(128sse2);
 #endif
 
+#ifdef CONFIG_AVX2
+MAKEFUNCS(256avx2);
+#endif
+
 static csafuncs_t current;
 
+/*
+ * Kernels, fastest first
+ */
+#define CSA_CPU_MMX  (1<<0)
+#define CSA_CPU_SSE2 (1<<1)
+#define CSA_CPU_AVX2 (1<<2)
+
+typedef struct {
+  const char *name;
+  csafuncs_t *funcs;
+  int         cpu;      ///< Required CPU features
+  int         usable;   ///< Supported by this CPU and passed the self-test
+} csakernel_t;
+
+static csakernel_t kernels[] = {
+#ifdef CONFIG_AVX2
+  { "AVX2 256bit", &funcs_256avx2, CSA_CPU_AVX2 },
+#endif
+#ifdef CONFIG_SSE2
+  { "SSE2 128bit", &funcs_128sse2, CSA_CPU_SSE2 },
+#endif
+#ifdef CONFIG_MMX
+  { "MMX 64bit",   &funcs_64mmx,   CSA_CPU_MMX  },
+#endif
+  { "32bit",       &funcs_32int,   0            },
+};
+
+#define CSA_KERNELS   (sizeof(kernels) / sizeof(kernels[0]))
+#define CSA_TEST_PKTS 600
+
 
 
 
@@ -126,18 +162,29 @@ typedef int x86_reg;
            "=c" (ecx), "=d" (edx)\
          : "0" (index));
 
+#define cpuid7(eax,ebx,ecx,edx)\
+    __asm__ volatile\
+        ("mov %%"REG_b", %%"REG_S"\n\t"\
+         "cpuid\n\t"\
+         "xchg %%"REG_b", %%"REG_S\
+         : "=a" (eax), "=S" (ebx),\
+           "=c" (ecx), "=d" (edx)\
+         : "0" (7), "2" (0));
+
 
 
-void
-ffdecsa_init(void)
+/*
+ * Detect the CPU features usable for the parallel kernels
+ */
+static int
+ffdecsa_cpu_caps(void)
 {
-  current = funcs_32int;
-
+  int caps = 0;
 
 #if defined(__i386__) || defined(__x86_64__)
 
   int eax, ebx, ecx, edx;
-  int max_std_level, std_caps=0;
+  int max_std_level, std_caps=0, ext_caps=0;
   
 #if defined(__i386__)
 
@@ -168,30 +215,189 @@ ffdecsa_init(void)
     cpuid(0, max_std_level, ebx, ecx, edx);
 
     if(max_std_level >= 1){
-      cpuid(1, eax, ebx, ecx, std_caps);
-
-#ifdef CONFIG_SSE2
-      if (std_caps & (1<<26)) {
-	current = funcs_128sse2;
-	tvhlog(LOG_INFO, "CSA", "Using SSE2 128bit parallel descrambling");
-	return;
+      cpuid(1, eax, ebx, ext_caps, std_caps);
+
+      if (std_caps & (1<<23))
+        caps |= CSA_CPU_MMX;
+      if (std_caps & (1<<26))
+        caps |= CSA_CPU_SSE2;
+
+      /* AVX2 needs OS support for the YMM state (OSXSAVE + XCR0) */
+      if (max_std_level >= 7 &&
+          (ext_caps & (1<<27)) && (ext_caps & (1<<28))) {
+        uint32_t xcr0_lo, xcr0_hi;
+        __asm__ volatile (".byte 0x0f, 0x01, 0xd0" /* xgetbv */
+                          : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+        if ((xcr0_lo & 6) == 6) {
+          cpuid7(eax, ebx, ecx, edx);
+          if (ebx & (1<<5))
+            caps |= CSA_CPU_AVX2;
+        }
       }
-#endif
-
-#ifdef CONFIG_MMX
-      if (std_caps & (1<<23)) {
-	current = funcs_64mmx;
-	tvhlog(LOG_INFO, "CSA", "Using MMX 64bit parallel descrambling");
-	return;
-      }
-#endif
     }
 #if defined(__i386__)
   }
 #endif
 #endif
 
-  tvhlog(LOG_INFO, "CSA", "Using 32bit parallel descrambling");
+  return caps;
+}
+
+/*
+ * Build a cluster of scrambled looking packets (even/odd keys, some
+ * with adaptation fields and residues)
+ */
+static void
+ffdecsa_test_packets(unsigned char *buf, int count)
+{
+  uint32_t seed = 0x12345678;
+  unsigned char *pkt;
+  int i, j, afl;
+
+  for (i = 0, pkt = buf; i < count; i++, pkt += 188) {
+    for (j = 0; j < 188; j++) {
+      seed = seed * 1103515245 + 12345;
+      pkt[j] = seed >> 16;
+    }
+    pkt[0] = 0x47;
+    pkt[1] = 0x01;
+    pkt[2] = 0x00;
+    pkt[3] = ((i / 50) & 1 ? 0xc0 : 0x80) | (i & 0x0f);
+    if (i % 7 == 3) {
+      afl = 1 + (i % 23);
+      pkt[3] |= 0x30;
+      pkt[4] = afl;
+    } else {
+      pkt[3] |= 0x10;
+    }
+  }
+}
+
+/*
+ * Decrypt a whole buffer, returns number of packets processed
+ */
+static int
+ffdecsa_test_decrypt(csafuncs_t *f, void *keys, unsigned char *buf, int count)
+{
+  unsigned char *vec[3];
+  int done = 0, r;
+
+  while (done < count) {
+    vec[0] = buf + done * 188;
+    vec[1] = buf + count * 188;
+    vec[2] = NULL;
+    r = f->decrypt_packets(keys, vec);
+    if (r <= 0)
+      break;
+    done += r;
+  }
+  return done;
+}
+
+static void *
+ffdecsa_test_keys(csafuncs_t *f)
+{
+  static const unsigned char even[8] = { 0x11, 0x22, 0x33, 0x66, 0x44, 0x55, 0x66, 0xff };
+  static const unsigned char odd[8]  = { 0xa1, 0xb2, 0xc3, 0x16, 0xd4, 0xe5, 0xf6, 0xcf };
+  void *keys = f->get_key_struct();
+  f->set_even_control_word(keys, even);
+  f->set_odd_control_word(keys, odd);
+  return keys;
+}
+
+/*
+ * Compare every usable kernel against the 32bit reference
+ */
+static void
+ffdecsa_selftest(void)
+{
+  unsigned char *ref, *buf;
+  csakernel_t *k, *r = &kernels[CSA_KERNELS - 1];
+  void *keys;
+  int n, nref;
+
+  ref = malloc(CSA_TEST_PKTS * 188);
+  buf = malloc(CSA_TEST_PKTS * 188);
+  ffdecsa_test_packets(ref, CSA_TEST_PKTS);
+  keys = ffdecsa_test_keys(r->funcs);
+  nref = ffdecsa_test_decrypt(r->funcs, keys, ref, CSA_TEST_PKTS);
+  r->funcs->free_key_struct(keys);
+
+  for (k = kernels; k != r; k++) {
+    if (!k->usable)
+      continue;
+    ffdecsa_test_packets(buf, CSA_TEST_PKTS);
+    keys = ffdecsa_test_keys(k->funcs);
+    n = ffdecsa_test_decrypt(k->funcs, keys, buf, CSA_TEST_PKTS);
+    k->funcs->free_key_struct(keys);
+    if (n != nref || memcmp(ref, buf, CSA_TEST_PKTS * 188)) {
+      tvhlog(LOG_ERR, "CSA", "%s descrambling failed self-test, disabled",
+             k->name);
+      k->usable = 0;
+    }
+  }
+
+  free(buf);
+  free(ref);
+}
+
+void
+ffdecsa_init(void)
+{
+  csakernel_t *k;
+  int caps = ffdecsa_cpu_caps();
+
+  for (k = kernels; k != kernels + CSA_KERNELS; k++)
+    k->usable = (k->cpu & caps) == k->cpu;
+
+  ffdecsa_selftest();
+
+  for (k = kernels; !k->usable; k++);
+  current = *k->funcs;
+  tvhlog(LOG_INFO, "CSA", "Using %s parallel descrambling (cluster size %d)",
+         k->name, current.get_suggested_cluster_size());
+}
+
+/*
+ * Microbenchmark all usable kernels
+ */
+void
+ffdecsa_benchmark(void)
+{
+  csakernel_t *k;
+  unsigned char *tmpl, *buf;
+  struct timespec ts;
+  int64_t start, now;
+  void *keys;
+  int csize, pkts;
+
+  for (k = kernels; k != kernels + CSA_KERNELS; k++) {
+    if (!k->usable) {
+      tvhlog(LOG_INFO, "CSA", "benchmark %-12s: not supported", k->name);
+      continue;
+    }
+    csize = k->funcs->get_suggested_cluster_size();
+    tmpl  = malloc(csize * 188);
+    buf   = malloc(csize * 188);
+    ffdecsa_test_packets(tmpl, csize);
+    keys  = ffdecsa_test_keys(k->funcs);
+    pkts  = 0;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    start = now = ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+    while (now - start < 250000) {
+      memcpy(buf, tmpl, csize * 188);
+      pkts += ffdecsa_test_decrypt(k->funcs, keys, buf, csize);
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      now = ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+    }
+    tvhlog(LOG_INFO, "CSA", "benchmark %-12s: %"PRId64" pkts/s%s",
+           k->name, (int64_t)pkts * 1000000 / (now - start),
+           k->funcs->decrypt_packets == current.decrypt_packets ?
+             " (selected)" : "");
+    k->funcs->free_key_struct(keys);
+    free(buf);
+    free(tmpl);
+  }
 }
 
 
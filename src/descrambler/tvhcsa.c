@@ -24,11 +24,72 @@
 #include <unistd.h>
 #include <assert.h>
 
-void
-tvhcsa_descramble
-  ( tvhcsa_t *csa, struct mpegts_service *s, const uint8_t *tsb )
+#define TVHCSA_MAX_JOBS     8   // clusters in flight per service
+#define TVHCSA_STATS_PERIOD 10  // seconds
+#define TVHCSA_IDLE_FLUSH   50  // ms, max. wait for a partly filled cluster
+
+/*
+ * Worker pool job (one filled cluster)
+ */
+#define TVHCSA_JOB_IDLE    0
+#define TVHCSA_JOB_QUEUED  1
+#define TVHCSA_JOB_RUNNING 2
+#define TVHCSA_JOB_DONE    3
+
+struct tvhcsa_job
+{
+  TAILQ_ENTRY(tvhcsa_job) job_link;     ///< Pool queue
+  TAILQ_ENTRY(tvhcsa_job) job_csa_link; ///< csa_jobs / csa_jobs_free
+  int      job_state;
+  uint8_t *job_tsbcluster;
+  int      job_fill;                    ///< Packets in the cluster
+  int      job_done;                    ///< Packets ready for output
+  int      job_cw_gen;
+  int64_t  job_queued;
+#if ENABLE_DVBCSA
+  struct dvbcsa_bs_batch_s *job_tsbbatch_even;
+  struct dvbcsa_bs_batch_s *job_tsbbatch_odd;
+  struct dvbcsa_bs_key_s   *job_key_even;
+  struct dvbcsa_bs_key_s   *job_key_odd;
+#else
+  void    *job_keys;
+#endif
+};
+
+static pthread_mutex_t         tvhcsa_pool_lock;
+static pthread_cond_t          tvhcsa_pool_cond;
+static pthread_cond_t          tvhcsa_pool_done_cond;
+static TAILQ_HEAD(,tvhcsa_job) tvhcsa_pool_queue;
+static int                     tvhcsa_pool_size;
+static int                     tvhcsa_pool_running;
+
+static pthread_mutex_t         tvhcsa_active_lock;
+static LIST_HEAD(,tvhcsa)      tvhcsa_active;
+static pthread_t               tvhcsa_idle_tid;
+static volatile int            tvhcsa_idle_run;
+
+static inline int64_t
+tvhcsa_clock ( void )
 {
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+  return tp.tv_sec * 1000000LL + tp.tv_nsec / 1000;
+}
+
+/* **************************************************************************
+ * Decryption
+ * *************************************************************************/
+
 #if ENABLE_DVBCSA
+/*
+ * Decrypt a complete cluster, returns number of packets ready
+ */
+static int
+tvhcsa_dvbcsa_cluster
+  ( uint8_t *cluster, int fill,
+    struct dvbcsa_bs_batch_s *batch_even, struct dvbcsa_bs_key_s *key_even,
+    struct dvbcsa_bs_batch_s *batch_odd,  struct dvbcsa_bs_key_s *key_odd )
+{
   uint8_t *pkt;
   int xc0;
   int ev_od;
@@ -36,96 +97,337 @@ tvhcsa_descramble
   int offset;
   int n;
   int i;
-  const uint8_t *t0;
-
-  pkt = csa->csa_tsbcluster + csa->csa_fill * 188;
-  memcpy(pkt, tsb, 188);
-  csa->csa_fill++;
+  int fill_even = 0, fill_odd = 0;
 
-  do { // handle this packet
+  for (i = 0, pkt = cluster; i < fill; i++, pkt += 188) {
     xc0 = pkt[3] & 0xc0;
     if(xc0 == 0x00) { // clear
-      break;
+      continue;
     }
     if(xc0 == 0x40) { // reserved
-      break;
+      continue;
     }
-    if(xc0 == 0x80 || xc0 == 0xc0) { // encrypted
-      ev_od = (xc0 & 0x40) >> 6; // 0 even, 1 odd
-      pkt[3] &= 0x3f;  // consider it decrypted now
-      if(pkt[3] & 0x20) { // incomplete packet
-        offset = 4 + pkt[4] + 1;
-        len = 188 - offset;
-        n = len >> 3;
-        // FIXME: //residue = len - (n << 3);
-        if(n == 0) { // decrypted==encrypted!
-          break; // this doesn't need more processing
-        }
-      } else {
-        len = 184;
-        offset = 4;
-        // FIXME: //n = 23;
-        // FIXME: //residue = 0;
-      }
-      if(ev_od == 0) {
-        csa->csa_tsbbatch_even[csa->csa_fill_even].data = pkt + offset;
-        csa->csa_tsbbatch_even[csa->csa_fill_even].len = len;
-        csa->csa_fill_even++;
-      } else {
-        csa->csa_tsbbatch_odd[csa->csa_fill_odd].data = pkt + offset;
-        csa->csa_tsbbatch_odd[csa->csa_fill_odd].len = len;
-        csa->csa_fill_odd++;
+    ev_od = (xc0 & 0x40) >> 6; // 0 even, 1 odd
+    pkt[3] &= 0x3f;  // consider it decrypted now
+    if(pkt[3] & 0x20) { // incomplete packet
+      offset = 4 + pkt[4] + 1;
+      len = 188 - offset;
+      n = len >> 3;
+      // FIXME: //residue = len - (n << 3);
+      if(n == 0) { // decrypted==encrypted!
+        continue; // this doesn't need more processing
       }
+    } else {
+      len = 184;
+      offset = 4;
+      // FIXME: //n = 23;
+      // FIXME: //residue = 0;
     }
-  } while(0);
-
-  if(csa->csa_fill != csa->csa_cluster_size)
-    return;
+    if(ev_od == 0) {
+      batch_even[fill_even].data = pkt + offset;
+      batch_even[fill_even].len = len;
+      fill_even++;
+    } else {
+      batch_odd[fill_odd].data = pkt + offset;
+      batch_odd[fill_odd].len = len;
+      fill_odd++;
+    }
+  }
 
-  if(csa->csa_fill_even) {
-    csa->csa_tsbbatch_even[csa->csa_fill_even].data = NULL;
-    dvbcsa_bs_decrypt(csa->csa_key_even, csa->csa_tsbbatch_even, 184);
-    csa->csa_fill_even = 0;
+  if(fill_even) {
+    batch_even[fill_even].data = NULL;
+    dvbcsa_bs_decrypt(key_even, batch_even, 184);
   }
-  if(csa->csa_fill_odd) {
-    csa->csa_tsbbatch_odd[csa->csa_fill_odd].data = NULL;
-    dvbcsa_bs_decrypt(csa->csa_key_odd, csa->csa_tsbbatch_odd, 184);
-    csa->csa_fill_odd = 0;
+  if(fill_odd) {
+    batch_odd[fill_odd].data = NULL;
+    dvbcsa_bs_decrypt(key_odd, batch_odd, 184);
   }
 
-  t0 = csa->csa_tsbcluster;
+  return fill;
+}
+#endif
 
-  for(i = 0; i < csa->csa_fill; i++) {
-	  ts_recv_packet2(s, t0);
-	  t0 += 188;
+/*
+ * Deliver decrypted packets
+ */
+static void
+tvhcsa_deliver
+  ( tvhcsa_t *csa, struct mpegts_service *s, const uint8_t *t0, int count,
+    int64_t start )
+{
+  int i;
+
+  for(i = 0; i < count; i++) {
+    ts_recv_packet2(s, t0);
+    t0 += 188;
   }
-  csa->csa_fill = 0;
 
+  /* Statistics */
+  csa->csa_stats_clusters++;
+  csa->csa_stats_pkts    += count;
+  csa->csa_stats_latency += tvhcsa_clock() - start;
+  if (csa->csa_stats_start + TVHCSA_STATS_PERIOD <= dispatch_clock) {
+    if (csa->csa_stats_start && csa->csa_stats_clusters) {
+      tvhdebug("csa", "%s - %d pkts/s, %d clusters, avg latency %"PRId64"us%s",
+               service_nicename((service_t *)s), csa->csa_stats_pkts / TVHCSA_STATS_PERIOD,
+               csa->csa_stats_clusters,
+               csa->csa_stats_latency / csa->csa_stats_clusters,
+               tvhcsa_pool_size > 0 ? " (pool)" : "");
+    }
+    csa->csa_stats_start    = dispatch_clock;
+    csa->csa_stats_clusters = 0;
+    csa->csa_stats_pkts     = 0;
+    csa->csa_stats_latency  = 0;
+  }
+}
+
+/* **************************************************************************
+ * Worker pool
+ * *************************************************************************/
+
+static void
+tvhcsa_job_decrypt ( tvhcsa_job_t *job )
+{
+#if ENABLE_DVBCSA
+  job->job_done =
+    tvhcsa_dvbcsa_cluster(job->job_tsbcluster, job->job_fill,
+                          job->job_tsbbatch_even, job->job_key_even,
+                          job->job_tsbbatch_odd,  job->job_key_odd);
 #else
   int r;
   unsigned char *vec[3];
 
-  memcpy(csa->csa_tsbcluster + csa->csa_fill * 188, tsb, 188);
-  csa->csa_fill++;
+  job->job_done = 0;
+  while (job->job_done < job->job_fill) {
+    vec[0] = job->job_tsbcluster + job->job_done * 188;
+    vec[1] = job->job_tsbcluster + job->job_fill * 188;
+    vec[2] = NULL;
+    r = decrypt_packets(job->job_keys, vec);
+    if (r <= 0)
+      break;
+    job->job_done += r;
+  }
+#endif
+}
 
-  if(csa->csa_fill != csa->csa_cluster_size)
+/*
+ * Run a job in the calling thread, called and returns with the pool lock
+ */
+static void
+tvhcsa_job_inline ( tvhcsa_job_t *job )
+{
+  job->job_state = TVHCSA_JOB_RUNNING;
+  pthread_mutex_unlock(&tvhcsa_pool_lock);
+  tvhcsa_job_decrypt(job);
+  pthread_mutex_lock(&tvhcsa_pool_lock);
+  job->job_state = TVHCSA_JOB_DONE;
+  pthread_cond_broadcast(&tvhcsa_pool_done_cond);
+}
+
+static void *
+tvhcsa_worker ( void *aux )
+{
+  tvhcsa_job_t *job;
+
+  pthread_mutex_lock(&tvhcsa_pool_lock);
+  while (1) {
+
+    /* Wait for work */
+    if (!(job = TAILQ_FIRST(&tvhcsa_pool_queue))) {
+      if (tvhcsa_pool_running > tvhcsa_pool_size)
+        break;
+      pthread_cond_wait(&tvhcsa_pool_cond, &tvhcsa_pool_lock);
+      continue;
+    }
+    TAILQ_REMOVE(&tvhcsa_pool_queue, job, job_link);
+    job->job_state = TVHCSA_JOB_RUNNING;
+    pthread_mutex_unlock(&tvhcsa_pool_lock);
+
+    /* Decrypt */
+    tvhcsa_job_decrypt(job);
+
+    pthread_mutex_lock(&tvhcsa_pool_lock);
+    job->job_state = TVHCSA_JOB_DONE;
+    pthread_cond_broadcast(&tvhcsa_pool_done_cond);
+  }
+  tvhcsa_pool_running--;
+  pthread_cond_broadcast(&tvhcsa_pool_done_cond);
+  pthread_mutex_unlock(&tvhcsa_pool_lock);
+  return NULL;
+}
+
+static tvhcsa_job_t *
+tvhcsa_job_alloc ( tvhcsa_t *csa )
+{
+  tvhcsa_job_t *job = calloc(1, sizeof(*job));
+  job->job_tsbcluster    = malloc(csa->csa_cluster_size * 188);
+  job->job_cw_gen        = -1;
+#if ENABLE_DVBCSA
+  job->job_tsbbatch_even = malloc((csa->csa_cluster_size + 1) *
+                                   sizeof(struct dvbcsa_bs_batch_s));
+  job->job_tsbbatch_odd  = malloc((csa->csa_cluster_size + 1) *
+                                   sizeof(struct dvbcsa_bs_batch_s));
+  job->job_key_even      = dvbcsa_bs_key_alloc();
+  job->job_key_odd       = dvbcsa_bs_key_alloc();
+#else
+  job->job_keys          = get_key_struct();
+#endif
+  csa->csa_jobs_count++;
+  return job;
+}
+
+static void
+tvhcsa_job_free ( tvhcsa_t *csa, tvhcsa_job_t *job )
+{
+#if ENABLE_DVBCSA
+  dvbcsa_bs_key_free(job->job_key_odd);
+  dvbcsa_bs_key_free(job->job_key_even);
+  free(job->job_tsbbatch_odd);
+  free(job->job_tsbbatch_even);
+#else
+  free_key_struct(job->job_keys);
+#endif
+  free(job->job_tsbcluster);
+  free(job);
+  csa->csa_jobs_count--;
+}
+
+/*
+ * Output finished jobs in stream order
+ *
+ * wait: 0 - only what is already done, 1 - wait for the oldest job,
+ *       2 - wait for all jobs
+ */
+static void
+tvhcsa_flush_jobs ( tvhcsa_t *csa, struct mpegts_service *s, int wait )
+{
+  tvhcsa_job_t *job;
+
+  while ((job = TAILQ_FIRST(&csa->csa_jobs)) != NULL) {
+    pthread_mutex_lock(&tvhcsa_pool_lock);
+    if (wait) {
+      /* Not picked up by a worker (yet), don't wait for one */
+      if (job->job_state == TVHCSA_JOB_QUEUED) {
+        TAILQ_REMOVE(&tvhcsa_pool_queue, job, job_link);
+        tvhcsa_job_inline(job);
+      }
+      while (job->job_state != TVHCSA_JOB_DONE)
+        pthread_cond_wait(&tvhcsa_pool_done_cond, &tvhcsa_pool_lock);
+    }
+    if (job->job_state != TVHCSA_JOB_DONE) {
+      pthread_mutex_unlock(&tvhcsa_pool_lock);
+      break;
+    }
+    pthread_mutex_unlock(&tvhcsa_pool_lock);
+    TAILQ_REMOVE(&csa->csa_jobs, job, job_csa_link);
+    job->job_state = TVHCSA_JOB_IDLE;
+    tvhcsa_deliver(csa, s, job->job_tsbcluster, job->job_done,
+                   job->job_queued);
+    TAILQ_INSERT_HEAD(&csa->csa_jobs_free, job, job_csa_link);
+    if (wait == 1)
+      wait = 0;
+  }
+}
+
+/*
+ * Hand the current cluster over to the pool
+ */
+static void
+tvhcsa_submit ( tvhcsa_t *csa, struct mpegts_service *s )
+{
+  tvhcsa_job_t *job;
+  uint8_t *tmp;
+
+  /* Get a free job (wait for the oldest if all are busy) */
+  tvhcsa_flush_jobs(csa, s, 0);
+  if (!TAILQ_FIRST(&csa->csa_jobs_free)) {
+    if (csa->csa_jobs_count < TVHCSA_MAX_JOBS)
+      TAILQ_INSERT_HEAD(&csa->csa_jobs_free, tvhcsa_job_alloc(csa),
+                        job_csa_link);
+    else
+      tvhcsa_flush_jobs(csa, s, 1);
+  }
+  job = TAILQ_FIRST(&csa->csa_jobs_free);
+  assert(job);
+  TAILQ_REMOVE(&csa->csa_jobs_free, job, job_csa_link);
+
+  /* Keys as of now */
+  if (job->job_cw_gen != csa->csa_cw_gen) {
+#if ENABLE_DVBCSA
+    dvbcsa_bs_key_set(csa->csa_cw[0], job->job_key_even);
+    dvbcsa_bs_key_set(csa->csa_cw[1], job->job_key_odd);
+#else
+    set_even_control_word(job->job_keys, csa->csa_cw[0]);
+    set_odd_control_word(job->job_keys, csa->csa_cw[1]);
+#endif
+    job->job_cw_gen = csa->csa_cw_gen;
+  }
+
+  /* Swap the cluster buffers */
+  tmp = job->job_tsbcluster;
+  job->job_tsbcluster = csa->csa_tsbcluster;
+  csa->csa_tsbcluster = tmp;
+  job->job_fill   = csa->csa_fill;
+  job->job_queued = tvhcsa_clock();
+  csa->csa_fill   = 0;
+
+  TAILQ_INSERT_TAIL(&csa->csa_jobs, job, job_csa_link);
+  pthread_mutex_lock(&tvhcsa_pool_lock);
+  if (tvhcsa_pool_size > 0) {
+    /* Workers only exit while running > size, so one is left */
+    job->job_state = TVHCSA_JOB_QUEUED;
+    TAILQ_INSERT_TAIL(&tvhcsa_pool_queue, job, job_link);
+    pthread_cond_signal(&tvhcsa_pool_cond);
+  } else {
+    /* The pool was shrunk to zero meanwhile */
+    tvhcsa_job_inline(job);
+  }
+  pthread_mutex_unlock(&tvhcsa_pool_lock);
+}
+
+/*
+ * Decrypt and deliver the current (possibly partly filled) cluster
+ */
+static void
+tvhcsa_cluster ( tvhcsa_t *csa, struct mpegts_service *s )
+{
+  int64_t start;
+#if !ENABLE_DVBCSA
+  int r;
+  unsigned char *vec[3];
+#endif
+
+  /* Parallel (rechecked under the pool lock in tvhcsa_submit) */
+  if (tvhcsa_pool_size > 0) {
+    tvhcsa_submit(csa, s);
     return;
+  }
 
+  /* Inline (finish pending pool work first to keep the order) */
+  if (TAILQ_FIRST(&csa->csa_jobs))
+    tvhcsa_flush_jobs(csa, s, 2);
+  start = tvhcsa_clock();
+
+#if ENABLE_DVBCSA
+  tvhcsa_dvbcsa_cluster(csa->csa_tsbcluster, csa->csa_fill,
+                        csa->csa_tsbbatch_even, csa->csa_key_even,
+                        csa->csa_tsbbatch_odd,  csa->csa_key_odd);
+  tvhcsa_deliver(csa, s, csa->csa_tsbcluster, csa->csa_fill, start);
+  csa->csa_fill = 0;
+
+#else
   while(1) {
 
     vec[0] = csa->csa_tsbcluster;
     vec[1] = csa->csa_tsbcluster + csa->csa_fill * 188;
     vec[2] = NULL;
-    
+
     r = decrypt_packets(csa->csa_keys, vec);
     if(r > 0) {
-      int i;
       const uint8_t *t0 = csa->csa_tsbcluster;
 
-      for(i = 0; i < r; i++) {
-	      ts_recv_packet2(s, t0);
-	      t0 += 188;
-      }
+      tvhcsa_deliver(csa, s, t0, r, start);
+      t0 += r * 188;
 
       r = csa->csa_fill - r;
       assert(r >= 0);
@@ -141,6 +443,147 @@ tvhcsa_descramble
 #endif
 }
 
+/*
+ * Flush the clusters of the streams which went quiet, a partly filled
+ * cluster would otherwise wait for the next packets indefinitely
+ */
+static void *
+tvhcsa_idle_thread ( void *aux )
+{
+  tvhcsa_t *csa;
+  tvhcsa_job_t *job;
+  struct mpegts_service *s;
+  pthread_mutex_t *mutex;
+  int64_t limit;
+  int flush;
+
+  while (tvhcsa_idle_run) {
+    usleep(TVHCSA_IDLE_FLUSH * 1000 / 2);
+    limit = tvhcsa_clock() - TVHCSA_IDLE_FLUSH * 1000;
+    pthread_mutex_lock(&tvhcsa_active_lock);
+    LIST_FOREACH(csa, &tvhcsa_active, csa_link) {
+      if ((s = csa->csa_service) == NULL)
+        continue;
+      // Note: lock order is s_stream_mutex -> tvhcsa_active_lock, and
+      //       a busy stream gets flushed by its own packets anyway
+      mutex = &((service_t *)s)->s_stream_mutex;
+      if (pthread_mutex_trylock(mutex))
+        continue;
+      flush = 0;
+      if (csa->csa_fill && csa->csa_fill_start < limit) {
+        tvhcsa_cluster(csa, s);
+        flush = 1;
+      }
+      if ((job = TAILQ_FIRST(&csa->csa_jobs)) != NULL &&
+          (flush || job->job_queued < limit))
+        tvhcsa_flush_jobs(csa, s, 2);
+      pthread_mutex_unlock(mutex);
+    }
+    pthread_mutex_unlock(&tvhcsa_active_lock);
+  }
+  return NULL;
+}
+
+void
+tvhcsa_pool_threads ( int threads )
+{
+  pthread_t tid;
+  pthread_attr_t attr;
+
+  if (threads < 0)
+    threads = 0;
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+  pthread_mutex_lock(&tvhcsa_pool_lock);
+  if (threads != tvhcsa_pool_size)
+    tvhinfo("csa", "using %d descrambler thread%s%s", threads,
+            threads == 1 ? "" : "s", threads ? "" : " (inline)");
+  tvhcsa_pool_size = threads;
+  while (tvhcsa_pool_running < tvhcsa_pool_size) {
+    tvhcsa_pool_running++;
+    tvhthread_create(&tid, &attr, tvhcsa_worker, NULL);
+  }
+  pthread_cond_broadcast(&tvhcsa_pool_cond);
+  pthread_mutex_unlock(&tvhcsa_pool_lock);
+
+  pthread_attr_destroy(&attr);
+}
+
+void
+tvhcsa_pool_init ( int threads )
+{
+  pthread_mutex_init(&tvhcsa_pool_lock, NULL);
+  pthread_cond_init(&tvhcsa_pool_cond, NULL);
+  pthread_cond_init(&tvhcsa_pool_done_cond, NULL);
+  TAILQ_INIT(&tvhcsa_pool_queue);
+  tvhcsa_pool_threads(threads);
+  pthread_mutex_init(&tvhcsa_active_lock, NULL);
+  LIST_INIT(&tvhcsa_active);
+  tvhcsa_idle_run = 1;
+  tvhthread_create(&tvhcsa_idle_tid, NULL, tvhcsa_idle_thread, NULL);
+}
+
+void
+tvhcsa_pool_done ( void )
+{
+  tvhcsa_idle_run = 0;
+  pthread_join(tvhcsa_idle_tid, NULL);
+
+  pthread_mutex_lock(&tvhcsa_pool_lock);
+  tvhcsa_pool_size = 0;
+  pthread_cond_broadcast(&tvhcsa_pool_cond);
+  while (tvhcsa_pool_running > 0)
+    pthread_cond_wait(&tvhcsa_pool_done_cond, &tvhcsa_pool_lock);
+  pthread_mutex_unlock(&tvhcsa_pool_lock);
+}
+
+/* **************************************************************************
+ * CSA
+ * *************************************************************************/
+
+void
+tvhcsa_set_key_even ( tvhcsa_t *csa, const uint8_t *cw )
+{
+#if ENABLE_DVBCSA
+  dvbcsa_bs_key_set(cw, csa->csa_key_even);
+#else
+  set_even_control_word(csa->csa_keys, cw);
+#endif
+  memcpy(csa->csa_cw[0], cw, 8);
+  csa->csa_cw_gen++;
+}
+
+void
+tvhcsa_set_key_odd ( tvhcsa_t *csa, const uint8_t *cw )
+{
+#if ENABLE_DVBCSA
+  dvbcsa_bs_key_set(cw, csa->csa_key_odd);
+#else
+  set_odd_control_word(csa->csa_keys, cw);
+#endif
+  memcpy(csa->csa_cw[1], cw, 8);
+  csa->csa_cw_gen++;
+}
+
+void
+tvhcsa_descramble
+  ( tvhcsa_t *csa, struct mpegts_service *s, const uint8_t *tsb )
+{
+  if (csa->csa_fill == 0)
+    csa->csa_fill_start = tvhcsa_clock();
+  csa->csa_service = s;
+
+  memcpy(csa->csa_tsbcluster + csa->csa_fill * 188, tsb, 188);
+  csa->csa_fill++;
+
+  if(csa->csa_fill != csa->csa_cluster_size)
+    return;
+
+  tvhcsa_cluster(csa, s);
+}
+
 void
 tvhcsa_init ( tvhcsa_t *csa )
 {
@@ -160,11 +603,46 @@ tvhcsa_init ( tvhcsa_t *csa )
 #else
   csa->csa_keys          = get_key_struct();
 #endif
+  TAILQ_INIT(&csa->csa_jobs);
+  TAILQ_INIT(&csa->csa_jobs_free);
+  pthread_mutex_lock(&tvhcsa_active_lock);
+  LIST_INSERT_HEAD(&tvhcsa_active, csa, csa_link);
+  pthread_mutex_unlock(&tvhcsa_active_lock);
 }
 
 void
 tvhcsa_destroy ( tvhcsa_t *csa )
 {
+  tvhcsa_job_t *job;
+
+  pthread_mutex_lock(&tvhcsa_active_lock);
+  LIST_REMOVE(csa, csa_link);
+  pthread_mutex_unlock(&tvhcsa_active_lock);
+
+  /* Cancel pool work */
+  pthread_mutex_lock(&tvhcsa_pool_lock);
+  TAILQ_FOREACH(job, &csa->csa_jobs, job_csa_link)
+    if (job->job_state == TVHCSA_JOB_QUEUED) {
+      TAILQ_REMOVE(&tvhcsa_pool_queue, job, job_link);
+      job->job_state = TVHCSA_JOB_DONE;
+    }
+  while (1) {
+    TAILQ_FOREACH(job, &csa->csa_jobs, job_csa_link)
+      if (job->job_state == TVHCSA_JOB_RUNNING)
+        break;
+    if (!job) break;
+    pthread_cond_wait(&tvhcsa_pool_done_cond, &tvhcsa_pool_lock);
+  }
+  pthread_mutex_unlock(&tvhcsa_pool_lock);
+  while ((job = TAILQ_FIRST(&csa->csa_jobs)) != NULL) {
+    TAILQ_REMOVE(&csa->csa_jobs, job, job_csa_link);
+    tvhcsa_job_free(csa, job);
+  }
+  while ((job = TAILQ_FIRST(&csa->csa_jobs_free)) != NULL) {
+    TAILQ_REMOVE(&csa->csa_jobs_free, job, job_csa_link);
+    tvhcsa_job_free(csa, job);
+  }
+
 #if ENABLE_DVBCSA
   dvbcsa_bs_key_free(csa->csa_key_odd);
   dvbcsa_bs_key_free(csa->csa_key_even);
@@ -25,12 +25,15 @@ struct elementary_stream;
 #include "tvheadend.h"
 
 #include <stdint.h>
+#include "queue.h"
 #if ENABLE_DVBCSA
 #include <dvbcsa/dvbcsa.h>
 #else
 #include "ffdecsa/FFdecsa.h"
 #endif
 
+typedef struct tvhcsa_job tvhcsa_job_t;
+
 typedef struct tvhcsa
 {
 
@@ -40,38 +43,45 @@ typedef struct tvhcsa
   int      csa_cluster_size;
   uint8_t *csa_tsbcluster;
   int      csa_fill;
+  int64_t  csa_fill_start;   ///< First packet of the cluster (us)
 
 #if ENABLE_DVBCSA
   struct dvbcsa_bs_batch_s *csa_tsbbatch_even;
   struct dvbcsa_bs_batch_s *csa_tsbbatch_odd;
-  int csa_fill_even;
-  int csa_fill_odd;
 
   struct dvbcsa_bs_key_s *csa_key_even;
   struct dvbcsa_bs_key_s *csa_key_odd;
 #else
   void *csa_keys;
 #endif
-  
-} tvhcsa_t;
-
-#if ENABLE_DVBCSA
 
-#define tvhcsa_set_key_even(csa, cw)\
-  dvbcsa_bs_key_set(cw, (csa)->csa_key_even)
-
-#define tvhcsa_set_key_odd(csa, cw)\
-  dvbcsa_bs_key_set(cw, (csa)->csa_key_odd)
-
-#else
+  /**
+   * Worker pool
+   */
+  uint8_t  csa_cw[2][8];     ///< Current even/odd control words
+  int      csa_cw_gen;       ///< Bumped on every control word change
+  TAILQ_HEAD(,tvhcsa_job) csa_jobs;      ///< Submitted, in stream order
+  TAILQ_HEAD(,tvhcsa_job) csa_jobs_free;
+  int      csa_jobs_count;
 
-#define tvhcsa_set_key_even(csa, cw)\
-  set_even_control_word((csa)->csa_keys, cw)
+  /**
+   * Idle flush
+   */
+  LIST_ENTRY(tvhcsa)     csa_link;
+  struct mpegts_service *csa_service; ///< Last service descrambled
 
-#define tvhcsa_set_key_odd(csa, cw)\
-  set_odd_control_word((csa)->csa_keys, cw)
+  /**
+   * Statistics
+   */
+  time_t   csa_stats_start;
+  int      csa_stats_clusters;
+  int      csa_stats_pkts;
+  int64_t  csa_stats_latency;
+  
+} tvhcsa_t;
 
-#endif
+void tvhcsa_set_key_even ( tvhcsa_t *csa, const uint8_t *cw );
+void tvhcsa_set_key_odd  ( tvhcsa_t *csa, const uint8_t *cw );
 
 void
 tvhcsa_descramble
@@ -80,4 +90,8 @@ tvhcsa_descramble
 void tvhcsa_init    ( tvhcsa_t *csa );
 void tvhcsa_destroy ( tvhcsa_t *csa );
 
+void tvhcsa_pool_init    ( int threads );
+void tvhcsa_pool_done    ( void );
+void tvhcsa_pool_threads ( int threads );
+
 #endif /* __TVH_CSA_H__ */
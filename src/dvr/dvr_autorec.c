@@ -668,18 +668,26 @@ void dvr_autorec_check_serieslink(epg_serieslink_t *s)
 static void
 dvr_autorec_changed(dvr_autorec_entry_t *dae, int purge)
 {
-  channel_t *ch;
+  epg_query_result_t eqr;
   epg_broadcast_t *e;
+  int i;
 
   if (purge)
     dvr_autorec_purge_spawns(dae);
 
-  CHANNEL_FOREACH(ch) {
-    RB_FOREACH(e, &ch->ch_epg_schedule, sched_link) {
-      if(autorec_cmp(dae, e))
-	      dvr_entry_create_by_autorec(e, dae);
-    }
+  // Note: series links match regardless of title and genre
+  if (dae->dae_serieslink)
+    epg_query_candidates(&eqr, NULL, NULL);
+  else
+    epg_query_candidates(&eqr, dae->dae_title,
+                         dae->dae_content_type.code ?
+                           &dae->dae_content_type : NULL);
+  for (i = 0; i < eqr.eqr_entries; i++) {
+    e = eqr.eqr_array[i];
+    if(autorec_cmp(dae, e))
+      dvr_entry_create_by_autorec(e, dae);
   }
+  epg_query_free(&eqr);
 }
 
 
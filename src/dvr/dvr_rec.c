@@ -87,10 +87,11 @@ dvr_rec_subscribe(dvr_entry_t *de)
     tsfix_set_start_time(de->de_tsfix, de->de_start - (60 * de->de_start_extra));
     flags = 0;
   }
-
   de->de_s = subscription_create_from_channel(de->de_channel, weight,
 					      buf, st, flags,
 					      NULL, NULL, NULL);
+  if(de->de_s)
+    streaming_queue_register(&de->de_sq, buf);
 
   tvhthread_create(&de->de_thread, NULL, dvr_thread, de);
 }
@@ -110,6 +111,8 @@ dvr_rec_unsubscribe(dvr_entry_t *de, int stopcode)
   pthread_join(de->de_thread, NULL);
   de->de_s = NULL;
 
+  streaming_queue_deinit(&de->de_sq);
+
   if(de->de_tsfix)
     tsfix_destroy(de->de_tsfix);
 
@@ -455,7 +458,7 @@ dvr_thread(void *aux)
         atomic_add(&de->de_s->ths_bytes_out, pktbuf_len(pb));
     }
 
-    TAILQ_REMOVE(&sq->sq_queue, sm, sm_link);
+    streaming_queue_remove(sq, sm);
 
     pthread_mutex_unlock(&sq->sq_mutex);
 
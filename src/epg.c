@@ -20,7 +20,6 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
-#include <regex.h>
 #include <assert.h>
 #include <inttypes.h>
 #include <time.h>
@@ -810,6 +809,7 @@ static void _epg_episode_destroy ( void *eo )
   }
   if (ee->image)       free(ee->image);
   if (ee->epnum.text)  free(ee->epnum.text);
+  epg_index_episode_remove(ee);
   _epg_object_destroy(eo, &epg_episodes);
   free(ee);
 }
@@ -848,15 +848,21 @@ int epg_episode_set_title
   ( epg_episode_t *episode, const char *title, const char *lang,
     epggrab_module_t *src )
 {
+  int save;
   if (!episode) return 0;
-  return _epg_object_set_lang_str(episode, &episode->title, title, lang, src);
+  save = _epg_object_set_lang_str(episode, &episode->title, title, lang, src);
+  if (save) epg_index_episode_title(episode);
+  return save;
 }
 
 int epg_episode_set_title2
   ( epg_episode_t *episode, const lang_str_t *str, epggrab_module_t *src )
 {
+  int save;
   if (!episode || !str) return 0;
-  return _epg_object_set_lang_str2(episode, &episode->title, str, src);
+  save = _epg_object_set_lang_str2(episode, &episode->title, str, src);
+  if (save) epg_index_episode_title(episode);
+  return save;
 }
 
 int epg_episode_set_subtitle
@@ -1010,6 +1016,7 @@ int epg_episode_set_genre
     save |= epg_genre_list_add(&ee->genre, g1);
   }
 
+  if (save) epg_index_episode_genre(ee);
   return save;
 }
 
@@ -1370,6 +1377,7 @@ static void _epg_channel_rem_broadcast
 {
   if (new) dvr_event_replaced(ebc, new);
   RB_REMOVE(&ch->ch_epg_schedule, ebc, sched_link);
+  epg_index_broadcast_remove(ebc);
   if (ch->ch_epg_now  == ebc) ch->ch_epg_now  = NULL;
   if (ch->ch_epg_next == ebc) ch->ch_epg_next = NULL;
   _epg_object_putref(ebc);
@@ -1461,6 +1469,7 @@ static epg_broadcast_t *_epg_channel_add_broadcast
       _epg_object_create(ret);
       // Note: sets updated
       _epg_object_getref(ret);
+      epg_index_broadcast_add(ret);
       tvhtrace("epg", "added event %u (%s) on %s @ %"PRItime_t " to %"PRItime_t,
                ret->id, epg_broadcast_get_title(ret, NULL),
                channel_get_name(ch), ret->start, ret->stop);
@@ -1611,6 +1620,7 @@ int epg_broadcast_set_episode
       _epg_episode_rem_broadcast(broadcast->episode, broadcast);
     broadcast->episode = episode;
     _epg_episode_add_broadcast(episode, broadcast);
+    epg_index_broadcast_genre(broadcast);
     _epg_object_set_updated(broadcast);
     save = 1;
   }
@@ -2200,114 +2210,6 @@ htsmsg_t *epg_genres_list_all ( int major_only, int major_prefix )
   return m;
 }
 
-/* **************************************************************************
- * Querying
- * *************************************************************************/
-
-static void _eqr_add 
-  ( epg_query_result_t *eqr, epg_broadcast_t *e,
-    epg_genre_t *genre, regex_t *preg, time_t start, const char *lang, int min_duration, int max_duration )
-{
-  const char *title;
-  double duration;
-
-  /* Ignore */
-  if ( e->stop < start ) return;
-  if ( !(title = epg_episode_get_title(e->episode, lang)) ) return;
-  if ( genre && !epg_genre_list_contains(&e->episode->genre, genre, 1) ) return;
-  if ( preg && regexec(preg, title, 0, NULL, 0)) return;
-
-  duration = difftime(e->stop,e->start);
-  if ( duration < min_duration || duration > max_duration ) return;
-
-  /* More space */
-  if ( eqr->eqr_entries == eqr->eqr_alloced ) {
-    eqr->eqr_alloced = MAX(100, eqr->eqr_alloced * 2);
-    eqr->eqr_array   = realloc(eqr->eqr_array, 
-                               eqr->eqr_alloced * sizeof(epg_broadcast_t));
-  }
-  
-  /* Store */
-  eqr->eqr_array[eqr->eqr_entries++] = e;
-}
-
-static void _eqr_add_channel 
-  ( epg_query_result_t *eqr, channel_t *ch, epg_genre_t *genre,
-    regex_t *preg, time_t start, const char *lang, int min_duration, int max_duration )
-{
-  epg_broadcast_t *ebc;
-  RB_FOREACH(ebc, &ch->ch_epg_schedule, sched_link) {
-    if ( ebc->episode ) _eqr_add(eqr, ebc, genre, preg, start, lang, min_duration, max_duration);
-  }
-}
-
-void epg_query0
-  ( epg_query_result_t *eqr, channel_t *channel, channel_tag_t *tag,
-    epg_genre_t *genre, const char *title, const char *lang, int min_duration, int max_duration )
-{
-  time_t now;
-  channel_tag_mapping_t *ctm;
-  regex_t preg0, *preg;
-  time(&now);
-
-  /* Clear (just incase) */
-  memset(eqr, 0, sizeof(epg_query_result_t));
-
-  /* Setup exp */
-  if ( title ) {
-    if (regcomp(&preg0, title, REG_ICASE | REG_EXTENDED | REG_NOSUB) )
-      return;
-    preg = &preg0;
-  } else {
-    preg = NULL;
-  }
-  
-  /* Single channel */
-  if (channel && !tag) {
-    _eqr_add_channel(eqr, channel, genre, preg, now, lang, min_duration, max_duration);
-  
-  /* Tag based */
-  } else if ( tag ) {
-    LIST_FOREACH(ctm, &tag->ct_ctms, ctm_tag_link) {
-      if(channel == NULL || ctm->ctm_channel == channel)
-        _eqr_add_channel(eqr, ctm->ctm_channel, genre, preg, now, lang, min_duration, max_duration);
-    }
-
-  /* All channels */
-  } else {
-    CHANNEL_FOREACH(channel)
-      _eqr_add_channel(eqr, channel, genre, preg, now, lang, min_duration, max_duration);
-  }
-  if (preg) regfree(preg);
-
-  return;
-}
-
-void epg_query(epg_query_result_t *eqr, const char *channel, const char *tag,
-            epg_genre_t *genre, const char *title, const char *lang, int min_duration, int max_duration)
-{
-  channel_t     *ch = channel ? channel_find(channel)    : NULL;
-  channel_tag_t *ct = tag     ? channel_tag_find_by_name(tag, 0) : NULL;
-
-  epg_query0(eqr, ch, ct, genre, title, lang, min_duration, max_duration);
-}
-
-void epg_query_free(epg_query_result_t *eqr)
-{
-  free(eqr->eqr_array);
-}
-
-static int _epg_sort_start_ascending ( const void *a, const void *b )
-{
-  return (*(epg_broadcast_t**)a)->start - (*(epg_broadcast_t**)b)->start;
-}
-
-void epg_query_sort(epg_query_result_t *eqr)
-{
-  qsort(eqr->eqr_array, eqr->eqr_entries, sizeof(epg_broadcast_t*),
-        _epg_sort_start_ascending);
-}
-
 /* **************************************************************************
  * Miscellaneous
  * *************************************************************************/
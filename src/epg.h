@@ -276,6 +276,9 @@ struct epg_episode
   epg_brand_t               *brand;         ///< (Grand-)Parent brand
   epg_season_t              *season;        ///< Parent season
   epg_broadcast_list_t       broadcasts;    ///< Broadcast list
+
+  uint32_t                   query_slot;    ///< Title index slot
+  uint32_t                   query_postings;///< Title index entries
 };
 
 /* Lookup */
@@ -443,6 +446,9 @@ struct epg_broadcast
   epg_serieslink_t          *serieslink;       ///< SeriesLink;
   struct channel            *channel;          ///< Channel being broadcast on
 
+  RB_ENTRY(epg_broadcast)    time_link;        ///< Start time index link
+  uint32_t                   query_slot;       ///< Genre index slot
+  uint16_t                   query_genres;     ///< Indexed major genres
 };
 
 /* Lookup */
@@ -535,6 +541,8 @@ typedef struct epg_query_result {
   epg_broadcast_t **eqr_array;
   int               eqr_entries;
   int               eqr_alloced;
+  int               eqr_total;    ///< All matches, paged queries only
+                                  ///< return a part of them
 } epg_query_result_t;
 
 void epg_query_free(epg_query_result_t *eqr);
@@ -549,6 +557,24 @@ void epg_query0(epg_query_result_t *eqr, struct channel *ch,
                 const char *lang, int min_duration, int max_duration);
 void epg_query(epg_query_result_t *eqr, const char *channel, const char *tag,
 	       epg_genre_t *genre, const char *title, const char *lang, int min_duration, int max_duration);
+void epg_query_paged
+  ( epg_query_result_t *eqr, const char *channel, const char *tag,
+    epg_genre_t *genre, const char *title, const char *lang,
+    int min_duration, int max_duration, int start, int limit );
+
+/* Scheduled broadcasts that may match a title regex / genre, all of
+   them if neither is given */
+void epg_query_candidates
+  ( epg_query_result_t *eqr, const char *title, epg_genre_t *genre );
+
+/* Index maintenance (epgquery.c) */
+void epg_index_broadcast_add    ( epg_broadcast_t *ebc );
+void epg_index_broadcast_remove ( epg_broadcast_t *ebc );
+void epg_index_broadcast_genre  ( epg_broadcast_t *ebc );
+void epg_index_episode_title    ( epg_episode_t *ee );
+void epg_index_episode_genre    ( epg_episode_t *ee );
+void epg_index_episode_remove   ( epg_episode_t *ee );
+void epg_index_done             ( void );
 
 
 /* ************************************************************************
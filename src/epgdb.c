@@ -17,6 +17,8 @@
  */
 
 #include <string.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -138,6 +140,9 @@ _epgdb_v2_process( char **sect, htsmsg_t *m, epggrab_stats_t *stats )
   }
 }
 
+static void _epg_save_init ( void );
+static void _epg_save_done ( void );
+
 /*
  * Load data
  */
@@ -151,6 +156,8 @@ void epg_init ( void )
   int ver = EPG_DB_VERSION;
   char *sect = NULL;
 
+  _epg_save_init();
+
   /* Find the right file (and version) */
   while (fd < 0 && ver > 0) {
     fd = hts_settings_open_file(0, "epgdb.v%d", ver);
@@ -237,10 +244,13 @@ void epg_done ( void )
 {
   channel_t *ch;
 
+  _epg_save_done();
+
   pthread_mutex_lock(&global_lock);
   CHANNEL_FOREACH(ch)
     epg_channel_unlink(ch);
   epg_skel_done();
+  epg_index_done();
   pthread_mutex_unlock(&global_lock);
 }
 
@@ -248,34 +258,157 @@ void epg_done ( void )
  * Save
  * *************************************************************************/
 
-static int _epg_write ( int fd, htsmsg_t *m )
+/*
+ * The database is captured into one flat buffer while global_lock is
+ * held, writing it to disk (and replacing the old file) is left to a
+ * background thread. If saves are requested faster than they can be
+ * written only the latest snapshot is kept.
+ */
+#define EPGDB_WRITE_SIZE (1024 * 1024)
+
+typedef struct epgdb_snapshot
 {
-  int ret = 1;
-  size_t msglen;
-  void *msgdata;
-  if (m) {
-    int r = htsmsg_binary_serialize(m, &msgdata, &msglen, 0x10000);
-    htsmsg_destroy(m);
-    if (!r) {
-      ret = tvh_write(fd, msgdata, msglen);
-      free(msgdata);
-    }
-  } else {
-    ret = 0;
+  uint8_t         *data;
+  size_t           len;
+  size_t           size;
+  epggrab_stats_t  stats;
+  int64_t          start;       ///< Capture start (mono time)
+  int64_t          captured;    ///< Capture duration (us)
+} epgdb_snapshot_t;
+
+static pthread_t         epgdb_save_tid;
+static pthread_mutex_t   epgdb_save_mutex;
+static pthread_cond_t    epgdb_save_cond;
+static epgdb_snapshot_t *epgdb_save_pending;
+static int               epgdb_save_running;
+
+static void _epg_snapshot_free ( epgdb_snapshot_t *s )
+{
+  free(s->data);
+  free(s);
+}
+
+static int _epg_write ( epgdb_snapshot_t *s, htsmsg_t *m )
+{
+  size_t len;
+  int r;
+
+  if (!m) return 0;
+  while (1) {
+    len = s->size - s->len;
+    r   = htsmsg_binary_serialize_to(m, s->data + s->len, &len, 0x10000);
+    if (r <= 0) break;
+    s->size = MAX(s->size * 2, s->len + len);
+    s->data = realloc(s->data, s->size);
   }
-  if(ret) {
+  htsmsg_destroy(m);
+  if (r) {
     tvhlog(LOG_ERR, "epgdb", "failed to store epg to disk");
-    close(fd);
-    hts_settings_remove("epgdb.v%d", EPG_DB_VERSION);
+    return 1;
   }
-  return ret;
+  s->len += len;
+  return 0;
 }
 
-static int _epg_write_sect ( int fd, const char *sect )
+static int _epg_write_sect ( epgdb_snapshot_t *s, const char *sect )
 {
   htsmsg_t *m = htsmsg_create_map();
   htsmsg_add_str(m, "__section__", sect);
-  return _epg_write(fd, m);
+  return _epg_write(s, m);
+}
+
+/*
+ * Write a snapshot (background thread)
+ */
+static void _epg_save_write ( epgdb_snapshot_t *s )
+{
+  char path[PATH_MAX], tmppath[PATH_MAX + 8];
+  size_t off, len;
+  int64_t t;
+  int fd, ok = 1;
+
+  t = getmonoclock();
+  if (hts_settings_buildpath(path, sizeof(path), "epgdb.v%d", EPG_DB_VERSION))
+    return;
+  if (hts_settings_makedirs(path))
+    return;
+  snprintf(tmppath, sizeof(tmppath), "%s.tmp", path);
+  if ((fd = tvh_open(tmppath, O_CREAT | O_TRUNC | O_WRONLY, 0700)) < 0) {
+    tvhlog(LOG_ERR, "epgdb", "unable to create \"%s\" - %s",
+           tmppath, strerror(errno));
+    return;
+  }
+
+  for (off = 0; off < s->len; off += len) {
+    len = MIN(s->len - off, EPGDB_WRITE_SIZE);
+    if (tvh_write(fd, s->data + off, len)) {
+      ok = 0;
+      break;
+    }
+  }
+  if (ok && fsync(fd))
+    ok = 0;
+  close(fd);
+
+  if (!ok || rename(tmppath, path)) {
+    tvhlog(LOG_ERR, "epgdb", "failed to store epg to disk - %s",
+           strerror(errno));
+    unlink(tmppath);
+    return;
+  }
+  t = getmonoclock() - t;
+
+  /* Stats */
+  tvhlog(LOG_INFO, "epgdb", "saved");
+  tvhlog(LOG_INFO, "epgdb", "  brands     %d", s->stats.brands.total);
+  tvhlog(LOG_INFO, "epgdb", "  seasons    %d", s->stats.seasons.total);
+  tvhlog(LOG_INFO, "epgdb", "  episodes   %d", s->stats.episodes.total);
+  tvhlog(LOG_INFO, "epgdb", "  broadcasts %d", s->stats.broadcasts.total);
+  tvhlog(LOG_INFO, "epgdb", "  stored %zu bytes, capture %"PRId64"ms"
+         " (locked), write %"PRId64"ms, total %"PRId64"ms",
+         s->len, s->captured / 1000, t / 1000,
+         (getmonoclock() - s->start) / 1000);
+}
+
+static void *_epg_save_thread ( void *p )
+{
+  epgdb_snapshot_t *s;
+
+  pthread_mutex_lock(&epgdb_save_mutex);
+  while (1) {
+    if (!(s = epgdb_save_pending)) {
+      if (!epgdb_save_running) break;
+      pthread_cond_wait(&epgdb_save_cond, &epgdb_save_mutex);
+      continue;
+    }
+    epgdb_save_pending = NULL;
+    pthread_mutex_unlock(&epgdb_save_mutex);
+    _epg_save_write(s);
+    _epg_snapshot_free(s);
+    pthread_mutex_lock(&epgdb_save_mutex);
+  }
+  pthread_mutex_unlock(&epgdb_save_mutex);
+  return NULL;
+}
+
+static void _epg_save_init ( void )
+{
+  pthread_mutex_init(&epgdb_save_mutex, NULL);
+  pthread_cond_init(&epgdb_save_cond, NULL);
+  epgdb_save_running = 1;
+  tvhthread_create(&epgdb_save_tid, NULL, _epg_save_thread, NULL);
+}
+
+/*
+ * Wait for the pending save to complete
+ */
+static void _epg_save_done ( void )
+{
+  pthread_mutex_lock(&epgdb_save_mutex);
+  epgdb_save_running = 0;
+  pthread_cond_signal(&epgdb_save_cond);
+  pthread_mutex_unlock(&epgdb_save_mutex);
+  pthread_join(epgdb_save_tid, NULL);
 }
 
 void epg_save_callback ( void *p )
@@ -285,52 +418,59 @@ void epg_save_callback ( void *p )
 
 void epg_save ( void )
 {
-  int fd;
+  epgdb_snapshot_t *s;
   epg_object_t *eo;
   epg_broadcast_t *ebc;
   channel_t *ch;
-  epggrab_stats_t stats;
   extern gtimer_t epggrab_save_timer;
 
   if (epggrab_epgdb_periodicsave)
     gtimer_arm(&epggrab_save_timer, epg_save_callback, NULL, epggrab_epgdb_periodicsave);
-  
-  fd = hts_settings_open_file(1, "epgdb.v%d", EPG_DB_VERSION);
 
-  memset(&stats, 0, sizeof(stats));
-  if ( _epg_write_sect(fd, "brands") ) return;
+  s = calloc(1, sizeof(*s));
+  s->start = getmonoclock();
+  s->size  = EPGDB_WRITE_SIZE;
+  s->data  = malloc(s->size);
+
+  if ( _epg_write_sect(s, "brands") ) goto fail;
   RB_FOREACH(eo,  &epg_brands, uri_link) {
-    if (_epg_write(fd, epg_brand_serialize((epg_brand_t*)eo))) return;
-    stats.brands.total++;
+    if (_epg_write(s, epg_brand_serialize((epg_brand_t*)eo))) goto fail;
+    s->stats.brands.total++;
   }
-  if ( _epg_write_sect(fd, "seasons") ) return;
+  if ( _epg_write_sect(s, "seasons") ) goto fail;
   RB_FOREACH(eo,  &epg_seasons, uri_link) {
-    if (_epg_write(fd, epg_season_serialize((epg_season_t*)eo))) return;
-    stats.seasons.total++;
+    if (_epg_write(s, epg_season_serialize((epg_season_t*)eo))) goto fail;
+    s->stats.seasons.total++;
   }
-  if ( _epg_write_sect(fd, "episodes") ) return;
+  if ( _epg_write_sect(s, "episodes") ) goto fail;
   RB_FOREACH(eo,  &epg_episodes, uri_link) {
-    if (_epg_write(fd, epg_episode_serialize((epg_episode_t*)eo))) return;
-    stats.episodes.total++;
+    if (_epg_write(s, epg_episode_serialize((epg_episode_t*)eo))) goto fail;
+    s->stats.episodes.total++;
   }
-  if ( _epg_write_sect(fd, "serieslinks") ) return;
+  if ( _epg_write_sect(s, "serieslinks") ) goto fail;
   RB_FOREACH(eo, &epg_serieslinks, uri_link) {
-    if (_epg_write(fd, epg_serieslink_serialize((epg_serieslink_t*)eo)))
-      return;
-    stats.seasons.total++;
+    if (_epg_write(s, epg_serieslink_serialize((epg_serieslink_t*)eo)))
+      goto fail;
+    s->stats.seasons.total++;
   }
-  if ( _epg_write_sect(fd, "broadcasts") ) return;
+  if ( _epg_write_sect(s, "broadcasts") ) goto fail;
   CHANNEL_FOREACH(ch) {
     RB_FOREACH(ebc, &ch->ch_epg_schedule, sched_link) {
-      if (_epg_write(fd, epg_broadcast_serialize(ebc))) return;
-      stats.broadcasts.total++;
+      if (_epg_write(s, epg_broadcast_serialize(ebc))) goto fail;
+      s->stats.broadcasts.total++;
     }
   }
-
-  /* Stats */
-  tvhlog(LOG_INFO, "epgdb", "saved");
-  tvhlog(LOG_INFO, "epgdb", "  brands     %d", stats.brands.total);
-  tvhlog(LOG_INFO, "epgdb", "  seasons    %d", stats.seasons.total);
-  tvhlog(LOG_INFO, "epgdb", "  episodes   %d", stats.episodes.total);
-  tvhlog(LOG_INFO, "epgdb", "  broadcasts %d", stats.broadcasts.total);
+  s->captured = getmonoclock() - s->start;
+
+  /* Hand over to the writer */
+  pthread_mutex_lock(&epgdb_save_mutex);
+  if (epgdb_save_pending)
+    _epg_snapshot_free(epgdb_save_pending);
+  epgdb_save_pending = s;
+  pthread_cond_signal(&epgdb_save_cond);
+  pthread_mutex_unlock(&epgdb_save_mutex);
+  return;
+
+fail:
+  _epg_snapshot_free(s);
 }
@@ -68,6 +68,19 @@ static void _epggrab_module_grab ( epggrab_module_int_t *mod )
 {
   time_t tm1, tm2;
   htsmsg_t *data;
+  int fd;
+
+  /* Parse as the data arrives */
+  if (mod->stream) {
+    tvhlog(LOG_INFO, mod->id, "grab %s", mod->path);
+    if (spawn_and_give_stdout(mod->path, NULL, &fd)) {
+      tvhlog(LOG_ERR, mod->id, "failed to spawn %s", mod->path);
+      return;
+    }
+    epggrab_module_stream(mod, fd);
+    close(fd);
+    return;
+  }
 
   /* Grab */
   time(&tm1);
@@ -389,6 +402,17 @@ void epggrab_init ( void )
   tvhthread_create(&epggrab_tid, NULL, _epggrab_internal_thread, NULL);
 }
 
+/*
+ * Microbenchmark the huffman decoders
+ */
+void epggrab_huffman_benchmark ( void )
+{
+#if ENABLE_MPEGTS
+  freesat_huffman_benchmark();
+  opentv_huffman_benchmark();
+#endif
+}
+
 /*
  * Cleanup
  */
@@ -172,6 +172,9 @@ struct epggrab_module_int
   char*     (*grab)   ( void *mod );
   htsmsg_t* (*trans)  ( void *mod, char *data );
   int       (*parse)  ( void *mod, htsmsg_t *data, epggrab_stats_t *stat );
+
+  /* Parse while reading (optional, used instead of grab/trans/parse) */
+  int       (*stream) ( void *mod, int fd, epggrab_stats_t *stat );
 };
 
 /*
@@ -295,6 +298,7 @@ int  epggrab_ota_set_initial      ( uint32_t e );
  */
 void epggrab_init                 ( void );
 void epggrab_done                 ( void );
+void epggrab_huffman_benchmark    ( void );
 void epggrab_save                 ( void );
 void epggrab_ota_init             ( void );
 void epggrab_ota_post             ( void );
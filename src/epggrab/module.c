@@ -105,6 +105,29 @@ epggrab_module_t *epggrab_module_create
   return skel;
 }
 
+/*
+ * Parse stats
+ */
+static void _epggrab_module_stats
+  ( epggrab_module_int_t *mod, epggrab_stats_t *stats )
+{
+  tvhlog(LOG_INFO, mod->id, "  channels   tot=%5d new=%5d mod=%5d",
+         stats->channels.total, stats->channels.created,
+         stats->channels.modified);
+  tvhlog(LOG_INFO, mod->id, "  brands     tot=%5d new=%5d mod=%5d",
+         stats->brands.total, stats->brands.created,
+         stats->brands.modified);
+  tvhlog(LOG_INFO, mod->id, "  seasons    tot=%5d new=%5d mod=%5d",
+         stats->seasons.total, stats->seasons.created,
+         stats->seasons.modified);
+  tvhlog(LOG_INFO, mod->id, "  episodes   tot=%5d new=%5d mod=%5d",
+         stats->episodes.total, stats->episodes.created,
+         stats->episodes.modified);
+  tvhlog(LOG_INFO, mod->id, "  broadcasts tot=%5d new=%5d mod=%5d",
+         stats->broadcasts.total, stats->broadcasts.created,
+         stats->broadcasts.modified);
+}
+
 /*
  * Run the parse
  */
@@ -127,21 +150,56 @@ void epggrab_module_parse( void *m, htsmsg_t *data )
 
   /* Debug stats */
   tvhlog(LOG_INFO, mod->id, "parse took %"PRItime_t" seconds", tm2 - tm1);
-  tvhlog(LOG_INFO, mod->id, "  channels   tot=%5d new=%5d mod=%5d",
-         stats.channels.total, stats.channels.created,
-         stats.channels.modified);
-  tvhlog(LOG_INFO, mod->id, "  brands     tot=%5d new=%5d mod=%5d",
-         stats.brands.total, stats.brands.created,
-         stats.brands.modified);
-  tvhlog(LOG_INFO, mod->id, "  seasons    tot=%5d new=%5d mod=%5d",
-         stats.seasons.total, stats.seasons.created,
-         stats.seasons.modified);
-  tvhlog(LOG_INFO, mod->id, "  episodes   tot=%5d new=%5d mod=%5d",
-         stats.episodes.total, stats.episodes.created,
-         stats.episodes.modified);
-  tvhlog(LOG_INFO, mod->id, "  broadcasts tot=%5d new=%5d mod=%5d",
-         stats.broadcasts.total, stats.broadcasts.created,
-         stats.broadcasts.modified);
+  _epggrab_module_stats(mod, &stats);
+}
+
+/*
+ * Run the parse on a stream (global_lock must not be held)
+ */
+void epggrab_module_stream( void *m, int fd )
+{
+  int64_t tm1, tm2;
+  epggrab_stats_t stats;
+  epggrab_module_int_t *mod = m;
+
+  memset(&stats, 0, sizeof(stats));
+  tm1 = getmonoclock();
+  if (mod->stream(mod, fd, &stats) < 0)
+    tvhlog(LOG_ERR, mod->id, "failed to parse data");
+  tm2 = getmonoclock() - tm1;
+
+  /* Debug stats */
+  tvhlog(LOG_INFO, mod->id, "parse took %"PRId64".%03"PRId64" seconds",
+         tm2 / 1000000, (tm2 / 1000) % 1000);
+  _epggrab_module_stats(mod, &stats);
+}
+
+/* **************************************************************************
+ * Incremental updates
+ * *************************************************************************/
+
+void epggrab_batch_lock ( epggrab_batch_t *b )
+{
+  if (!b->locked) {
+    pthread_mutex_lock(&global_lock);
+    b->locked = 1;
+  }
+}
+
+void epggrab_batch_done ( epggrab_batch_t *b, int save )
+{
+  b->save |= save;
+  if (++b->count >= EPGGRAB_BATCH)
+    epggrab_batch_commit(b);
+}
+
+void epggrab_batch_commit ( epggrab_batch_t *b )
+{
+  if (b->locked) {
+    if (b->save) epg_updated();
+    pthread_mutex_unlock(&global_lock);
+  }
+  b->locked = b->save = b->count = 0;
 }
 
 /* **************************************************************************
@@ -326,6 +384,13 @@ static void _epggrab_socket_handler ( epggrab_module_ext_t *mod, int s )
   time_t tm1, tm2;
   htsmsg_t *data = NULL;
 
+  /* Parse as the data arrives */
+  if (mod->stream) {
+    epggrab_module_stream(mod, s);
+    close(s);
+    return;
+  }
+
   /* Grab/Translate */
   time(&tm1);
   outlen = file_readall(s, &outbuf);
@@ -48,6 +48,7 @@ typedef struct opentv_dict
 {
   char                  *id;
   huffman_node_t        *codes;
+  huffman_table_t       *table;  ///< Compiled codes (NULL if failed)
   RB_ENTRY(opentv_dict) h_link;
 } opentv_dict_t;
 
@@ -174,7 +175,9 @@ static char *_opentv_parse_string
   // Note: unlikely decoded string will be longer (though its possible)
   ret = tmp = malloc(2*len);
   *ret = 0;
-  if (huffman_decode(prov->dict->codes, buf, len, 0x20, tmp, 2*len)) {
+  if (prov->dict->table ?
+        huffman_table_decode(prov->dict->table, buf, len, 0x20, tmp, 2*len) :
+        huffman_decode(prov->dict->codes, buf, len, 0x20, tmp, 2*len)) {
 
     /* Ignore (empty) strings */
     while (*tmp) {
@@ -650,6 +653,102 @@ static void _opentv_genre_load ( htsmsg_t *m )
   htsmsg_destroy(m);
 }
 
+#define OPENTV_DICT_TEST_STRS 1000
+
+/*
+ * Test strings for the dictionaries (any bit pattern decodes)
+ */
+static int _opentv_dict_test_string
+  ( uint8_t *buf, int size, uint32_t *seed, int i )
+{
+  int j, len = 1 + i % (size - 1);
+  for (j = 0; j < len; j++) {
+    *seed = *seed * 1103515245 + 12345;
+    buf[j] = *seed >> 16;
+  }
+  return len;
+}
+
+/*
+ * Compare the compiled table against the tree
+ */
+static int _opentv_dict_selftest ( opentv_dict_t *dict )
+{
+  uint8_t buf[80];
+  char a[161], b[161];
+  uint32_t seed = 0x6b8b4567;
+  int i, len, outl;
+
+  for (i = 0; i < OPENTV_DICT_TEST_STRS; i++) {
+    len  = _opentv_dict_test_string(buf, sizeof(buf), &seed, i);
+    outl = (i % 7) ? 2 * len : 1 + i % (2 * len);
+    huffman_decode(dict->codes, buf, len, 0x20, a, outl);
+    huffman_table_decode(dict->table, buf, len, 0x20, b, outl);
+    if (strcmp(a, b))
+      return 0;
+  }
+  return 1;
+}
+
+static void _opentv_dict_compile ( opentv_dict_t *dict )
+{
+  dict->table = huffman_table_compile(&dict->codes, 1);
+  if (!dict->table || !_opentv_dict_selftest(dict)) {
+    tvhlog(LOG_ERR, "opentv", "dictionary %s table failed self-test, "
+           "using tree", dict->id);
+    huffman_table_destroy(dict->table);
+    dict->table = NULL;
+  }
+}
+
+/*
+ * Microbenchmark, tree vs table decoder for every dictionary
+ */
+void opentv_huffman_benchmark ( void )
+{
+  opentv_dict_t *dict;
+  uint8_t *src;
+  int *lens, i, n, d;
+  char out[161];
+  uint32_t seed = 0x6b8b4567;
+  struct timespec ts;
+  int64_t start, now, strs, bytes;
+
+  src  = malloc(OPENTV_DICT_TEST_STRS * 80);
+  lens = malloc(OPENTV_DICT_TEST_STRS * sizeof(int));
+  for (i = 0; i < OPENTV_DICT_TEST_STRS; i++)
+    lens[i] = _opentv_dict_test_string(src + i * 80, 80, &seed, i);
+
+  RB_FOREACH(dict, &_opentv_dicts, h_link) {
+    for (d = 0; d < 2; d++) {
+      if (d && !dict->table) continue;
+      strs = bytes = 0;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      start = now = ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+      while (now - start < 250000) {
+        for (n = 0; n < 100; n++, strs++) {
+          i = strs % OPENTV_DICT_TEST_STRS;
+          if (d)
+            huffman_table_decode(dict->table, src + i * 80, lens[i], 0x20,
+                                 out, 2 * lens[i]);
+          else
+            huffman_decode(dict->codes, src + i * 80, lens[i], 0x20,
+                           out, 2 * lens[i]);
+          bytes += strlen(out);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        now = ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+      }
+      tvhlog(LOG_INFO, "opentv",
+             "benchmark %-8s %-5s: %"PRId64" strings/s, %.1f MB/s decoded",
+             dict->id, d ? "table" : "tree", strs * 1000000 / (now - start),
+             (double)bytes / (now - start));
+    }
+  }
+  free(lens);
+  free(src);
+}
+
 static int _opentv_dict_load_one ( const char *id, htsmsg_t *m )
 {
   opentv_dict_t *dict = calloc(1, sizeof(opentv_dict_t));
@@ -666,6 +765,7 @@ static int _opentv_dict_load_one ( const char *id, htsmsg_t *m )
       return -1;
     } else {
       dict->id = strdup(id);
+      _opentv_dict_compile(dict);
       return 1;
     }
   }
@@ -820,6 +920,7 @@ void opentv_done ( void )
   while ((dict = RB_FIRST(&_opentv_dicts)) != NULL) {
     RB_REMOVE(&_opentv_dicts, dict, h_link);
     huffman_tree_destroy(dict->codes);
+    huffman_table_destroy(dict->table);
     free(dict->id);
     free(dict);
   }
@@ -660,6 +660,68 @@ static int _xmltv_parse_tv
   return save;
 }
 
+/**
+ * Streaming parse, one <channel> or <programme> at a time
+ */
+typedef struct xmltv_stream {
+  epggrab_module_t *mod;
+  epggrab_stats_t  *stats;
+  epggrab_batch_t   batch;
+  int               programmes;
+} xmltv_stream_t;
+
+static int _xmltv_stream_element
+  ( void *opaque, const char *name, htsmsg_t *body )
+{
+  xmltv_stream_t *xs = opaque;
+  int save;
+
+  /* Don't hold global_lock while the parser waits for input */
+  if (!name) {
+    epggrab_batch_commit(&xs->batch);
+    return 0;
+  }
+  if (!strcmp(name, "channel")) {
+    epggrab_batch_lock(&xs->batch);
+    save = _xmltv_parse_channel(xs->mod, body, xs->stats);
+  } else if (!strcmp(name, "programme")) {
+    epggrab_batch_lock(&xs->batch);
+    save = _xmltv_parse_programme(xs->mod, body, xs->stats);
+    xs->programmes++;
+  } else {
+    return 0;
+  }
+  epggrab_batch_done(&xs->batch, save);
+  return !epggrab_running;
+}
+
+static int _xmltv_stream
+  ( void *mod, int fd, epggrab_stats_t *stats )
+{
+  xmltv_stream_t xs;
+  char errbuf[100];
+  int64_t t;
+  int r;
+
+  memset(&xs, 0, sizeof(xs));
+  xs.mod   = mod;
+  xs.stats = stats;
+
+  t = getmonoclock();
+  r = htsmsg_xml_deserialize_stream(fd, _xmltv_stream_element, &xs,
+                                    errbuf, sizeof(errbuf));
+  epggrab_batch_commit(&xs.batch);
+  t = getmonoclock() - t;
+
+  if (r)
+    tvhlog(LOG_ERR, ((epggrab_module_t *)mod)->id,
+           "htsmsg_xml_deserialize error %s", errbuf);
+  tvhlog(LOG_INFO, ((epggrab_module_t *)mod)->id,
+         "%d programmes (%"PRId64" programmes/s)", xs.programmes,
+         t > 0 ? (int64_t)xs.programmes * 1000000 / t : 0);
+  return r;
+}
+
 static int _xmltv_parse
   ( void *mod, htsmsg_t *data, epggrab_stats_t *stats )
 {
@@ -680,6 +742,7 @@ static int _xmltv_parse
 
 static void _xmltv_load_grabbers ( void )
 {
+  epggrab_module_int_t *mod;
   int outlen;
   size_t i, p, n;
   char *outbuf;
@@ -696,8 +759,9 @@ static void _xmltv_load_grabbers ( void )
       if ( outbuf[i] == '\n' || outbuf[i] == '\0' ) {
         outbuf[i] = '\0';
         sprintf(name, "XMLTV: %s", &outbuf[n]);
-        epggrab_module_int_create(NULL, &outbuf[p], name, 3, &outbuf[p],
+        mod = epggrab_module_int_create(NULL, &outbuf[p], name, 3, &outbuf[p],
                                 NULL, _xmltv_parse, NULL, NULL);
+        mod->stream = _xmltv_stream;
         p = n = i + 1;
       } else if ( outbuf[i] == '|' ) {
         outbuf[i] = '\0';
@@ -734,8 +798,9 @@ static void _xmltv_load_grabbers ( void )
           if ((outlen = spawn_and_store_stdout(bin, argv, &outbuf)) > 0) {
             if (outbuf[outlen-1] == '\n') outbuf[outlen-1] = '\0';
             snprintf(name, sizeof(name), "XMLTV: %s", outbuf);
-            epggrab_module_int_create(NULL, bin, name, 3, bin,
+            mod = epggrab_module_int_create(NULL, bin, name, 3, bin,
                                       NULL, _xmltv_parse, NULL, NULL);
+            mod->stream = _xmltv_stream;
             free(outbuf);
           }
         }
@@ -754,6 +819,7 @@ void xmltv_init ( void )
     epggrab_module_ext_create(NULL, "xmltv", "XMLTV", 3, "xmltv",
                               _xmltv_parse, NULL,
                               &_xmltv_channels);
+  ((epggrab_module_int_t *)_xmltv_module)->stream = _xmltv_stream;
 
   /* Standard modules */
   _xmltv_load_grabbers();
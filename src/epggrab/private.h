@@ -39,6 +39,27 @@ void      epggrab_module_ch_mod  ( void *m, struct channel *ch );
 void      epggrab_module_ch_save ( void *m, epggrab_channel_t *ec );
 
 void      epggrab_module_parse ( void *m, htsmsg_t *data );
+void      epggrab_module_stream ( void *m, int fd );
+
+/*
+ * Incremental updates
+ *
+ * Used by stream parsers, global_lock is taken per object and released
+ * (with the EPG updates committed) after every EPGGRAB_BATCH objects, or
+ * earlier with epggrab_batch_commit() before blocking on input.
+ */
+#define EPGGRAB_BATCH 256
+
+typedef struct epggrab_batch
+{
+  int locked;
+  int save;
+  int count;
+} epggrab_batch_t;
+
+void      epggrab_batch_lock   ( epggrab_batch_t *b );
+void      epggrab_batch_done   ( epggrab_batch_t *b, int save );
+void      epggrab_batch_commit ( epggrab_batch_t *b );
 
 void      epggrab_module_channels_load ( epggrab_module_t *m );
 
@@ -166,6 +187,9 @@ int  xmltv_parse_accessibility
 /* Freesat huffman decoder */
 size_t freesat_huffman_decode
   (char *dst, size_t* dstlen, const uint8_t *src, size_t srclen);
+void freesat_huffman_init      ( void );
+void freesat_huffman_done      ( void );
+void freesat_huffman_benchmark ( void );
 
 /* **************************************************************************
  * Module setup(s)
@@ -180,6 +204,7 @@ void eit_load    ( void );
 void opentv_init ( void );
 void opentv_done ( void );
 void opentv_load ( void );
+void opentv_huffman_benchmark ( void );
 
 /* PyEPG module */
 void pyepg_init  ( void );
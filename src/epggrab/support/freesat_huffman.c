@@ -33,6 +33,7 @@
 #include "epg.h"
 #include "epggrab.h"
 #include "epggrab/private.h"
+#include "huffman.h"
 
 struct fsattab {
 	unsigned int value;
@@ -5757,7 +5758,11 @@ unsigned fsat_index_2[] = {
 		3160  /* 128 */
 };
 
-size_t freesat_huffman_decode
+/*
+ * Reference decoder, walks the code list of the previous character
+ * for every symbol. Used to verify and benchmark the table decoder.
+ */
+static size_t freesat_huffman_decode_ref
   (char *dst, size_t* dstlen, const uint8_t *src, size_t srclen)
 {
 	struct fsattab *fsat_table;
@@ -5860,3 +5865,249 @@ size_t freesat_huffman_decode
     return -1;
 	}
 }
+
+/* **************************************************************************
+ * Table driven decoder
+ * *************************************************************************/
+
+#define FSAT_CONTEXTS  128
+#define FSAT_TEST_STRS 2000
+
+static huffman_table_t *fsat_huffman[2];
+
+/*
+ * Code tree for one previous character, the first matching code wins
+ * (like the linear search of the reference decoder)
+ */
+static huffman_node_t *
+freesat_huffman_tree ( struct fsattab *table, unsigned int *index, int ctx )
+{
+  unsigned int j;
+  int b;
+  huffman_node_t *root = calloc(1, sizeof(huffman_node_t)), *node, **child;
+
+  for (j = index[ctx]; j < index[ctx + 1]; j++) {
+    node = root;
+    for (b = 0; b < table[j].bits && !node->data; b++) {
+      child = (table[j].value & (0x80000000 >> b)) ? &node->b1 : &node->b0;
+      if (!*child)
+        *child = calloc(1, sizeof(huffman_node_t));
+      node = *child;
+    }
+    if (!node->data && !node->b0 && !node->b1) {
+      node->data = calloc(1, 2);
+      node->data[0] = table[j].next;
+    }
+  }
+  return root;
+}
+
+static huffman_table_t *
+freesat_huffman_compile ( struct fsattab *table, unsigned int *index )
+{
+  int i;
+  huffman_table_t *t;
+  huffman_node_t *trees[FSAT_CONTEXTS];
+
+  for (i = 0; i < FSAT_CONTEXTS; i++)
+    trees[i] = freesat_huffman_tree(table, index, i);
+  t = huffman_table_compile(trees, FSAT_CONTEXTS);
+  for (i = 0; i < FSAT_CONTEXTS; i++)
+    huffman_tree_destroy(trees[i]);
+  return t;
+}
+
+size_t freesat_huffman_decode
+  (char *dst, size_t* dstlen, const uint8_t *src, size_t srclen)
+{
+  huffman_table_t *t;
+  const huffman_entry_t *e;
+  size_t p = 0, pos = 16, byte0;
+  char lastch = START, nextch;
+
+  if (srclen < 2 || src[0] != 0x1f || (src[1] != 1 && src[1] != 2))
+    return freesat_huffman_decode_ref(dst, dstlen, src, srclen);
+  if (!(t = fsat_huffman[src[1] - 1]))
+    return freesat_huffman_decode_ref(dst, dstlen, src, srclen);
+
+  // Note: the reference decoder counts (whole) bytes loaded into its
+  //       32 bit window and stops 4 bytes past the end of the data
+  byte0 = srclen < 6 ? MAX(srclen, 2) : 6;
+  do {
+    if (lastch == ESCAPE) {
+      // Encoded in the next 8 bits, terminated by the first ASCII character
+      nextch = huffman_peek8(src, srclen, pos);
+      pos += 8;
+      if ((nextch & 0x80) == 0) {
+        if (nextch < ' ')
+          nextch = STOP;
+        lastch = nextch;
+      }
+    } else {
+      if ((unsigned char)lastch >= FSAT_CONTEXTS ||
+          !(e = huffman_table_step(t, (unsigned char)lastch,
+                                   src, srclen, &pos)))
+        return -1;
+      lastch = nextch = t->syms[e->next].str[0];
+    }
+    if (nextch != STOP && nextch != ESCAPE) {
+      if (p >= *dstlen) return 0;
+      dst[p++] = nextch;
+    }
+  } while (lastch != STOP && byte0 + (pos - 16) / 8 < srclen + 4);
+
+  dst[p] = '\0';
+  *dstlen = p;
+  return 0;
+}
+
+static inline void
+freesat_huffman_put_bit ( uint8_t *buf, size_t *nbits, int bit )
+{
+  if (bit)
+    buf[*nbits >> 3] |= 0x80 >> (*nbits & 7);
+  (*nbits)++;
+}
+
+/*
+ * Test strings, random walks through the code tables (with the odd
+ * escaped character) and some plain noise
+ */
+static int
+freesat_huffman_test_string ( uint8_t *buf, size_t size, uint32_t *seed )
+{
+  struct fsattab *table;
+  unsigned int *index;
+  size_t nbits = 16;
+  int ctx = START, n, j, b, v;
+
+#define FSAT_RAND() (*seed = *seed * 1103515245 + 12345, *seed >> 16)
+
+  memset(buf, 0, size);
+  buf[0] = 0x1f;
+  buf[1] = 1 + (FSAT_RAND() & 1);
+  table  = buf[1] == 1 ? fsat_table_1 : fsat_table_2;
+  index  = buf[1] == 1 ? fsat_index_1 : fsat_index_2;
+
+  if (FSAT_RAND() % 8 == 0) {
+    n = 2 + FSAT_RAND() % (size - 2);
+    for (j = 2; j < n; j++)
+      buf[j] = FSAT_RAND();
+    return n;
+  }
+
+  for (n = FSAT_RAND() % 120; n >= 0 && nbits + 40 < size * 8; n--) {
+    if (ctx == ESCAPE) {
+      v = 0x20 + FSAT_RAND() % 0x5f;
+      for (b = 0; b < 8; b++)
+        freesat_huffman_put_bit(buf, &nbits, v & (0x80 >> b));
+      ctx = v;
+      continue;
+    }
+    if (index[ctx] == index[ctx + 1])
+      break;
+    j = index[ctx] + FSAT_RAND() % (index[ctx + 1] - index[ctx]);
+    for (b = 0; b < table[j].bits; b++)
+      freesat_huffman_put_bit(buf, &nbits, table[j].value & (0x80000000 >> b));
+    if ((ctx = table[j].next) == STOP || ctx < 0 || ctx >= FSAT_CONTEXTS)
+      break;
+  }
+  return MIN((nbits + 7) / 8 + FSAT_RAND() % 3, size);
+
+#undef FSAT_RAND
+}
+
+static int
+freesat_huffman_selftest ( void )
+{
+  uint8_t src[256];
+  char a[512], b[512];
+  size_t alen, blen, ra, rb;
+  uint32_t seed = 0x4f1bbcdc;
+  int i, len;
+
+  for (i = 0; i < FSAT_TEST_STRS; i++) {
+    len  = freesat_huffman_test_string(src, sizeof(src), &seed);
+    alen = blen = (i % 5) ? sizeof(a) - 1 : 1 + i % 40;
+    memset(a, 0, sizeof(a));
+    memset(b, 0, sizeof(b));
+    ra = freesat_huffman_decode_ref(a, &alen, src, len);
+    rb = freesat_huffman_decode(b, &blen, src, len);
+    if (ra != rb || alen != blen || memcmp(a, b, sizeof(a)))
+      return 0;
+  }
+  return 1;
+}
+
+void freesat_huffman_init ( void )
+{
+  fsat_huffman[0] = freesat_huffman_compile(fsat_table_1, fsat_index_1);
+  fsat_huffman[1] = freesat_huffman_compile(fsat_table_2, fsat_index_2);
+  if (!fsat_huffman[0] || !fsat_huffman[1] || !freesat_huffman_selftest()) {
+    tvhlog(LOG_ERR, "freesat", "huffman tables failed self-test, disabled");
+    freesat_huffman_done();
+    return;
+  }
+  tvhlog(LOG_DEBUG, "freesat", "huffman tables compiled (%d+%d tables)",
+         fsat_huffman[0]->ntables, fsat_huffman[1]->ntables);
+}
+
+void freesat_huffman_done ( void )
+{
+  huffman_table_destroy(fsat_huffman[0]);
+  huffman_table_destroy(fsat_huffman[1]);
+  fsat_huffman[0] = fsat_huffman[1] = NULL;
+}
+
+/*
+ * Microbenchmark, reference vs table decoder
+ */
+void freesat_huffman_benchmark ( void )
+{
+  static const struct {
+    const char *name;
+    size_t (*decode)(char *, size_t *, const uint8_t *, size_t);
+  } decoders[] = {
+    { "reference", freesat_huffman_decode_ref },
+    { "table",     freesat_huffman_decode     },
+  };
+  uint8_t *src;
+  int *lens, i, d, n;
+  char dst[512];
+  size_t dlen;
+  uint32_t seed = 0x4f1bbcdc;
+  struct timespec ts;
+  int64_t start, now, strs, bytes;
+
+  src  = malloc(FSAT_TEST_STRS * 256);
+  lens = malloc(FSAT_TEST_STRS * sizeof(int));
+  for (i = 0; i < FSAT_TEST_STRS; i++)
+    lens[i] = freesat_huffman_test_string(src + i * 256, 256, &seed);
+
+  for (d = 0; d < ARRAY_SIZE(decoders); d++) {
+    if (d && !fsat_huffman[0]) {
+      tvhlog(LOG_INFO, "freesat", "benchmark %-10s: not available",
+             decoders[d].name);
+      continue;
+    }
+    strs = bytes = 0;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    start = now = ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+    while (now - start < 250000) {
+      for (n = 0; n < 100; n++, strs++) {
+        i = strs % FSAT_TEST_STRS;
+        dlen = sizeof(dst) - 1;
+        if (!decoders[d].decode(dst, &dlen, src + i * 256, lens[i]))
+          bytes += dlen;
+      }
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      now = ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+    }
+    tvhlog(LOG_INFO, "freesat",
+           "benchmark %-10s: %"PRId64" strings/s, %.1f MB/s decoded",
+           decoders[d].name, strs * 1000000 / (now - start),
+           (double)bytes / (now - start));
+  }
+  free(lens);
+  free(src);
+}
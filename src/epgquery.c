@@ -0,0 +1,768 @@
+/*
+ *  Electronic Program Guide - Indexes and querying
+ *  Copyright (C) 2012 Adam Sutton
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <regex.h>
+
+#include "tvheadend.h"
+#include "queue.h"
+#include "channels.h"
+#include "epg.h"
+
+/*
+ * Three secondary indexes are kept up to date as broadcasts and
+ * episodes change (all under global_lock):
+ *
+ *   - all scheduled broadcasts ordered by start time
+ *   - a bitmap per major genre over broadcast slots
+ *   - an inverted index of ASCII title trigrams over episode slots
+ *
+ * Slots are dense numbers handed out to indexed objects and recycled
+ * when they go away. The title index only ever answers "may match":
+ * postings are appended on every title change and never removed, the
+ * regex is still run on the candidates. Stale postings are dropped by
+ * a rebuild once they outnumber the live ones.
+ */
+
+/* **************************************************************************
+ * Slots
+ * *************************************************************************/
+
+typedef struct epg_index_slots
+{
+  void     **ptr;        ///< Objects, slot 0 is never used
+  uint32_t   count;      ///< Slots handed out (incl. free ones)
+  uint32_t   alloc;
+  uint32_t  *free;       ///< Recycled slots
+  uint32_t   nfree;
+  uint32_t   free_alloc;
+} epg_index_slots_t;
+
+static epg_index_slots_t epg_bcast_slots;
+static epg_index_slots_t epg_episode_slots;
+
+static uint32_t
+_epg_slot_get ( epg_index_slots_t *s, void *p )
+{
+  uint32_t slot;
+
+  if (s->nfree) {
+    slot = s->free[--s->nfree];
+  } else {
+    if (s->count == 0)
+      s->count = 1;
+    if (s->count >= s->alloc) {
+      s->alloc = MAX(1024, s->alloc * 2);
+      s->ptr   = realloc(s->ptr, s->alloc * sizeof(void *));
+    }
+    slot = s->count++;
+  }
+  s->ptr[slot] = p;
+  return slot;
+}
+
+static void
+_epg_slot_put ( epg_index_slots_t *s, uint32_t slot )
+{
+  s->ptr[slot] = NULL;
+  if (s->nfree == s->free_alloc) {
+    s->free_alloc = MAX(1024, s->free_alloc * 2);
+    s->free       = realloc(s->free, s->free_alloc * sizeof(uint32_t));
+  }
+  s->free[s->nfree++] = slot;
+}
+
+static void
+_epg_slots_done ( epg_index_slots_t *s )
+{
+  free(s->ptr);
+  free(s->free);
+  memset(s, 0, sizeof(*s));
+}
+
+/* **************************************************************************
+ * Start time index
+ * *************************************************************************/
+
+static RB_HEAD(, epg_broadcast) epg_time_index;
+
+static int _ebc_time_cmp ( const void *_a, const void *_b )
+{
+  const epg_broadcast_t *a = _a, *b = _b;
+  if (a->start != b->start)
+    return a->start < b->start ? -1 : 1;
+  if (a->id != b->id)
+    return a->id < b->id ? -1 : 1;
+  return 0;
+}
+
+static int _ebc_time_sort ( const void *a, const void *b )
+{
+  return _ebc_time_cmp(*(epg_broadcast_t**)a, *(epg_broadcast_t**)b);
+}
+
+/* **************************************************************************
+ * Genre bitmaps
+ * *************************************************************************/
+
+static uint64_t *epg_genre_bits[16];
+static uint32_t  epg_genre_words;
+
+static void
+_epg_genre_bits_grow ( void )
+{
+  uint32_t words = (epg_bcast_slots.alloc + 63) / 64;
+  int i;
+
+  if (words <= epg_genre_words)
+    return;
+  for (i = 0; i < 16; i++) {
+    epg_genre_bits[i] = realloc(epg_genre_bits[i], words * sizeof(uint64_t));
+    memset(epg_genre_bits[i] + epg_genre_words, 0,
+           (words - epg_genre_words) * sizeof(uint64_t));
+  }
+  epg_genre_words = words;
+}
+
+static uint16_t
+_epg_genre_mask ( epg_episode_t *ee )
+{
+  epg_genre_t *g;
+  uint16_t mask = 0;
+  if (ee)
+    LIST_FOREACH(g, &ee->genre, link)
+      mask |= 1 << (g->code >> 4);
+  return mask;
+}
+
+static void
+_epg_genre_bits_set ( epg_broadcast_t *ebc, uint16_t mask )
+{
+  uint16_t diff = ebc->query_genres ^ mask;
+  uint32_t w = ebc->query_slot / 64;
+  uint64_t b = 1ULL << (ebc->query_slot % 64);
+  int i;
+
+  for (i = 0; diff; i++, diff >>= 1)
+    if (diff & 1)
+      epg_genre_bits[i][w] ^= b;
+  ebc->query_genres = mask;
+}
+
+/* **************************************************************************
+ * Title trigrams
+ * *************************************************************************/
+
+typedef struct epg_trigram
+{
+  uint32_t  key;         ///< Folded characters, 0 = empty bucket
+  uint32_t  count;
+  uint32_t  alloc;
+  int       sorted;
+  uint32_t *slots;       ///< Episode slots (may be stale)
+} epg_trigram_t;
+
+static epg_trigram_t *epg_trigrams;
+static uint32_t       epg_trigrams_size;
+static uint32_t       epg_trigrams_used;
+static uint64_t       epg_postings_total;
+static uint64_t       epg_postings_live;
+
+static inline uint32_t
+_epg_trigram_key ( const uint8_t *p )
+{
+  /* Only ASCII, case folding of anything else is up to the locale */
+  if (!p[0] || !p[1] || !p[2] || ((p[0] | p[1] | p[2]) & 0x80))
+    return 0;
+  return tolower(p[0]) << 16 | tolower(p[1]) << 8 | tolower(p[2]);
+}
+
+static inline uint32_t
+_epg_trigram_hash ( uint32_t key, uint32_t size )
+{
+  return (key * 0x9E3779B1) & (size - 1);
+}
+
+static epg_trigram_t *
+_epg_trigram_find ( uint32_t key, int create )
+{
+  epg_trigram_t *t, *old;
+  uint32_t i, size;
+
+  if (create && (epg_trigrams_used + 1) * 2 > epg_trigrams_size) {
+    old  = epg_trigrams;
+    size = epg_trigrams_size;
+    epg_trigrams_size = MAX(4096, size * 2);
+    epg_trigrams      = calloc(epg_trigrams_size, sizeof(epg_trigram_t));
+    for (i = 0; i < size; i++) {
+      if (!old[i].key) continue;
+      t = epg_trigrams + _epg_trigram_hash(old[i].key, epg_trigrams_size);
+      while (t->key)
+        if (++t == epg_trigrams + epg_trigrams_size) t = epg_trigrams;
+      *t = old[i];
+    }
+    free(old);
+  }
+  if (!epg_trigrams_size)
+    return NULL;
+
+  t = epg_trigrams + _epg_trigram_hash(key, epg_trigrams_size);
+  while (t->key) {
+    if (t->key == key)
+      return t;
+    if (++t == epg_trigrams + epg_trigrams_size) t = epg_trigrams;
+  }
+  if (!create)
+    return NULL;
+  t->key = key;
+  epg_trigrams_used++;
+  return t;
+}
+
+static void
+_epg_trigram_add ( uint32_t key, uint32_t slot )
+{
+  epg_trigram_t *t = _epg_trigram_find(key, 1);
+  if (t->count == t->alloc) {
+    t->alloc = MAX(4, t->alloc * 2);
+    t->slots = realloc(t->slots, t->alloc * sizeof(uint32_t));
+  }
+  if (t->count && t->slots[t->count - 1] >= slot)
+    t->sorted = 0;
+  else if (!t->count)
+    t->sorted = 1;
+  t->slots[t->count++] = slot;
+  epg_postings_total++;
+}
+
+static int _u32_cmp ( const void *_a, const void *_b )
+{
+  uint32_t a = *(uint32_t*)_a, b = *(uint32_t*)_b;
+  return a < b ? -1 : a > b;
+}
+
+static uint32_t
+_u32_unique ( uint32_t *v, uint32_t n )
+{
+  uint32_t i, j;
+  qsort(v, n, sizeof(uint32_t), _u32_cmp);
+  for (i = j = 0; i < n; i++)
+    if (!j || v[j-1] != v[i])
+      v[j++] = v[i];
+  return j;
+}
+
+static void
+_epg_trigram_compact ( epg_trigram_t *t )
+{
+  uint32_t n;
+  if (t->sorted) return;
+  n = _u32_unique(t->slots, t->count);
+  epg_postings_total -= t->count - n;
+  t->count  = n;
+  t->sorted = 1;
+}
+
+/* Distinct trigrams of all title translations */
+static uint32_t
+_epg_title_keys ( epg_episode_t *ee, uint32_t **keys, uint32_t *alloc )
+{
+  lang_str_ele_t *ls;
+  const uint8_t *p;
+  uint32_t n = 0, k;
+
+  if (!ee->title)
+    return 0;
+  RB_FOREACH(ls, ee->title, link) {
+    for (p = (const uint8_t *)ls->str; *p; p++) {
+      if (!(k = _epg_trigram_key(p)))
+        continue;
+      if (n == *alloc) {
+        *alloc = MAX(64, *alloc * 2);
+        *keys  = realloc(*keys, *alloc * sizeof(uint32_t));
+      }
+      (*keys)[n++] = k;
+    }
+  }
+  return n ? _u32_unique(*keys, n) : 0;
+}
+
+static void
+_epg_title_add ( epg_episode_t *ee )
+{
+  static uint32_t *keys, alloc;
+  uint32_t i, n;
+
+  n = _epg_title_keys(ee, &keys, &alloc);
+  for (i = 0; i < n; i++)
+    _epg_trigram_add(keys[i], ee->query_slot);
+  ee->query_postings  = n;
+  epg_postings_live  += n;
+}
+
+static void
+_epg_title_rebuild ( void )
+{
+  epg_episode_t *ee;
+  uint32_t i;
+
+  for (i = 0; i < epg_trigrams_size; i++) {
+    epg_trigrams[i].count  = 0;
+    epg_trigrams[i].sorted = 1;
+  }
+  epg_postings_total = epg_postings_live = 0;
+  for (i = 1; i < epg_episode_slots.count; i++)
+    if ((ee = epg_episode_slots.ptr[i]) != NULL)
+      _epg_title_add(ee);
+  tvhdebug("epg", "title index rebuilt, %u trigrams, %"PRIu64" postings",
+           epg_trigrams_used, epg_postings_total);
+}
+
+static void
+_epg_title_check ( void )
+{
+  if (epg_postings_total > 2 * epg_postings_live + 65536)
+    _epg_title_rebuild();
+}
+
+/* **************************************************************************
+ * Index maintenance
+ * *************************************************************************/
+
+void epg_index_broadcast_add ( epg_broadcast_t *ebc )
+{
+  if (ebc->query_slot) return;
+  ebc->query_slot   = _epg_slot_get(&epg_bcast_slots, ebc);
+  ebc->query_genres = 0;
+  _epg_genre_bits_grow();
+  _epg_genre_bits_set(ebc, _epg_genre_mask(ebc->episode));
+  RB_INSERT_SORTED(&epg_time_index, ebc, time_link, _ebc_time_cmp);
+}
+
+void epg_index_broadcast_remove ( epg_broadcast_t *ebc )
+{
+  if (!ebc->query_slot) return;
+  _epg_genre_bits_set(ebc, 0);
+  RB_REMOVE(&epg_time_index, ebc, time_link);
+  _epg_slot_put(&epg_bcast_slots, ebc->query_slot);
+  ebc->query_slot = 0;
+}
+
+void epg_index_broadcast_genre ( epg_broadcast_t *ebc )
+{
+  if (ebc->query_slot)
+    _epg_genre_bits_set(ebc, _epg_genre_mask(ebc->episode));
+}
+
+void epg_index_episode_genre ( epg_episode_t *ee )
+{
+  epg_broadcast_t *ebc;
+  uint16_t mask = _epg_genre_mask(ee);
+  LIST_FOREACH(ebc, &ee->broadcasts, ep_link)
+    if (ebc->query_slot)
+      _epg_genre_bits_set(ebc, mask);
+}
+
+void epg_index_episode_title ( epg_episode_t *ee )
+{
+  if (!ee->query_slot)
+    ee->query_slot = _epg_slot_get(&epg_episode_slots, ee);
+  epg_postings_live -= ee->query_postings;
+  _epg_title_add(ee);
+  _epg_title_check();
+}
+
+void epg_index_episode_remove ( epg_episode_t *ee )
+{
+  if (!ee->query_slot) return;
+  epg_postings_live -= ee->query_postings;
+  ee->query_postings = 0;
+  _epg_slot_put(&epg_episode_slots, ee->query_slot);
+  ee->query_slot = 0;
+  _epg_title_check();
+}
+
+void epg_index_done ( void )
+{
+  uint32_t i;
+
+  for (i = 0; i < epg_trigrams_size; i++)
+    free(epg_trigrams[i].slots);
+  free(epg_trigrams);
+  epg_trigrams = NULL;
+  epg_trigrams_size = epg_trigrams_used = 0;
+  epg_postings_total = epg_postings_live = 0;
+  for (i = 0; i < 16; i++) {
+    free(epg_genre_bits[i]);
+    epg_genre_bits[i] = NULL;
+  }
+  epg_genre_words = 0;
+  _epg_slots_done(&epg_bcast_slots);
+  _epg_slots_done(&epg_episode_slots);
+}
+
+/* **************************************************************************
+ * Querying
+ * *************************************************************************/
+
+#define EPG_QUERY_KEYS 64
+
+typedef struct epg_query_filter
+{
+  channel_t         *channel;
+  channel_tag_t     *tag;
+  epg_genre_t       *genre;
+  regex_t           *preg;
+  const char        *lang;
+  int                min_duration;
+  int                max_duration;
+  time_t             now;
+  int                skip;     ///< Paging (streaming sources only)
+  int                limit;
+} epg_query_filter_t;
+
+/*
+ * Trigrams every match of the (case insensitive, extended) regex must
+ * contain. Returns -1 if nothing can be derived safely.
+ */
+static int
+_eq_title_keys ( const char *re, uint32_t *keys, int max )
+{
+  uint8_t run[128];
+  int rlen = 0, n = 0, i, lit;
+  const char *p;
+  uint32_t k;
+
+  if (!re || strchr(re, '|') || strchr(re, '('))
+    return -1;
+
+  for (p = re; ; p++) {
+    lit = -1;
+    if (*p == '\\' && p[1]) {
+      p++;
+      if (!isalnum((uint8_t)*p) && !((uint8_t)*p & 0x80))
+        lit = *p;
+    } else if (*p && !((uint8_t)*p & 0x80) && !strchr(".[]()*+?{}|^$", *p)) {
+      lit = *p;
+    }
+    /* An optional or repeated character ends the run */
+    if (lit >= 0 && p[1] && strchr("*+?{", p[1]))
+      lit = -1;
+
+    if (lit >= 0 && rlen < sizeof(run)) {
+      run[rlen++] = lit;
+      continue;
+    }
+
+    for (i = 0; i + 3 <= rlen && n < max; i++)
+      if ((k = _epg_trigram_key(run + i)))
+        keys[n++] = k;
+    rlen = 0;
+    if (lit >= 0) {
+      run[rlen++] = lit;
+      continue;
+    }
+
+    if (*p == '\0')
+      break;
+    if (*p == '[') {
+      p++;
+      if (*p == '^') p++;
+      if (*p == ']') p++;
+      while (*p && *p != ']') {
+        if (*p == '[' && p[1] && strchr(":.=", p[1])) {
+          const char *e = strchr(p + 2, p[1]);
+          if (!e || e[1] != ']') return -1;
+          p = e + 1;
+        }
+        p++;
+      }
+      if (!*p) return -1;
+    } else if (*p == '{') {
+      if (!(p = strchr(p, '}'))) return -1;
+    }
+  }
+  return n ? (int)_u32_unique(keys, n) : -1;
+}
+
+/*
+ * Episode slots containing all the trigrams, sorted
+ */
+static uint32_t *
+_eq_title_episodes ( uint32_t *keys, int nkeys, uint32_t *count )
+{
+  epg_trigram_t *lists[EPG_QUERY_KEYS], *t;
+  uint32_t *res, i, j, n;
+  int k, l;
+
+  *count = 0;
+  for (k = 0; k < nkeys; k++) {
+    if (!(lists[k] = _epg_trigram_find(keys[k], 0)) || !lists[k]->count)
+      return NULL;
+    _epg_trigram_compact(lists[k]);
+  }
+
+  /* Shortest lists first */
+  for (k = 1; k < nkeys; k++)
+    for (l = k; l > 0 && lists[l]->count < lists[l-1]->count; l--) {
+      t = lists[l]; lists[l] = lists[l-1]; lists[l-1] = t;
+    }
+
+  n   = lists[0]->count;
+  res = malloc(n * sizeof(uint32_t));
+  memcpy(res, lists[0]->slots, n * sizeof(uint32_t));
+  for (k = 1; k < nkeys && n; k++) {
+    t = lists[k];
+    for (i = j = 0; i < n; i++)
+      if (bsearch(&res[i], t->slots, t->count, sizeof(uint32_t), _u32_cmp))
+        res[j++] = res[i];
+    n = j;
+  }
+  *count = n;
+  return res;
+}
+
+static int
+_eq_match ( epg_query_filter_t *f, epg_broadcast_t *e )
+{
+  channel_tag_mapping_t *ctm;
+  lang_str_t *ls;
+  const char *title;
+  double duration;
+
+  if ( !e->episode ) return 0;
+  if ( e->stop < f->now ) return 0;
+  if ( f->channel && e->channel != f->channel ) return 0;
+  if ( f->tag ) {
+    LIST_FOREACH(ctm, &e->channel->ch_ctms, ctm_channel_link)
+      if (ctm->ctm_tag == f->tag) break;
+    if (!ctm) return 0;
+  }
+  duration = difftime(e->stop, e->start);
+  if ( duration < f->min_duration || duration > f->max_duration ) return 0;
+  if ( f->genre && !epg_genre_list_contains(&e->episode->genre, f->genre, 1) )
+    return 0;
+
+  /* Language lookup is only needed to run the regex */
+  if ( !(ls = e->episode->title) || !RB_FIRST(ls) ) return 0;
+  if ( f->preg ) {
+    if ( !(title = lang_str_get(ls, f->lang)) ) return 0;
+    if ( regexec(f->preg, title, 0, NULL, 0) ) return 0;
+  }
+  return 1;
+}
+
+static void
+_eqr_store ( epg_query_result_t *eqr, epg_broadcast_t *e )
+{
+  if ( eqr->eqr_entries == eqr->eqr_alloced ) {
+    eqr->eqr_alloced = MAX(100, eqr->eqr_alloced * 2);
+    eqr->eqr_array   = realloc(eqr->eqr_array,
+                               eqr->eqr_alloced * sizeof(epg_broadcast_t *));
+  }
+  eqr->eqr_array[eqr->eqr_entries++] = e;
+}
+
+/* Streaming sources deliver in start order, only the page is stored */
+static void
+_eqr_add_ordered
+  ( epg_query_result_t *eqr, epg_query_filter_t *f, epg_broadcast_t *e )
+{
+  if (!_eq_match(f, e)) return;
+  if (eqr->eqr_total++ < f->skip) return;
+  if (f->limit >= 0 && eqr->eqr_entries >= f->limit) return;
+  _eqr_store(eqr, e);
+}
+
+/* Sort collected matches and cut out the page */
+static void
+_eqr_page ( epg_query_result_t *eqr, epg_query_filter_t *f )
+{
+  int n;
+
+  qsort(eqr->eqr_array, eqr->eqr_entries, sizeof(epg_broadcast_t *),
+        _ebc_time_sort);
+  eqr->eqr_total = eqr->eqr_entries;
+  n = MIN(f->skip, eqr->eqr_entries);
+  if (n) {
+    eqr->eqr_entries -= n;
+    memmove(eqr->eqr_array, eqr->eqr_array + n,
+            eqr->eqr_entries * sizeof(epg_broadcast_t *));
+  }
+  if (f->limit >= 0 && eqr->eqr_entries > f->limit)
+    eqr->eqr_entries = f->limit;
+}
+
+/*
+ * Candidate broadcasts from the title or genre index, NULL filter only
+ * requires the broadcast to be scheduled. Returns 0 if neither index
+ * applies.
+ */
+static int
+_eq_collect
+  ( epg_query_result_t *eqr, epg_query_filter_t *f,
+    const char *title, epg_genre_t *genre )
+{
+  uint32_t keys[EPG_QUERY_KEYS], *slots, count, i, w;
+  epg_episode_t *ee;
+  epg_broadcast_t *e;
+  uint64_t bits;
+  int nkeys;
+
+  /* Title trigrams */
+  if ((nkeys = _eq_title_keys(title, keys, EPG_QUERY_KEYS)) > 0) {
+    slots = _eq_title_episodes(keys, nkeys, &count);
+    for (i = 0; i < count; i++) {
+      if (!(ee = epg_episode_slots.ptr[slots[i]])) continue;
+      LIST_FOREACH(e, &ee->broadcasts, ep_link)
+        if (e->query_slot && (!f || _eq_match(f, e)))
+          _eqr_store(eqr, e);
+    }
+    free(slots);
+    return 1;
+  }
+
+  /* Major genre bitmap */
+  if (genre && epg_genre_words) {
+    for (w = 0; w < epg_genre_words; w++) {
+      bits = epg_genre_bits[genre->code >> 4][w];
+      while (bits) {
+        e = epg_bcast_slots.ptr[w * 64 + __builtin_ctzll(bits)];
+        bits &= bits - 1;
+        if (!f || _eq_match(f, e))
+          _eqr_store(eqr, e);
+      }
+    }
+    return 1;
+  }
+
+  return genre != NULL;
+}
+
+static void
+_epg_query
+  ( epg_query_result_t *eqr, channel_t *channel, channel_tag_t *tag,
+    epg_genre_t *genre, const char *title, const char *lang,
+    int min_duration, int max_duration, int start, int limit )
+{
+  epg_query_filter_t f;
+  epg_broadcast_t *e;
+  regex_t preg;
+
+  /* Clear (just incase) */
+  memset(eqr, 0, sizeof(epg_query_result_t));
+
+  /* Setup exp */
+  if ( title ) {
+    if (regcomp(&preg, title, REG_ICASE | REG_EXTENDED | REG_NOSUB) )
+      return;
+  }
+
+  memset(&f, 0, sizeof(f));
+  f.channel      = channel;
+  f.tag          = tag;
+  f.genre        = genre;
+  f.preg         = title ? &preg : NULL;
+  f.lang         = lang;
+  f.min_duration = min_duration;
+  f.max_duration = max_duration;
+  f.skip         = MAX(0, start);
+  f.limit        = limit;
+  time(&f.now);
+
+  /* Single channel, the schedule is ordered */
+  if (channel && !tag) {
+    RB_FOREACH(e, &channel->ch_epg_schedule, sched_link)
+      _eqr_add_ordered(eqr, &f, e);
+
+  /* Title / genre index */
+  } else if (_eq_collect(eqr, &f, title, genre)) {
+    _eqr_page(eqr, &f);
+
+  /* Everything, in start order */
+  } else {
+    RB_FOREACH(e, &epg_time_index, time_link)
+      _eqr_add_ordered(eqr, &f, e);
+  }
+
+  if (title) regfree(&preg);
+}
+
+void epg_query0
+  ( epg_query_result_t *eqr, channel_t *channel, channel_tag_t *tag,
+    epg_genre_t *genre, const char *title, const char *lang, int min_duration, int max_duration )
+{
+  _epg_query(eqr, channel, tag, genre, title, lang,
+             min_duration, max_duration, 0, -1);
+}
+
+void epg_query(epg_query_result_t *eqr, const char *channel, const char *tag,
+            epg_genre_t *genre, const char *title, const char *lang, int min_duration, int max_duration)
+{
+  channel_t     *ch = channel ? channel_find(channel)    : NULL;
+  channel_tag_t *ct = tag     ? channel_tag_find_by_name(tag, 0) : NULL;
+
+  _epg_query(eqr, ch, ct, genre, title, lang,
+             min_duration, max_duration, 0, -1);
+}
+
+void epg_query_paged
+  ( epg_query_result_t *eqr, const char *channel, const char *tag,
+    epg_genre_t *genre, const char *title, const char *lang,
+    int min_duration, int max_duration, int start, int limit )
+{
+  channel_t     *ch = channel ? channel_find(channel)    : NULL;
+  channel_tag_t *ct = tag     ? channel_tag_find_by_name(tag, 0) : NULL;
+
+  _epg_query(eqr, ch, ct, genre, title, lang,
+             min_duration, max_duration, start, limit);
+}
+
+void epg_query_candidates
+  ( epg_query_result_t *eqr, const char *title, epg_genre_t *genre )
+{
+  epg_broadcast_t *e;
+
+  memset(eqr, 0, sizeof(epg_query_result_t));
+  if (_eq_collect(eqr, NULL, title, genre)) {
+    qsort(eqr->eqr_array, eqr->eqr_entries, sizeof(epg_broadcast_t *),
+          _ebc_time_sort);
+  } else {
+    RB_FOREACH(e, &epg_time_index, time_link)
+      _eqr_store(eqr, e);
+  }
+  eqr->eqr_total = eqr->eqr_entries;
+}
+
+void epg_query_free(epg_query_result_t *eqr)
+{
+  free(eqr->eqr_array);
+}
+
+static int _epg_sort_start_ascending ( const void *a, const void *b )
+{
+  return (*(epg_broadcast_t**)a)->start - (*(epg_broadcast_t**)b)->start;
+}
+
+void epg_query_sort(epg_query_result_t *eqr)
+{
+  qsort(eqr->eqr_array, eqr->eqr_entries, sizeof(epg_broadcast_t*),
+        _epg_sort_start_ascending);
+}
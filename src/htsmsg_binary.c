@@ -22,6 +22,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
 
 #include "htsmsg_binary.h"
 
@@ -180,10 +181,60 @@ htsmsg_binary_count(htsmsg_t *msg)
 
 
 /*
+ * iovec state for htsmsg_binary_serialize_iov()
+ */
+typedef struct htsmsg_binary_iov {
+  struct iovec *iov;
+  int           iovcnt;
+  int           iovmax;
+  size_t        minref;
+  uint8_t      *base;
+} htsmsg_binary_iov_t;
+
+#define HTSMSG_BINARY_CANREF(f, l, iv) \
+  ((l) >= (iv)->minref && !((f)->hmf_flags & HMF_ALLOCED) && \
+   (iv)->iovcnt + 2 < (iv)->iovmax)
+
+/*
+ * Bytes of the fields htsmsg_binary_write() will reference
  *
+ * Every reference uses two iovec entries (the header bytes before it and
+ * the data itself), mirror that here to know what is left to copy.
  */
-static void
-htsmsg_binary_write(htsmsg_t *msg, uint8_t *ptr)
+static size_t
+htsmsg_binary_count_ref(htsmsg_t *msg, htsmsg_binary_iov_t *iv)
+{
+  htsmsg_field_t *f;
+  size_t len = 0;
+
+  TAILQ_FOREACH(f, &msg->hm_fields, hmf_link) {
+    switch(f->hmf_type) {
+    case HMF_MAP:
+    case HMF_LIST:
+      len += htsmsg_binary_count_ref(&f->hmf_msg, iv);
+      break;
+
+    case HMF_BIN:
+      if(HTSMSG_BINARY_CANREF(f, f->hmf_binsize, iv)) {
+        iv->iovcnt += 2;
+        len += f->hmf_binsize;
+      }
+      break;
+    }
+  }
+  return len;
+}
+
+/*
+ * Write the fields of msg at ptr, returns the end pointer
+ *
+ * If iov is given, HMF_BIN fields that only point at their data (binptr)
+ * and are at least iv->minref bytes long are not copied but referenced
+ * by a separate iovec entry. The iovec entry for the preceding bytes is
+ * closed and a new one is opened right after the field header.
+ */
+static uint8_t *
+htsmsg_binary_write(htsmsg_t *msg, uint8_t *ptr, htsmsg_binary_iov_t *iv)
 {
   htsmsg_field_t *f;
   uint64_t u64;
@@ -234,14 +285,23 @@ htsmsg_binary_write(htsmsg_t *msg, uint8_t *ptr)
     switch(f->hmf_type) {
     case HMF_MAP:
     case HMF_LIST:
-      htsmsg_binary_write(&f->hmf_msg, ptr);
-      break;
+      ptr = htsmsg_binary_write(&f->hmf_msg, ptr, iv);
+      continue;
 
     case HMF_STR:
       memcpy(ptr, f->hmf_str, l);
       break;
 
     case HMF_BIN:
+      if(iv && HTSMSG_BINARY_CANREF(f, l, iv)) {
+        iv->iov[iv->iovcnt].iov_len = ptr - iv->base;
+        iv->iovcnt++;
+        iv->iov[iv->iovcnt].iov_base = (void *)f->hmf_bin;
+        iv->iov[iv->iovcnt].iov_len  = l;
+        iv->iovcnt++;
+        iv->iov[iv->iovcnt].iov_base = iv->base = ptr;
+        continue;
+      }
       memcpy(ptr, f->hmf_bin, l);
       break;
 
@@ -255,6 +315,7 @@ htsmsg_binary_write(htsmsg_t *msg, uint8_t *ptr)
     }
     ptr += l;
   }
+  return ptr;
 }
 
 
@@ -278,8 +339,94 @@ htsmsg_binary_serialize(htsmsg_t *msg, void **datap, size_t *lenp, int maxlen)
   data[2] = len >> 8;
   data[3] = len;
 
-  htsmsg_binary_write(msg, data + 4);
+  htsmsg_binary_write(msg, data + 4, NULL);
   *datap = data;
   *lenp  = len + 4;
   return 0;
 }
+
+
+/*
+ * Serialize into a caller provided buffer of *lenp bytes
+ *
+ * *lenp is set to the serialized size. If the buffer is too small
+ * nothing is written and 1 is returned, -1 if maxlen is exceeded.
+ */
+int
+htsmsg_binary_serialize_to(htsmsg_t *msg, void *dst, size_t *lenp, int maxlen)
+{
+  size_t len;
+  uint8_t *data = dst;
+
+  len = htsmsg_binary_count(msg);
+  if(len + 4 > maxlen)
+    return -1;
+  if(len + 4 > *lenp) {
+    *lenp = len + 4;
+    return 1;
+  }
+
+  data[0] = len >> 24;
+  data[1] = len >> 16;
+  data[2] = len >> 8;
+  data[3] = len;
+
+  htsmsg_binary_write(msg, data + 4, NULL);
+  *lenp = len + 4;
+  return 0;
+}
+
+/*
+ * Serialize into an iovec list
+ *
+ * Referenced binary fields (see htsmsg_add_binptr) of at least minref
+ * bytes are not copied, their iovec entries point at the field data so
+ * the caller must keep that alive until the iovecs are written. All the
+ * other bytes are copied into *datap which the caller must free.
+ * On input *iovcnt is the size of iov, on output the number of entries
+ * used. *lenp is set to the number of copied bytes.
+ */
+int
+htsmsg_binary_serialize_iov(htsmsg_t *msg, void **datap, size_t *lenp,
+                            struct iovec *iov, int *iovcnt,
+                            size_t minref, int maxlen)
+{
+  htsmsg_binary_iov_t iv;
+  size_t len, ref;
+  uint8_t *data, *end;
+
+  if(*iovcnt < 1)
+    return -1;
+
+  len = htsmsg_binary_count(msg);
+  if(len + 4 > maxlen)
+    return -1;
+
+  iv.iov    = iov;
+  iv.iovcnt = 0;
+  iv.iovmax = *iovcnt;
+  iv.minref = minref;
+  ref       = htsmsg_binary_count_ref(msg, &iv);
+  iv.iovcnt = 0;
+
+  data = malloc(len + 4 - ref);
+
+  data[0] = len >> 24;
+  data[1] = len >> 16;
+  data[2] = len >> 8;
+  data[3] = len;
+
+  iv.base   = data;
+  iov[0].iov_base = data;
+
+  end = htsmsg_binary_write(msg, data + 4, &iv);
+  if(end > iv.base) {
+    iov[iv.iovcnt].iov_len = end - iv.base;
+    iv.iovcnt++;
+  }
+
+  *datap  = data;
+  *lenp   = len + 4 - ref;
+  *iovcnt = iv.iovcnt;
+  return 0;
+}
@@ -19,6 +19,7 @@
 #ifndef HTSMSG_BINARY_H_
 #define HTSMSG_BINARY_H_
 
+#include <sys/uio.h>
 #include "htsmsg.h"
 
 /**
@@ -30,4 +31,11 @@ htsmsg_t *htsmsg_binary_deserialize(const void *data, size_t len,
 int htsmsg_binary_serialize(htsmsg_t *msg, void **datap, size_t *lenp,
 			    int maxlen);
 
+int htsmsg_binary_serialize_to(htsmsg_t *msg, void *dst, size_t *lenp,
+                               int maxlen);
+
+int htsmsg_binary_serialize_iov(htsmsg_t *msg, void **datap, size_t *lenp,
+                                struct iovec *iov, int *iovcnt,
+                                size_t minref, int maxlen);
+
 #endif /* HTSMSG_BINARY_H_ */
@@ -43,12 +43,14 @@
  */
 
 
+#define _GNU_SOURCE
 #include <assert.h>
 #include <sys/types.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 
 #include "tvheadend.h"
 
@@ -499,6 +501,34 @@ xml_parse_comment(xmlparser_t *xp, char *src)
   }
 }
 
+/**
+ * Skip the rest of a <!DOCTYPE, including an internal subset [ ... ]
+ * (which can contain '>')
+ */
+static char *
+xml_skip_doctype(char *src)
+{
+  int quote = 0, depth = 0;
+
+  while(*src != 0) {
+    if(quote) {
+      if(*src == quote)
+        quote = 0;
+    } else if(*src == '"' || *src == '\'') {
+      quote = *src;
+    } else if(*src == '[') {
+      depth++;
+    } else if(*src == ']') {
+      if(depth > 0)
+        depth--;
+    } else if(*src == '>' && !depth) {
+      return src + 1;
+    }
+    src++;
+  }
+  return src;
+}
+
 /**
  *
  */
@@ -787,13 +817,7 @@ htsmsg_parse_prolog(xmlparser_t *xp, char *src)
     }
 
     if(!strncmp(src, "<!DOCTYPE", 9)) {
-      while(*src != 0) {
-	if(*src == '>') {
-	  src++;
-	  break;
-	}
-	src++;
-      }
+      src = xml_skip_doctype(src + 9);
       continue;
     }
     break;
@@ -866,6 +890,366 @@ htsmsg_xml_deserialize(char *src, char *errbuf, size_t errbufsize)
   return NULL;
 }
 
+/* **************************************************************************
+ * Streaming
+ *
+ * Large documents which are just a list of elements under the root
+ * (XMLTV) are read from a file descriptor and every child of the root is
+ * deserialized on its own, so only one element is in memory at a time.
+ * *************************************************************************/
+
+#define XMLSTREAM_READ  65536
+#define XMLSTREAM_MAX   (64 * 1024 * 1024)  /* Largest single element */
+
+typedef struct xmlstream {
+  int     xs_fd;
+  int     xs_eof;
+  char   *xs_buf;
+  size_t  xs_len;
+  size_t  xs_size;
+  htsmsg_xml_stream_cb_t *xs_cb;
+  void   *xs_opaque;
+} xmlstream_t;
+
+/**
+ * Read more data, returns -1 at end of input
+ */
+static int
+xmlstream_fill(xmlstream_t *xs)
+{
+  ssize_t r;
+
+  if(xs->xs_eof)
+    return -1;
+  if(xs->xs_size - xs->xs_len < XMLSTREAM_READ) {
+    if(xs->xs_size >= XMLSTREAM_MAX) {
+      xs->xs_eof = 1;
+      return -1;
+    }
+    xs->xs_size += XMLSTREAM_READ;
+    xs->xs_buf   = realloc(xs->xs_buf, xs->xs_size + 1);
+  }
+  xs->xs_cb(xs->xs_opaque, NULL, NULL);
+  do {
+    r = read(xs->xs_fd, xs->xs_buf + xs->xs_len, xs->xs_size - xs->xs_len);
+  } while(r < 0 && ERRNO_AGAIN(errno));
+  if(r <= 0) {
+    xs->xs_eof = 1;
+    return -1;
+  }
+  xs->xs_len += r;
+  return 0;
+}
+
+/**
+ * Check for str at offset
+ */
+static int
+xmlstream_match(xmlstream_t *xs, size_t off, const char *str)
+{
+  size_t l = strlen(str);
+  while(xs->xs_len < off + l)
+    if(xmlstream_fill(xs))
+      return 0;
+  return !memcmp(xs->xs_buf + off, str, l);
+}
+
+/**
+ * Character at offset (-1 at end of input)
+ */
+static inline int
+xmlstream_char(xmlstream_t *xs, size_t off)
+{
+  while(xs->xs_len <= off)
+    if(xmlstream_fill(xs))
+      return -1;
+  return (unsigned char)xs->xs_buf[off];
+}
+
+/**
+ * Offset just past the next str, or -1
+ */
+static ssize_t
+xmlstream_skip(xmlstream_t *xs, size_t off, const char *str)
+{
+  size_t l = strlen(str);
+  char *p;
+
+  while(1) {
+    if(xs->xs_len >= off + l) {
+      p = memmem(xs->xs_buf + off, xs->xs_len - off, str, l);
+      if(p)
+        return p - xs->xs_buf + l;
+      off = xs->xs_len - l + 1;
+    }
+    if(xmlstream_fill(xs))
+      return -1;
+  }
+}
+
+/**
+ * Offset just past the '>' of the tag starting at off, or -1
+ * *empty is set for <tag/>
+ */
+static ssize_t
+xmlstream_tagend(xmlstream_t *xs, size_t off, int *empty)
+{
+  int c, quote = 0;
+
+  while((c = xmlstream_char(xs, off)) >= 0) {
+    off++;
+    if(quote) {
+      if(c == quote)
+        quote = 0;
+    } else if(c == '"' || c == '\'') {
+      quote = c;
+    } else if(c == '>') {
+      *empty = xs->xs_buf[off - 2] == '/';
+      return off;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Offset just past the '>' closing a <!DOCTYPE at off, or -1
+ *
+ * An internal subset [ ... ] can contain '>', it ends at the matching ']'.
+ */
+static ssize_t
+xmlstream_doctype(xmlstream_t *xs, size_t off)
+{
+  int c, quote = 0, depth = 0;
+
+  while((c = xmlstream_char(xs, off)) >= 0) {
+    off++;
+    if(quote) {
+      if(c == quote)
+        quote = 0;
+    } else if(c == '"' || c == '\'') {
+      quote = c;
+    } else if(c == '[') {
+      depth++;
+    } else if(c == ']') {
+      if(depth > 0)
+        depth--;
+    } else if(c == '>' && !depth) {
+      return off;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Skip comments, PIs, CDATA and DOCTYPE at off, returns the new offset,
+ * off if there was nothing to skip or -1 at end of input
+ */
+static ssize_t
+xmlstream_misc(xmlstream_t *xs, size_t off)
+{
+  if(xmlstream_match(xs, off, "<!--"))
+    return xmlstream_skip(xs, off + 4, "-->");
+  if(xmlstream_match(xs, off, "<![CDATA["))
+    return xmlstream_skip(xs, off + 9, "]]>");
+  if(xmlstream_match(xs, off, "<?"))
+    return xmlstream_skip(xs, off + 2, "?>");
+  if(xmlstream_match(xs, off, "<!DOCTYPE"))
+    return xmlstream_doctype(xs, off + 9);
+  if(xmlstream_match(xs, off, "<!"))
+    return xmlstream_skip(xs, off + 2, ">");
+  return off;
+}
+
+/**
+ * Element name at off (just past '<'), 0 if it's too long
+ */
+static size_t
+xmlstream_name(xmlstream_t *xs, size_t off, char *name, size_t namelen)
+{
+  size_t l = 0;
+  int c;
+
+  while((c = xmlstream_char(xs, off + l)) > 0 &&
+        !is_xmlws(c) && c != '>' && c != '/') {
+    if(l + 1 >= namelen)
+      return 0;
+    name[l++] = c;
+  }
+  name[l] = '\0';
+  return l;
+}
+
+/**
+ * End of the element starting at off (incl. its end tag), or -1
+ */
+static ssize_t
+xmlstream_element(xmlstream_t *xs, size_t off, const char *name)
+{
+  char tag[64];
+  ssize_t o, n;
+  int depth = 0, empty;
+  size_t l;
+
+  while(1) {
+    if((o = xmlstream_tagend(xs, off, &empty)) < 0)
+      return -1;
+    if(empty) {
+      if(depth == 0)
+        return o;
+    } else {
+      depth++;
+    }
+    /* Next tag of the same name */
+    while(1) {
+      if((o = xmlstream_skip(xs, o, "<")) < 0)
+        return -1;
+      o--;
+      if((n = xmlstream_misc(xs, o)) != o) {
+        if(n < 0)
+          return -1;
+        o = n;
+        continue;
+      }
+      if(xmlstream_char(xs, o + 1) == '/') {
+        l = xmlstream_name(xs, o + 2, tag, sizeof(tag));
+        if(l && !strcmp(tag, name)) {
+          if((o = xmlstream_skip(xs, o, ">")) < 0)
+            return -1;
+          if(--depth == 0)
+            return o;
+          continue;
+        }
+      } else {
+        l = xmlstream_name(xs, o + 1, tag, sizeof(tag));
+        if(l && !strcmp(tag, name)) {
+          off = o;
+          break;
+        }
+      }
+      o++;
+    }
+  }
+}
+
+/**
+ * Deserialize the children of the root element one at a time
+ *
+ * cb gets the body (attrib/tags) of every element, it must not keep it.
+ * A non zero return from cb stops the parse. Before every (possibly
+ * blocking) read of more input cb is called with name and body NULL,
+ * its return value is ignored then.
+ */
+int
+htsmsg_xml_deserialize_stream(int fd, htsmsg_xml_stream_cb_t *cb,
+                              void *opaque, char *errbuf, size_t errbufsize)
+{
+  xmlstream_t xs;
+  char *prolog = NULL, *src, name[64];
+  size_t pl = 0, off = 0, l;
+  ssize_t o;
+  int c, r = -1, root = 0, empty;
+  htsmsg_t *m, *tags, *body;
+
+  memset(&xs, 0, sizeof(xs));
+  xs.xs_fd     = fd;
+  xs.xs_cb     = cb;
+  xs.xs_opaque = opaque;
+  errbuf[0] = '\0';
+
+  while(1) {
+
+    /* Discard what is done */
+    if(off) {
+      memmove(xs.xs_buf, xs.xs_buf + off, xs.xs_len - off);
+      xs.xs_len -= off;
+      off = 0;
+    }
+
+    while((c = xmlstream_char(&xs, off)) >= 0 && c != '<')
+      off++;
+    if(c < 0) {
+      if(root)
+        snprintf(errbuf, errbufsize, "Unexpected end of input");
+      else
+        snprintf(errbuf, errbufsize, "No root element");
+      break;
+    }
+
+    /* Keep the XML declaration (encoding) for the elements */
+    if(!root && !prolog && xmlstream_match(&xs, off, "<?xml")) {
+      if((o = xmlstream_skip(&xs, off, "?>")) < 0)
+        break;
+      pl = o - off;
+      prolog = malloc(pl);
+      memcpy(prolog, xs.xs_buf + off, pl);
+      off = o;
+      continue;
+    }
+
+    if((o = xmlstream_misc(&xs, off)) != (ssize_t)off) {
+      if(o < 0)
+        break;
+      off = o;
+      continue;
+    }
+
+    if(xmlstream_char(&xs, off + 1) == '/') {
+      if(root) /* End of root */
+        r = 0;
+      else
+        snprintf(errbuf, errbufsize, "Unexpected end tag");
+      break;
+    }
+
+    if(!root) {
+      if((o = xmlstream_tagend(&xs, off, &empty)) < 0)
+        break;
+      if(empty) {
+        r = 0;
+        break;
+      }
+      root = 1;
+      off = o;
+      continue;
+    }
+
+    /* Child of root */
+    if(!xmlstream_name(&xs, off + 1, name, sizeof(name))) {
+      snprintf(errbuf, errbufsize, "Invalid element name");
+      break;
+    }
+    if((o = xmlstream_element(&xs, off, name)) < 0) {
+      snprintf(errbuf, errbufsize, "Unterminated element <%s>", name);
+      break;
+    }
+
+    l   = o - off;
+    src = malloc(pl + l + 1);
+    if(pl)
+      memcpy(src, prolog, pl);
+    memcpy(src + pl, xs.xs_buf + off, l);
+    src[pl + l] = '\0';
+    off = o;
+
+    if((m = htsmsg_xml_deserialize(src, errbuf, errbufsize)) == NULL)
+      break;
+    if((tags = htsmsg_get_map(m, "tags")) != NULL &&
+       (body = htsmsg_get_map(tags, name)) != NULL)
+      c = cb(opaque, name, body);
+    else
+      c = 0;
+    htsmsg_destroy(m);
+    if(c) {
+      r = 0;
+      break;
+    }
+  }
+
+  free(prolog);
+  free(xs.xs_buf);
+  return r;
+}
+
 /*
  * Get cdata string field
  */
@@ -101,6 +101,12 @@ typedef struct htsp_msg {
 			   hm_msg can contain messages that points
 			   to packet payload so to avoid copy we
 			   keep a reference here */
+
+  uint8_t *hm_hdr;      /* Preformatted message (muxpkt) used instead of
+                           hm_msg, the hm_pb payload follows on the wire */
+  int hm_hdrlen;
+
+  int64_t hm_dts;       /* For queue delay calculation */
 } htsp_msg_t;
 
 
@@ -155,6 +161,15 @@ typedef struct htsp_connection {
   htsp_msg_q_t htsp_hmq_epg;
   htsp_msg_q_t htsp_hmq_qstatus;
 
+  /**
+   * Output statistics (updated by the writer thread)
+   */
+  uint64_t htsp_tx_msgs;
+  uint64_t htsp_tx_writes;
+  uint64_t htsp_tx_bytes;
+  uint64_t htsp_tx_copied;      /* Bytes copied by the serializer */
+  uint64_t htsp_tx_serialize;   /* Time spent serializing (ns) */
+
   struct htsp_subscription_list htsp_subscriptions;
   struct htsp_file_list htsp_files;
   int htsp_file_id;
@@ -205,6 +220,9 @@ streaming_target_t *hs_transcoder;
 
   int hs_first;
 
+  uint8_t hs_muxpkt[48];   /* Constant head of the muxpkt message */
+  int hs_muxpktlen;
+
 } htsp_subscription_t;
 
 
@@ -347,17 +365,8 @@ htsp_subscription_destroy(htsp_connection_t *htsp, htsp_subscription_t *hs)
  *
  */
 static void
-htsp_send(htsp_connection_t *htsp, htsmsg_t *m, pktbuf_t *pb,
-	  htsp_msg_q_t *hmq, int payloadsize)
+htsp_enqueue(htsp_connection_t *htsp, htsp_msg_t *hm, htsp_msg_q_t *hmq)
 {
-  htsp_msg_t *hm = malloc(sizeof(htsp_msg_t));
-
-  hm->hm_msg = m;
-  hm->hm_pb = pb;
-  if(pb != NULL)
-    pktbuf_ref_inc(pb);
-  hm->hm_payloadsize = payloadsize;
-  
   pthread_mutex_lock(&htsp->htsp_out_mutex);
 
   TAILQ_INSERT_TAIL(&hmq->hmq_q, hm, hm_link);
@@ -373,11 +382,32 @@ htsp_send(htsp_connection_t *htsp, htsmsg_t *m, pktbuf_t *pb,
   }
 
   hmq->hmq_length++;
-  hmq->hmq_payload += payloadsize;
+  hmq->hmq_payload += hm->hm_payloadsize;
   pthread_cond_signal(&htsp->htsp_out_cond);
   pthread_mutex_unlock(&htsp->htsp_out_mutex);
 }
 
+/**
+ *
+ */
+static void
+htsp_send(htsp_connection_t *htsp, htsmsg_t *m, pktbuf_t *pb,
+	  htsp_msg_q_t *hmq, int payloadsize)
+{
+  htsp_msg_t *hm = malloc(sizeof(htsp_msg_t));
+
+  hm->hm_msg = m;
+  hm->hm_pb = pb;
+  if(pb != NULL)
+    pktbuf_ref_inc(pb);
+  hm->hm_payloadsize = payloadsize;
+  hm->hm_hdr = NULL;
+  hm->hm_hdrlen = 0;
+  hm->hm_dts = PTS_UNSET;
+
+  htsp_enqueue(htsp, hm, hmq);
+}
+
 /**
  *
  */
@@ -387,6 +417,62 @@ htsp_send_message(htsp_connection_t *htsp, htsmsg_t *m, htsp_msg_q_t *hmq)
   htsp_send(htsp, m, NULL, hmq ?: &htsp->htsp_hmq_ctrl, 0);
 }
 
+/* **************************************************************************
+ * muxpkt encoding
+ *
+ * muxpkt messages are written straight into the HTSP binary layout, the
+ * same bytes htsmsg_binary_serialize() would produce for the equivalent
+ * htsmsg (fields in the same order, integers in the shortest little
+ * endian form). The fields that never change for a subscription are
+ * formatted once into hs_muxpkt.
+ * *************************************************************************/
+
+#define HTSP_MUXPKT_MAX 192   /* Worst case head incl. payload field header */
+
+static inline uint8_t *
+htsp_muxpkt_field(uint8_t *p, int type, const char *name, int namelen,
+                  uint32_t len)
+{
+  p[0] = type;
+  p[1] = namelen;
+  p[2] = len >> 24;
+  p[3] = len >> 16;
+  p[4] = len >> 8;
+  p[5] = len;
+  memcpy(p + 6, name, namelen);
+  return p + 6 + namelen;
+}
+
+static inline uint8_t *
+htsp_muxpkt_s64(uint8_t *p, const char *name, int namelen, int64_t s64)
+{
+  uint8_t *d = p + 6 + namelen;
+  uint64_t u64 = s64;
+  int l = 0;
+
+  while(u64 != 0) {
+    d[l++] = u64;
+    u64 = u64 >> 8;
+  }
+  htsp_muxpkt_field(p, HMF_S64, name, namelen, l);
+  return d + l;
+}
+
+#define HTSP_MUXPKT_S64(p, name, v) \
+  htsp_muxpkt_s64(p, name, sizeof(name) - 1, v)
+
+static void
+htsp_muxpkt_init(htsp_subscription_t *hs)
+{
+  uint8_t *p = hs->hs_muxpkt;
+
+  p = htsp_muxpkt_field(p, HMF_STR, "method", 6, 6);
+  memcpy(p, "muxpkt", 6);
+  p += 6;
+  p = HTSP_MUXPKT_S64(p, "subscriptionId", (uint32_t)hs->hs_sid);
+  hs->hs_muxpktlen = p - hs->hs_muxpkt;
+}
+
 /** 
  * Simple function to respond with an error
  */
@@ -1498,6 +1584,7 @@ htsp_method_subscribe(htsp_connection_t *htsp, htsmsg_t *in)
   htsp_init_queue(&hs->hs_q, 0);
 
   hs->hs_sid = sid;
+  htsp_muxpkt_init(hs);
   LIST_INSERT_HEAD(&htsp->htsp_subscriptions, hs, hs_link);
   streaming_target_init(&hs->hs_input, htsp_streaming_input, hs, 0);
 
@@ -2120,6 +2207,27 @@ readmsg:
   return 0;
 }
 
+/**
+ * Output coalescing
+ *
+ * Up to HTSP_WRITE_MSGS queued messages (or HTSP_WRITE_BYTES of payload)
+ * are sent with a single writev(). Payloads of at least HTSP_WRITE_REF
+ * bytes are not copied, the iovec points at the packet buffer which is
+ * kept referenced by the message (hm_pb) until the write is done.
+ */
+#define HTSP_WRITE_MSGS  64
+#define HTSP_WRITE_BYTES (1024 * 1024)
+#define HTSP_WRITE_REF   1024
+#define HTSP_WRITE_IOV   4     /* iovec entries per message */
+
+static inline uint64_t
+htsp_clock_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
 /**
  *
  */
@@ -2128,9 +2236,12 @@ htsp_write_scheduler(void *aux)
 {
   htsp_connection_t *htsp = aux;
   htsp_msg_q_t *hmq;
-  htsp_msg_t *hm;
-  void *dptr;
-  size_t dlen;
+  htsp_msg_t *hm, *hms[HTSP_WRITE_MSGS];
+  void *dptr[HTSP_WRITE_MSGS];
+  struct iovec iov[HTSP_WRITE_MSGS * HTSP_WRITE_IOV];
+  size_t dlen, copied, bytes;
+  uint64_t t;
+  int i, n, cnt, iovcnt, r;
 
   pthread_mutex_lock(&htsp->htsp_out_mutex);
 
@@ -2146,37 +2257,85 @@ htsp_write_scheduler(void *aux)
       continue;
     }
 
-    hm = TAILQ_FIRST(&hmq->hmq_q);
-    TAILQ_REMOVE(&hmq->hmq_q, hm, hm_link);
-    hmq->hmq_length--;
-    hmq->hmq_payload -= hm->hm_payloadsize;
-
-    TAILQ_REMOVE(&htsp->htsp_active_output_queues, hmq, hmq_link);
-    if(hmq->hmq_length) {
-      /* Still messages to be sent, put back in active queues */
-      if(hmq->hmq_strict_prio) {
-	      TAILQ_INSERT_HEAD(&htsp->htsp_active_output_queues, hmq, hmq_link);
-      } else {
-        TAILQ_INSERT_TAIL(&htsp->htsp_active_output_queues, hmq, hmq_link);
+    /* Take everything that is ready (up to the limits) */
+    n = 0;
+    bytes = 0;
+    do {
+      hm = TAILQ_FIRST(&hmq->hmq_q);
+      TAILQ_REMOVE(&hmq->hmq_q, hm, hm_link);
+      hmq->hmq_length--;
+      hmq->hmq_payload -= hm->hm_payloadsize;
+
+      TAILQ_REMOVE(&htsp->htsp_active_output_queues, hmq, hmq_link);
+      if(hmq->hmq_length) {
+        /* Still messages to be sent, put back in active queues */
+        if(hmq->hmq_strict_prio) {
+          TAILQ_INSERT_HEAD(&htsp->htsp_active_output_queues, hmq, hmq_link);
+        } else {
+          TAILQ_INSERT_TAIL(&htsp->htsp_active_output_queues, hmq, hmq_link);
+        }
       }
-    }
+
+      hms[n++] = hm;
+      bytes += hm->hm_payloadsize;
+    } while(n < HTSP_WRITE_MSGS && bytes < HTSP_WRITE_BYTES &&
+            (hmq = TAILQ_FIRST(&htsp->htsp_active_output_queues)) != NULL);
 
     pthread_mutex_unlock(&htsp->htsp_out_mutex);
 
-    if (htsmsg_binary_serialize(hm->hm_msg, &dptr, &dlen, INT32_MAX) != 0) {
-      tvhlog(LOG_WARNING, "htsp", "%s: failed to serialize data",
-             htsp->htsp_logname);
+    t = htsp_clock_ns();
+    iovcnt = 0;
+    copied = 0;
+    for(i = 0; i < n; i++) {
+      hm = hms[i];
+      if (hm->hm_hdr) {
+        /* Preformatted, the payload is always referenced */
+        dptr[i] = NULL;
+        iov[iovcnt].iov_base = hm->hm_hdr;
+        iov[iovcnt++].iov_len = hm->hm_hdrlen;
+        iov[iovcnt].iov_base = pktbuf_ptr(hm->hm_pb);
+        iov[iovcnt++].iov_len = pktbuf_len(hm->hm_pb);
+        copied += hm->hm_hdrlen;
+        continue;
+      }
+      cnt = HTSP_WRITE_IOV;
+      if (htsmsg_binary_serialize_iov(hms[i]->hm_msg, &dptr[i], &dlen,
+                                      iov + iovcnt, &cnt,
+                                      HTSP_WRITE_REF, INT32_MAX) != 0) {
+        tvhlog(LOG_WARNING, "htsp", "%s: failed to serialize data",
+               htsp->htsp_logname);
+        dptr[i] = NULL;
+        continue;
+      }
+      iovcnt += cnt;
+      copied += dlen;
     }
+    htsp->htsp_tx_serialize += htsp_clock_ns() - t;
 
-    htsp_msg_destroy(hm);
+    bytes = 0;
+    for(i = 0; i < iovcnt; i++)
+      bytes += iov[i].iov_len;
+
+    r = tvh_writev(htsp->htsp_fd, iov, iovcnt);
 
-    if (tvh_write(htsp->htsp_fd, dptr, dlen)) {
+    /* Payload references are released only now */
+    for(i = 0; i < n; i++) {
+      free(dptr[i]);
+      htsp_msg_destroy(hms[i]);
+    }
+
+    if (r) {
       tvhlog(LOG_INFO, "htsp", "%s: Write error -- %s",
              htsp->htsp_logname, strerror(errno));
+      pthread_mutex_lock(&htsp->htsp_out_mutex);
       break;
     }
 
-    free(dptr);
+    htsp->htsp_tx_msgs   += n;
+    htsp->htsp_tx_writes += 1;
+    htsp->htsp_tx_bytes  += bytes;
+    htsp->htsp_tx_copied += copied;
+
     pthread_mutex_lock(&htsp->htsp_out_mutex);
   }
   // Shutdown socket to make receive thread terminate entire HTSP connection
@@ -2258,6 +2417,12 @@ htsp_serve(int fd, void **opaque, struct sockaddr_storage *source,
 
   pthread_join(htsp.htsp_writer_thread, NULL);
 
+  tvhdebug("htsp", "%s: sent %"PRIu64" messages in %"PRIu64" writes, "
+                   "%"PRIu64" bytes (%"PRIu64" copied), serialize %"PRIu64"us",
+           htsp.htsp_logname, htsp.htsp_tx_msgs, htsp.htsp_tx_writes,
+           htsp.htsp_tx_bytes, htsp.htsp_tx_copied,
+           htsp.htsp_tx_serialize / 1000);
+
   htsp_msg_q_t *hmq;
 
   TAILQ_FOREACH(hmq, &htsp.htsp_active_output_queues, hmq_link) {
@@ -2293,6 +2458,11 @@ htsp_server_status ( void *opaque, htsmsg_t *m )
   htsmsg_add_str(m, "type", "HTSP");
   if (htsp->htsp_username)
     htsmsg_add_str(m, "user", htsp->htsp_username);
+  htsmsg_add_s64(m, "tx_msgs", htsp->htsp_tx_msgs);
+  htsmsg_add_s64(m, "tx_writes", htsp->htsp_tx_writes);
+  htsmsg_add_s64(m, "tx_bytes", htsp->htsp_tx_bytes);
+  htsmsg_add_s64(m, "tx_copied", htsp->htsp_tx_copied);
+  htsmsg_add_s64(m, "tx_serialize", htsp->htsp_tx_serialize / 1000);
 }
 
 /*
@@ -2568,6 +2738,8 @@ htsp_stream_deliver(htsp_subscription_t *hs, th_pkt_t *pkt)
   htsp_connection_t *htsp = hs->hs_htsp;
   int64_t ts;
   int qlen = hs->hs_q.hmq_payload;
+  uint8_t *p;
+  uint32_t len;
 
   if(!htsp_is_stream_enabled(hs, pkt->pkt_componentindex)) {
     pkt_ref_dec(pkt);
@@ -2585,37 +2757,54 @@ htsp_stream_deliver(htsp_subscription_t *hs, th_pkt_t *pkt)
     return;
   }
 
-  m = htsmsg_create_map();
- 
-  htsmsg_add_str(m, "method", "muxpkt");
-  htsmsg_add_u32(m, "subscriptionId", hs->hs_sid);
-  htsmsg_add_u32(m, "frametype", frametypearray[pkt->pkt_frametype]);
+  /**
+   * The message is preformatted (see htsp_muxpkt_init), the payload is
+   * not copied but sent from the packet buffer, which is referenced
+   * by the message until written.
+   */
+  hm = malloc(sizeof(htsp_msg_t) + HTSP_MUXPKT_MAX);
+  p = hm->hm_hdr = (uint8_t *)(hm + 1);
 
-  htsmsg_add_u32(m, "stream", pkt->pkt_componentindex);
-  htsmsg_add_u32(m, "com", pkt->pkt_commercial);
+  p += 4;
+  memcpy(p, hs->hs_muxpkt, hs->hs_muxpktlen);
+  p += hs->hs_muxpktlen;
+  p = HTSP_MUXPKT_S64(p, "frametype",
+                      (uint32_t)frametypearray[pkt->pkt_frametype]);
+  p = HTSP_MUXPKT_S64(p, "stream", (uint32_t)pkt->pkt_componentindex);
+  p = HTSP_MUXPKT_S64(p, "com", (uint32_t)pkt->pkt_commercial);
 
   if(pkt->pkt_pts != PTS_UNSET) {
     int64_t pts = hs->hs_90khz ? pkt->pkt_pts : ts_rescale(pkt->pkt_pts, 1000000);
-    htsmsg_add_s64(m, "pts", pts);
+    p = HTSP_MUXPKT_S64(p, "pts", pts);
   }
 
+  hm->hm_dts = PTS_UNSET;
   if(pkt->pkt_dts != PTS_UNSET) {
     int64_t dts = hs->hs_90khz ? pkt->pkt_dts : ts_rescale(pkt->pkt_dts, 1000000);
-    htsmsg_add_s64(m, "dts", dts);
+    p = HTSP_MUXPKT_S64(p, "dts", dts);
+    hm->hm_dts = dts;
   }
 
   uint32_t dur = hs->hs_90khz ? pkt->pkt_duration : ts_rescale(pkt->pkt_duration, 1000000);
-  htsmsg_add_u32(m, "duration", dur);
-  
+  p = HTSP_MUXPKT_S64(p, "duration", dur);
+
   pkt = pkt_merge_header(pkt);
 
-  /**
-   * Since we will serialize directly we use 'binptr' which is a binary
-   * object that just points to data, thus avoiding a copy.
-   */
-  htsmsg_add_binptr(m, "payload", pktbuf_ptr(pkt->pkt_payload),
-		    pktbuf_len(pkt->pkt_payload));
-  htsp_send(htsp, m, pkt->pkt_payload, &hs->hs_q, pktbuf_len(pkt->pkt_payload));
+  len = pktbuf_len(pkt->pkt_payload);
+  p = htsp_muxpkt_field(p, HMF_BIN, "payload", 7, len);
+
+  hm->hm_hdrlen = p - hm->hm_hdr;
+  len += hm->hm_hdrlen - 4;
+  hm->hm_hdr[0] = len >> 24;
+  hm->hm_hdr[1] = len >> 16;
+  hm->hm_hdr[2] = len >> 8;
+  hm->hm_hdr[3] = len;
+
+  hm->hm_msg = NULL;
+  hm->hm_pb = pkt->pkt_payload;
+  pktbuf_ref_inc(hm->hm_pb);
+  hm->hm_payloadsize = pktbuf_len(pkt->pkt_payload);
+  htsp_enqueue(htsp, hm, &hs->hs_q);
   atomic_add(&hs->hs_s->ths_bytes_out, pktbuf_len(pkt->pkt_payload));
 
   if(hs->hs_last_report != dispatch_clock) {
@@ -2639,10 +2828,7 @@ htsp_stream_deliver(htsp_subscription_t *hs, th_pkt_t *pkt)
     int64_t min_dts = PTS_UNSET;
     int64_t max_dts = PTS_UNSET;
     TAILQ_FOREACH(hm, &hs->hs_q.hmq_q, hm_link) {
-      if(!hm->hm_msg)
-	continue;
-      if(htsmsg_get_s64(hm->hm_msg, "dts", &ts))
-	continue;
+      ts = hm->hm_dts;
       if(ts == PTS_UNSET)
 	continue;
   
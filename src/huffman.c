@@ -110,3 +110,122 @@ end:
   *outb = '\0';
   return ret;
 }
+
+/* **************************************************************************
+ * Table driven decoder
+ * *************************************************************************/
+
+static int
+huffman_table_add ( huffman_table_t *t, huffman_node_t *node )
+{
+  int i, j, d, idx, sub;
+  huffman_node_t *n;
+  huffman_entry_t e;
+
+  if (t->ntables >= 0x10000)
+    return -1;
+  idx = t->ntables++;
+  t->entries = realloc(t->entries,
+                       t->ntables * 256 * sizeof(huffman_entry_t));
+
+  // Note: a leaf (or dead end) at depth d covers 2^(8-d) consecutive
+  //       entries, so every leaf is visited exactly once
+  for (i = 0; i < 256; ) {
+    n = node;
+    for (d = 0; d < 8; ) {
+      n = (i & (0x80 >> d)) ? n->b1 : n->b0;
+      d++;
+      if (!n || n->data) break;
+    }
+    e.bits = d;
+    if (!n) {
+      e.type = HUFFMAN_INVALID;
+      e.next = 0;
+    } else if (n->data) {
+      if (t->nsyms >= 0x10000)
+        return -1;
+      e.type = HUFFMAN_LEAF;
+      e.next = t->nsyms++;
+      t->syms = realloc(t->syms, t->nsyms * sizeof(huffman_sym_t));
+      t->syms[e.next].str = strdup(n->data);
+      t->syms[e.next].len = strlen(n->data);
+    } else {
+      if ((sub = huffman_table_add(t, n)) < 0)
+        return -1;
+      e.type = HUFFMAN_SUB;
+      e.next = sub;
+    }
+    for (j = 0; j < (1 << (8 - d)); j++)
+      t->entries[(idx << 8) + i + j] = e;
+    i += 1 << (8 - d);
+  }
+  return idx;
+}
+
+huffman_table_t *huffman_table_compile ( huffman_node_t **trees, int count )
+{
+  int i;
+  huffman_table_t *t = calloc(1, sizeof(huffman_table_t));
+
+  t->nroots = count;
+  t->roots  = calloc(count, sizeof(int));
+  for (i = 0; i < count; i++) {
+    if (!trees[i] || (t->roots[i] = huffman_table_add(t, trees[i])) < 0) {
+      huffman_table_destroy(t);
+      return NULL;
+    }
+  }
+  return t;
+}
+
+void huffman_table_destroy ( huffman_table_t *t )
+{
+  int i;
+  if (!t) return;
+  for (i = 0; i < t->nsyms; i++)
+    free(t->syms[i].str);
+  free(t->syms);
+  free(t->entries);
+  free(t->roots);
+  free(t);
+}
+
+/*
+ * Same output as huffman_decode() on the tree the table was compiled from
+ */
+char *huffman_table_decode
+  ( huffman_table_t *t, const uint8_t *data, size_t len, uint8_t mask,
+    char *outb, int outl )
+{
+  char                  *ret = outb;
+  const huffman_entry_t *e;
+  const huffman_sym_t   *s;
+  size_t pos, nbits = len * 8;
+  int n;
+  if (!len) return NULL;
+
+  /* First bit */
+  pos = 0;
+  if (mask) {
+    while (!(mask & 0x80)) {
+      mask <<= 1;
+      pos++;
+    }
+  } else {
+    pos = 8;
+  }
+
+  outl--; // leave space for NULL
+  while (pos < nbits) {
+    if (!(e = huffman_table_step(t, 0, data, len, &pos)) || pos > nbits)
+      break;
+    s = &t->syms[e->next];
+    n = s->len < outl ? s->len : outl;
+    memcpy(outb, s->str, n);
+    outb += n;
+    outl -= n;
+    if (!outl) break;
+  }
+  *outb = '\0';
+  return ret;
+}
@@ -36,4 +36,83 @@ char *huffman_decode
   ( huffman_node_t *tree, const uint8_t *data, size_t len, uint8_t mask,
     char *outb, int outl );
 
+/*
+ * Table driven decoder
+ *
+ * Trees are compiled into flat 256 entry tables, each lookup decodes up
+ * to 8 bits. Longer codes continue in a sub-table. Several trees can share
+ * one huffman_table_t (e.g. Freesat has one tree per previous character),
+ * each with its own root table.
+ */
+
+#define HUFFMAN_INVALID 0
+#define HUFFMAN_LEAF    1
+#define HUFFMAN_SUB     2
+
+typedef struct huffman_entry
+{
+  uint16_t next; // LEAF: symbol, SUB: table
+  uint8_t  bits; // bits consumed
+  uint8_t  type;
+} huffman_entry_t;
+
+typedef struct huffman_sym
+{
+  char *str;
+  int   len;
+} huffman_sym_t;
+
+typedef struct huffman_table
+{
+  huffman_entry_t *entries; // 256 per table
+  int              ntables;
+  huffman_sym_t   *syms;
+  int              nsyms;
+  int             *roots;
+  int              nroots;
+} huffman_table_t;
+
+huffman_table_t *huffman_table_compile ( huffman_node_t **trees, int count );
+void huffman_table_destroy ( huffman_table_t *t );
+char *huffman_table_decode
+  ( huffman_table_t *t, const uint8_t *data, size_t len, uint8_t mask,
+    char *outb, int outl );
+
+/*
+ * Next 8 bits from bit position pos, zeros past the end
+ */
+static inline unsigned int
+huffman_peek8 ( const uint8_t *data, size_t len, size_t pos )
+{
+  size_t i = pos >> 3;
+  unsigned int w;
+  if (i + 1 < len)
+    w = (data[i] << 8) | data[i + 1];
+  else
+    w = i < len ? data[i] << 8 : 0;
+  return (w >> (8 - (pos & 7))) & 0xff;
+}
+
+/*
+ * Decode one symbol from tree root, returns NULL for an invalid code
+ *
+ * Note: bits past the end read as zero, so the caller has to check
+ *       *pos against the data length if that is not wanted
+ */
+static inline const huffman_entry_t *
+huffman_table_step
+  ( const huffman_table_t *t, int root, const uint8_t *data, size_t len,
+    size_t *pos )
+{
+  const huffman_entry_t *e;
+  int idx = t->roots[root];
+  while (1) {
+    e = &t->entries[(idx << 8) | huffman_peek8(data, len, *pos)];
+    *pos += e->bits;
+    if (e->type != HUFFMAN_SUB)
+      return e->type == HUFFMAN_LEAF ? e : NULL;
+    idx = e->next;
+  }
+}
+
 #endif
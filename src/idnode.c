@@ -36,8 +36,25 @@ typedef struct idclass_link
   RB_ENTRY(idclass_link) link;
 } idclass_link_t;
 
+/*
+ * Per class instance index, keyed by the class pointer. Nodes are linked
+ * to the index of their own class, superclasses reach them through
+ * ii_subs.
+ */
+typedef struct idclass_index
+{
+  const idclass_t               *ii_class;
+  RB_ENTRY(idclass_index)        ii_link;
+  struct idclass_index          *ii_super;
+  TAILQ_HEAD(,idnode)            ii_nodes; ///< Instances of this class
+  uint32_t                       ii_count; ///< Instances incl. subclasses
+  struct idclass_index         **ii_subs;  ///< This and all subclasses
+  int                            ii_nsubs;
+} idclass_index_t;
+
 static RB_HEAD(,idnode)       idnodes;
 static RB_HEAD(,idclass_link) idclasses;
+static RB_HEAD(,idclass_index) idclass_indexes;
 static pthread_cond_t         idnode_cond;
 static pthread_mutex_t        idnode_mutex;
 static htsmsg_t              *idnode_queue;
@@ -58,6 +75,64 @@ in_cmp(const idnode_t *a, const idnode_t *b)
   return memcmp(a->in_uuid, b->in_uuid, sizeof(a->in_uuid));
 }
 
+/* **************************************************************************
+ * Class index
+ * *************************************************************************/
+
+static int
+ii_cmp(const idclass_index_t *a, const idclass_index_t *b)
+{
+  if (a->ii_class == b->ii_class)
+    return 0;
+  return a->ii_class < b->ii_class ? -1 : 1;
+}
+
+static idclass_index_t *
+idclass_index_find ( const idclass_t *idc )
+{
+  idclass_index_t skel;
+  skel.ii_class = idc;
+  return RB_FIND(&idclass_indexes, &skel, ii_link, ii_cmp);
+}
+
+static idclass_index_t *
+idclass_index_get ( const idclass_t *idc )
+{
+  idclass_index_t *ii, *s;
+
+  if ((ii = idclass_index_find(idc)))
+    return ii;
+
+  ii = calloc(1, sizeof(idclass_index_t));
+  ii->ii_class = idc;
+  TAILQ_INIT(&ii->ii_nodes);
+  RB_INSERT_SORTED(&idclass_indexes, ii, ii_link, ii_cmp);
+  if (idc->ic_super)
+    ii->ii_super = idclass_index_get(idc->ic_super);
+
+  /* Visible from itself and all superclasses */
+  for (s = ii; s; s = s->ii_super) {
+    s->ii_subs = realloc(s->ii_subs, (s->ii_nsubs + 1) * sizeof(ii));
+    s->ii_subs[s->ii_nsubs++] = ii;
+  }
+  return ii;
+}
+
+static void
+idclass_index_done ( void )
+{
+  idclass_index_t *ii;
+
+  /* Nodes still around keep pointers into their index */
+  if (RB_FIRST(&idnodes))
+    return;
+  while ((ii = RB_FIRST(&idclass_indexes)) != NULL) {
+    RB_REMOVE(&idclass_indexes, ii, ii_link);
+    free(ii->ii_subs);
+    free(ii);
+  }
+}
+
 /* **************************************************************************
  * Registration
  * *************************************************************************/
@@ -87,6 +162,7 @@ idnode_done(void)
   htsmsg_destroy(idnode_queue);
   idnode_queue = NULL;
   pthread_mutex_unlock(&idnode_mutex);  
+  idclass_index_done();
   while ((il = RB_FIRST(&idclasses)) != NULL) {
     RB_REMOVE(&idclasses, il, link);
     free(il);
@@ -101,6 +177,7 @@ int
 idnode_insert(idnode_t *in, const char *uuid, const idclass_t *class)
 {
   idnode_t *c;
+  idclass_index_t *ii;
   lock_assert(&global_lock);
   tvh_uuid_t u;
   if (uuid_init_bin(&u, uuid))
@@ -119,6 +196,12 @@ idnode_insert(idnode_t *in, const char *uuid, const idclass_t *class)
   /* Register the class */
   idclass_register(class); // Note: we never actually unregister
 
+  /* Add to the class index */
+  ii = idclass_index_get(class);
+  TAILQ_INSERT_TAIL(&ii->ii_nodes, in, in_class_link);
+  for (; ii; ii = ii->ii_super)
+    ii->ii_count++;
+
   /* Fire event */
   idnode_notify(in, NULL, 0, 1);
 
@@ -131,8 +214,13 @@ idnode_insert(idnode_t *in, const char *uuid, const idclass_t *class)
 void
 idnode_unlink(idnode_t *in)
 {
+  idclass_index_t *ii;
   lock_assert(&global_lock);
   RB_REMOVE(&idnodes, in, in_link);
+  ii = idclass_index_find(in->in_class);
+  TAILQ_REMOVE(&ii->ii_nodes, in, in_class_link);
+  for (; ii; ii = ii->ii_super)
+    ii->ii_count--;
   tvhtrace("idnode", "unlink node %s", idnode_uuid_as_str(in));
   idnode_notify(in, NULL, 0, 1);
 }
@@ -397,23 +485,29 @@ idnode_set_t *
 idnode_find_all ( const idclass_t *idc )
 {
   idnode_t *in;
-  const idclass_t *ic;
+  idclass_index_t *ii;
+  int i;
   tvhtrace("idnode", "find class %s", idc->ic_class);
   idnode_set_t *is = calloc(1, sizeof(idnode_set_t));
-  RB_FOREACH(in, &idnodes, in_link) {
-    ic = in->in_class;
-    while (ic) {
-      if (ic == idc) {
+  if ((ii = idclass_index_find(idc)) && ii->ii_count) {
+    is->is_alloc = ii->ii_count;
+    is->is_array = malloc(is->is_alloc * sizeof(idnode_t*));
+    for (i = 0; i < ii->ii_nsubs; i++)
+      TAILQ_FOREACH(in, &ii->ii_subs[i]->ii_nodes, in_class_link) {
         tvhtrace("idnode", "  add node %s", idnode_uuid_as_str(in));
-        idnode_set_add(is, in, NULL);
-        break;
+        is->is_array[is->is_count++] = in;
       }
-      ic = ic->ic_super;
-    }
   }
   return is;
 }
 
+uint32_t
+idnode_count ( const idclass_t *idc )
+{
+  idclass_index_t *ii = idclass_index_find(idc);
+  return ii ? ii->ii_count : 0;
+}
+
 /* **************************************************************************
  * Set processing
  * *************************************************************************/
@@ -429,63 +523,89 @@ idnode_cmp_title
   return strcmp(sa ?: "", sb ?: "");
 }
 
-static int
-idnode_cmp_sort
-  ( const void *a, const void *b, void *s )
+/*
+ * Sort keys are pulled out once per node, the property lookup and
+ * rendering are far too slow to run for each comparison.
+ */
+typedef struct idnode_sort_key
 {
-  idnode_t      *ina  = *(idnode_t**)a;
-  idnode_t      *inb  = *(idnode_t**)b;
-  idnode_sort_t *sort = s;
-  const property_t *p = idnode_find_prop(ina, sort->key);
-  if (!p) return 0;
+  idnode_t *in;
+  char     *str;  ///< String key, NULL for numeric
+  int64_t   num;
+} idnode_sort_key_t;
+
+static void
+idnode_sort_key_get
+  ( idnode_sort_key_t *k, idnode_t *in, const char *key )
+{
+  const property_t *p = idnode_find_prop(in, key);
+  uint32_t u32 = 0;
+
+  k->in  = in;
+  k->str = NULL;
+  k->num = 0;
+  if (!p) return;
 
   /* Get display string */
   if (p->islist || (p->list && !(p->opts & PO_SORTKEY))) {
-    int r;
-    char *stra = idnode_get_display(ina, p);
-    char *strb = idnode_get_display(inb, p);
-    if (sort->dir == IS_ASC)
-      r = strcmp(stra ?: "", strb ?: "");
-    else
-      r = strcmp(strb ?: "", stra ?: "");
-    free(stra);
-    free(strb);
-    return r;
+    k->str = idnode_get_display(in, p) ?: strdup("");
+    return;
   }
 
   switch (p->type) {
     case PT_STR:
-      {
-        int r;
-        const char *stra = tvh_strdupa(idnode_get_str(ina, sort->key) ?: "");
-        const char *strb = idnode_get_str(inb, sort->key);
-        if (sort->dir == IS_ASC)
-          r = strcmp(stra ?: "", strb ?: "");
-        else
-          r = strcmp(strb ?: "", stra ?: "");
-        return r;
-      }
+      k->str = strdup(idnode_get_str(in, key) ?: "");
       break;
     case PT_INT:
+      idnode_get_u32(in, key, &u32);
+      k->num = (int32_t)u32;
+      break;
     case PT_U16:
     case PT_U32:
     case PT_BOOL:
-      {
-        uint32_t u32a = 0, u32b = 0;
-        idnode_get_u32(ina, sort->key, &u32a);
-        idnode_get_u32(inb, sort->key, &u32b);
-        if (sort->dir == IS_ASC)
-          return u32a - u32b;
-        else
-          return u32b - u32a;
-      }
+      idnode_get_u32(in, key, &u32);
+      k->num = u32;
       break;
     case PT_DBL:
       // TODO
     case PT_NONE:
       break;
   }
-  return 0;
+}
+
+static int
+idnode_cmp_sort
+  ( const void *a, const void *b, void *s )
+{
+  const idnode_sort_key_t *ka = a, *kb = b;
+  idnode_sort_t *sort = s;
+  int r;
+
+  if (ka->str || kb->str)
+    r = strcmp(ka->str ?: "", kb->str ?: "");
+  else
+    r = (ka->num > kb->num) - (ka->num < kb->num);
+  return sort->dir == IS_ASC ? r : -r;
+}
+
+static void
+idnode_sort_nodes
+  ( idnode_t **nodes, size_t count, idnode_sort_t *sort )
+{
+  idnode_sort_key_t *keys;
+  size_t i;
+
+  if (count < 2)
+    return;
+  keys = malloc(count * sizeof(idnode_sort_key_t));
+  for (i = 0; i < count; i++)
+    idnode_sort_key_get(&keys[i], nodes[i], sort->key);
+  tvh_qsort_r(keys, count, sizeof(idnode_sort_key_t), idnode_cmp_sort, sort);
+  for (i = 0; i < count; i++) {
+    nodes[i] = keys[i].in;
+    free(keys[i].str);
+  }
+  free(keys);
 }
 
 int
@@ -642,7 +762,7 @@ void
 idnode_set_sort
   ( idnode_set_t *is, idnode_sort_t *sort )
 {
-  tvh_qsort_r(is->is_array, is->is_count, sizeof(idnode_t*), idnode_cmp_sort, (void*)sort);
+  idnode_sort_nodes(is->is_array, is->is_count, sort);
 }
 
 void
@@ -67,6 +67,7 @@ struct idnode {
   uint8_t           in_uuid[UUID_BIN_SIZE]; ///< Unique ID
   RB_ENTRY(idnode)  in_link;                ///< Global hash
   const idclass_t  *in_class;               ///< Class definition
+  TAILQ_ENTRY(idnode) in_class_link;        ///< Class instance list
 };
 
 /*
@@ -128,6 +129,7 @@ void          idnode_movedown     (idnode_t *in);
 
 void         *idnode_find    (const char *uuid, const idclass_t *idc);
 idnode_set_t *idnode_find_all(const idclass_t *idc);
+uint32_t      idnode_count   (const idclass_t *idc);
 
 #define idnode_updated(in) idnode_notify(in, NULL, 0, 0)
 void idnode_notify
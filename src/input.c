@@ -86,6 +86,11 @@ tvh_input_stream_create_msg
   htsmsg_add_u32(m, "bps", st->stats.bps);
   htsmsg_add_u32(m, "te", st->stats.te);
   htsmsg_add_u32(m, "cc", st->stats.cc);
+  htsmsg_add_u32(m, "ring_depth", st->ring_depth);
+  htsmsg_add_u32(m, "ring_hwm", st->ring_hwm);
+  htsmsg_add_u32(m, "ring_drops", st->ring_drops);
+  htsmsg_add_u32(m, "table_batch", st->table_batch);
+  htsmsg_add_u32(m, "table_latency", st->table_latency);
   return m;
 }
 
@@ -58,6 +58,12 @@ struct tvh_input_stream {
   int   subs_count;   ///< Number of subcscriptions
   int   max_weight;   ///< Current max weight
 
+  int   ring_depth;   ///< Input ring depth (kB)
+  int   ring_hwm;     ///< Input ring high-water mark (kB)
+  int   ring_drops;   ///< TS packets dropped on input ring overflow
+  int   table_batch;  ///< Average TS packets per table feed batch
+  int   table_latency;///< Average table feed queue latency (usec)
+
   tvh_input_stream_stats_t stats;
 };
 
@@ -28,12 +28,14 @@
 #include "service.h"
 #include "mpegts/dvb.h"
 #include "subscriptions.h"
+#include "atomic.h"
 
 #define MPEGTS_ONID_NONE        0xFFFF
 #define MPEGTS_TSID_NONE        0xFFFF
 #define MPEGTS_PSI_SECTION_SIZE 5000
 #define MPEGTS_FULLMUX_PID      0x2000
 #define MPEGTS_PID_NONE         0xFFFF
+#define MPEGTS_PID_COUNT        0x2000
 
 /* Types */
 typedef struct mpegts_table         mpegts_table_t;
@@ -76,11 +78,26 @@ void mpegts_done ( void );
  * Data / SI processing
  * *************************************************************************/
 
+/*
+ * Input ring record
+ *
+ * Each input has a preallocated byte ring of these, the frontend reader
+ * (producer) appends them and mpegts_input_thread (consumer) drains them.
+ * The records are sized to the data (small chunks from SAT>IP or IPTV
+ * take only the space they need) and are never split at the ring end,
+ * a record with mp_len 0 (or a gap smaller than the header) means the
+ * rest of the ring is skipped.
+ */
+#define MPEGTS_INPUT_SLOT_PKTS  128
+#define MPEGTS_INPUT_SLOT_SIZE  (MPEGTS_INPUT_SLOT_PKTS * 188)
+#define MPEGTS_INPUT_RING_SIZE  (4*1024*1024) // bytes, must be a power of 2
+#define MPEGTS_INPUT_REC_SIZE(l) \
+  ((sizeof(mpegts_packet_t) + (l) + 7) & ~7)
+
 struct mpegts_packet
 {
-  TAILQ_ENTRY(mpegts_packet)  mp_link;
-  size_t                      mp_len;
   mpegts_mux_t               *mp_mux;
+  size_t                      mp_len;
   uint8_t                     mp_data[0];
 };
 
@@ -134,6 +151,23 @@ typedef struct mpegts_pid
   RB_ENTRY(mpegts_pid)     mp_link;
 } mpegts_pid_t;
 
+/*
+ * Direct-indexed PID dispatch entry (one per PID in mm_pid_map)
+ *
+ * Rebuilt whenever the PID or service registrations change so that the
+ * input thread never has to walk the PID/subscriber trees per packet
+ */
+#define MPEGTS_PID_SVCS 4
+
+typedef struct mpegts_pid_entry
+{
+  mpegts_pid_t             *pe_mp;    // NULL if the PID is not open
+  uint8_t                   pe_type;  // MPS_* subscriber types
+  uint8_t                   pe_all;   // deliver to all services on the mux
+  uint8_t                   pe_nsvcs;
+  mpegts_service_t         *pe_svcs[MPEGTS_PID_SVCS];
+} mpegts_pid_entry_t;
+
 struct mpegts_table
 {
   /**
@@ -199,6 +233,15 @@ struct mpegts_table
 
   mpegts_psi_section_t mt_sect;
 
+  /**
+   * Section pre-filter, only touched by the table thread
+   * (see mpegts_table_prefilter)
+   */
+  struct mpegts_table_filter *mt_filter;
+  uint64_t mt_sect_seen;
+  uint64_t mt_sect_dups;
+  uint64_t mt_sect_dispatched;
+
   struct mpegts_table_mux_cb *mt_mux_cb;
 
   mpegts_service_t *mt_service;
@@ -214,10 +257,15 @@ struct mpegts_table
  * global_lock when doing delivery of the tables
  */
 
+#define MPEGTS_TABLE_FEED_PKTS  64
+#define MPEGTS_TABLE_FEED_POOL  32  // max. number of idle blocks kept
+
 struct mpegts_table_feed {
   TAILQ_ENTRY(mpegts_table_feed) mtf_link;
-  uint8_t mtf_tsb[188];
   mpegts_mux_t *mtf_mux;
+  int           mtf_len;    // number of TS packets in mtf_tsb
+  int64_t       mtf_queued; // queue time (for latency stats)
+  uint8_t       mtf_tsb[MPEGTS_TABLE_FEED_PKTS * 188];
 };
 
 /*
@@ -375,6 +423,7 @@ struct mpegts_mux
   RB_HEAD(, mpegts_pid)       mm_pids;
   int                         mm_last_pid;
   mpegts_pid_t               *mm_last_mp;
+  mpegts_pid_entry_t         *mm_pid_map; // MPEGTS_PID_COUNT entries
 
   int                         mm_num_tables;
   LIST_HEAD(, mpegts_table)   mm_tables;
@@ -544,11 +593,19 @@ struct mpegts_input
   time_t mi_last_dispatch;
 
   /* Data input */
-  // Note: this section is protected by mi_input_lock
+  // Note: the ring is lock-free, there is exactly one producer (the
+  //       reader thread of the input, or a caller serialised by the
+  //       reader's own lock as in IPTV) and one consumer (mi_input_tid).
+  //       mi_input_lock is only used to put the consumer to sleep.
   pthread_t                       mi_input_tid;
   pthread_mutex_t                 mi_input_lock;
   pthread_cond_t                  mi_input_cond;
-  TAILQ_HEAD(,mpegts_packet)      mi_input_queue;
+  uint8_t                        *mi_input_ring;
+  volatile unsigned int           mi_input_head;    // bytes, producer
+  volatile unsigned int           mi_input_tail;    // bytes, consumer
+  volatile int                    mi_input_waiting; // consumer sleeping
+  unsigned int                    mi_input_hwm;     // high-water (bytes)
+  volatile int                    mi_input_drops;   // TS packets dropped
 
   /* Data processing/output */
   // Note: this lock (mi_output_lock) protects all the remaining
@@ -562,7 +619,15 @@ struct mpegts_input
   /* Table processing */
   pthread_t                       mi_table_tid;
   pthread_cond_t                  mi_table_cond;
+  mpegts_table_feed_t            *mi_table_feed;   // feed being processed
+  mpegts_mux_t                   *mi_table_busy;   // mux being pre-filtered
+  pthread_cond_t                  mi_table_busy_cond;
   mpegts_table_feed_queue_t       mi_table_queue;
+  mpegts_table_feed_queue_t       mi_table_pool;   // idle feed blocks
+  int                             mi_table_pool_count;
+  int                             mi_table_batches;
+  int                             mi_table_pkts;
+  int64_t                         mi_table_latency; // sum (usec)
 
   /*
    * Functions
@@ -763,15 +828,29 @@ void mpegts_input_close_pid
 
 void mpegts_table_dispatch
   (const uint8_t *sec, size_t r, void *mt);
+int  mpegts_table_prefilter
+  (mpegts_table_t *mt, const uint8_t *sec, size_t r);
+void mpegts_table_dispatch_filtered
+  (mpegts_table_t *mt, const uint8_t *sec, size_t r);
 static inline void mpegts_table_grab
-  (mpegts_table_t *mt) { mt->mt_refcount++; }
+  (mpegts_table_t *mt) { atomic_add(&mt->mt_refcount, 1); }
 void mpegts_table_release_
   (mpegts_table_t *mt);
 static inline void mpegts_table_release
   (mpegts_table_t *mt)
 {
   assert(mt->mt_refcount > 0);
-  if(--mt->mt_refcount == 0) mpegts_table_release_(mt);
+  if(atomic_add(&mt->mt_refcount, -1) == 1) mpegts_table_release_(mt);
+}
+/* Drop a reference unless it is the last one (returns 0 then) */
+static inline int mpegts_table_release_shared
+  (mpegts_table_t *mt)
+{
+  int r;
+  while ((r = mt->mt_refcount) > 1)
+    if (atomic_cas(&mt->mt_refcount, r, r - 1))
+      return 1;
+  return 0;
 }
 int mpegts_table_type
   ( mpegts_table_t *mt );
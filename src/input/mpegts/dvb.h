@@ -454,6 +454,9 @@ int dvb_mux_conf_str ( dvb_mux_conf_t *conf, char *buf, size_t bufsize );
 
 #endif /* ENABLE_MPEGTS_DVB */
 
+void dvb_init       ( void );
 void dvb_done       ( void );
 
+void dvb_charset_benchmark ( void );
+
 #endif /* DVB_SUPPORT_H */
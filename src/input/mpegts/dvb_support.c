@@ -30,6 +30,7 @@
 #include "dvb.h"
 #include "dvb_charset_tables.h"
 #include "input.h"
+#include "intlconv.h"
 
 static int convert_iso_8859[16] = {
   -1, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, -1, 11, 12, 13
@@ -65,19 +66,21 @@ static inline int encode_utf8(unsigned int c, char *outb, int outleft)
 static inline size_t conv_utf8(const uint8_t *src, size_t srclen,
                               char *dst, size_t *dstlen)
 {
-  while (srclen>0 && (*dstlen)>0) {
-    *dst = (char) *src;
-    srclen--; (*dstlen)--;
-    src++; dst++;
-  }
-  if (srclen>0) {
+  size_t n = MIN(srclen, *dstlen);
+  memcpy(dst, src, n);
+  (*dstlen) -= n;
+  if (srclen>n) {
     errno = E2BIG;
     return -1;
   }
   return 0;
 }
 
-static inline size_t conv_8859(int conv,
+/*
+ * Reference converters, the lookup tables below are checked against them
+ */
+
+static size_t conv_8859_ref(int conv,
                               const uint8_t *src, size_t srclen,
                               char *dst, size_t *dstlen)
 {
@@ -117,7 +120,7 @@ static inline size_t conv_8859(int conv,
   return 0;
 }
 
-static inline size_t conv_6937(const uint8_t *src, size_t srclen,
+static size_t conv_6937_ref(const uint8_t *src, size_t srclen,
                               char *dst, size_t *dstlen)
 {
   while (srclen>0 && (*dstlen)>0) {
@@ -175,26 +178,171 @@ static inline size_t conv_6937(const uint8_t *src, size_t srclen,
   return 0;
 }
 
-static inline size_t dvb_convert(int conv,
+/*
+ * Byte to UTF-8 maps for the single byte charsets, 14 ISO-8859 parts
+ * plus ISO-6937. Each entry is the encoded sequence and its length,
+ * zero for ignored or unmapped codes. ISO-6937 diacritic prefixes
+ * 0xc0-0xcf are marked and resolved through a second map indexed by
+ * the following byte.
+ */
+#define DVB_CONV_MAPS      15
+#define DVB_CONV_6937      14
+#define DVB_CONV_DIACRITIC 0xff
+
+typedef struct dvb_conv_map {
+  uint8_t len;
+  uint8_t utf8[3];
+} dvb_conv_map_t;
+
+static dvb_conv_map_t dvb_conv_maps[DVB_CONV_MAPS][256];
+static dvb_conv_map_t dvb_conv_6937_pairs[16][256];
+static int            dvb_conv_maps_ok;
+
+static void
+dvb_conv_map_set(dvb_conv_map_t *m, uint16_t uc)
+{
+  char buf[4];
+  int len = uc ? encode_utf8(uc, buf, 3) : 0;
+  m->len = len > 0 ? len : 0;
+  memcpy(m->utf8, buf, m->len);
+}
+
+static void
+dvb_conv_maps_build(void)
+{
+  dvb_conv_map_t *map;
+  uint16_t uc;
+  int conv, c, c2;
+
+  for (conv = 0; conv < DVB_CONV_MAPS; conv++) {
+    map = dvb_conv_maps[conv];
+    for (c = 0; c < 0x80; c++) {
+      map[c].len = 1;
+      map[c].utf8[0] = c;
+    }
+    for (c = 0x80; c < 0xa0; c++)
+      map[c].len = 0;
+    for (c = 0xa0; c < 0x100; c++) {
+      if (conv == DVB_CONV_6937) {
+        if (c >= 0xc0 && c <= 0xcf)
+          map[c].len = DVB_CONV_DIACRITIC;
+        else
+          dvb_conv_map_set(&map[c], iso6937_single_byte[c-0xa0]);
+      } else {
+        dvb_conv_map_set(&map[c], conv_8859_table[conv][c-0xa0]);
+      }
+    }
+  }
+  for (c = 0; c < 16; c++)
+    for (c2 = 0; c2 < 256; c2++) {
+      if (c2 == 0x20)
+        uc = iso6937_lone_accents[c];
+      else if (c2 >= 0x41 && c2 <= 0x5a)
+        uc = iso6937_multi_byte[c][c2-0x41];
+      else if (c2 >= 0x61 && c2 <= 0x7a)
+        uc = iso6937_multi_byte[c][c2-0x61+26];
+      else
+        uc = 0;
+      dvb_conv_map_set(&dvb_conv_6937_pairs[c][c2], uc);
+    }
+}
+
+static inline int
+dvb_conv_put(const dvb_conv_map_t *m, char *dst, size_t *dstlen)
+{
+  if (m->len > *dstlen)
+    return -1;
+  memcpy(dst, m->utf8, m->len);
+  (*dstlen) -= m->len;
+  return m->len;
+}
+
+static size_t conv_map(const dvb_conv_map_t *map,
+                       const uint8_t *src, size_t srclen,
+                       char *dst, size_t *dstlen)
+{
+  const dvb_conv_map_t *m;
+  uint64_t w;
+  size_t i, n;
+  int len;
+
+  while (srclen > 0) {
+    /* copy ASCII runs, eight bytes at a time */
+    n = MIN(srclen, *dstlen);
+    for (i = 0; i + 8 <= n; i += 8) {
+      memcpy(&w, src + i, 8);
+      if (w & 0x8080808080808080ULL)
+        break;
+    }
+    while (i < n && src[i] < 0x80)
+      i++;
+    memcpy(dst, src, i);
+    src += i; srclen -= i;
+    dst += i; (*dstlen) -= i;
+    if (srclen == 0)
+      break;
+    if (*dstlen == 0) {
+      errno = E2BIG;
+      return -1;
+    }
+
+    m = &map[*src];
+    if (m->len == DVB_CONV_DIACRITIC) {
+      // map two-byte sequence, skipping illegal combinations.
+      if (srclen < 2) {
+        errno = EINVAL;
+        return -1;
+      }
+      m = &dvb_conv_6937_pairs[*src-0xc0][src[1]];
+      src++; srclen--;
+    }
+    if ((len = dvb_conv_put(m, dst, dstlen)) < 0) {
+      errno = E2BIG;
+      return -1;
+    }
+    dst += len;
+    src++; srclen--;
+  }
+  return 0;
+}
+
+static size_t dvb_convert_ref(int conv,
+                          const uint8_t *src, size_t srclen,
+                          char *dst, size_t *dstlen)
+{
+  switch (conv) {
+    case convert_utf8: return conv_utf8(src, srclen, dst, dstlen);
+    case convert_iso6937: return conv_6937_ref(src, srclen, dst, dstlen);
+    default: return conv_8859_ref(conv, src, srclen, dst, dstlen);
+  }
+}
+
+static size_t dvb_convert(int conv,
                           const uint8_t *src, size_t srclen,
                           char *dst, size_t *dstlen)
 {
+  if (!dvb_conv_maps_ok)
+    return dvb_convert_ref(conv, src, srclen, dst, dstlen);
   switch (conv) {
     case convert_utf8: return conv_utf8(src, srclen, dst, dstlen);
-    case convert_iso6937: return conv_6937(src, srclen, dst, dstlen);
-    default: return conv_8859(conv, src, srclen, dst, dstlen);
+    case convert_iso6937:
+      return conv_map(dvb_conv_maps[DVB_CONV_6937], src, srclen, dst, dstlen);
+    default: return conv_map(dvb_conv_maps[conv], src, srclen, dst, dstlen);
   }
 }
 
+typedef size_t (*dvb_convert_t)(int conv, const uint8_t *src, size_t srclen,
+                                char *dst, size_t *dstlen);
+
 /*
  * DVB String conversion according to EN 300 468, Annex A
  * Not all character sets are supported, but it should cover most of them
  */
 
-int
-dvb_get_string
-  (char *dst, size_t dstlen, const uint8_t *src, size_t srclen, 
-   const char *dvb_charset, dvb_string_conv_t *conv)
+static int
+dvb_get_string0
+  (char *dst, size_t dstlen, const uint8_t *src, size_t srclen,
+   const char *dvb_charset, dvb_string_conv_t *conv, dvb_convert_t convert)
 {
   int ic = -1;
   size_t len, outlen;
@@ -282,7 +430,7 @@ dvb_get_string
 
   outlen = dstlen - 1;
 
-  if (dvb_convert(ic, src, srclen, dst, &outlen) == -1) {
+  if (convert(ic, src, srclen, dst, &outlen) == -1) {
     return -1;
   }
 
@@ -291,6 +439,15 @@ dvb_get_string
   return 0;
 }
 
+int
+dvb_get_string
+  (char *dst, size_t dstlen, const uint8_t *src, size_t srclen, 
+   const char *dvb_charset, dvb_string_conv_t *conv)
+{
+  return dvb_get_string0(dst, dstlen, src, srclen, dvb_charset, conv,
+                         dvb_convert);
+}
+
 
 int
 dvb_get_string_with_len(char *dst, size_t dstlen, 
@@ -761,6 +918,221 @@ dvb_mux_conf_str ( dvb_mux_conf_t *dmc, char *buf, size_t bufsize )
 
 #endif /* ENABLE_MPEGTS_DVB */
 
+/*
+ * Charset map self-test, all single bytes, random strings against
+ * small output buffers and all ISO-6937 diacritic pairs
+ */
+static int
+dvb_conv_check( int conv, const uint8_t *src, size_t len, size_t olen )
+{
+  char a[600], b[600];
+  size_t alen = olen, blen = olen, ra, rb;
+  int ea = 0, eb = 0;
+
+  errno = 0;
+  if ((ra = dvb_convert_ref(conv, src, len, a, &alen)) != 0)
+    ea = errno;
+  errno = 0;
+  if ((rb = dvb_convert(conv, src, len, b, &blen)) != 0)
+    eb = errno;
+  if (ra != rb || ea != eb)
+    return 0;
+  return ra || (alen == blen && !memcmp(a, b, olen - alen));
+}
+
+static int
+dvb_conv_selftest( void )
+{
+  uint8_t src[300];
+  size_t len, j;
+  uint32_t seed = 0x2545f491;
+  int conv, i;
+
+  for (conv = 0; conv < 16; conv++) {
+    for (i = 0; i < 0x100; i++) {
+      src[0] = i;
+      if (!dvb_conv_check(conv, src, 1, 600) ||
+          !dvb_conv_check(conv, src, 1, i & 3))
+        return 0;
+    }
+    for (i = 0; i < 2000; i++) {
+      seed = seed * 1103515245 + 12345;
+      len = (seed >> 8) % sizeof(src);
+      for (j = 0; j < len; j++) {
+        seed = seed * 1103515245 + 12345;
+        src[j] = (seed >> 16) & 0x40 ? seed >> 24 : 0x20 + (seed >> 24) % 0x5f;
+      }
+      if (!dvb_conv_check(conv, src, len, (i & 7) ? 600 : i % 64))
+        return 0;
+    }
+  }
+  for (i = 0xc000; i < 0xd000; i++) {
+    src[0] = i >> 8;
+    src[1] = i;
+    if (!dvb_conv_check(convert_iso6937, src, 2, 600))
+      return 0;
+  }
+  return 1;
+}
+
+void dvb_init( void )
+{
+  dvb_conv_maps_build();
+  dvb_conv_maps_ok = 1;
+  if (!dvb_conv_selftest()) {
+    tvhlog(LOG_ERR, "charset", "DVB charset maps failed self-test, disabled");
+    dvb_conv_maps_ok = 0;
+  }
+}
+
+/*
+ * Microbenchmark, decode a synthetic EIT text dump with the reference
+ * and the table converters, then convert it with iconv from several
+ * threads as the DVR filename code does
+ */
+#define DVB_BENCH_STRS 20000
+
+typedef struct dvb_bench_thread {
+  pthread_t   thread;
+  char      **strs;
+  int         nstrs;
+  int64_t     done;
+  volatile int *run;
+} dvb_bench_thread_t;
+
+static void *
+dvb_charset_bench_thread( void *aux )
+{
+  dvb_bench_thread_t *bt = aux;
+  const char *id = intlconv_charset_id("ISO-8859-1", 1, 1);
+  char buf[512];
+  int i = 0;
+
+  while (*bt->run) {
+    intlconv_utf8(buf, sizeof(buf), id, bt->strs[i]);
+    if (++i == bt->nstrs)
+      i = 0;
+    bt->done++;
+  }
+  return NULL;
+}
+
+void dvb_charset_benchmark( void )
+{
+  static const char *words[] = {
+    "the", "news", "weather", "film", "series", "episode", "live",
+    "sport", "documentary", "with", "and", "from", "season", "new",
+  };
+  static const uint8_t accents[] = {
+    0xc1, 0xc2, 0xc3, 0xc8, 0xcf, 0xe9, 0xf9, 0xa9, 0xb0, 0xe1, 0xfb,
+  };
+  static const struct {
+    const char *name;
+    dvb_convert_t convert;
+  } converters[] = {
+    { "reference", dvb_convert_ref },
+    { "table",     dvb_convert     },
+  };
+  static const int threads[] = { 1, 2, 4 };
+  dvb_bench_thread_t bt[4];
+  volatile int run;
+  uint8_t *src, *p;
+  int *lens, i, d, n, t, len;
+  char dst[512], **utf8;
+  uint32_t seed = 0x2545f491;
+  struct timespec ts;
+  int64_t start, now, strs, bytes;
+
+  if (!dvb_conv_maps_ok) {
+    tvhlog(LOG_INFO, "charset", "benchmark: maps not available");
+    return;
+  }
+
+  /* EN 300 468 text fields, mostly default ISO-6937 with some ISO-8859
+     and UTF-8 ones, roughly like short and extended event descriptors */
+  src  = malloc(DVB_BENCH_STRS * 256);
+  lens = malloc(DVB_BENCH_STRS * sizeof(int));
+  for (i = 0; i < DVB_BENCH_STRS; i++) {
+    p = src + i * 256;
+    seed = seed * 1103515245 + 12345;
+    len = 16 + (seed >> 8) % 224;
+    n = 0;
+    switch ((seed >> 4) % 10) {
+    case 0 ... 5: break;
+    case 6: case 7: p[n++] = 0x05; break;
+    case 8: p[n++] = 0x10; p[n++] = 0x00; p[n++] = 0x02; break;
+    default: p[n++] = 0x15; break;
+    }
+    while (n < len) {
+      seed = seed * 1103515245 + 12345;
+      if ((seed >> 16) % 12 == 0 && p[0] != 0x15) {
+        p[n++] = accents[(seed >> 20) % ARRAY_SIZE(accents)];
+        if (p[n-1] >= 0xc0 && p[n-1] <= 0xcf && n < len)
+          p[n++] = 'a' + (seed >> 24) % 26;
+      } else {
+        const char *w = words[(seed >> 20) % ARRAY_SIZE(words)];
+        while (*w && n < len)
+          p[n++] = *w++;
+        if (n < len)
+          p[n++] = ' ';
+      }
+    }
+    lens[i] = n;
+  }
+
+  for (d = 0; d < ARRAY_SIZE(converters); d++) {
+    strs = bytes = 0;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    start = now = ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+    while (now - start < 250000) {
+      for (n = 0; n < 100; n++, strs++) {
+        i = strs % DVB_BENCH_STRS;
+        if (!dvb_get_string0(dst, sizeof(dst), src + i * 256, lens[i],
+                             NULL, NULL, converters[d].convert))
+          bytes += lens[i];
+      }
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      now = ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+    }
+    tvhlog(LOG_INFO, "charset",
+           "benchmark %-10s: %"PRId64" strings/s, %.1f MB/s",
+           converters[d].name, strs * 1000000 / (now - start),
+           (double)bytes / (now - start));
+  }
+
+  utf8 = malloc(DVB_BENCH_STRS * sizeof(char *));
+  for (i = 0; i < DVB_BENCH_STRS; i++) {
+    if (dvb_get_string(dst, sizeof(dst), src + i * 256, lens[i], NULL, NULL))
+      dst[0] = '\0';
+    utf8[i] = strdup(dst);
+  }
+  for (t = 0; t < ARRAY_SIZE(threads); t++) {
+    run = 1;
+    for (i = 0; i < threads[t]; i++) {
+      bt[i].strs  = utf8 + i * (DVB_BENCH_STRS / 4);
+      bt[i].nstrs = DVB_BENCH_STRS / 4;
+      bt[i].done  = 0;
+      bt[i].run   = &run;
+      tvhthread_create(&bt[i].thread, NULL, dvb_charset_bench_thread, &bt[i]);
+    }
+    usleep(250000);
+    run = 0;
+    for (i = 0, strs = 0; i < threads[t]; i++) {
+      pthread_join(bt[i].thread, NULL);
+      strs += bt[i].done;
+    }
+    tvhlog(LOG_INFO, "charset",
+           "benchmark iconv %d thread(s): %"PRId64" strings/s",
+           threads[t], strs * 4);
+  }
+
+  for (i = 0; i < DVB_BENCH_STRS; i++)
+    free(utf8[i]);
+  free(utf8);
+  free(lens);
+  free(src);
+}
+
 /**
  *
  */
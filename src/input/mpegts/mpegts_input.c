@@ -255,6 +255,79 @@ mps_cmp ( mpegts_pid_sub_t *a, mpegts_pid_sub_t *b )
   return 0;
 }
 
+/*
+ * Rebuild the dispatch entry for a PID (mi_output_lock held)
+ */
+static void
+mpegts_input_update_pid
+  ( mpegts_input_t *mi, mpegts_mux_t *mm, int pid, mpegts_pid_t *mp )
+{
+  mpegts_pid_entry_t *pe;
+  mpegts_pid_sub_t *mps;
+  service_t *s;
+  int type = 0, all = 0, n = 0;
+
+  if (!mm->mm_pid_map || pid < 0 || pid >= MPEGTS_PID_COUNT)
+    return;
+  pe = &mm->mm_pid_map[pid];
+  memset(pe, 0, sizeof(*pe));
+  if (!mp)
+    return;
+  pe->pe_mp = mp;
+
+  /* PAT goes everywhere */
+  if (pid == 0) {
+    pe->pe_type = MPS_STREAM | MPS_TABLE;
+    pe->pe_all  = 1;
+    return;
+  }
+
+  /* Determine PID type */
+  RB_FOREACH(mps, &mp->mp_subs, mps_link) {
+    type |= mps->mps_type & (MPS_STREAM | MPS_TABLE | MPS_FTABLE);
+    if (!(mps->mps_type & MPS_STREAM) || all) continue;
+    /* Stream owners which are not services (i.e. tables) want all */
+    LIST_FOREACH(s, &mi->mi_transports, s_active_link)
+      if (s == mps->mps_owner &&
+          ((mpegts_service_t*)s)->s_dvb_mux == mm)
+        break;
+    if (!s)
+      all = 1;
+  }
+
+  /* Interested services */
+  LIST_FOREACH(s, &mi->mi_transports, s_active_link) {
+    if (((mpegts_service_t*)s)->s_dvb_mux != mm) continue;
+    if (pid == s->s_pmt_pid || pid == s->s_pcr_pid) {
+      type |= MPS_STREAM;
+    } else {
+      RB_FOREACH(mps, &mp->mp_subs, mps_link)
+        if (mps->mps_owner == s && (mps->mps_type & MPS_STREAM))
+          break;
+      if (!mps) continue;
+    }
+    if (n < MPEGTS_PID_SVCS)
+      pe->pe_svcs[n] = (mpegts_service_t*)s;
+    n++;
+  }
+
+  /* Table data is passed to all services (raw output) */
+  if (type & (MPS_TABLE | MPS_FTABLE))
+    all = 1;
+
+  pe->pe_type  = type;
+  pe->pe_all   = all || n > MPEGTS_PID_SVCS;
+  pe->pe_nsvcs = MIN(n, MPEGTS_PID_SVCS);
+}
+
+static void
+mpegts_input_update_pids ( mpegts_input_t *mi, mpegts_mux_t *mm )
+{
+  mpegts_pid_t *mp;
+  RB_FOREACH(mp, &mm->mm_pids, mp_link)
+    mpegts_input_update_pid(mi, mm, mp->mp_pid, mp);
+}
+
 mpegts_pid_t *
 mpegts_input_open_pid
   ( mpegts_input_t *mi, mpegts_mux_t *mm, int pid, int type, void *owner )
@@ -271,6 +344,7 @@ mpegts_input_open_pid
       tvhdebug("mpegts", "%s - open PID %04X (%d) [%d/%p]",
                buf, mp->mp_pid, mp->mp_pid, type, owner);
       SKEL_USED(mpegts_pid_sub_skel);
+      mpegts_input_update_pid(mi, mm, pid, mp);
     }
   }
   return mp;
@@ -306,7 +380,9 @@ mpegts_input_close_pid
         close(mp->mp_fd);
       }
       free(mp);
+      mp = NULL;
     }
+    mpegts_input_update_pid(mi, mm, pid, mp);
   }
 }
 
@@ -333,6 +409,7 @@ mpegts_input_open_service ( mpegts_input_t *mi, mpegts_service_t *s, int init )
       mi->mi_open_pid(mi, s->s_dvb_mux, st->es_pid, MPS_STREAM, s);
     }
   }
+  mpegts_input_update_pids(mi, s->s_dvb_mux);
 
   pthread_mutex_unlock(&s->s_stream_mutex);
   pthread_mutex_unlock(&mi->mi_output_lock);
@@ -372,7 +449,7 @@ mpegts_input_close_service ( mpegts_input_t *mi, mpegts_service_t *s )
       mi->mi_close_pid(mi, s->s_dvb_mux, st->es_pid, MPS_STREAM, s);
     }
   }
-
+  mpegts_input_update_pids(mi, s->s_dvb_mux);
 
   pthread_mutex_unlock(&s->s_stream_mutex);
   pthread_mutex_unlock(&mi->mi_output_lock);
@@ -469,13 +546,73 @@ ts_sync_count ( const uint8_t *tsb, int len )
   return i;
 }
 
+/*
+ * Copy synced TS data into the input ring (producer side)
+ */
+static void
+mpegts_input_ring_push
+  ( mpegts_input_t *mi, mpegts_mux_t *mm, const uint8_t *tsb, int len )
+{
+  unsigned int head, depth, off, gap, need, skip;
+  mpegts_packet_t *mp;
+  int len2;
+
+  while (len > 0) {
+    head  = mi->mi_input_head;
+    depth = head - mi->mi_input_tail;
+    len2  = MIN(len, MPEGTS_INPUT_SLOT_SIZE);
+    need  = MPEGTS_INPUT_REC_SIZE(len2);
+    off   = head & (MPEGTS_INPUT_RING_SIZE - 1);
+    gap   = MPEGTS_INPUT_RING_SIZE - off;
+    skip  = gap < need ? gap : 0;
+
+    /* Overflow */
+    if (MPEGTS_INPUT_RING_SIZE - depth < skip + need) {
+      atomic_add(&mi->mi_input_drops, len / 188);
+      break;
+    }
+
+    /* Wrap */
+    if (skip) {
+      if (gap >= sizeof(mpegts_packet_t)) {
+        mp = (mpegts_packet_t *)(mi->mi_input_ring + off);
+        mp->mp_mux = NULL;
+        mp->mp_len = 0;
+      }
+      off = 0;
+    }
+
+    /* Fill */
+    mp = (mpegts_packet_t *)(mi->mi_input_ring + off);
+    mp->mp_mux = mm;
+    mp->mp_len = len2;
+    memcpy(mp->mp_data, tsb, len2);
+
+    /* Publish */
+    atomic_barrier();
+    mi->mi_input_head = head + skip + need;
+    if (depth + skip + need > mi->mi_input_hwm)
+      mi->mi_input_hwm = depth + skip + need;
+
+    tsb += len2;
+    len -= len2;
+  }
+
+  /* Wake consumer */
+  atomic_barrier();
+  if (mi->mi_input_waiting) {
+    pthread_mutex_lock(&mi->mi_input_lock);
+    pthread_cond_signal(&mi->mi_input_cond);
+    pthread_mutex_unlock(&mi->mi_input_lock);
+  }
+}
+
 void
 mpegts_input_recv_packets
   ( mpegts_input_t *mi, mpegts_mux_instance_t *mmi, sbuf_t *sb,
     int64_t *pcr, uint16_t *pcr_pid )
 {
   int i, p = 0, len2, off = 0;
-  mpegts_packet_t *mp;
   uint8_t *tsb = sb->sb_data;
   int     len  = sb->sb_ptr;
 #define MIN_TS_PKT 100
@@ -518,20 +655,11 @@ mpegts_input_recv_packets
   /* Pass */
   if (p >= MIN_TS_SYN) {
     len2 = p * 188;
-    
-    mp = malloc(sizeof(mpegts_packet_t) + len2);
-    mp->mp_mux  = mmi->mmi_mux;
-    mp->mp_len  = len2;
-    memcpy(mp->mp_data, tsb, len2);
+
+    mpegts_input_ring_push(mi, mmi->mmi_mux, tsb, len2);
 
     len -= len2;
     off += len2;
-
-    pthread_mutex_lock(&mi->mi_input_lock);
-    if (TAILQ_FIRST(&mi->mi_input_queue) == NULL)
-      pthread_cond_signal(&mi->mi_input_cond);
-    TAILQ_INSERT_TAIL(&mi->mi_input_queue, mp, mp_link);
-    pthread_mutex_unlock(&mi->mi_input_lock);
   }
 
   /* Adjust buffer */
@@ -541,8 +669,63 @@ mpegts_input_recv_packets
     sb->sb_ptr = 0;    // clear
 }
 
+/*
+ * Sections passed by the pre-filter, dispatched in one global_lock pass
+ */
+typedef struct mpegts_table_pending {
+  uint8_t        *tp_buf;
+  size_t          tp_len;
+  size_t          tp_size;
+  mpegts_table_t *tp_table;   // table being reassembled
+} mpegts_table_pending_t;
+
+typedef struct mpegts_table_pending_sect {
+  mpegts_table_t *tps_table;  // referenced
+  size_t          tps_len;    // 0 = only release the reference
+} mpegts_table_pending_sect_t;
+
 static void
-mpegts_input_table_dispatch ( mpegts_mux_t *mm, const uint8_t *tsb )
+mpegts_input_table_pending_add
+  ( mpegts_table_pending_t *tp, mpegts_table_t *mt,
+    const uint8_t *sec, size_t r )
+{
+  size_t need = sizeof(mpegts_table_pending_sect_t) + ((r + 7) & ~7);
+  mpegts_table_pending_sect_t *tps;
+
+  if (tp->tp_len + need > tp->tp_size) {
+    tp->tp_size = MAX(tp->tp_size * 2, tp->tp_len + need);
+    tp->tp_buf  = realloc(tp->tp_buf, tp->tp_size);
+  }
+  tps = (mpegts_table_pending_sect_t *)(tp->tp_buf + tp->tp_len);
+  tps->tps_table = mt;
+  tps->tps_len   = r;
+  if (r)
+    memcpy(tps + 1, sec, r);
+  tp->tp_len += need;
+}
+
+static void
+mpegts_input_table_collect ( const uint8_t *sec, size_t r, void *aux )
+{
+  mpegts_table_pending_t *tp = aux;
+
+  if (!mpegts_table_prefilter(tp->tp_table, sec, r))
+    return;
+  mpegts_table_grab(tp->tp_table);
+  mpegts_input_table_pending_add(tp, tp->tp_table, sec, r);
+}
+
+/*
+ * Reassemble table sections, with tp set the complete sections are
+ * only pre-filtered and collected (no global_lock needed), otherwise
+ * they are dispatched directly
+ *
+ * The pre-filter never drops the last table reference (the destroy
+ * hooks need global_lock), that is left to the dispatch pass.
+ */
+static void
+mpegts_input_table_reassemble
+  ( mpegts_mux_t *mm, const uint8_t *tsb, mpegts_table_pending_t *tp )
 {
   int i, len = 0, c = 0;
   uint16_t pid = ((tsb[1] & 0x1f) << 8) | tsb[2];
@@ -580,11 +763,63 @@ mpegts_input_table_dispatch ( mpegts_mux_t *mm, const uint8_t *tsb )
           tvhdebug("psi", "PID %04X CC error %d != %d", pid, cc, mt->mt_cc);
          }
         mt->mt_cc = (cc + 1) & 0xF;
-        mpegts_psi_section_reassemble(&mt->mt_sect, tsb, 0, ccerr,
-                                      mpegts_table_dispatch, mt);
+        if (tp) {
+          tp->tp_table = mt;
+          mpegts_psi_section_reassemble(&mt->mt_sect, tsb, 0, ccerr,
+                                        mpegts_input_table_collect, tp);
+        } else {
+          mpegts_psi_section_reassemble(&mt->mt_sect, tsb, 0, ccerr,
+                                        mpegts_table_dispatch, mt);
+        }
       }
     }
-    mpegts_table_release(mt);
+    if (!tp)
+      mpegts_table_release(mt);
+    else if (!mpegts_table_release_shared(mt))
+      mpegts_input_table_pending_add(tp, mt, NULL, 0);
+  }
+}
+
+static void
+mpegts_input_table_dispatch ( mpegts_mux_t *mm, const uint8_t *tsb )
+{
+  mpegts_input_table_reassemble(mm, tsb, NULL);
+}
+
+/*
+ * Table feed blocks (mi_output_lock held)
+ */
+static mpegts_table_feed_t *
+mpegts_input_table_feed_alloc ( mpegts_input_t *mi, mpegts_mux_t *mm )
+{
+  mpegts_table_feed_t *mtf;
+
+  if ((mtf = TAILQ_FIRST(&mi->mi_table_pool)) != NULL) {
+    TAILQ_REMOVE(&mi->mi_table_pool, mtf, mtf_link);
+    mi->mi_table_pool_count--;
+  } else {
+    mtf = malloc(sizeof(mpegts_table_feed_t));
+  }
+  mtf->mtf_mux = mm;
+  mtf->mtf_len = 0;
+  return mtf;
+}
+
+static void
+mpegts_input_table_feed_queue ( mpegts_input_t *mi, mpegts_table_feed_t *mtf )
+{
+  mtf->mtf_queued = getmonoclock();
+  TAILQ_INSERT_TAIL(&mi->mi_table_queue, mtf, mtf_link);
+}
+
+static void
+mpegts_input_table_feed_release ( mpegts_input_t *mi, mpegts_table_feed_t *mtf )
+{
+  if (mi->mi_table_pool_count < MPEGTS_TABLE_FEED_POOL) {
+    TAILQ_INSERT_HEAD(&mi->mi_table_pool, mtf, mtf_link);
+    mi->mi_table_pool_count++;
+  } else {
+    free(mtf);
   }
 }
 
@@ -627,15 +862,14 @@ mpegts_input_process
   uint8_t cc;
   uint8_t *tsb = mpkt->mp_data;
   int len = mpkt->mp_len;
-  int table, stream, f;
+  int i, f;
   mpegts_pid_t *mp;
-  mpegts_pid_sub_t *mps;
+  mpegts_pid_entry_t *pe;
+  mpegts_table_feed_t *mtf = NULL;
   service_t *s;
-  int table_wakeup = 0;
   uint8_t *end = mpkt->mp_data + len;
   mpegts_mux_t          *mm  = mpkt->mp_mux;
   mpegts_mux_instance_t *mmi = mm->mm_active;
-  mpegts_pid_t *last_mp = NULL;
 
   mi->mi_live = 1;
 
@@ -657,7 +891,9 @@ mpegts_input_process
     if (pid == 0x1FFF) goto done;
 
     /* Find PID */
-    if ((mp = mpegts_mux_find_pid(mm, pid, 0))) {
+    if (!mm->mm_pid_map) goto done;
+    pe = &mm->mm_pid_map[pid];
+    if ((mp = pe->pe_mp)) {
 
       /* Low level CC check */
       if (cc & 0x10) {
@@ -669,55 +905,38 @@ mpegts_input_process
         mp->mp_cc = (cc + 1) & 0xF;
       }
 
-      // Note: there is a minor danger this caching will get things
-      //       wrong for a brief period of time if the registrations on
-      //       the PID change
-      if (mp != last_mp) {
-        if (pid == 0) {
-          stream = MPS_STREAM;
-          table  = MPS_TABLE;
-        } else {
-          stream = table = 0;
-
-          /* Determine PID type */
-          RB_FOREACH(mps, &mp->mp_subs, mps_link) {
-            stream |= mps->mps_type & MPS_STREAM;
-            table  |= mps->mps_type & (MPS_TABLE | MPS_FTABLE);
-            if (table == (MPS_TABLE|MPS_FTABLE) && stream) break;
-          }
-
-          /* Special case streams */
+      /* Stream data */
+      if (pe->pe_type & MPS_STREAM) {
+        f = pe->pe_type & (MPS_TABLE | MPS_FTABLE);
+        if (pe->pe_all) {
           LIST_FOREACH(s, &mi->mi_transports, s_active_link) {
-            if (((mpegts_service_t*)s)->s_dvb_mux != mmi->mmi_mux) continue;
-                 if (pid == s->s_pmt_pid) stream = MPS_STREAM;
-            else if (pid == s->s_pcr_pid) stream = MPS_STREAM;
+            if (((mpegts_service_t*)s)->s_dvb_mux != mm) continue;
+            ts_recv_packet1((mpegts_service_t*)s, tsb, NULL,
+                            f || (pid == s->s_pmt_pid) || (pid == s->s_pcr_pid));
+          }
+        } else {
+          for (i = 0; i < pe->pe_nsvcs; i++) {
+            s = (service_t*)pe->pe_svcs[i];
+            ts_recv_packet1((mpegts_service_t*)s, tsb, NULL,
+                            f || (pid == s->s_pmt_pid) || (pid == s->s_pcr_pid));
           }
-        }
-      }
-    
-      /* Stream data */
-      if (stream) {
-        LIST_FOREACH(s, &mi->mi_transports, s_active_link) {
-          if (((mpegts_service_t*)s)->s_dvb_mux != mmi->mmi_mux) continue;
-          f = table || (pid == s->s_pmt_pid) || (pid == s->s_pcr_pid);
-          ts_recv_packet1((mpegts_service_t*)s, tsb, NULL, f);
         }
       }
 
       /* Table data */
-      if (table) {
+      if (pe->pe_type & (MPS_TABLE | MPS_FTABLE)) {
         if (!(tsb[1] & 0x80)) {
-          if (table & MPS_FTABLE)
+          if (pe->pe_type & MPS_FTABLE)
             mpegts_input_table_dispatch(mm, tsb);
-          if (table & MPS_TABLE) {
-            // TODO: might be able to optimise this a bit by having slightly
-            //       larger buffering and trying to aggregate data (if we get
-            //       same PID multiple times in the loop)
-            mpegts_table_feed_t *mtf = malloc(sizeof(mpegts_table_feed_t));
-            memcpy(mtf->mtf_tsb, tsb, 188);
-            mtf->mtf_mux   = mm;
-            TAILQ_INSERT_TAIL(&mi->mi_table_queue, mtf, mtf_link);
-            table_wakeup = 1;
+          if (pe->pe_type & MPS_TABLE) {
+            if (mtf && mtf->mtf_len == MPEGTS_TABLE_FEED_PKTS) {
+              mpegts_input_table_feed_queue(mi, mtf);
+              mtf = NULL;
+            }
+            if (!mtf)
+              mtf = mpegts_input_table_feed_alloc(mi, mm);
+            memcpy(mtf->mtf_tsb + mtf->mtf_len * 188, tsb, 188);
+            mtf->mtf_len++;
           }
         } else {
           //tvhdebug("tsdemux", "%s - SI packet had errors", name);
@@ -742,30 +961,65 @@ done:
   }
 
   /* Wake table */
-  if (table_wakeup)
+  if (mtf) {
+    mpegts_input_table_feed_queue(mi, mtf);
     pthread_cond_signal(&mi->mi_table_cond);
+  }
 
   /* Bandwidth monitoring */
   atomic_add(&mmi->mmi_stats.bps, tsb - mpkt->mp_data);
 }
 
+/*
+ * Next record of the input ring (consumer side), skips the wrap gap
+ */
+static mpegts_packet_t *
+mpegts_input_ring_peek ( mpegts_input_t *mi, unsigned int *tail )
+{
+  unsigned int t = *tail, off, gap;
+  mpegts_packet_t *mp;
+
+  off = t & (MPEGTS_INPUT_RING_SIZE - 1);
+  gap = MPEGTS_INPUT_RING_SIZE - off;
+  if (gap >= sizeof(mpegts_packet_t)) {
+    mp = (mpegts_packet_t *)(mi->mi_input_ring + off);
+    if (mp->mp_len) {
+      *tail = t + MPEGTS_INPUT_REC_SIZE(mp->mp_len);
+      return mp;
+    }
+  }
+  *tail = t + gap;
+  return NULL;
+}
+
 static void *
 mpegts_input_thread ( void * p )
 {
+  unsigned int tail, next;
   mpegts_packet_t *mp;
   mpegts_input_t  *mi = p;
 
-  pthread_mutex_lock(&mi->mi_input_lock);
   while (mi->mi_running) {
 
     /* Wait for a packet */
-    if (!(mp = TAILQ_FIRST(&mi->mi_input_queue))) {
-      pthread_cond_wait(&mi->mi_input_cond, &mi->mi_input_lock);
+    tail = mi->mi_input_tail;
+    if (tail == mi->mi_input_head) {
+      pthread_mutex_lock(&mi->mi_input_lock);
+      mi->mi_input_waiting = 1;
+      atomic_barrier();
+      if (mi->mi_running && tail == mi->mi_input_head)
+        pthread_cond_wait(&mi->mi_input_cond, &mi->mi_input_lock);
+      mi->mi_input_waiting = 0;
+      pthread_mutex_unlock(&mi->mi_input_lock);
       continue;
     }
-    TAILQ_REMOVE(&mi->mi_input_queue, mp, mp_link);
-    pthread_mutex_unlock(&mi->mi_input_lock);
-      
+    atomic_barrier();
+    next = tail;
+    if (!(mp = mpegts_input_ring_peek(mi, &next))) {
+      mi->mi_input_tail = next;
+      continue;
+    }
+
     /* Process */
     pthread_mutex_lock(&mi->mi_output_lock);
     if (mp->mp_mux && mp->mp_mux->mm_active) {
@@ -774,17 +1028,13 @@ mpegts_input_thread ( void * p )
     }
     pthread_mutex_unlock(&mi->mi_output_lock);
 
-    /* Cleanup */
-    free(mp);
-    pthread_mutex_lock(&mi->mi_input_lock);
+    /* Release record */
+    atomic_barrier();
+    mi->mi_input_tail = next;
   }
 
   /* Flush */
-  while ((mp = TAILQ_FIRST(&mi->mi_input_queue))) {
-    TAILQ_REMOVE(&mi->mi_input_queue, mp, mp_link);
-    free(mp);
-  }
-  pthread_mutex_unlock(&mi->mi_input_lock);
+  mi->mi_input_tail = mi->mi_input_head;
 
   return NULL;
 }
@@ -792,9 +1042,16 @@ mpegts_input_thread ( void * p )
 static void *
 mpegts_input_table_thread ( void *aux )
 {
+  int i;
+  int64_t latency;
+  uint8_t *p;
+  mpegts_mux_t          *mm;
   mpegts_table_feed_t   *mtf;
+  mpegts_table_pending_t tp;
+  mpegts_table_pending_sect_t *tps;
   mpegts_input_t        *mi = aux;
 
+  memset(&tp, 0, sizeof(tp));
   pthread_mutex_lock(&mi->mi_output_lock);
   while (mi->mi_running) {
 
@@ -804,18 +1061,44 @@ mpegts_input_table_thread ( void *aux )
       continue;
     }
     TAILQ_REMOVE(&mi->mi_table_queue, mtf, mtf_link);
+    mi->mi_table_feed = mtf;
+    mi->mi_table_busy = mm = mtf->mtf_mux;
     pthread_mutex_unlock(&mi->mi_output_lock);
-    
-    /* Process */
-    if (mtf->mtf_mux) {
+    latency = getmonoclock() - mtf->mtf_queued;
+
+    /* Reassemble and filter */
+    // Note: no global_lock, mpegts_input_flush_mux() waits for us instead
+    tp.tp_len = 0;
+    if (mm)
+      for (i = 0; i < mtf->mtf_len; i++)
+        mpegts_input_table_reassemble(mm, mtf->mtf_tsb + i * 188, &tp);
+    pthread_mutex_lock(&mi->mi_output_lock);
+    mi->mi_table_busy = NULL;
+    pthread_cond_broadcast(&mi->mi_table_busy_cond);
+    pthread_mutex_unlock(&mi->mi_output_lock);
+
+    /* Dispatch */
+    // Note: callbacks may stop the mux, which clears mtf_mux
+    if (tp.tp_len) {
       pthread_mutex_lock(&global_lock);
-      mpegts_input_table_dispatch(mtf->mtf_mux, mtf->mtf_tsb);
+      for (p = tp.tp_buf; p < tp.tp_buf + tp.tp_len;
+           p += sizeof(*tps) + ((tps->tps_len + 7) & ~7)) {
+        tps = (mpegts_table_pending_sect_t *)p;
+        if (mtf->mtf_mux && tps->tps_len)
+          mpegts_table_dispatch_filtered(tps->tps_table,
+                                         (uint8_t *)(tps + 1), tps->tps_len);
+        mpegts_table_release(tps->tps_table);
+      }
       pthread_mutex_unlock(&global_lock);
     }
 
     /* Cleanup */
-    free(mtf);
     pthread_mutex_lock(&mi->mi_output_lock);
+    mi->mi_table_feed = NULL;
+    mi->mi_table_batches++;
+    mi->mi_table_pkts    += mtf->mtf_len;
+    mi->mi_table_latency += latency;
+    mpegts_input_table_feed_release(mi, mtf);
   }
 
   /* Flush */
@@ -823,7 +1106,13 @@ mpegts_input_table_thread ( void *aux )
     TAILQ_REMOVE(&mi->mi_table_queue, mtf, mtf_link);
     free(mtf);
   }
+  while ((mtf = TAILQ_FIRST(&mi->mi_table_pool)) != NULL) {
+    TAILQ_REMOVE(&mi->mi_table_pool, mtf, mtf_link);
+    free(mtf);
+  }
+  mi->mi_table_pool_count = 0;
   pthread_mutex_unlock(&mi->mi_output_lock);
+  free(tp.tp_buf);
 
   return NULL;
 }
@@ -834,25 +1123,34 @@ mpegts_input_flush_mux
 {
   mpegts_table_feed_t *mtf;
   mpegts_packet_t *mp;
+  unsigned int i, head;
 
   // Note: to avoid long delays in here, rather than actually
   //       remove things from the Q, we simply invalidate by clearing
   //       the mux pointer and allow the threads to deal with the deletion
 
-  /* Flush input Q */
-  pthread_mutex_lock(&mi->mi_input_lock);
-  TAILQ_FOREACH(mp, &mi->mi_input_queue, mp_link) {
-    if (mp->mp_mux == mm)
+  /* Flush input ring */
+  // Note: the consumer only looks at a slot with mi_output_lock held
+  pthread_mutex_lock(&mi->mi_output_lock);
+  head = mi->mi_input_head;
+  atomic_barrier();
+  for (i = mi->mi_input_tail; i != head; ) {
+    mp = mpegts_input_ring_peek(mi, &i);
+    if (mp && mp->mp_mux == mm)
       mp->mp_mux = NULL;
   }
-  pthread_mutex_unlock(&mi->mi_input_lock);
 
   /* Flush table Q */
-  pthread_mutex_lock(&mi->mi_output_lock);
   TAILQ_FOREACH(mtf, &mi->mi_table_queue, mtf_link) {
     if (mtf->mtf_mux == mm)
       mtf->mtf_mux = NULL;
   }
+  if (mi->mi_table_feed && mi->mi_table_feed->mtf_mux == mm)
+    mi->mi_table_feed->mtf_mux = NULL;
+
+  /* Wait for the (unlocked) section pre-filter */
+  while (mi->mi_table_busy == mm)
+    pthread_cond_wait(&mi->mi_table_busy_cond, &mi->mi_output_lock);
   pthread_mutex_unlock(&mi->mi_output_lock);
 }
 
@@ -894,6 +1192,15 @@ mpegts_input_stream_status
   st->max_weight  = w;
   st->stats       = mmi->mmi_stats;
   st->stats.bps   = atomic_exchange(&mmi->mmi_stats.bps, 0) * 8;
+  st->ring_depth  = (mi->mi_input_head - mi->mi_input_tail) / 1024;
+  st->ring_hwm    = mi->mi_input_hwm / 1024;
+  st->ring_drops  = mi->mi_input_drops;
+  if (mi->mi_table_batches) {
+    st->table_batch   = mi->mi_table_pkts / mi->mi_table_batches;
+    st->table_latency = mi->mi_table_latency / mi->mi_table_batches;
+    mi->mi_table_batches = mi->mi_table_pkts = 0;
+    mi->mi_table_latency = 0;
+  }
 }
 
 static void
@@ -1009,11 +1316,13 @@ mpegts_input_create0
   /* Init input/output structures */
   pthread_mutex_init(&mi->mi_input_lock, NULL);
   pthread_cond_init(&mi->mi_input_cond, NULL);
-  TAILQ_INIT(&mi->mi_input_queue);
+  mi->mi_input_ring = malloc(MPEGTS_INPUT_RING_SIZE);
 
   pthread_mutex_init(&mi->mi_output_lock, NULL);
   pthread_cond_init(&mi->mi_table_cond, NULL);
+  pthread_cond_init(&mi->mi_table_busy_cond, NULL);
   TAILQ_INIT(&mi->mi_table_queue);
+  TAILQ_INIT(&mi->mi_table_pool);
 
   /* Defaults */
   mi->mi_ota_epg = 1;
@@ -1068,6 +1377,8 @@ mpegts_input_delete ( mpegts_input_t *mi, int delconf )
 
   pthread_mutex_destroy(&mi->mi_output_lock);
   pthread_cond_destroy(&mi->mi_table_cond);
+  pthread_cond_destroy(&mi->mi_table_busy_cond);
+  free(mi->mi_input_ring);
   free(mi->mi_name);
   free(mi);
 }
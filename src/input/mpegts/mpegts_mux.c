@@ -690,6 +690,10 @@ mpegts_mux_stop ( mpegts_mux_t *mm, int force )
     }
     free(mp);
   }
+  if (mi) pthread_mutex_lock(&mi->mi_output_lock);
+  free(mm->mm_pid_map);
+  mm->mm_pid_map = NULL;
+  if (mi) pthread_mutex_unlock(&mi->mi_output_lock);
 
   /* Scanning */
   mpegts_network_scan_mux_cancel(mm, 1);
@@ -1099,6 +1103,8 @@ mpegts_mux_find_pid_ ( mpegts_mux_t *mm, int pid, int create )
       SKEL_USED(mpegts_pid_skel);
       mp->mp_fd = -1;
       mp->mp_cc = -1;
+      if (!mm->mm_pid_map)
+        mm->mm_pid_map = calloc(MPEGTS_PID_COUNT, sizeof(mpegts_pid_entry_t));
     }
   }
   if (mp) {
@@ -45,16 +45,15 @@ mpegts_table_fastswitch ( mpegts_mux_t *mm )
   mpegts_mux_scan_done(mm, buf, 1);
 }
 
-void
-mpegts_table_dispatch
-  ( const uint8_t *sec, size_t r, void *aux )
+static int
+mpegts_table_dispatch0
+  ( mpegts_table_t *mt, const uint8_t *sec, size_t r, int chkcrc )
 {
   int tid, len, ret;
-  mpegts_table_t *mt = aux;
-  int chkcrc = mt->mt_flags & MT_CRC;
+  int crc = mt->mt_flags & MT_CRC;
 
   if(mt->mt_destroyed)
-    return;
+    return -1;
 
   /* Table info */
   tid = sec[0];
@@ -64,28 +63,28 @@ mpegts_table_dispatch
     if (len != r - 3)
       tvhwarn(mt->mt_name, "stuffing found with trailing data (len %i, total %zi)", len, r);
     dvb_table_reset(mt);
-    return;
+    return -1;
   }
 
   /* It seems some hardware (or is it the dvb API?) does not
      honour the DMX_CHECK_CRC flag, so we check it again */
-  if(chkcrc && tvh_crc32(sec, r, 0xffffffff)) {
+  if(crc && chkcrc && tvh_crc32(sec, r, 0xffffffff)) {
     tvhwarn(mt->mt_name, "invalid checksum (len %zi)", r);
-    return;
+    return -1;
   }
 
   /* Not enough data */
   if(len < r - 3) {
     tvhtrace(mt->mt_name, "not enough data, %d < %d", (int)r, len);
-    return;
+    return -1;
   }
 
   /* Check table mask */
   if((tid & mt->mt_mask) != mt->mt_table)
-    return;
+    return -1;
 
   /* Strip trailing CRC */
-  if(chkcrc)
+  if(crc)
     len -= 4;
 
   /* Pass with tableid / len in data */
@@ -102,6 +101,189 @@ mpegts_table_dispatch
 
   if(!ret && mt->mt_flags & MT_QUICKREQ)
     mpegts_table_fastswitch(mt->mt_mux);
+
+  return ret;
+}
+
+void
+mpegts_table_dispatch
+  ( const uint8_t *sec, size_t r, void *aux )
+{
+  mpegts_table_dispatch0(aux, sec, r, 1);
+}
+
+/* **************************************************************************
+ * Section pre-filter
+ *
+ * The table thread reassembles sections without global_lock, so it can
+ * also throw away most of the carousel repeats before anything has to
+ * be locked. Each long-form section of a CRC protected table is keyed on
+ * table id, extension and section number (plus the transport ids for
+ * EIT, whose extension is only the service id) and remembers the version
+ * and CRC last seen. An unchanged section is dropped once the callback
+ * has accepted it and then rejected a repeat of it, the dvb_table_begin()
+ * state machine needs that first repeat to mark the table complete.
+ * *************************************************************************/
+
+#define MPEGTS_TABLE_FILTER_HASH 256
+#define MPEGTS_TABLE_FILTER_MAX  8192
+
+typedef struct mpegts_table_seen {
+  LIST_ENTRY(mpegts_table_seen) link;
+  uint64_t key;
+  uint32_t crc;     // covers the version too
+  int      state;
+#define MT_SEEN_NEW      0 // not accepted by the callback (yet)
+#define MT_SEEN_ACCEPTED 1 // accepted, repeats still dispatched
+#define MT_SEEN_DONE     2 // accepted and a repeat ignored, filter
+} mpegts_table_seen_t;
+
+struct mpegts_table_filter {
+  LIST_HEAD(,mpegts_table_seen) hash[MPEGTS_TABLE_FILTER_HASH];
+  int count;
+};
+
+static void
+mpegts_table_filter_flush ( mpegts_table_t *mt )
+{
+  int i;
+  mpegts_table_seen_t *ms;
+  struct mpegts_table_filter *mf = mt->mt_filter;
+
+  if (!mf) return;
+  for (i = 0; i < MPEGTS_TABLE_FILTER_HASH; i++)
+    while ((ms = LIST_FIRST(&mf->hash[i])) != NULL) {
+      LIST_REMOVE(ms, link);
+      free(ms);
+    }
+  mf->count = 0;
+}
+
+/*
+ * Section key, returns 0 for sections that can't be filtered
+ */
+static inline int
+mpegts_table_seen_key
+  ( mpegts_table_t *mt, const uint8_t *sec, size_t r, uint64_t *key )
+{
+  if (!(mt->mt_flags & MT_CRC) || !(sec[1] & 0x80) || r < 12)
+    return 0;
+  *key = ((uint32_t)sec[0] << 24) | (sec[3] << 16) | (sec[4] << 8) | sec[6];
+  if (sec[0] >= 0x4e && sec[0] <= 0x6f && r >= 16)
+    *key |= (uint64_t)(((uint32_t)sec[8] << 24) | (sec[9] << 16) |
+                       (sec[10] << 8) | sec[11]) << 32;
+  return 1;
+}
+
+static inline int
+mpegts_table_seen_hash ( uint64_t key )
+{
+  return (key ^ (key >> 29) ^ (key >> 45)) % MPEGTS_TABLE_FILTER_HASH;
+}
+
+static mpegts_table_seen_t *
+mpegts_table_seen_find ( mpegts_table_t *mt, uint64_t key )
+{
+  mpegts_table_seen_t *ms;
+  struct mpegts_table_filter *mf = mt->mt_filter;
+
+  if (!mf) return NULL;
+  LIST_FOREACH(ms, &mf->hash[mpegts_table_seen_hash(key)], link)
+    if (ms->key == key)
+      return ms;
+  return NULL;
+}
+
+/*
+ * Check a complete section, returns 1 if it must be dispatched
+ *
+ * Note: called from the table thread without global_lock, does the
+ *       checks of mpegts_table_dispatch() that don't need the lock
+ */
+int
+mpegts_table_prefilter
+  ( mpegts_table_t *mt, const uint8_t *sec, size_t r )
+{
+  int len;
+  uint32_t crc;
+  uint64_t key;
+  mpegts_table_seen_t *ms;
+  struct mpegts_table_filter *mf;
+
+  if (mt->mt_destroyed || r < 3)
+    return 0;
+  mt->mt_sect_seen++;
+
+  /* Stuffing resets the table, forget everything */
+  if (sec[0] == 0x72) {
+    mpegts_table_filter_flush(mt);
+    goto dispatch;
+  }
+
+  /* Not for us (mpegts_table_dispatch() would ignore it too) */
+  len = ((sec[1] & 0x0f) << 8) | sec[2];
+  if (len < r - 3 || (sec[0] & mt->mt_mask) != mt->mt_table)
+    return 0;
+  if ((mt->mt_flags & MT_CRC) && tvh_crc32(sec, r, 0xffffffff)) {
+    tvhwarn(mt->mt_name, "invalid checksum (len %zi)", r);
+    return 0;
+  }
+
+  /* Duplicate? */
+  if (!mpegts_table_seen_key(mt, sec, r, &key))
+    goto dispatch;
+  crc = ((uint32_t)sec[r-4] << 24) | (sec[r-3] << 16) | (sec[r-2] << 8) | sec[r-1];
+  if ((ms = mpegts_table_seen_find(mt, key)) != NULL) {
+    if (ms->crc == crc) {
+      if (ms->state == MT_SEEN_DONE) {
+        mt->mt_sect_dups++;
+        return 0;
+      }
+      goto dispatch;
+    }
+  } else {
+    if (!(mf = mt->mt_filter))
+      mf = mt->mt_filter = calloc(1, sizeof(*mf));
+    if (mf->count >= MPEGTS_TABLE_FILTER_MAX) {
+      tvhtrace(mt->mt_name, "section filter full, flushed");
+      mpegts_table_filter_flush(mt);
+    }
+    ms = malloc(sizeof(*ms));
+    ms->key = key;
+    LIST_INSERT_HEAD(&mf->hash[mpegts_table_seen_hash(key)], ms, link);
+    mf->count++;
+  }
+  ms->crc   = crc;
+  ms->state = MT_SEEN_NEW;
+
+dispatch:
+  mt->mt_sect_dispatched++;
+  return 1;
+}
+
+/*
+ * Dispatch a section passed by mpegts_table_prefilter (global_lock held)
+ */
+void
+mpegts_table_dispatch_filtered
+  ( mpegts_table_t *mt, const uint8_t *sec, size_t r )
+{
+  int ret;
+  uint64_t key;
+  mpegts_table_seen_t *ms;
+
+  ret = mpegts_table_dispatch0(mt, sec, r, 0);
+
+  /* Feedback */
+  if (!mpegts_table_seen_key(mt, sec, r, &key))
+    return;
+  if (!(ms = mpegts_table_seen_find(mt, key)))
+    return;
+  if (ret >= 0) {
+    if (ms->state == MT_SEEN_NEW)
+      ms->state = MT_SEEN_ACCEPTED;
+  } else if (ms->state == MT_SEEN_ACCEPTED)
+    ms->state = MT_SEEN_DONE;
 }
 
 void
@@ -113,6 +295,12 @@ mpegts_table_release_ ( mpegts_table_t *mt )
     RB_REMOVE(&mt->mt_state, st, link);
     free(st);
   }
+  if (mt->mt_sect_seen)
+    tvhdebug(mt->mt_name, "sections %"PRIu64" seen, %"PRIu64" duplicate, "
+             "%"PRIu64" dispatched", mt->mt_sect_seen, mt->mt_sect_dups,
+             mt->mt_sect_dispatched);
+  mpegts_table_filter_flush(mt);
+  free(mt->mt_filter);
   if (mt->mt_destroy)
     mt->mt_destroy(mt);
   free(mt->mt_name);
@@ -34,6 +34,9 @@ void tsfile_done ( void );
 /* Add a new file (multiplex) */
 void tsfile_add_file ( const char *path );
 
+/* Replay all files unthrottled N times and report the throughput */
+void tsfile_benchmark ( int loops, const char *mux, const char *outdir );
+
 #endif /* __TVH_TSFILE_H__ */
 
 /******************************************************************************
@@ -0,0 +1,474 @@
+/*
+ *  Tvheadend - TS file input benchmark
+ *
+ *  Copyright (C) 2014 Tvheadend
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The files are replayed as fast as the input thread consumes them. Every
+ * service of the multiplex gets a chain like a recording (tsfix,
+ * globalheaders and a muxer) that is fed synchronously from the input
+ * thread, so the time of each stage is taken with the thread CPU clock:
+ *
+ *   read    - the tsfile reader thread
+ *   demux   - the input thread, less the chains (TS demux, parsers)
+ *   tables  - the input table thread
+ *   fix     - tsfix and globalheaders
+ *   mux     - the muxer, the output is discarded unless a directory
+ *             is given
+ */
+
+#include "tvheadend.h"
+#include "tsfile_private.h"
+#include "input.h"
+#include "subscriptions.h"
+#include "streaming.h"
+#include "packet.h"
+#include "muxer.h"
+#include "plumbing/tsfix.h"
+#include "plumbing/globalheaders.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <unistd.h>
+
+int tsfile_bench_loops;
+
+static muxer_container_type_t tsfile_bench_mc;
+static char *tsfile_bench_outdir;
+static pthread_t tsfile_bench_tid;
+
+/*
+ * Per service chain
+ */
+typedef struct tsfile_bench_chain
+{
+  LIST_ENTRY(tsfile_bench_chain) tbc_link;
+  service_t          *tbc_service;
+  th_subscription_t  *tbc_sub;
+  streaming_target_t  tbc_probe;   ///< Subscription output
+  streaming_target_t *tbc_next;    ///< tsfix or the sink
+  streaming_target_t *tbc_tsfix;
+  streaming_target_t *tbc_gh;
+  streaming_target_t  tbc_sink;
+  muxer_t            *tbc_mux;
+  char               *tbc_filename;
+  int                 tbc_idx;
+  volatile int        tbc_started;
+
+  uint64_t            tbc_pkts;
+  uint64_t            tbc_bytes;
+  uint64_t            tbc_out;
+  int64_t             tbc_cpu_fix;  ///< probe to end (ns)
+  int64_t             tbc_cpu_mux;  ///< muxer only (ns)
+} tsfile_bench_chain_t;
+
+LIST_HEAD(tsfile_bench_chain_list, tsfile_bench_chain);
+
+/*
+ * Counter snapshot
+ */
+typedef struct tsfile_bench_stats
+{
+  int64_t  wall;
+  int64_t  cpu_input;
+  int64_t  cpu_tables;
+  int64_t  cpu_fix;
+  int64_t  cpu_mux;
+  uint64_t pkts;
+  uint64_t bytes;
+  uint64_t out;
+  int      drops;
+  unsigned pkt_allocs;
+  unsigned pktbuf_allocs;
+  unsigned msg_allocs;
+} tsfile_bench_stats_t;
+
+static inline int64_t
+tsfile_bench_cpu ( clockid_t clk )
+{
+  struct timespec ts;
+  clock_gettime(clk, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int64_t
+tsfile_bench_thread_cpu ( pthread_t tid )
+{
+  clockid_t clk;
+  if (pthread_getcpuclockid(tid, &clk))
+    return 0;
+  return tsfile_bench_cpu(clk);
+}
+
+/* **************************************************************************
+ * Chain
+ * *************************************************************************/
+
+static void
+tsfile_bench_probe ( void *opaque, streaming_message_t *sm )
+{
+  tsfile_bench_chain_t *tbc = opaque;
+  int64_t t = tsfile_bench_cpu(CLOCK_THREAD_CPUTIME_ID);
+  streaming_target_deliver2(tbc->tbc_next, sm);
+  tbc->tbc_cpu_fix += tsfile_bench_cpu(CLOCK_THREAD_CPUTIME_ID) - t;
+}
+
+static int
+tsfile_bench_null ( void *opaque, const void *data, size_t len )
+{
+  tsfile_bench_chain_t *tbc = opaque;
+  tbc->tbc_out += len;
+  return 0;
+}
+
+static void
+tsfile_bench_start ( tsfile_bench_chain_t *tbc, const streaming_start_t *ss )
+{
+  char path[PATH_MAX];
+  int r;
+
+  if (tsfile_bench_outdir) {
+    snprintf(path, sizeof(path), "%s/tsfile-bench-%d-%04x.%s",
+             tsfile_bench_outdir, tbc->tbc_idx,
+             ((mpegts_service_t*)tbc->tbc_service)->s_dvb_service_id,
+             muxer_suffix(tbc->tbc_mux, ss) ?: "bin");
+    tbc->tbc_filename = strdup(path);
+    r = muxer_open_file(tbc->tbc_mux, path);
+  } else {
+    r = muxer_open_sink(tbc->tbc_mux, tsfile_bench_null, tbc);
+  }
+  if (!r)
+    r = muxer_init(tbc->tbc_mux, ss, "tsfile benchmark");
+  if (r)
+    tvhlog(LOG_ERR, "tsfile", "benchmark: unable to start the muxer");
+  tbc->tbc_started = r ? -1 : 1;
+}
+
+static void
+tsfile_bench_sink ( void *opaque, streaming_message_t *sm )
+{
+  tsfile_bench_chain_t *tbc = opaque;
+  pktbuf_t *pb;
+  int64_t t;
+
+  switch (sm->sm_type) {
+  case SMT_START:
+    if (!tbc->tbc_started)
+      tsfile_bench_start(tbc, sm->sm_data);
+    else if (tbc->tbc_started > 0)
+      muxer_reconfigure(tbc->tbc_mux, sm->sm_data);
+    break;
+
+  case SMT_MPEGTS:
+  case SMT_PACKET:
+    if (tbc->tbc_started <= 0)
+      break;
+    if (sm->sm_type == SMT_PACKET)
+      pb = ((th_pkt_t*)sm->sm_data)->pkt_payload;
+    else
+      pb = sm->sm_data;
+    tbc->tbc_pkts++;
+    tbc->tbc_bytes += pb ? pktbuf_len(pb) : 0;
+    t = tsfile_bench_cpu(CLOCK_THREAD_CPUTIME_ID);
+    muxer_write_pkt(tbc->tbc_mux, sm->sm_type, sm->sm_data);
+    sm->sm_data = NULL;
+    tbc->tbc_cpu_mux += tsfile_bench_cpu(CLOCK_THREAD_CPUTIME_ID) - t;
+    break;
+
+  default:
+    break;
+  }
+
+  streaming_msg_free(sm);
+}
+
+static tsfile_bench_chain_t *
+tsfile_bench_chain_create ( service_t *t, int idx )
+{
+  muxer_config_t cfg;
+  tsfile_bench_chain_t *tbc = calloc(1, sizeof(*tbc));
+  int flags = 0;
+
+  memset(&cfg, 0, sizeof(cfg));
+  cfg.m_cache            = MC_CACHE_SYSTEM;
+  cfg.m_file_permissions = 0644;
+
+  tbc->tbc_service = t;
+  tbc->tbc_idx     = idx;
+  tbc->tbc_mux     = muxer_create(tsfile_bench_mc, &cfg);
+  if (!tbc->tbc_mux) {
+    free(tbc);
+    return NULL;
+  }
+
+  streaming_target_init(&tbc->tbc_sink, tsfile_bench_sink, tbc, 0);
+  if (tsfile_bench_mc == MC_PASS) {
+    tbc->tbc_next = &tbc->tbc_sink;
+    flags = SUBSCRIPTION_RAW_MPEGTS;
+  } else {
+    tbc->tbc_gh    = globalheaders_create(&tbc->tbc_sink);
+    tbc->tbc_tsfix = tsfix_create(tbc->tbc_gh);
+    tbc->tbc_next  = tbc->tbc_tsfix;
+  }
+  streaming_target_init(&tbc->tbc_probe, tsfile_bench_probe, tbc, 0);
+
+  tbc->tbc_sub = subscription_create_from_service(t, 500, "tsfile benchmark",
+                                                  &tbc->tbc_probe, flags,
+                                                  NULL, NULL, "tsfile_bench");
+  return tbc;
+}
+
+static void
+tsfile_bench_chain_destroy ( tsfile_bench_chain_t *tbc )
+{
+  struct stat st;
+
+  if (tbc->tbc_sub)
+    subscription_unsubscribe(tbc->tbc_sub);
+  if (tbc->tbc_tsfix)
+    tsfix_destroy(tbc->tbc_tsfix);
+  if (tbc->tbc_gh)
+    globalheaders_destroy(tbc->tbc_gh);
+  if (tbc->tbc_started > 0)
+    muxer_close(tbc->tbc_mux);
+  muxer_destroy(tbc->tbc_mux);
+  if (tbc->tbc_filename && !stat(tbc->tbc_filename, &st))
+    tvhlog(LOG_INFO, "tsfile", "benchmark: wrote %s (%"PRIoff_t" bytes)",
+           tbc->tbc_filename, st.st_size);
+  free(tbc->tbc_filename);
+  free(tbc);
+}
+
+/* **************************************************************************
+ * Measurement
+ * *************************************************************************/
+
+static void
+tsfile_bench_snapshot
+  ( tsfile_input_t *ti, struct tsfile_bench_chain_list *chains,
+    tsfile_bench_stats_t *st )
+{
+  tsfile_bench_chain_t *tbc;
+
+  memset(st, 0, sizeof(*st));
+  st->wall          = getmonoclock();
+  st->cpu_input     = tsfile_bench_thread_cpu(ti->mi_input_tid);
+  st->cpu_tables    = tsfile_bench_thread_cpu(ti->mi_table_tid);
+  st->drops         = ti->mi_input_drops;
+  st->pkt_allocs    = pkt_alloc_count;
+  st->pktbuf_allocs = pktbuf_alloc_count;
+  st->msg_allocs    = streaming_msg_alloc_count;
+  LIST_FOREACH(tbc, chains, tbc_link) {
+    st->cpu_fix += tbc->tbc_cpu_fix;
+    st->cpu_mux += tbc->tbc_cpu_mux;
+    st->pkts    += tbc->tbc_pkts;
+    st->bytes   += tbc->tbc_bytes;
+    st->out     += tbc->tbc_out;
+  }
+}
+
+static void
+tsfile_bench_drain ( tsfile_input_t *ti )
+{
+  while (tvheadend_running && ti->mi_input_head != ti->mi_input_tail)
+    usleep(10000);
+}
+
+static int
+tsfile_bench_services ( mpegts_mux_t *mm )
+{
+  mpegts_service_t *s;
+  int n = 0;
+
+  LIST_FOREACH(s, &mm->mm_services, s_dvb_mux_link) {
+    pthread_mutex_lock(&s->s_stream_mutex);
+    if (TAILQ_FIRST(&s->s_components))
+      n++;
+    pthread_mutex_unlock(&s->s_stream_mutex);
+  }
+  return n;
+}
+
+static void
+tsfile_bench_mux ( mpegts_mux_t *mm, int idx )
+{
+  struct tsfile_bench_chain_list chains;
+  tsfile_bench_chain_t *tbc;
+  tsfile_bench_stats_t s0, s1;
+  th_subscription_t *sub = NULL;
+  tsfile_input_t *ti = NULL;
+  mpegts_service_t *s;
+  char name[256], out[32];
+  int i, n, last = 0, stable = 0, err;
+  int64_t wall, cpu_chain;
+
+  LIST_INIT(&chains);
+
+  /* Tune (the tuner may still be busy with the previous file) */
+  for (i = 0; i < 100 && tvheadend_running; i++) {
+    pthread_mutex_lock(&global_lock);
+    mm->mm_display_name(mm, name, sizeof(name));
+    sub = subscription_create_from_mux(mm, 500, "tsfile benchmark", NULL,
+                                       SUBSCRIPTION_NONE, NULL, NULL,
+                                       "tsfile_bench", &err);
+    if (sub && mm->mm_active)
+      ti = (tsfile_input_t*)mm->mm_active->mmi_input;
+    pthread_mutex_unlock(&global_lock);
+    if (sub) break;
+    usleep(100000);
+  }
+  if (!sub || !ti) {
+    tvhlog(LOG_ERR, "tsfile", "benchmark %s: unable to tune", name);
+    goto out;
+  }
+
+  /* Wait for the services */
+  for (i = 0; i < 200 && tvheadend_running && stable < 10; i++) {
+    usleep(100000);
+    pthread_mutex_lock(&global_lock);
+    n = tsfile_bench_services(mm);
+    pthread_mutex_unlock(&global_lock);
+    stable = n && n == last ? stable + 1 : 0;
+    last = n;
+  }
+  if (!last) {
+    tvhlog(LOG_ERR, "tsfile", "benchmark %s: no services found", name);
+    goto out;
+  }
+
+  /* Subscribe */
+  pthread_mutex_lock(&global_lock);
+  n = 0;
+  LIST_FOREACH(s, &mm->mm_services, s_dvb_mux_link) {
+    if (!TAILQ_FIRST(&s->s_components))
+      continue;
+    if ((tbc = tsfile_bench_chain_create((service_t*)s, idx)))
+      LIST_INSERT_HEAD(&chains, tbc, tbc_link);
+  }
+  pthread_mutex_unlock(&global_lock);
+
+  for (i = 0; i < 100 && tvheadend_running; i++) {
+    n = 0;
+    LIST_FOREACH(tbc, &chains, tbc_link)
+      n += !tbc->tbc_started;
+    if (!n) break;
+    usleep(100000);
+  }
+
+  /* Measure */
+  ti->ti_bench_state = TSFILE_BENCH_HOLD;
+  usleep(50000);
+  tsfile_bench_drain(ti);
+  tsfile_bench_snapshot(ti, &chains, &s0);
+  ti->ti_bench_state = TSFILE_BENCH_START;
+  while (tvheadend_running && ti->ti_bench_state != TSFILE_BENCH_DONE)
+    usleep(10000);
+  tsfile_bench_drain(ti);
+  tsfile_bench_snapshot(ti, &chains, &s1);
+
+  if (!tvheadend_running)
+    goto out;
+
+  /* Report */
+  wall      = MAX(s1.wall - s0.wall, 1);
+  cpu_chain = s1.cpu_fix - s0.cpu_fix;
+  tvhlog(LOG_INFO, "tsfile",
+         "benchmark %s: %d loops, %"PRIu64" MB in %.3fs, %.0f TS packets/s, %.1f MB/s",
+         name, ti->ti_bench_passes, ti->ti_bench_bytes >> 20, wall / 1e6,
+         ti->ti_bench_bytes / 188 * 1e6 / wall, ti->ti_bench_bytes / (double)wall);
+  tvhlog(LOG_INFO, "tsfile",
+         "benchmark %s: cpu read %.3fs, demux %.3fs, tables %.3fs, fix %.3fs, mux %.3fs",
+         name, ti->ti_bench_cpu / 1e9,
+         (s1.cpu_input - s0.cpu_input - cpu_chain) / 1e9,
+         (s1.cpu_tables - s0.cpu_tables) / 1e9,
+         (cpu_chain - (s1.cpu_mux - s0.cpu_mux)) / 1e9,
+         (s1.cpu_mux - s0.cpu_mux) / 1e9);
+  out[0] = '\0';
+  if (!tsfile_bench_outdir)
+    snprintf(out, sizeof(out), " %"PRIu64" MB out,", (s1.out - s0.out) >> 20);
+  tvhlog(LOG_INFO, "tsfile",
+         "benchmark %s: %"PRIu64" frames, %"PRIu64" MB in,%s %d drops",
+         name, s1.pkts - s0.pkts, (s1.bytes - s0.bytes) >> 20,
+         out, s1.drops - s0.drops);
+  tvhlog(LOG_INFO, "tsfile",
+         "benchmark %s: allocated %u packets, %u buffers, %u messages (%.2f per frame)",
+         name, s1.pkt_allocs - s0.pkt_allocs, s1.pktbuf_allocs - s0.pktbuf_allocs,
+         s1.msg_allocs - s0.msg_allocs,
+         (double)(s1.pkt_allocs - s0.pkt_allocs + s1.pktbuf_allocs - s0.pktbuf_allocs +
+                  s1.msg_allocs - s0.msg_allocs) / MAX(s1.pkts - s0.pkts, 1));
+
+out:
+  if (ti)
+    ti->ti_bench_state = TSFILE_BENCH_WARMUP;
+  pthread_mutex_lock(&global_lock);
+  while ((tbc = LIST_FIRST(&chains))) {
+    LIST_REMOVE(tbc, tbc_link);
+    tsfile_bench_chain_destroy(tbc);
+  }
+  if (sub)
+    subscription_unsubscribe(sub);
+  pthread_mutex_unlock(&global_lock);
+}
+
+static void *
+tsfile_bench_thread ( void *aux )
+{
+  mpegts_mux_t *mm, **mms;
+  int i, n = 0;
+
+  /* Copy, the list must not be walked without the lock */
+  pthread_mutex_lock(&global_lock);
+  LIST_FOREACH(mm, &tsfile_network.mn_muxes, mm_network_link)
+    n++;
+  mms = alloca(n * sizeof(mpegts_mux_t *));
+  n = 0;
+  LIST_FOREACH(mm, &tsfile_network.mn_muxes, mm_network_link)
+    mms[n++] = mm;
+  pthread_mutex_unlock(&global_lock);
+
+  for (i = 0; i < n && tvheadend_running; i++)
+    tsfile_bench_mux(mms[i], i);
+
+  tvhlog(LOG_INFO, "tsfile", "benchmark done");
+  kill(getpid(), SIGTERM);
+  return NULL;
+}
+
+/*
+ * Start the benchmark, tvheadend exits when it is done
+ */
+void
+tsfile_benchmark ( int loops, const char *mux, const char *outdir )
+{
+  tsfile_bench_mc = mux ? muxer_container_txt2type(mux) : MC_MATROSKA;
+  if (tsfile_bench_mc == MC_UNKNOWN) {
+    tvhlog(LOG_WARNING, "tsfile", "benchmark: unknown muxer %s, using matroska", mux);
+    tsfile_bench_mc = MC_MATROSKA;
+  }
+  tsfile_bench_outdir = outdir ? strdup(outdir) : NULL;
+  tsfile_bench_loops  = loops;
+  tvhlog(LOG_INFO, "tsfile", "benchmark: %d loops, %s muxer, output %s",
+         loops, muxer_container_type2txt(tsfile_bench_mc), outdir ?: "discarded");
+  tvhthread_create(&tsfile_bench_tid, NULL, tsfile_bench_thread, NULL);
+}
+
+/******************************************************************************
+ * Editor Configuration
+ *
+ * vim:sts=2:ts=2:sw=2:et
+ *****************************************************************************/
@@ -22,6 +22,7 @@
 #include "input.h"
 #include "input/mpegts/dvb.h"
 #include "tvhpoll.h"
+#include "atomic.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -33,6 +34,14 @@
 
 extern const idclass_t mpegts_input_class;
 
+static inline int64_t
+tsfile_thread_cpu ( void )
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
 
 static void *
 tsfile_input_thread ( void *aux )
@@ -44,7 +53,8 @@ tsfile_input_thread ( void *aux )
   tvhpoll_event_t ev;
   struct stat st;
   sbuf_t buf;
-  int64_t pcr, pcr_last = PTS_UNSET;
+  int64_t pcr, pcr_last = PTS_UNSET, cpu = 0;
+  int bench_end;
 #if PLATFORM_LINUX
   int64_t pcr_last_realtime = 0;
 #endif
@@ -107,6 +117,29 @@ tsfile_input_thread ( void *aux )
     /* Check for terminate */
     nfds = tvhpoll_wait(efd, &ev, 1, 0);
     if (nfds == 1) break;
+
+    /* Benchmark, no pacing, the input ring is not allowed to overflow */
+    bench_end = 0;
+    if (tsfile_bench_loops) {
+      if (mi->ti_bench_state == TSFILE_BENCH_HOLD ||
+          mi->ti_bench_state == TSFILE_BENCH_DONE) {
+        if (tvhpoll_wait(efd, &ev, 1, 10) == 1) break;
+        continue;
+      }
+      if (mi->ti_bench_state == TSFILE_BENCH_START) {
+        lseek(fd, 0, SEEK_SET);
+        len = 0;
+        buf.sb_ptr = 0;
+        mi->ti_bench_passes = 0;
+        mi->ti_bench_bytes  = 0;
+        cpu = tsfile_thread_cpu();
+        mi->ti_bench_state = TSFILE_BENCH_RUN;
+      }
+      if (mi->mi_input_head - mi->mi_input_tail >= MPEGTS_INPUT_RING_SIZE / 2) {
+        if (tvhpoll_wait(efd, &ev, 1, 1) == 1) break;
+        continue;
+      }
+    }
     
     /* Read */
     c = sbuf_read(&buf, fd);
@@ -126,6 +159,8 @@ tsfile_input_thread ( void *aux )
       tvhtrace("tsfile", "adapter %d reached eof, resetting", mi->mi_instance);
       lseek(fd, 0, SEEK_SET);
       pcr_last = PTS_UNSET;
+      if (mi->ti_bench_state == TSFILE_BENCH_RUN)
+        bench_end = ++mi->ti_bench_passes >= tsfile_bench_loops;
     }
 
     /* Process */
@@ -133,9 +168,11 @@ tsfile_input_thread ( void *aux )
       pcr = PTS_UNSET;
       mpegts_input_recv_packets((mpegts_input_t*)mi, mmi, &buf,
                                 &pcr, &tmi->mmi_tsfile_pcr_pid);
+      if (mi->ti_bench_state == TSFILE_BENCH_RUN)
+        mi->ti_bench_bytes += c;
 
       /* Delay */
-      if (pcr != PTS_UNSET) {
+      if (pcr != PTS_UNSET && !tsfile_bench_loops) {
         if (pcr_last != PTS_UNSET) {
           struct timespec slp;
           int64_t delta;
@@ -165,6 +202,12 @@ tsfile_input_thread ( void *aux )
 #endif
       }
     }
+
+    if (bench_end) {
+      mi->ti_bench_cpu = tsfile_thread_cpu() - cpu;
+      atomic_barrier();
+      mi->ti_bench_state = TSFILE_BENCH_DONE;
+    }
     sched_yield();
   }
 
@@ -35,6 +35,16 @@ typedef LIST_HEAD(,tsfile_input)   tsfile_input_list_t;
 extern mpegts_network_t    tsfile_network;
 extern tsfile_input_list_t tsfile_inputs;
 extern pthread_mutex_t     tsfile_lock;
+extern int                 tsfile_bench_loops; ///< Unthrottled if set
+
+/*
+ * Benchmark replay state (per input)
+ */
+#define TSFILE_BENCH_WARMUP 0 ///< Replay, not measured
+#define TSFILE_BENCH_HOLD   1 ///< Reader paused
+#define TSFILE_BENCH_START  2 ///< Restart from the top and measure
+#define TSFILE_BENCH_RUN    3
+#define TSFILE_BENCH_DONE   4 ///< Loops done, reader paused
 
 
 /*
@@ -67,6 +77,14 @@ struct tsfile_input
   LIST_ENTRY(tsfile_input) tsi_link;
   th_pipe_t  ti_thread_pipe;
   pthread_t  ti_thread_id;
+
+  /*
+   * Benchmark
+   */
+  volatile int ti_bench_state;
+  int          ti_bench_passes;
+  uint64_t     ti_bench_bytes;
+  int64_t      ti_bench_cpu;     ///< Reader thread CPU time (ns)
 };
 
 /*
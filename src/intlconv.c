@@ -2,36 +2,54 @@
 #include "tvheadend.h"
 #include "intlconv.h"
 
+/*
+ * Converters are cached per thread, iconv handles carry conversion
+ * state and must not be shared. The MRU entry is kept in the first
+ * slot, the least recently used one is closed when the cache is full.
+ */
+#define INTLCONV_CACHE_SIZE 8
+
 typedef struct intlconv_cache {
-  RB_ENTRY(intlconv_cache) ic_link;
   char    *ic_charset_id;
-  iconv_t *ic_handle;
+  iconv_t  ic_handle;
 } intlconv_cache_t;
 
-static RB_HEAD(,intlconv_cache) intlconv_all;
-static intlconv_cache_t        *intlconv_last_ic;
-pthread_mutex_t                 intlconv_lock;
+typedef struct intlconv_thread {
+  int              it_count;
+  intlconv_cache_t it_cache[INTLCONV_CACHE_SIZE];
+} intlconv_thread_t;
+
+static pthread_key_t             intlconv_key;
+static __thread intlconv_thread_t *intlconv_self;
+
+static void
+intlconv_thread_free( void *aux )
+{
+  intlconv_thread_t *it = aux;
+  int i;
+
+  for (i = 0; i < it->it_count; i++) {
+    iconv_close(it->it_cache[i].ic_handle);
+    free(it->it_cache[i].ic_charset_id);
+  }
+  free(it);
+}
 
 void
 intlconv_init( void )
 {
-  pthread_mutex_init(&intlconv_lock, NULL);
+  pthread_key_create(&intlconv_key, intlconv_thread_free);
 }
 
 void
 intlconv_done( void )
 {
-  intlconv_cache_t *ic;
-
-  pthread_mutex_lock(&intlconv_lock);
-  intlconv_last_ic = NULL;
-  while ((ic = RB_FIRST(&intlconv_all)) != NULL) {
-    iconv_close(ic->ic_handle);
-    free(ic->ic_charset_id);
-    RB_REMOVE(&intlconv_all, ic, ic_link);
-    free(ic);
+  /* other threads release their caches on exit */
+  if (intlconv_self) {
+    pthread_setspecific(intlconv_key, NULL);
+    intlconv_thread_free(intlconv_self);
+    intlconv_self = NULL;
   }
-  pthread_mutex_unlock(&intlconv_lock);
 }
 
 const char *
@@ -44,12 +62,6 @@ intlconv_filesystem_charset( void )
   return "ASCII";
 }
 
-static int
-intlconv_cmp ( intlconv_cache_t *a, intlconv_cache_t *b )
-{
-  return strcmp(a->ic_charset_id, b->ic_charset_id);
-}
-
 char *
 intlconv_charset_id( const char *charset,
                      int transil,
@@ -77,12 +89,58 @@ intlconv_charset_id( const char *charset,
   return buf;
 }
 
+static intlconv_cache_t *
+intlconv_find( const char *charset_id )
+{
+  intlconv_thread_t *it = intlconv_self;
+  intlconv_cache_t ic;
+  iconv_t c;
+  int i;
+
+  if (it == NULL) {
+    it = calloc(1, sizeof(*it));
+    if (it == NULL)
+      return NULL;
+    pthread_setspecific(intlconv_key, it);
+    intlconv_self = it;
+  }
+
+  for (i = 0; i < it->it_count; i++)
+    if (strcmp(it->it_cache[i].ic_charset_id, charset_id) == 0) {
+      if (i) {
+        ic = it->it_cache[i];
+        memmove(it->it_cache + 1, it->it_cache, i * sizeof(ic));
+        it->it_cache[0] = ic;
+      }
+      return it->it_cache;
+    }
+
+  c = iconv_open(charset_id, "UTF-8");
+  if ((iconv_t)-1 == c)
+    return NULL;
+  ic.ic_charset_id = strdup(charset_id);
+  if (ic.ic_charset_id == NULL) {
+    iconv_close(c);
+    return NULL;
+  }
+  ic.ic_handle = c;
+  if (it->it_count == INTLCONV_CACHE_SIZE) {
+    it->it_count--;
+    iconv_close(it->it_cache[it->it_count].ic_handle);
+    free(it->it_cache[it->it_count].ic_charset_id);
+  }
+  memmove(it->it_cache + 1, it->it_cache, it->it_count * sizeof(ic));
+  it->it_cache[0] = ic;
+  it->it_count++;
+  return it->it_cache;
+}
+
 ssize_t
 intlconv_utf8( char *dst, size_t dst_size,
                const char *dst_charset_id,
                const char *src_utf8 )
 {
-  intlconv_cache_t templ, *ic;
+  intlconv_cache_t *ic;
   char **inbuf, **outbuf;
   size_t inbuf_left, outbuf_left;
   ssize_t res;
@@ -92,48 +150,17 @@ intlconv_utf8( char *dst, size_t dst_size,
     dst[dst_size - 1] = '\0';
     return strlen(dst);
   }
-  templ.ic_charset_id = (char *)dst_charset_id;
-  pthread_mutex_lock(&intlconv_lock);
-  if (intlconv_last_ic &&
-      strcmp(intlconv_last_ic->ic_charset_id, dst_charset_id) == 0) {
-    ic = intlconv_last_ic;
-    goto found;
-  }
-  ic = RB_FIND(&intlconv_all, &templ, ic_link, intlconv_cmp);
-  if (!ic) {
-    iconv_t c = iconv_open(dst_charset_id, "UTF-8");
-    if ((iconv_t)-1 == c) {
-      pthread_mutex_unlock(&intlconv_lock);
-      return -EIO;
-    }
-    ic = malloc(sizeof(*ic));
-    if (ic == NULL) {
-      pthread_mutex_unlock(&intlconv_lock);
-      return -ENOMEM;
-    }
-    ic->ic_charset_id = strdup(dst_charset_id);
-    if (ic->ic_charset_id == NULL) {
-      pthread_mutex_unlock(&intlconv_lock);
-      free(ic);
-      iconv_close(c);
-      return -ENOMEM;
-    }
-    ic->ic_handle = c;
-    RB_INSERT_SORTED(&intlconv_all, ic, ic_link, intlconv_cmp);
-  }
-found:
+  ic = intlconv_find(dst_charset_id);
+  if (ic == NULL)
+    return errno == ENOMEM ? -ENOMEM : -EIO;
   inbuf       = (char **)&src_utf8;
   inbuf_left  = strlen(src_utf8);
   outbuf      = &dst;
   outbuf_left = dst_size;
   res = iconv(ic->ic_handle, inbuf, &inbuf_left, outbuf, &outbuf_left);
-  if (res == -1) {
+  if (res == -1)
     res = -errno;
-  } else {
-    intlconv_last_ic = ic;
-  }
-  pthread_mutex_unlock(&intlconv_lock);
-  if (res >= 0)
+  else
     res = dst_size - outbuf_left;
   return res;
 }
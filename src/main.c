@@ -60,6 +60,7 @@
 #include "idnode.h"
 #include "imagecache.h"
 #include "timeshift.h"
+#include "muxer/muxer_io.h"
 #include "fsmonitor.h"
 #include "lang_codes.h"
 #include "esfilter.h"
@@ -172,9 +173,20 @@ pthread_mutex_t atomic_lock;
 /*
  * Locals
  */
-static LIST_HEAD(, gtimer) gtimers;
+static gtimer_t **gtimers;       ///< Binary min-heap on gti_expire
+static int gtimers_count;
+static int gtimers_size;
+static uint32_t gtimer_seq;
 static pthread_cond_t gtimer_cond;
 
+/* Statistics (protected by global_lock) */
+static uint64_t gtimer_arms;
+static uint64_t gtimer_arms_last;
+static int64_t  gtimer_stats_last;
+static uint64_t gtimer_fired;
+static int64_t  gtimer_latency_sum;
+static int64_t  gtimer_latency_max;
+
 static void
 handle_sigpipe(int x)
 {
@@ -210,7 +222,7 @@ get_user_groups (const struct passwd *pw, gid_t* glist, size_t gmax)
 /**
  *
  */
-static int
+static inline int
 gtimercmp(gtimer_t *a, gtimer_t *b)
 {
   if(a->gti_expire.tv_sec  < b->gti_expire.tv_sec)
@@ -221,7 +233,81 @@ gtimercmp(gtimer_t *a, gtimer_t *b)
     return -1;
   if(a->gti_expire.tv_nsec > b->gti_expire.tv_nsec)
     return 1;
- return 0;
+  /* Same expiry: the most recently armed timer runs first */
+  return (int32_t)(b->gti_seq - a->gti_seq);
+}
+
+/**
+ * Timer heap
+ */
+static inline void
+gtimer_heap_set(int slot, gtimer_t *gti)
+{
+  gtimers[slot] = gti;
+  gti->gti_slot = slot;
+}
+
+static void
+gtimer_heap_up(int slot)
+{
+  gtimer_t *gti = gtimers[slot];
+  int parent;
+
+  while (slot > 0) {
+    parent = (slot - 1) / 2;
+    if (gtimercmp(gti, gtimers[parent]) >= 0)
+      break;
+    gtimer_heap_set(slot, gtimers[parent]);
+    slot = parent;
+  }
+  gtimer_heap_set(slot, gti);
+}
+
+static void
+gtimer_heap_down(int slot)
+{
+  gtimer_t *gti = gtimers[slot];
+  int child;
+
+  while ((child = 2 * slot + 1) < gtimers_count) {
+    if (child + 1 < gtimers_count &&
+        gtimercmp(gtimers[child + 1], gtimers[child]) < 0)
+      child++;
+    if (gtimercmp(gtimers[child], gti) >= 0)
+      break;
+    gtimer_heap_set(slot, gtimers[child]);
+    slot = child;
+  }
+  gtimer_heap_set(slot, gti);
+}
+
+static void
+gtimer_heap_remove(gtimer_t *gti)
+{
+  int slot = gti->gti_slot;
+  gtimer_t *last;
+
+  assert(slot >= 0 && slot < gtimers_count && gtimers[slot] == gti);
+  last = gtimers[--gtimers_count];
+  if (last != gti) {
+    gtimer_heap_set(slot, last);
+    if (slot > 0 && gtimercmp(last, gtimers[(slot - 1) / 2]) < 0)
+      gtimer_heap_up(slot);
+    else
+      gtimer_heap_down(slot);
+  }
+}
+
+static void
+gtimer_heap_insert(gtimer_t *gti)
+{
+  if (gtimers_count == gtimers_size) {
+    gtimers_size = gtimers_size ? gtimers_size * 2 : 1024;
+    gtimers = realloc(gtimers, gtimers_size * sizeof(gtimer_t *));
+  }
+  gtimer_heap_set(gtimers_count, gti);
+  gtimers_count++;
+  gtimer_heap_up(gti->gti_slot);
 }
 
 /**
@@ -234,17 +320,19 @@ gtimer_arm_abs2
   lock_assert(&global_lock);
 
   if (gti->gti_callback != NULL)
-    LIST_REMOVE(gti, gti_link);
+    gtimer_heap_remove(gti);
 
   gti->gti_callback = callback;
   gti->gti_opaque   = opaque;
   gti->gti_expire   = *when;
+  gti->gti_seq      = ++gtimer_seq;
 
-  LIST_INSERT_SORTED(&gtimers, gti, gti_link, gtimercmp);
+  gtimer_heap_insert(gti);
+  gtimer_arms++;
 
   //tvhdebug("gtimer", "%p @ %ld.%09ld", gti, when->tv_sec, when->tv_nsec);
 
-  if (LIST_FIRST(&gtimers) == gti)
+  if (gti->gti_slot == 0)
     pthread_cond_signal(&gtimer_cond); // force timer re-check
 }
 
@@ -293,11 +381,38 @@ gtimer_disarm(gtimer_t *gti)
 {
   if(gti->gti_callback) {
     //tvhdebug("gtimer", "%p disarm", gti);
-    LIST_REMOVE(gti, gti_link);
+    gtimer_heap_remove(gti);
     gti->gti_callback = NULL;
   }
 }
 
+/**
+ * Timer statistics (arm rate and maximum latency since the previous call)
+ */
+htsmsg_t *
+gtimer_stats(void)
+{
+  htsmsg_t *m = htsmsg_create_map();
+  int64_t now = getmonoclock(), dt;
+
+  lock_assert(&global_lock);
+
+  htsmsg_add_u32(m, "count", gtimers_count);
+  htsmsg_add_s64(m, "arms", gtimer_arms);
+  htsmsg_add_s64(m, "fired", gtimer_fired);
+  dt = now - gtimer_stats_last;
+  if (gtimer_stats_last && dt > 0)
+    htsmsg_add_u32(m, "arms_per_sec",
+                   (gtimer_arms - gtimer_arms_last) * 1000000 / dt);
+  if (gtimer_fired)
+    htsmsg_add_s64(m, "latency_avg", gtimer_latency_sum / gtimer_fired);
+  htsmsg_add_s64(m, "latency_max", gtimer_latency_max);
+  gtimer_arms_last   = gtimer_arms;
+  gtimer_stats_last  = now;
+  gtimer_latency_max = 0;
+  return m;
+}
+
 /**
  * Show version info
  */
@@ -365,10 +480,12 @@ mainloop(void)
 {
   gtimer_t *gti;
   gti_callback_t *cb;
-  struct timespec ts;
+  struct timespec ts, now, wake, due, sleep = { 0, 0 };
+  int64_t latency;
 
   while(tvheadend_running) {
     clock_gettime(CLOCK_REALTIME, &ts);
+    wake = ts;
 
     /* 1sec stuff */
     if (ts.tv_sec > dispatch_clock) {
@@ -387,12 +504,14 @@ mainloop(void)
     
 #if 0
     tvhdebug("gtimer", "now %ld.%09ld", ts.tv_sec, ts.tv_nsec);
-    LIST_FOREACH(gti, &gtimers, gti_link)
+    for (i = 0; i < gtimers_count; i++)
       tvhdebug("gtimer", "  gti %p expire %ld.%08ld",
-               gti, gti->gti_expire.tv_sec, gti->gti_expire.tv_nsec);
+               gtimers[i], gtimers[i]->gti_expire.tv_sec,
+               gtimers[i]->gti_expire.tv_nsec);
 #endif
 
-    while((gti = LIST_FIRST(&gtimers)) != NULL) {
+    while(gtimers_count) {
+      gti = gtimers[0];
       
       if ((gti->gti_expire.tv_sec > ts.tv_sec) ||
           ((gti->gti_expire.tv_sec == ts.tv_sec) &&
@@ -404,20 +523,36 @@ mainloop(void)
       cb = gti->gti_callback;
       //tvhdebug("gtimer", "%p callback", gti);
 
-      LIST_REMOVE(gti, gti_link);
+      gtimer_heap_remove(gti);
       gti->gti_callback = NULL;
 
+      /* Latency (usec), timers armed in the past count from the wakeup */
+      clock_gettime(CLOCK_REALTIME, &now);
+      if (gti->gti_expire.tv_sec > sleep.tv_sec ||
+          (gti->gti_expire.tv_sec == sleep.tv_sec &&
+           gti->gti_expire.tv_nsec >= sleep.tv_nsec))
+        due = gti->gti_expire;
+      else
+        due = wake;
+      latency = (now.tv_sec - due.tv_sec) * 1000000LL +
+                (now.tv_nsec - due.tv_nsec) / 1000;
+      gtimer_fired++;
+      gtimer_latency_sum += latency;
+      if (latency > gtimer_latency_max)
+        gtimer_latency_max = latency;
+
       cb(gti->gti_opaque);
     }
 
     /* Bound wait */
-    if ((LIST_FIRST(&gtimers) == NULL) || (ts.tv_sec > (dispatch_clock + 1))) {
+    if (!gtimers_count || (ts.tv_sec > (dispatch_clock + 1))) {
       ts.tv_sec  = dispatch_clock + 1;
       ts.tv_nsec = 0;
     }
 
     /* Wait */
     //tvhdebug("gtimer", "wait till %ld.%09ld", ts.tv_sec, ts.tv_nsec);
+    clock_gettime(CLOCK_REALTIME, &sleep);
     pthread_cond_timedwait(&gtimer_cond, &global_lock, &ts);
     pthread_mutex_unlock(&global_lock);
   }
@@ -469,7 +604,12 @@ main(int argc, char **argv)
               opt_threadid     = 0,
               opt_ipv6         = 0,
               opt_tsfile_tuner = 0,
+              opt_tsfile_bench = 0,
               opt_dump         = 0,
+              opt_csa_bench    = 0,
+              opt_crc_bench    = 0,
+              opt_huff_bench   = 0,
+              opt_cset_bench   = 0,
               opt_xspf         = 0;
   const char *opt_config       = NULL,
              *opt_user         = NULL,
@@ -483,7 +623,9 @@ main(int argc, char **argv)
 #endif
              *opt_bindaddr     = NULL,
              *opt_subscribe    = NULL,
-             *opt_user_agent   = NULL;
+             *opt_user_agent   = NULL,
+             *opt_tsbench_mux  = NULL,
+             *opt_tsbench_out  = NULL;
   str_list_t  opt_satip_xml    = { .max = 10, .num = 0, .str = calloc(10, sizeof(char*)) };
   str_list_t  opt_tsfile       = { .max = 10, .num = 0, .str = calloc(10, sizeof(char*)) };
   cmdline_opt_t cmdline_opts[] = {
@@ -540,6 +682,16 @@ main(int argc, char **argv)
     {   0, "uidebug",   "Enable webUI debug (non-minified JS)", OPT_BOOL, &opt_uidebug },
     { 'A', "abort",     "Immediately abort",       OPT_BOOL, &opt_abort   },
     { 'D', "dump",      "Enable coredumps for daemon", OPT_BOOL, &opt_dump },
+    {   0, "csa_benchmark", "Benchmark the CSA descrambling kernels",
+      OPT_BOOL, &opt_csa_bench },
+    {   0, "crc_benchmark", "Benchmark the CRC32 implementations",
+      OPT_BOOL, &opt_crc_bench },
+    {   0, "huffman_benchmark", "Benchmark the EPG huffman decoders",
+      OPT_BOOL, &opt_huff_bench },
+#if ENABLE_MPEGTS
+    {   0, "charset_benchmark", "Benchmark the DVB text conversion",
+      OPT_BOOL, &opt_cset_bench },
+#endif
     {   0, "noacl",     "Disable all access control checks",
       OPT_BOOL, &opt_noacl },
     { 'j', "join",      "Subscribe to a service permanently",
@@ -549,6 +701,15 @@ main(int argc, char **argv)
     { 0, NULL, "TODO: testing", OPT_BOOL, NULL },
     { 0, "tsfile_tuners", "Number of tsfile tuners", OPT_INT, &opt_tsfile_tuner },
     { 0, "tsfile", "tsfile input (mux file)", OPT_STR_LIST, &opt_tsfile },
+#if ENABLE_TSFILE
+    { 0, "tsfile_benchmark", "Replay the tsfile inputs unthrottled N times,\n"
+                             "report the throughput and exit",
+      OPT_INT, &opt_tsfile_bench },
+    { 0, "tsfile_bench_mux", "Benchmark muxer (default matroska)",
+      OPT_STR, &opt_tsbench_mux },
+    { 0, "tsfile_bench_out", "Benchmark output directory (default discard)",
+      OPT_STR, &opt_tsbench_out },
+#endif
 
   };
 
@@ -767,6 +928,10 @@ main(int argc, char **argv)
    * Initialize subsystems
    */
 
+  tvh_crc32_init();
+  if (opt_crc_bench)
+    tvh_crc32_benchmark();
+
   intlconv_init();
   
   api_init();
@@ -786,6 +951,9 @@ main(int argc, char **argv)
   service_init();
 
 #if ENABLE_MPEGTS
+  dvb_init();
+  if (opt_cset_bench)
+    dvb_charset_benchmark();
   mpegts_init(adapter_mask, &opt_satip_xml, &opt_tsfile, opt_tsfile_tuner);
 #endif
 
@@ -809,10 +977,15 @@ main(int argc, char **argv)
   service_mapper_init();
 
   descrambler_init();
+  if (opt_csa_bench)
+    descrambler_benchmark();
 
   epggrab_init();
+  if (opt_huff_bench)
+    epggrab_huffman_benchmark();
   epg_init();
 
+  muxer_io_init();
   dvr_init();
 
   htsp_init(opt_bindaddr);
@@ -821,6 +994,11 @@ main(int argc, char **argv)
   if(opt_subscribe != NULL)
     subscription_dummy_join(opt_subscribe, 1);
 
+#if ENABLE_TSFILE
+  if(opt_tsfile_bench > 0 && opt_tsfile.num)
+    tsfile_benchmark(opt_tsfile_bench, opt_tsbench_mux, opt_tsbench_out);
+#endif
+
   avahi_init();
   bonjour_init();
 
@@ -881,6 +1059,7 @@ main(int argc, char **argv)
   tvhftrace("main", service_done);
   tvhftrace("main", channel_done);
   tvhftrace("main", dvr_done);
+  tvhftrace("main", muxer_io_done);
   tvhftrace("main", subscription_done);
   tvhftrace("main", access_done);
   tvhftrace("main", epg_done);
@@ -361,6 +361,21 @@ muxer_open_stream(muxer_t *m, int fd)
 }
 
 
+/**
+ * Open the muxer as a stream muxer writing into a callback
+ */
+int
+muxer_open_sink(muxer_t *m, muxer_sink_t *sink, void *opaque)
+{
+  if(!m || !sink)
+    return -1;
+
+  m->m_sink        = sink;
+  m->m_sink_opaque = opaque;
+  return m->m_open_stream(m, -1);
+}
+
+
 /**
  * sanity wrapper arround m_close()
  */
@@ -421,7 +436,8 @@ static struct strtab cache_types[] = {
   { "System",             MC_CACHE_SYSTEM },
   { "Do not keep",        MC_CACHE_DONTKEEP },
   { "Sync",               MC_CACHE_SYNC },
-  { "Sync + Do not keep", MC_CACHE_SYNCDONTKEEP }
+  { "Sync + Do not keep", MC_CACHE_SYNCDONTKEEP },
+  { "Direct I/O",         MC_CACHE_DIRECT }
 };
 
 const char*
@@ -448,6 +464,7 @@ muxer_cache_update(muxer_t *m, int fd, off_t pos, size_t size)
   switch (m->m_config.m_cache) {
   case MC_CACHE_UNKNOWN:
   case MC_CACHE_SYSTEM:
+  case MC_CACHE_DIRECT:
     break;
   case MC_CACHE_SYNC:
     fdatasync(fd);
@@ -42,7 +42,8 @@ typedef enum {
   MC_CACHE_DONTKEEP     = 2,
   MC_CACHE_SYNC         = 3,
   MC_CACHE_SYNCDONTKEEP = 4,
-  MC_CACHE_LAST         = MC_CACHE_SYNCDONTKEEP
+  MC_CACHE_DIRECT       = 5,
+  MC_CACHE_LAST         = MC_CACHE_DIRECT
 } muxer_cache_type_t;
 
 /* Muxer configuration used when creating a muxer. */
@@ -61,6 +62,9 @@ typedef struct muxer_config {
 
 struct muxer;
 struct streaming_start;
+
+/* Stream output callback, returns non-zero on failure */
+typedef int (muxer_sink_t)(void *opaque, const void *data, size_t len);
 struct th_pkt;
 struct epg_broadcast;
 struct service;
@@ -87,6 +91,8 @@ typedef struct muxer {
   int                    m_errors;     // Number of errors
   muxer_container_type_t m_container;  // The type of the container
   muxer_config_t         m_config;     // general configuration
+  muxer_sink_t          *m_sink;       // Stream output (instead of a socket)
+  void                  *m_sink_opaque;
 } muxer_t;
 
 
@@ -107,6 +113,7 @@ muxer_t *muxer_create(muxer_container_type_t mc, const muxer_config_t *m_cfg);
 // Wrapper functions
 int         muxer_open_file   (muxer_t *m, const char *filename);
 int         muxer_open_stream (muxer_t *m, int fd);
+int         muxer_open_sink   (muxer_t *m, muxer_sink_t *sink, void *opaque);
 int         muxer_init        (muxer_t *m, const struct streaming_start *ss, const char *name);
 int         muxer_reconfigure (muxer_t *m, const struct streaming_start *ss);
 int         muxer_add_marker  (muxer_t *m);
@@ -0,0 +1,581 @@
+/*
+ *  tvheadend, write-behind file output for the muxers
+ *  Copyright (C) 2014 Tvheadend
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Recordings are written from the dvr thread into aligned blocks, full
+ * blocks are queued to a small pool of I/O threads which write them in
+ * order with pwrite(). The dvr thread only waits when a file has more
+ * than MUXER_IO_QUEUE bytes outstanding. The sync cache modes call
+ * fdatasync() on a time / size interval instead of after every write and
+ * the "do not keep" modes drop the completed ranges from the page cache.
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "tvheadend.h"
+#include "muxer_io.h"
+
+#if defined(PLATFORM_DARWIN)
+#define fdatasync(fd)       fcntl(fd, F_FULLFSYNC)
+#endif
+
+#define MUXER_IO_THREADS    2
+#define MUXER_IO_ALIGN      4096
+#define MUXER_IO_BLOCK      (1024 * 1024)
+#define MUXER_IO_QUEUE      (8 * MUXER_IO_BLOCK)  ///< Outstanding per file
+#define MUXER_IO_FREE       2                     ///< Spare blocks per file
+#define MUXER_IO_HOLD       1000000               ///< Partial block age (us)
+#define MUXER_IO_SYNC_TIME  2000000               ///< fdatasync interval (us)
+#define MUXER_IO_SYNC_SIZE  (16 * MUXER_IO_BLOCK)
+
+typedef struct muxer_io_block {
+  TAILQ_ENTRY(muxer_io_block) mb_link;
+  off_t    mb_off;     ///< File position
+  size_t   mb_len;
+  size_t   mb_cap;     ///< Ends on an aligned file position
+  int64_t  mb_time;    ///< Started filling
+  uint8_t *mb_data;
+} muxer_io_block_t;
+
+TAILQ_HEAD(muxer_io_block_queue, muxer_io_block);
+
+struct muxer_io {
+  LIST_ENTRY(muxer_io)        mi_link;      ///< All open files
+  TAILQ_ENTRY(muxer_io)       mi_work_link; ///< Waiting for a thread
+  int                         mi_work;      ///< Queued or being written
+  pthread_cond_t              mi_cond;
+
+  int                         mi_fd;
+  char                       *mi_filename;
+  muxer_cache_type_t          mi_cache;
+
+  muxer_io_block_t           *mi_cur;       ///< Being filled by the muxer
+  struct muxer_io_block_queue mi_queue;     ///< Full blocks
+  struct muxer_io_block_queue mi_free;
+  int                         mi_nfree;
+  size_t                      mi_queued;    ///< Bytes not yet written
+  int                         mi_error;
+
+  /* Owned by the writing thread */
+  int                         mi_direct;    ///< O_DIRECT set on mi_fd
+  int                         mi_nodirect;  ///< Not supported here
+  int64_t                     mi_sync_time;
+  size_t                      mi_unsynced;
+  off_t                       mi_dirty_lo;
+  off_t                       mi_dirty_hi;
+
+  /* Statistics */
+  size_t                      mi_queued_max;
+  uint64_t                    mi_bytes;
+  uint32_t                    mi_writes;
+  int64_t                     mi_write_time;
+  int64_t                     mi_write_max;
+  uint32_t                    mi_syncs;
+  int64_t                     mi_sync_total;
+  int64_t                     mi_sync_max;
+  uint32_t                    mi_stalls;
+  int64_t                     mi_stall_time;
+};
+
+static pthread_mutex_t       muxer_io_mutex;
+static pthread_cond_t        muxer_io_cond;
+static TAILQ_HEAD(,muxer_io) muxer_io_work;
+static LIST_HEAD(,muxer_io)  muxer_io_all;
+static pthread_t             muxer_io_tid[MUXER_IO_THREADS];
+static int                   muxer_io_running;
+
+/**
+ *
+ */
+static int64_t
+muxer_io_clock(void)
+{
+  struct timespec tp;
+
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+  return tp.tv_sec * 1000000LL + tp.tv_nsec / 1000;
+}
+
+
+/**
+ * Get an empty block for file position off, muxer_io_mutex held
+ */
+static muxer_io_block_t *
+muxer_io_block_get(muxer_io_t *mi, off_t off)
+{
+  muxer_io_block_t *mb;
+  void *p;
+
+  if ((mb = TAILQ_FIRST(&mi->mi_free)) != NULL) {
+    TAILQ_REMOVE(&mi->mi_free, mb, mb_link);
+    mi->mi_nfree--;
+  } else {
+    if (posix_memalign(&p, MUXER_IO_ALIGN, MUXER_IO_BLOCK))
+      return NULL;
+    mb = calloc(1, sizeof(muxer_io_block_t));
+    mb->mb_data = p;
+  }
+  mb->mb_off  = off;
+  mb->mb_len  = 0;
+  mb->mb_cap  = MUXER_IO_BLOCK - (off & (MUXER_IO_ALIGN - 1));
+  mb->mb_time = getmonoclock();
+  return mb;
+}
+
+
+/**
+ * Return a written block, muxer_io_mutex held
+ */
+static void
+muxer_io_block_put(muxer_io_t *mi, muxer_io_block_t *mb)
+{
+  if (mi->mi_nfree < MUXER_IO_FREE) {
+    TAILQ_INSERT_HEAD(&mi->mi_free, mb, mb_link);
+    mi->mi_nfree++;
+  } else {
+    free(mb->mb_data);
+    free(mb);
+  }
+}
+
+
+/**
+ * Write a block, O_DIRECT is used for the aligned ones in direct mode
+ */
+static int
+muxer_io_pwrite(muxer_io_t *mi, muxer_io_block_t *mb)
+{
+  const uint8_t *p = mb->mb_data;
+  size_t len = mb->mb_len;
+  off_t off = mb->mb_off;
+  ssize_t r;
+
+#ifdef O_DIRECT
+  if (mi->mi_cache == MC_CACHE_DIRECT && !mi->mi_nodirect) {
+    int fl, direct = !(off & (MUXER_IO_ALIGN - 1)) &&
+                     !(len & (MUXER_IO_ALIGN - 1));
+    if (direct != mi->mi_direct) {
+      fl = fcntl(mi->mi_fd, F_GETFL);
+      if (fl != -1 &&
+          !fcntl(mi->mi_fd, F_SETFL, direct ? fl | O_DIRECT : fl & ~O_DIRECT))
+        mi->mi_direct = direct;
+      else if (direct)
+        mi->mi_nodirect = 1;
+    }
+  }
+#endif
+
+  while (len) {
+    r = pwrite(mi->mi_fd, p, len, off);
+    if (r < 0) {
+      if (errno == EINTR)
+        continue;
+#ifdef O_DIRECT
+      /* Filesystem does not do direct I/O */
+      if (errno == EINVAL && mi->mi_direct) {
+        int fl = fcntl(mi->mi_fd, F_GETFL);
+        if (fl != -1 && !fcntl(mi->mi_fd, F_SETFL, fl & ~O_DIRECT)) {
+          tvhwarn("muxer", "%s: direct I/O failed, using the page cache",
+                  mi->mi_filename);
+          mi->mi_direct = 0;
+          mi->mi_nodirect = 1;
+          continue;
+        }
+      }
+#endif
+      return errno;
+    }
+    p   += r;
+    off += r;
+    len -= r;
+  }
+  return 0;
+}
+
+
+/**
+ * Apply the cache scheme to what has been written so far, returns the
+ * fdatasync() time or -1 if none was done
+ */
+static int64_t
+muxer_io_flush(muxer_io_t *mi, int force)
+{
+  int64_t t = -1, now;
+
+  if (mi->mi_dirty_hi <= mi->mi_dirty_lo)
+    return -1;
+
+  switch (mi->mi_cache) {
+  case MC_CACHE_SYNC:
+  case MC_CACHE_SYNCDONTKEEP:
+  case MC_CACHE_DIRECT:
+    now = muxer_io_clock();
+    if (!force && mi->mi_unsynced < MUXER_IO_SYNC_SIZE &&
+        now - mi->mi_sync_time < MUXER_IO_SYNC_TIME)
+      return -1;
+    fdatasync(mi->mi_fd);
+    mi->mi_sync_time = muxer_io_clock();
+    t = mi->mi_sync_time - now;
+    break;
+  default:
+    break;
+  }
+
+#if !defined(PLATFORM_DARWIN)
+  if (mi->mi_cache == MC_CACHE_DONTKEEP ||
+      mi->mi_cache == MC_CACHE_SYNCDONTKEEP)
+    posix_fadvise(mi->mi_fd, mi->mi_dirty_lo,
+                  mi->mi_dirty_hi - mi->mi_dirty_lo, POSIX_FADV_DONTNEED);
+#endif
+
+  mi->mi_unsynced = 0;
+  mi->mi_dirty_lo = mi->mi_dirty_hi = 0;
+  return t;
+}
+
+
+/**
+ * Write out the queued blocks, muxer_io_mutex held (and dropped while
+ * writing)
+ */
+static void
+muxer_io_process(muxer_io_t *mi)
+{
+  muxer_io_block_t *mb;
+  int64_t t, s;
+  int err;
+
+  while ((mb = TAILQ_FIRST(&mi->mi_queue)) != NULL) {
+    TAILQ_REMOVE(&mi->mi_queue, mb, mb_link);
+    err = mi->mi_error;
+    pthread_mutex_unlock(&muxer_io_mutex);
+
+    s = -1;
+    t = muxer_io_clock();
+    if (!err && !(err = muxer_io_pwrite(mi, mb))) {
+      t = muxer_io_clock() - t;
+      if (mi->mi_dirty_hi <= mi->mi_dirty_lo) {
+        mi->mi_dirty_lo = mb->mb_off;
+        mi->mi_dirty_hi = mb->mb_off + mb->mb_len;
+      } else {
+        mi->mi_dirty_lo = MIN(mi->mi_dirty_lo, mb->mb_off);
+        mi->mi_dirty_hi = MAX(mi->mi_dirty_hi, mb->mb_off + mb->mb_len);
+      }
+      mi->mi_unsynced += mb->mb_len;
+      s = muxer_io_flush(mi, 0);
+    }
+
+    pthread_mutex_lock(&muxer_io_mutex);
+    if (err) {
+      if (!mi->mi_error)
+        tvherror("muxer", "%s: Write failed -- %s",
+                 mi->mi_filename, strerror(err));
+      mi->mi_error = err;
+    } else {
+      mi->mi_bytes += mb->mb_len;
+      mi->mi_writes++;
+      mi->mi_write_time += t;
+      mi->mi_write_max   = MAX(mi->mi_write_max, t);
+      if (s >= 0) {
+        mi->mi_syncs++;
+        mi->mi_sync_total += s;
+        mi->mi_sync_max    = MAX(mi->mi_sync_max, s);
+      }
+    }
+    mi->mi_queued -= mb->mb_len;
+    muxer_io_block_put(mi, mb);
+    pthread_cond_signal(&mi->mi_cond);
+  }
+}
+
+
+/**
+ *
+ */
+static void *
+muxer_io_thread(void *aux)
+{
+  muxer_io_t *mi;
+
+  pthread_mutex_lock(&muxer_io_mutex);
+  while (muxer_io_running || TAILQ_FIRST(&muxer_io_work)) {
+    if ((mi = TAILQ_FIRST(&muxer_io_work)) == NULL) {
+      pthread_cond_wait(&muxer_io_cond, &muxer_io_mutex);
+      continue;
+    }
+    TAILQ_REMOVE(&muxer_io_work, mi, mi_work_link);
+    muxer_io_process(mi);
+    mi->mi_work = 0;
+    pthread_cond_signal(&mi->mi_cond);
+  }
+  pthread_mutex_unlock(&muxer_io_mutex);
+  return NULL;
+}
+
+
+/**
+ * Queue the current block and wait while too much is outstanding
+ */
+static int
+muxer_io_submit(muxer_io_t *mi)
+{
+  muxer_io_block_t *mb = mi->mi_cur;
+  int64_t t;
+  int err;
+
+  mi->mi_cur = NULL;
+  pthread_mutex_lock(&muxer_io_mutex);
+
+  if (mb && mb->mb_len && !mi->mi_error) {
+    TAILQ_INSERT_TAIL(&mi->mi_queue, mb, mb_link);
+    mi->mi_queued    += mb->mb_len;
+    mi->mi_queued_max = MAX(mi->mi_queued_max, mi->mi_queued);
+    if (!mi->mi_work) {
+      mi->mi_work = 1;
+      if (muxer_io_running) {
+        TAILQ_INSERT_TAIL(&muxer_io_work, mi, mi_work_link);
+        pthread_cond_signal(&muxer_io_cond);
+      } else {
+        muxer_io_process(mi);
+        mi->mi_work = 0;
+      }
+    }
+  } else if (mb) {
+    muxer_io_block_put(mi, mb);
+  }
+
+  if (mi->mi_queued > MUXER_IO_QUEUE && !mi->mi_error) {
+    t = muxer_io_clock();
+    while (mi->mi_queued > MUXER_IO_QUEUE && !mi->mi_error)
+      pthread_cond_wait(&mi->mi_cond, &muxer_io_mutex);
+    mi->mi_stalls++;
+    mi->mi_stall_time += muxer_io_clock() - t;
+  }
+
+  err = mi->mi_error;
+  pthread_mutex_unlock(&muxer_io_mutex);
+  return err;
+}
+
+
+/**
+ * Create the file
+ */
+muxer_io_t *
+muxer_io_open(const char *filename, int permissions, muxer_cache_type_t cache)
+{
+  muxer_io_t *mi;
+  int fd;
+
+  fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, permissions);
+  if (fd < 0)
+    return NULL;
+
+#if defined(PLATFORM_DARWIN)
+  if (cache == MC_CACHE_DONTKEEP || cache == MC_CACHE_SYNCDONTKEEP ||
+      cache == MC_CACHE_DIRECT)
+    fcntl(fd, F_NOCACHE, 1);
+#endif
+
+  mi = calloc(1, sizeof(muxer_io_t));
+  mi->mi_fd        = fd;
+  mi->mi_filename  = strdup(filename);
+  mi->mi_cache     = cache;
+  mi->mi_sync_time = muxer_io_clock();
+  pthread_cond_init(&mi->mi_cond, NULL);
+  TAILQ_INIT(&mi->mi_queue);
+  TAILQ_INIT(&mi->mi_free);
+
+  pthread_mutex_lock(&muxer_io_mutex);
+  LIST_INSERT_HEAD(&muxer_io_all, mi, mi_link);
+  pthread_mutex_unlock(&muxer_io_mutex);
+
+  return mi;
+}
+
+
+/**
+ * Write at file position off, returns -1 with errno set on failure
+ */
+int
+muxer_io_write(muxer_io_t *mi, const void *data, size_t len, off_t off)
+{
+  muxer_io_block_t *mb;
+  size_t n;
+  int err;
+
+  while (len) {
+    mb = mi->mi_cur;
+    if (mb && (mb->mb_off + mb->mb_len != off || mb->mb_len == mb->mb_cap)) {
+      if ((err = muxer_io_submit(mi)) != 0) {
+        errno = err;
+        return -1;
+      }
+      mb = NULL;
+    }
+    if (!mb) {
+      pthread_mutex_lock(&muxer_io_mutex);
+      mb = mi->mi_cur = muxer_io_block_get(mi, off);
+      pthread_mutex_unlock(&muxer_io_mutex);
+      if (!mb) {
+        errno = ENOMEM;
+        return -1;
+      }
+    }
+    n = MIN(len, mb->mb_cap - mb->mb_len);
+    memcpy(mb->mb_data + mb->mb_len, data, n);
+    mb->mb_len += n;
+    data       += n;
+    off        += n;
+    len        -= n;
+  }
+
+  /* Slow streams should not sit in memory */
+  if (mi->mi_cur && getmonoclock() - mi->mi_cur->mb_time > MUXER_IO_HOLD &&
+      (err = muxer_io_submit(mi)) != 0) {
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
+
+
+/**
+ * Write everything out and close the file
+ */
+int
+muxer_io_close(muxer_io_t *mi)
+{
+  muxer_io_block_t *mb;
+  int err;
+
+  muxer_io_submit(mi);
+
+  pthread_mutex_lock(&muxer_io_mutex);
+  while (mi->mi_work)
+    pthread_cond_wait(&mi->mi_cond, &muxer_io_mutex);
+  LIST_REMOVE(mi, mi_link);
+  pthread_mutex_unlock(&muxer_io_mutex);
+
+  if (!mi->mi_error && muxer_io_flush(mi, 1) >= 0)
+    mi->mi_syncs++;
+  err = mi->mi_error;
+  if (close(mi->mi_fd) && !err)
+    err = errno;
+
+  tvhdebug("muxer", "%s: %"PRIu64" bytes in %u writes (avg %"PRId64"us max %"
+           PRId64"us), %u syncs (max %"PRId64"us), queue max %zu, "
+           "%u stalls %"PRId64"ms", mi->mi_filename, mi->mi_bytes,
+           mi->mi_writes, mi->mi_writes ? mi->mi_write_time / mi->mi_writes : 0,
+           mi->mi_write_max, mi->mi_syncs, mi->mi_sync_max,
+           mi->mi_queued_max, mi->mi_stalls, mi->mi_stall_time / 1000);
+
+  while ((mb = TAILQ_FIRST(&mi->mi_free)) != NULL) {
+    TAILQ_REMOVE(&mi->mi_free, mb, mb_link);
+    free(mb->mb_data);
+    free(mb);
+  }
+  pthread_cond_destroy(&mi->mi_cond);
+  free(mi->mi_filename);
+  free(mi);
+
+  errno = err;
+  return err ? -1 : 0;
+}
+
+
+/**
+ * Queue depth, write latency and stall time of the open files
+ */
+htsmsg_t *
+muxer_io_stats(void)
+{
+  muxer_io_t *mi;
+  htsmsg_t *l, *e, *m;
+  int c = 0;
+
+  l = htsmsg_create_list();
+  pthread_mutex_lock(&muxer_io_mutex);
+  LIST_FOREACH(mi, &muxer_io_all, mi_link) {
+    e = htsmsg_create_map();
+    htsmsg_add_str(e, "filename", mi->mi_filename);
+    htsmsg_add_str(e, "cache", muxer_cache_type2txt(mi->mi_cache));
+    htsmsg_add_s64(e, "queued", mi->mi_queued);
+    htsmsg_add_s64(e, "queuedmax", mi->mi_queued_max);
+    htsmsg_add_s64(e, "bytes", mi->mi_bytes);
+    htsmsg_add_u32(e, "writes", mi->mi_writes);
+    htsmsg_add_s64(e, "writeavg",
+                   mi->mi_writes ? mi->mi_write_time / mi->mi_writes : 0);
+    htsmsg_add_s64(e, "writemax", mi->mi_write_max);
+    htsmsg_add_u32(e, "syncs", mi->mi_syncs);
+    htsmsg_add_s64(e, "syncavg",
+                   mi->mi_syncs ? mi->mi_sync_total / mi->mi_syncs : 0);
+    htsmsg_add_s64(e, "syncmax", mi->mi_sync_max);
+    htsmsg_add_u32(e, "stalls", mi->mi_stalls);
+    htsmsg_add_s64(e, "stalltime", mi->mi_stall_time);
+    htsmsg_add_u32(e, "error", mi->mi_error);
+    htsmsg_add_msg(l, NULL, e);
+    c++;
+  }
+  pthread_mutex_unlock(&muxer_io_mutex);
+
+  m = htsmsg_create_map();
+  htsmsg_add_msg(m, "entries", l);
+  htsmsg_add_u32(m, "totalCount", c);
+  return m;
+}
+
+
+/**
+ *
+ */
+void
+muxer_io_init(void)
+{
+  int i;
+
+  pthread_mutex_init(&muxer_io_mutex, NULL);
+  pthread_cond_init(&muxer_io_cond, NULL);
+  TAILQ_INIT(&muxer_io_work);
+  LIST_INIT(&muxer_io_all);
+  muxer_io_running = 1;
+  for (i = 0; i < MUXER_IO_THREADS; i++)
+    tvhthread_create(&muxer_io_tid[i], NULL, muxer_io_thread, NULL);
+}
+
+
+/**
+ *
+ */
+void
+muxer_io_done(void)
+{
+  int i;
+
+  pthread_mutex_lock(&muxer_io_mutex);
+  muxer_io_running = 0;
+  pthread_cond_broadcast(&muxer_io_cond);
+  pthread_mutex_unlock(&muxer_io_mutex);
+  for (i = 0; i < MUXER_IO_THREADS; i++)
+    pthread_join(muxer_io_tid[i], NULL);
+}
@@ -0,0 +1,37 @@
+/*
+ *  tvheadend, write-behind file output for the muxers
+ *  Copyright (C) 2014 Tvheadend
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MUXER_IO_H_
+#define MUXER_IO_H_
+
+#include "muxer.h"
+
+typedef struct muxer_io muxer_io_t;
+
+void        muxer_io_init  (void);
+void        muxer_io_done  (void);
+
+muxer_io_t *muxer_io_open  (const char *filename, int permissions,
+                            muxer_cache_type_t cache);
+int         muxer_io_write (muxer_io_t *mi, const void *data, size_t len,
+                            off_t off);
+int         muxer_io_close (muxer_io_t *mi);
+
+htsmsg_t   *muxer_io_stats (void);
+
+#endif
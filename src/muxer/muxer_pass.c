@@ -27,6 +27,7 @@
 #include "service.h"
 #include "input/mpegts/dvb.h"
 #include "muxer_pass.h"
+#include "muxer_io.h"
 #include "dvr/dvr.h"
 
 typedef struct pass_muxer {
@@ -37,6 +38,7 @@ typedef struct pass_muxer {
   int   pm_fd;
   int   pm_seekable;
   int   pm_error;
+  muxer_io_t *pm_io;
 
   /* Filename is also used for logging */
   char *pm_filename;
@@ -370,14 +372,15 @@ pass_muxer_open_stream(muxer_t *m, int fd)
 static int
 pass_muxer_open_file(muxer_t *m, const char *filename)
 {
-  int fd;
+  muxer_io_t *io;
   pass_muxer_t *pm = (pass_muxer_t*)m;
 
   tvhtrace("pass", "Creating file \"%s\" with file permissions \"%o\"", filename, pm->m_config.m_file_permissions);
  
-  fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, pm->m_config.m_file_permissions);
+  io = muxer_io_open(filename, pm->m_config.m_file_permissions,
+                     pm->m_config.m_cache);
 
-  if(fd < 0) {
+  if(!io) {
     pm->pm_error = errno;
     tvhlog(LOG_ERR, "pass", "%s: Unable to create file, open failed -- %s",
 	   filename, strerror(errno));
@@ -387,7 +390,7 @@ pass_muxer_open_file(muxer_t *m, const char *filename)
 
   pm->pm_off      = 0;
   pm->pm_seekable = 1;
-  pm->pm_fd       = fd;
+  pm->pm_io       = io;
   pm->pm_filename = strdup(filename);
   return 0;
 }
@@ -403,6 +406,22 @@ pass_muxer_write(muxer_t *m, const void *data, size_t size)
 
   if(pm->pm_error) {
     pm->m_errors++;
+  } else if(m->m_sink) {
+    if(m->m_sink(m->m_sink_opaque, data, size)) {
+      pm->pm_error = ENOMEM;
+      m->m_errors++;
+    } else {
+      pm->pm_off += size;
+    }
+  } else if(pm->pm_io) {
+    if(muxer_io_write(pm->pm_io, data, size, pm->pm_off)) {
+      pm->pm_error = errno;
+      tvhlog(LOG_ERR, "pass", "%s: Write failed -- %s", pm->pm_filename,
+             strerror(errno));
+      m->m_errors++;
+    } else {
+      pm->pm_off += size;
+    }
   } else if(tvh_write(pm->pm_fd, data, size)) {
     pm->pm_error = errno;
     if (!MC_IS_EOS_ERROR(errno))
@@ -528,8 +547,10 @@ static int
 pass_muxer_close(muxer_t *m)
 {
   pass_muxer_t *pm = (pass_muxer_t*)m;
+  muxer_io_t *io = pm->pm_io;
 
-  if(pm->pm_seekable && close(pm->pm_fd)) {
+  pm->pm_io = NULL;
+  if(io && muxer_io_close(io) && !pm->pm_error) {
     pm->pm_error = errno;
     tvhlog(LOG_ERR, "pass", "%s: Unable to close file, close failed -- %s",
 	   pm->pm_filename, strerror(errno));
@@ -30,6 +30,7 @@
 #include "tvheadend.h"
 #include "streaming.h"
 #include "dvr/dvr.h"
+#include "muxer/muxer_io.h"
 #include "mkmux.h"
 #include "ebml.h"
 
@@ -81,12 +82,49 @@ typedef struct mk_chapter {
   int64_t ts;
 } mk_chapter_t;
 
+/**
+ * A piece of a cluster, either arena data or a referenced frame payload
+ */
+typedef struct mk_cpart {
+  pktbuf_t *pb; // NULL for arena data
+  size_t off;
+  size_t len;
+} mk_cpart_t;
+
+/**
+ * Cluster under construction. Frame payloads are held by reference until
+ * the cluster is flushed, the EBML element headers go into a small arena.
+ * The buffers are kept across clusters.
+ */
+typedef struct mk_cluster {
+  int active;
+  size_t size; // Cluster payload size
+
+  mk_cpart_t *parts;
+  int nparts;
+  int aparts;
+
+  uint8_t *arena;
+  size_t arena_len;
+  size_t arena_size;
+
+  struct iovec *iov;
+  int aiov;
+
+  int frames;
+  int refs;
+  int allocs; // Allocations done while building this cluster
+} mk_cluster_t;
+
+#define MK_CLUSTER_COPY_MAX 64 // Smaller payloads are copied to the arena
+
 /**
  *
  */
 struct mk_mux {
   muxer_t *m;
   int fd;
+  muxer_io_t *io;
   char *filename;
   int error;
   off_t fdpos; // Current position in file
@@ -98,7 +136,7 @@ struct mk_mux {
 
   int64_t totduration;
 
-  htsbuf_queue_t *cluster;
+  mk_cluster_t cluster;
   int64_t cluster_tc;
   off_t cluster_pos;
   int cluster_maxsize;
@@ -421,6 +459,58 @@ mk_build_tracks(mk_mux_t *mkm, const streaming_start_t *ss)
 }
 
 
+/**
+ * Write an io vector at the current position, the vector is consumed
+ */
+static int
+mk_write_iov(mk_mux_t *mkm, struct iovec *iov, int i)
+{
+  off_t oldpos = mkm->fdpos;
+  muxer_t *m = mkm->m;
+  ssize_t r;
+
+  if(m->m_sink) {
+    for(; i > 0; i--, iov++) {
+      if(m->m_sink(m->m_sink_opaque, iov->iov_base, iov->iov_len)) {
+        mkm->error = ENOMEM;
+        return -1;
+      }
+      mkm->fdpos += iov->iov_len;
+    }
+    return 0;
+  }
+
+  if(mkm->io) {
+    for(; i > 0; i--, iov++) {
+      if(muxer_io_write(mkm->io, iov->iov_base, iov->iov_len, mkm->fdpos)) {
+        mkm->error = errno;
+        return -1;
+      }
+      mkm->fdpos += iov->iov_len;
+    }
+    return 0;
+  }
+
+  while(i > 0) {
+    if((r = writev(mkm->fd, iov, i < dvr_iov_max ? i : dvr_iov_max)) == -1) {
+      mkm->error = errno;
+      return -1;
+    }
+    mkm->fdpos += r;
+    for(; i > 0 && r >= iov->iov_len; i--, iov++)
+      r -= iov->iov_len;
+    if(r) {
+      iov->iov_base  = (uint8_t *)iov->iov_base + r;
+      iov->iov_len  -= r;
+    }
+  }
+
+  muxer_cache_update(mkm->m, mkm->fd, oldpos, 0);
+
+  return 0;
+}
+
+
 /**
  *
  */
@@ -428,13 +518,13 @@ static int
 mk_write_to_fd(mk_mux_t *mkm, htsbuf_queue_t *hq)
 {
   htsbuf_data_t *hd;
+  struct iovec *iov;
   int i = 0;
-  off_t oldpos = mkm->fdpos;
 
   TAILQ_FOREACH(hd, &hq->hq_q, hd_link)
     i++;
 
-  struct iovec *iov = alloca(sizeof(struct iovec) * i);
+  iov = alloca(sizeof(struct iovec) * i);
 
   i = 0;
   TAILQ_FOREACH(hd, &hq->hq_q, hd_link) {
@@ -442,21 +532,7 @@ mk_write_to_fd(mk_mux_t *mkm, htsbuf_queue_t *hq)
     iov[i++].iov_len  = hd->hd_data_len - hd->hd_data_off;
   }
 
-  do {
-    ssize_t r;
-    int iovcnt = i < dvr_iov_max ? i : dvr_iov_max;
-    if((r = writev(mkm->fd, iov, iovcnt)) == -1) {
-      mkm->error = errno;
-      return -1;
-    }
-    mkm->fdpos += r;
-    i -= iovcnt;
-    iov += iovcnt;
-  } while(i);
-
-  muxer_cache_update(mkm->m, mkm->fd, oldpos, 0);
-
-  return 0;
+  return mk_write_iov(mkm, iov, i);
 }
 
 
@@ -797,14 +873,8 @@ mk_write_metaseek(mk_mux_t *mkm, int first)
   } else if(mkm->seekable) {
     off_t prev = mkm->fdpos;
     mkm->fdpos = mkm->segment_pos;
-    if(lseek(mkm->fd, mkm->segment_pos, SEEK_SET) == (off_t) -1)
-      mkm->error = errno;
-
     mk_write_queue(mkm, &q);
     mkm->fdpos = prev;
-    if(lseek(mkm->fd, mkm->fdpos, SEEK_SET) == (off_t) -1)
-      mkm->error = errno;
-   
   }
   htsbuf_queue_flush(&q);
 }
@@ -879,15 +949,146 @@ mk_add_chapter(mk_mux_t *mkm, int64_t ts)
   TAILQ_INSERT_TAIL(&mkm->chapters, ch, link);
 }
 
+/**
+ *
+ */
+static mk_cpart_t *
+mk_cluster_part(mk_cluster_t *c)
+{
+  if(c->nparts >= c->aparts) {
+    c->aparts = c->aparts ? c->aparts * 2 : 64;
+    c->parts = realloc(c->parts, c->aparts * sizeof(mk_cpart_t));
+    c->allocs++;
+  }
+  return &c->parts[c->nparts++];
+}
+
+
+/**
+ * Copy data to the arena, extending the last part when possible
+ */
+static void
+mk_cluster_append(mk_cluster_t *c, const void *data, size_t len)
+{
+  mk_cpart_t *p = c->nparts ? &c->parts[c->nparts - 1] : NULL;
+
+  if(c->arena_len + len > c->arena_size) {
+    c->arena_size = MAX(c->arena_size * 2, MAX(c->arena_len + len, 4096));
+    c->arena = realloc(c->arena, c->arena_size);
+    c->allocs++;
+  }
+
+  if(p == NULL || p->pb || p->off + p->len != c->arena_len) {
+    p = mk_cluster_part(c);
+    p->pb  = NULL;
+    p->off = c->arena_len;
+    p->len = 0;
+  }
+
+  memcpy(c->arena + c->arena_len, data, len);
+  c->arena_len += len;
+  p->len += len;
+  c->size += len;
+}
+
+
+/**
+ * Reference a frame payload, tiny ones are cheaper to copy
+ */
+static void
+mk_cluster_ref(mk_cluster_t *c, pktbuf_t *pb, size_t off, size_t len)
+{
+  mk_cpart_t *p;
+
+  if(len <= MK_CLUSTER_COPY_MAX) {
+    mk_cluster_append(c, pktbuf_ptr(pb) + off, len);
+    return;
+  }
+
+  pktbuf_ref_inc(pb);
+  p = mk_cluster_part(c);
+  p->pb  = pb;
+  p->off = off;
+  p->len = len;
+  c->size += len;
+  c->refs++;
+}
+
+
+/**
+ * Drop the payload references, the buffers are kept
+ */
+static void
+mk_cluster_reset(mk_cluster_t *c)
+{
+  int i;
+
+  for(i = 0; i < c->nparts; i++)
+    if(c->parts[i].pb)
+      pktbuf_ref_dec(c->parts[i].pb);
+
+  c->active    = 0;
+  c->size      = 0;
+  c->nparts    = 0;
+  c->arena_len = 0;
+  c->frames    = 0;
+  c->refs      = 0;
+  c->allocs    = 0;
+}
+
+
 /**
  *
  */
 static void
+mk_cluster_free(mk_cluster_t *c)
+{
+  mk_cluster_reset(c);
+  free(c->parts);
+  free(c->arena);
+  free(c->iov);
+  memset(c, 0, sizeof(*c));
+}
+
+
+/**
+ * Write the cluster with a single io vector
+ */
+static void
 mk_close_cluster(mk_mux_t *mkm)
 {
-  if(mkm->cluster != NULL)
-    mk_write_master(mkm, 0x1f43b675, mkm->cluster);
-  mkm->cluster = NULL;
+  mk_cluster_t *c = &mkm->cluster;
+  mk_cpart_t *p;
+  uint8_t hdr[9];
+  int i;
+
+  if(!c->active)
+    return;
+
+  if(c->aiov < c->nparts + 1) {
+    c->aiov = c->aparts + 1;
+    c->iov = realloc(c->iov, c->aiov * sizeof(struct iovec));
+    c->allocs++;
+  }
+
+  c->iov[0].iov_base = hdr;
+  c->iov[0].iov_len  = ebml_put_id(hdr, 0x1f43b675);
+  c->iov[0].iov_len += ebml_put_size(hdr + c->iov[0].iov_len, c->size);
+
+  for(i = 0, p = c->parts; i < c->nparts; i++, p++) {
+    c->iov[i + 1].iov_base = (p->pb ? pktbuf_ptr(p->pb) : c->arena) + p->off;
+    c->iov[i + 1].iov_len  = p->len;
+  }
+
+  tvhtrace("mkv", "%s: cluster %zu bytes, %d frames, %d refs, %d allocs",
+           mkm->filename, c->size, c->frames, c->refs, c->allocs);
+
+  if(!mkm->error && mk_write_iov(mkm, c->iov, c->nparts + 1) &&
+     !MC_IS_EOS_ERROR(mkm->error))
+    tvhlog(LOG_ERR, "mkv", "%s: Write failed -- %s", mkm->filename, 
+	   strerror(errno));
+
+  mk_cluster_reset(c);
 }
 
 
@@ -897,8 +1098,10 @@ mk_close_cluster(mk_mux_t *mkm)
 static void
 mk_write_frame_i(mk_mux_t *mkm, mk_track_t *t, th_pkt_t *pkt)
 {
+  mk_cluster_t *c = &mkm->cluster;
   int64_t pts = pkt->pkt_pts, delta, nxt;
-  unsigned char c_delta_flags[3];
+  uint8_t hdr[16];
+  int n;
 
   int keyframe  = pkt->pkt_frametype < PKT_P_FRAME;
   int skippable = pkt->pkt_frametype == PKT_B_FRAME;
@@ -935,23 +1138,23 @@ mk_write_frame_i(mk_mux_t *mkm, mk_track_t *t, th_pkt_t *pkt)
     return;
   }
 
-  if(vkeyframe && mkm->cluster && mkm->cluster->hq_size > mkm->cluster_maxsize)
+  if(vkeyframe && c->active && c->size > mkm->cluster_maxsize)
     mk_close_cluster(mkm);
 
-  else if(!mkm->has_video && mkm->cluster && mkm->cluster->hq_size > clusersizemax/40)
+  else if(!mkm->has_video && c->active && c->size > clusersizemax/40)
     mk_close_cluster(mkm);
 
-  else if(mkm->cluster && mkm->cluster->hq_size > clusersizemax)
+  else if(c->active && c->size > clusersizemax)
     mk_close_cluster(mkm);
 
-  if(mkm->cluster == NULL) {
+  if(!c->active) {
     mkm->cluster_tc = pts;
-    mkm->cluster = htsbuf_queue_alloc(0);
+    c->active = 1;
 
     mkm->cluster_pos = mkm->fdpos;
     mkm->addcue = 1;
 
-    ebml_append_uint(mkm->cluster, 0xe7, mkm->cluster_tc);
+    mk_cluster_append(c, hdr, ebml_put_uint(hdr, 0xe7, mkm->cluster_tc));
     delta = 0;
   }
 
@@ -970,15 +1173,16 @@ mk_write_frame_i(mk_mux_t *mkm, mk_track_t *t, th_pkt_t *pkt)
   }
 
 
-  ebml_append_id(mkm->cluster, 0xa3 ); // SimpleBlock
-  ebml_append_size(mkm->cluster, len + 4);
-  ebml_append_size(mkm->cluster, t->tracknum);
+  n  = ebml_put_id(hdr, 0xa3); // SimpleBlock
+  n += ebml_put_size(hdr + n, len + 4);
+  n += ebml_put_size(hdr + n, t->tracknum);
 
-  c_delta_flags[0] = delta >> 8;
-  c_delta_flags[1] = delta;
-  c_delta_flags[2] = (keyframe << 7) | skippable;
-  htsbuf_append(mkm->cluster, c_delta_flags, 3);
-  htsbuf_append(mkm->cluster, data, len);
+  hdr[n++] = delta >> 8;
+  hdr[n++] = delta;
+  hdr[n++] = (keyframe << 7) | skippable;
+  mk_cluster_append(c, hdr, n);
+  mk_cluster_ref(c, pkt->pkt_payload, data - pktbuf_ptr(pkt->pkt_payload), len);
+  c->frames++;
 }
 
 
@@ -1052,13 +1256,13 @@ mk_mux_open_stream(mk_mux_t *mkm, int fd)
 int
 mk_mux_open_file(mk_mux_t *mkm, const char *filename, int permissions)
 {
-  int fd;
+  muxer_io_t *io;
 
   tvhtrace("mkv", "Creating file \"%s\" with file permissions \"%o\"", filename, permissions);
   
-  fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, permissions);
+  io = muxer_io_open(filename, permissions, mkm->m->m_config.m_cache);
   
-  if(fd < 0) {
+  if(!io) {
     mkm->error = errno;
     tvhlog(LOG_ERR, "mkv", "%s: Unable to create file, open failed -- %s",
 	   mkm->filename, strerror(errno));
@@ -1066,7 +1270,7 @@ mk_mux_open_file(mk_mux_t *mkm, const char *filename, int permissions)
   }
 
   mkm->filename = strdup(filename);
-  mkm->fd = fd;
+  mkm->io = io;
   mkm->cluster_maxsize = 2000000/4;
   mkm->seekable = 1;
 
@@ -1225,28 +1429,20 @@ mk_mux_close(mk_mux_t *mkm)
 
   if(mkm->seekable) {
     // Rewrite segment info to update duration
-    if(lseek(mkm->fd, mkm->segmentinfo_pos, SEEK_SET) == mkm->segmentinfo_pos)
-      mk_write_master(mkm, 0x1549a966, mk_build_segment_info(mkm));
-    else {
-      mkm->error = errno;
-      tvhlog(LOG_ERR, "mkv", "%s: Unable to write duration, seek failed -- %s",
-	     mkm->filename, strerror(errno));
-    }
+    mkm->fdpos = mkm->segmentinfo_pos;
+    mk_write_master(mkm, 0x1549a966, mk_build_segment_info(mkm));
 
     // Rewrite segment header to update total size
-    if(lseek(mkm->fd, mkm->segment_header_pos, SEEK_SET) == mkm->segment_header_pos) {
-      mk_write_segment_header(mkm, totsize - mkm->segment_header_pos - 12);
-    } else {
-      mkm->error = errno;
-      tvhlog(LOG_ERR, "mkv", "%s: Unable to write total size, seek failed -- %s",
-	     mkm->filename, strerror(errno));
-    }
+    mkm->fdpos = mkm->segment_header_pos;
+    mk_write_segment_header(mkm, totsize - mkm->segment_header_pos - 12);
 
-    if(close(mkm->fd)) {
+    mkm->fdpos = totsize;
+    if(muxer_io_close(mkm->io) && !mkm->error) {
       mkm->error = errno;
       tvhlog(LOG_ERR, "mkv", "%s: Unable to close the file descriptor, close failed -- %s",
 	     mkm->filename, strerror(errno));
     }
+    mkm->io = NULL;
   }
 
   return mkm->error;
@@ -1266,6 +1462,8 @@ mk_mux_destroy(mk_mux_t *mkm)
     free(ch);
   }
 
+  mk_cluster_free(&mkm->cluster);
+
   free(mkm->filename);
   free(mkm->tracks);
   free(mkm->title);
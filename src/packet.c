@@ -22,6 +22,12 @@
 #include "string.h"
 #include "atomic.h"
 
+/*
+ * Allocation counters
+ */
+volatile int pkt_alloc_count;
+volatile int pktbuf_alloc_count;
+
 /*
  *
  */
@@ -47,6 +53,7 @@ pkt_alloc(const void *data, size_t datalen, int64_t pts, int64_t dts)
   th_pkt_t *pkt;
 
   pkt = calloc(1, sizeof(th_pkt_t));
+  atomic_add(&pkt_alloc_count, 1);
   if(datalen)
     pkt->pkt_payload = pktbuf_alloc(data, datalen);
   pkt->pkt_dts = dts;
@@ -138,6 +145,7 @@ pkt_merge_header(th_pkt_t *pkt)
     return pkt;
 
   n = malloc(sizeof(th_pkt_t));
+  atomic_add(&pkt_alloc_count, 1);
   *n = *pkt;
 
   n->pkt_refcount = 1;
@@ -167,6 +175,7 @@ th_pkt_t *
 pkt_copy_shallow(th_pkt_t *pkt)
 {
   th_pkt_t *n = malloc(sizeof(th_pkt_t));
+  atomic_add(&pkt_alloc_count, 1);
   *n = *pkt;
 
   n->pkt_refcount = 1;
@@ -213,6 +222,7 @@ pktbuf_t *
 pktbuf_alloc(const void *data, size_t size)
 {
   pktbuf_t *pb = malloc(sizeof(pktbuf_t));
+  atomic_add(&pktbuf_alloc_count, 1);
   pb->pb_refcount = 1;
   pb->pb_size = size;
 
@@ -228,6 +238,7 @@ pktbuf_t *
 pktbuf_make(void *data, size_t size)
 {
   pktbuf_t *pb = malloc(sizeof(pktbuf_t));
+  atomic_add(&pktbuf_alloc_count, 1);
   pb->pb_refcount = 1;
   pb->pb_size = size;
   pb->pb_data = data;
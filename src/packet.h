@@ -94,6 +94,12 @@ void pktref_enqueue(struct th_pktref_queue *q, th_pkt_t *pkt);
 void pktref_remove(struct th_pktref_queue *q, th_pktref_t *pr);
 
 
+/**
+ * Allocation counters (packets and buffers created), for benchmarks
+ */
+extern volatile int pkt_alloc_count;
+extern volatile int pktbuf_alloc_count;
+
 th_pkt_t *pkt_alloc(const void *data, size_t datalen, int64_t pts, int64_t dts);
 
 th_pkt_t *pkt_merge_header(th_pkt_t *pkt);
@@ -26,6 +26,9 @@
 #include "service.h"
 #include "timeshift.h"
 
+static LIST_HEAD(, streaming_queue) streaming_queues;
+static pthread_mutex_t              streaming_queues_lock = PTHREAD_MUTEX_INITIALIZER;
+
 void
 streaming_pad_init(streaming_pad_t *sp)
 {
@@ -47,6 +50,71 @@ streaming_target_init(streaming_target_t *st, st_callback_t *cb, void *opaque,
 }
 
 
+/**
+ * Payload size of a message (as accounted in the queue)
+ */
+static inline size_t
+streaming_message_data_size(streaming_message_t *sm)
+{
+  if (sm->sm_type == SMT_PACKET) {
+    th_pkt_t *pkt = sm->sm_data;
+    if (pkt && pkt->pkt_payload)
+      return pkt->pkt_payload->pb_size;
+  } else if (sm->sm_type == SMT_MPEGTS) {
+    pktbuf_t *pkt_payload = sm->sm_data;
+    if (pkt_payload)
+      return pkt_payload->pb_size;
+  }
+  return 0;
+}
+
+/**
+ * Queue size protection
+ *
+ * Above the high watermark B frames are dropped, from half way to the
+ * maximum size P frames too, and at the maximum anything with a payload.
+ * Once a reference frame is lost, P and B frames are dropped up to the
+ * next I frame. Control messages are never dropped.
+ */
+static int
+streaming_queue_drop(streaming_queue_t *sq, streaming_message_t *sm)
+{
+  int type, drop;
+
+  if (sm->sm_type == SMT_PACKET)
+    type = ((th_pkt_t *)sm->sm_data)->pkt_frametype;
+  else if (sm->sm_type == SMT_MPEGTS)
+    type = 0;
+  else
+    return 0;
+  if (type < 0 || type >= PKT_NTYPES)
+    type = 0;
+
+  if (sq->sq_size >= sq->sq_hiwater)
+    sq->sq_congested = 1;
+  else if (sq->sq_size <= sq->sq_lowater)
+    sq->sq_congested = 0;
+
+  if (sq->sq_size >= sq->sq_maxsize)
+    drop = 1;
+  else if (sq->sq_congested && type == PKT_B_FRAME)
+    drop = 1;
+  else if (sq->sq_congested && type == PKT_P_FRAME &&
+           sq->sq_size >= sq->sq_hiwater + (sq->sq_maxsize - sq->sq_hiwater) / 2)
+    drop = 1;
+  else
+    drop = sq->sq_drop_ref && (type == PKT_P_FRAME || type == PKT_B_FRAME);
+
+  if (drop) {
+    if (type == PKT_I_FRAME || type == PKT_P_FRAME)
+      sq->sq_drop_ref = 1;
+    sq->sq_dropstats[type]++;
+  } else if (type == PKT_I_FRAME) {
+    sq->sq_drop_ref = 0;
+  }
+  return drop;
+}
+
 /**
  *
  */
@@ -58,13 +126,13 @@ streaming_queue_deliver(void *opauqe, streaming_message_t *sm)
   pthread_mutex_lock(&sq->sq_mutex);
 
   /* queue size protection */
-  // TODO: would be better to update size as we go, but this would
-  //       require updates elsewhere to ensure all removals from the queue
-  //       are covered (new function)
-  if (sq->sq_maxsize && streaming_queue_size(&sq->sq_queue) >= sq->sq_maxsize)
+  if (sq->sq_maxsize && streaming_queue_drop(sq, sm)) {
     streaming_msg_free(sm);
-  else
+  } else {
+    sq->sq_size += streaming_message_data_size(sm);
+    sq->sq_count++;
     TAILQ_INSERT_TAIL(&sq->sq_queue, sm, sm_link);
+  }
 
   pthread_cond_signal(&sq->sq_cond);
   pthread_mutex_unlock(&sq->sq_mutex);
@@ -84,6 +152,62 @@ streaming_queue_init2(streaming_queue_t *sq, int reject_filter, size_t maxsize)
   TAILQ_INIT(&sq->sq_queue);
 
   sq->sq_maxsize = maxsize;
+  sq->sq_hiwater = maxsize / 2;
+  sq->sq_lowater = maxsize / 4;
+  sq->sq_size = 0;
+  sq->sq_count = 0;
+  sq->sq_congested = 0;
+  sq->sq_drop_ref = 0;
+  memset(sq->sq_dropstats, 0, sizeof(sq->sq_dropstats));
+  sq->sq_name = NULL;
+}
+
+/**
+ * Set the dropping thresholds (0 = default)
+ */
+void
+streaming_queue_set_watermarks
+  (streaming_queue_t *sq, size_t lowater, size_t hiwater)
+{
+  pthread_mutex_lock(&sq->sq_mutex);
+  sq->sq_hiwater = MIN(hiwater ?: sq->sq_maxsize / 2, sq->sq_maxsize);
+  sq->sq_lowater = MIN(lowater ?: sq->sq_hiwater / 2, sq->sq_hiwater);
+  pthread_mutex_unlock(&sq->sq_mutex);
+}
+
+/**
+ * Add the queue to the status list
+ */
+void
+streaming_queue_register(streaming_queue_t *sq, const char *name)
+{
+  pthread_mutex_lock(&streaming_queues_lock);
+  sq->sq_name = strdup(name);
+  LIST_INSERT_HEAD(&streaming_queues, sq, sq_link);
+  pthread_mutex_unlock(&streaming_queues_lock);
+}
+
+/**
+ * Remove a message from the queue (sq_mutex must be held)
+ */
+void
+streaming_queue_remove(streaming_queue_t *sq, streaming_message_t *sm)
+{
+  sq->sq_size -= streaming_message_data_size(sm);
+  sq->sq_count--;
+  TAILQ_REMOVE(&sq->sq_queue, sm, sm_link);
+}
+
+/**
+ * Free all queued messages (sq_mutex must be held)
+ */
+void
+streaming_queue_flush(streaming_queue_t *sq)
+{
+  streaming_queue_clear(&sq->sq_queue);
+  sq->sq_size = 0;
+  sq->sq_count = 0;
+  sq->sq_drop_ref = 0;
 }
 
 /**
@@ -102,7 +226,14 @@ streaming_queue_init(streaming_queue_t *sq, int reject_filter)
 void
 streaming_queue_deinit(streaming_queue_t *sq)
 {
-  streaming_queue_clear(&sq->sq_queue);
+  if (sq->sq_name) {
+    pthread_mutex_lock(&streaming_queues_lock);
+    LIST_REMOVE(sq, sq_link);
+    pthread_mutex_unlock(&streaming_queues_lock);
+    free(sq->sq_name);
+    sq->sq_name = NULL;
+  }
+  streaming_queue_flush(sq);
   pthread_mutex_destroy(&sq->sq_mutex);
   pthread_cond_destroy(&sq->sq_cond);
 }
@@ -141,6 +272,11 @@ streaming_target_disconnect(streaming_pad_t *sp, streaming_target_t *st)
 }
 
 
+/**
+ * Messages created, for benchmarks
+ */
+volatile int streaming_msg_alloc_count;
+
 /**
  *
  */
@@ -148,6 +284,7 @@ streaming_message_t *
 streaming_msg_create(streaming_message_type_t type)
 {
   streaming_message_t *sm = malloc(sizeof(streaming_message_t));
+  atomic_add(&streaming_msg_alloc_count, 1);
   sm->sm_type = type;
 #if ENABLE_TIMESHIFT
   sm->sm_time      = 0;
@@ -203,6 +340,8 @@ streaming_msg_clone(streaming_message_t *src)
   streaming_message_t *dst = malloc(sizeof(streaming_message_t));
   streaming_start_t *ss;
 
+  atomic_add(&streaming_msg_alloc_count, 1);
+
   dst->sm_type      = src->sm_type;
 #if ENABLE_TIMESHIFT
   dst->sm_time      = src->sm_time;
@@ -369,30 +508,53 @@ streaming_queue_clear(struct streaming_message_queue *q)
 size_t streaming_queue_size(struct streaming_message_queue *q)
 {
   streaming_message_t *sm;
-  int size = 0;
-
-  TAILQ_FOREACH(sm, q, sm_link) {
-    if (sm->sm_type == SMT_PACKET)
-    {
-      th_pkt_t *pkt = sm->sm_data;
-      if (pkt && pkt->pkt_payload)
-      {
-        size += pkt->pkt_payload->pb_size;
-      }
-    }
-    else if (sm->sm_type == SMT_MPEGTS)
-    {
-      pktbuf_t *pkt_payload = sm->sm_data;
-      if (pkt_payload)
-      {
-        size += pkt_payload->pb_size;
-      }
-    }
-  }
+  size_t size = 0;
+
+  TAILQ_FOREACH(sm, q, sm_link)
+    size += streaming_message_data_size(sm);
   return size;
 }
 
 
+/**
+ * Depth of the registered queues
+ */
+htsmsg_t *
+streaming_queue_stats(void)
+{
+  streaming_queue_t *sq;
+  htsmsg_t *l, *e, *m;
+  int c = 0;
+
+  l = htsmsg_create_list();
+  pthread_mutex_lock(&streaming_queues_lock);
+  LIST_FOREACH(sq, &streaming_queues, sq_link) {
+    e = htsmsg_create_map();
+    pthread_mutex_lock(&sq->sq_mutex);
+    htsmsg_add_str(e, "name", sq->sq_name);
+    htsmsg_add_s64(e, "size", sq->sq_size);
+    htsmsg_add_u32(e, "count", sq->sq_count);
+    htsmsg_add_s64(e, "maxsize", sq->sq_maxsize);
+    htsmsg_add_s64(e, "hiwater", sq->sq_hiwater);
+    htsmsg_add_s64(e, "lowater", sq->sq_lowater);
+    htsmsg_add_u32(e, "congested", sq->sq_congested);
+    htsmsg_add_u32(e, "Bdrops", sq->sq_dropstats[PKT_B_FRAME]);
+    htsmsg_add_u32(e, "Pdrops", sq->sq_dropstats[PKT_P_FRAME]);
+    htsmsg_add_u32(e, "Idrops", sq->sq_dropstats[PKT_I_FRAME]);
+    htsmsg_add_u32(e, "drops",  sq->sq_dropstats[0]);
+    pthread_mutex_unlock(&sq->sq_mutex);
+    htsmsg_add_msg(l, NULL, e);
+    c++;
+  }
+  pthread_mutex_unlock(&streaming_queues_lock);
+
+  m = htsmsg_create_map();
+  htsmsg_add_msg(m, "entries", l);
+  htsmsg_add_u32(m, "totalCount", c);
+  return m;
+}
+
+
 /**
  *
  */
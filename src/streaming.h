@@ -77,18 +77,31 @@ void streaming_queue_init(streaming_queue_t *sq, int reject_filter);
 void streaming_queue_init2
   (streaming_queue_t *sq, int reject_filter, size_t maxsize);
 
+void streaming_queue_set_watermarks
+  (streaming_queue_t *sq, size_t lowater, size_t hiwater);
+
+void streaming_queue_register(streaming_queue_t *sq, const char *name);
+
+void streaming_queue_remove(streaming_queue_t *sq, streaming_message_t *sm);
+
+void streaming_queue_flush(streaming_queue_t *sq);
+
 void streaming_queue_clear(struct streaming_message_queue *q);
 
 size_t streaming_queue_size(struct streaming_message_queue *q);
 
 void streaming_queue_deinit(streaming_queue_t *sq);
 
+htsmsg_t *streaming_queue_stats(void);
+
 void streaming_target_connect(streaming_pad_t *sp, streaming_target_t *st);
 
 void streaming_target_disconnect(streaming_pad_t *sp, streaming_target_t *st);
 
 void streaming_pad_deliver(streaming_pad_t *sp, streaming_message_t *sm);
 
+extern volatile int streaming_msg_alloc_count;
+
 void streaming_msg_free(streaming_message_t *sm);
 
 streaming_message_t *streaming_msg_clone(streaming_message_t *src);
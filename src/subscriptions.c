@@ -840,6 +840,21 @@ subscription_change_weight(th_subscription_t *s, int weight)
 	           subscription_reschedule_cb, NULL, 0);
 }
 
+/**
+ * Change the client shown as the owner (shared subscriptions)
+ */
+void
+subscription_set_client(th_subscription_t *s, const char *hostname,
+                        const char *username, const char *client)
+{
+  free(s->ths_hostname);
+  free(s->ths_username);
+  free(s->ths_client);
+  s->ths_hostname = hostname ? strdup(hostname) : NULL;
+  s->ths_username = username ? strdup(username) : NULL;
+  s->ths_client   = client   ? strdup(client)   : NULL;
+}
+
 /**
  * Set speed
  */
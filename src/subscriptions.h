@@ -154,6 +154,9 @@ th_subscription_t *subscription_create(int weight, const char *name,
 
 void subscription_change_weight(th_subscription_t *s, int weight);
 
+void subscription_set_client(th_subscription_t *s, const char *hostname,
+                             const char *username, const char *client);
+
 void subscription_set_speed
   (th_subscription_t *s, int32_t speed );
 
@@ -41,6 +41,8 @@ int       timeshift_unlimited_period;
 uint32_t  timeshift_max_period;
 int       timeshift_unlimited_size;
 uint64_t  timeshift_max_size;
+uint64_t  timeshift_ram_size;
+uint64_t  timeshift_ram_client_size;
 
 /*
  * Intialise global file manager
@@ -61,6 +63,8 @@ void timeshift_init ( void )
   timeshift_max_period       = 3600;                    // 1Hr
   timeshift_unlimited_size   = 0;
   timeshift_max_size         = 10000 * (size_t)1048576; // 10G
+  timeshift_ram_size         = 0;                       // disk only
+  timeshift_ram_client_size  = 0;                       // no client limit
 
   /* Load settings */
   if ((m = hts_settings_load("timeshift/config"))) {
@@ -77,6 +81,10 @@ void timeshift_init ( void )
       timeshift_unlimited_size = u32 ? 1 : 0;
     if (!htsmsg_get_u32(m, "max_size", &u32))
       timeshift_max_size = 1048576LL * u32;
+    if (!htsmsg_get_u32(m, "ram_size", &u32))
+      timeshift_ram_size = 1048576LL * u32;
+    if (!htsmsg_get_u32(m, "ram_client_size", &u32))
+      timeshift_ram_client_size = 1048576LL * u32;
     htsmsg_destroy(m);
   }
 }
@@ -105,6 +113,8 @@ void timeshift_save ( void )
   htsmsg_add_u32(m, "max_period", timeshift_max_period);
   htsmsg_add_u32(m, "unlimited_size", timeshift_unlimited_size);
   htsmsg_add_u32(m, "max_size", timeshift_max_size / 1048576);
+  htsmsg_add_u32(m, "ram_size", timeshift_ram_size / 1048576);
+  htsmsg_add_u32(m, "ram_client_size", timeshift_ram_client_size / 1048576);
 
   hts_settings_save(m, "timeshift/config");
 }
@@ -254,6 +264,7 @@ streaming_target_t *timeshift_create
   (streaming_target_t *out, time_t max_time)
 {
   timeshift_t *ts = calloc(1, sizeof(timeshift_t));
+  char buf[32];
 
   /* Must hold global lock */
   lock_assert(&global_lock);
@@ -271,12 +282,15 @@ streaming_target_t *timeshift_create
   ts->pts_delta  = PTS_UNSET;
   pthread_mutex_init(&ts->rdwr_mutex, NULL);
   pthread_mutex_init(&ts->state_mutex, NULL);
+  pthread_cond_init(&ts->spill_cond, NULL);
 
   /* Initialise output */
   tvh_pipe(O_NONBLOCK, &ts->rd_pipe);
 
   /* Initialise input */
   streaming_queue_init(&ts->wr_queue, 0);
+  snprintf(buf, sizeof(buf), "timeshift %d", ts->id);
+  streaming_queue_register(&ts->wr_queue, buf);
   streaming_target_init(&ts->input, timeshift_input, ts, 0);
   tvhthread_create(&ts->wr_thread, NULL, timeshift_writer, ts);
   tvhthread_create(&ts->rd_thread, NULL, timeshift_reader, ts);
@@ -27,6 +27,9 @@ extern uint32_t  timeshift_max_period;
 extern int       timeshift_unlimited_size;
 extern uint64_t  timeshift_max_size;
 extern uint64_t  timeshift_total_size;
+extern uint64_t  timeshift_ram_size;
+extern uint64_t  timeshift_ram_client_size;
+extern uint64_t  timeshift_ram_usage;
 
 typedef struct timeshift_status
 {
@@ -21,6 +21,11 @@
 
 #define TIMESHIFT_PLAY_BUF     200000 // us to buffer in TX
 #define TIMESHIFT_FILE_PERIOD      60 // number of secs in each buffer file
+#define TIMESHIFT_WBUF_SIZE    65536 // bytes staged before a write
+#define TIMESHIFT_WBUF_PERIOD 100000 // us staged data may wait for a write
+#define TIMESHIFT_RAM_CHUNK    262144 // initial RAM segment allocation
+
+#define TIMESHIFT_FD_RAM           -2 // "descriptor" of a RAM segment
 
 /**
  * Indexes of import data in the stream
@@ -51,6 +56,7 @@ typedef TAILQ_HEAD(timeshift_index_data_list,timeshift_index_data) timeshift_ind
  */
 typedef struct timeshift_file
 {
+  struct timeshift             *ts;       ///< Owner
   int                           fd;       ///< Write descriptor
   char                          *path;    ///< Full path to file
 
@@ -62,6 +68,15 @@ typedef struct timeshift_file
 
   int                           refcount; ///< Reader ref count
 
+  uint8_t                      *wbuf;      ///< Write staging buffer
+  size_t                        wbuf_len;  ///< Staged bytes
+  int64_t                       wbuf_time; ///< When staging started
+  uint32_t                      writes;    ///< Write calls (statistics)
+
+  uint8_t                      *ram;       ///< RAM segment (NULL = on disk)
+  size_t                        ram_len;   ///< RAM data (incl. partial msg)
+  size_t                        ram_alloc; ///< RAM allocated
+
   timeshift_index_iframe_list_t iframes;  ///< I-frame indexing
   timeshift_index_data_list_t   sstart;   ///< Stream start messages
 
@@ -98,12 +113,16 @@ typedef struct timeshift {
 
   streaming_queue_t           wr_queue;   ///< Writer queue
   pthread_t                   wr_thread;  ///< Writer thread
+  int64_t                     wr_flush;   ///< Deadline for staged data
 
   pthread_t                   rd_thread;  ///< Reader thread
   th_pipe_t                   rd_pipe;    ///< Message passing to reader
 
   pthread_mutex_t             rdwr_mutex; ///< Buffer protection
   timeshift_file_list_t       files;      ///< List of files
+  size_t                      ram_size;   ///< RAM used by the segments
+  int                         spilling;   ///< Unlocked spill in progress
+  pthread_cond_t              spill_cond; ///< Signalled when spill is done
 
   int                         vididx;     ///< Index of (current) video stream
 
@@ -113,14 +132,15 @@ typedef struct timeshift {
  * Write functions
  */
 ssize_t timeshift_write_start   ( int fd, int64_t time, streaming_start_t *ss );
-ssize_t timeshift_write_sigstat ( int fd, int64_t time, signal_status_t *ss );
-ssize_t timeshift_write_packet  ( int fd, int64_t time, th_pkt_t *pkt );
-ssize_t timeshift_write_mpegts  ( int fd, int64_t time, void *data );
+ssize_t timeshift_write_sigstat ( timeshift_file_t *tsf, int64_t time, signal_status_t *ss );
+ssize_t timeshift_write_packet  ( timeshift_file_t *tsf, int64_t time, th_pkt_t *pkt );
+ssize_t timeshift_write_mpegts  ( timeshift_file_t *tsf, int64_t time, void *data );
 ssize_t timeshift_write_skip    ( int fd, streaming_skip_t *skip );
 ssize_t timeshift_write_speed   ( int fd, int speed );
 ssize_t timeshift_write_stop    ( int fd, int code );
 ssize_t timeshift_write_exit    ( int fd );
-ssize_t timeshift_write_eof     ( int fd );
+ssize_t timeshift_write_eof     ( timeshift_file_t *tsf );
+ssize_t timeshift_write_flush   ( timeshift_file_t *tsf );
 
 void timeshift_writer_flush ( timeshift_t *ts );
 
@@ -151,5 +171,6 @@ void timeshift_filemgr_remove
   ( timeshift_t *ts, timeshift_file_t *tsf, int force );
 void timeshift_filemgr_flush ( timeshift_t *ts, timeshift_file_t *end );
 void timeshift_filemgr_close ( timeshift_file_t *tsf );
+int  timeshift_filemgr_ram_reserve ( timeshift_file_t *tsf, size_t len );
 
 #endif /* __TVH_TIMESHIFT_PRIVATE_H__ */
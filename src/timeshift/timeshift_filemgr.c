@@ -39,6 +39,7 @@ static pthread_mutex_t       timeshift_reaper_lock;
 static pthread_cond_t        timeshift_reaper_cond;
 
 uint64_t                     timeshift_total_size;
+uint64_t                     timeshift_ram_usage;
 
 /* **************************************************************************
  * File reaper thread
@@ -84,6 +85,7 @@ static void* timeshift_reaper_callback ( void *p )
       streaming_msg_free(sm);
       free(tid);
     }
+    free(tsf->wbuf);
     free(tsf->path);
     free(tsf);
 
@@ -103,6 +105,137 @@ static void timeshift_reaper_remove ( timeshift_file_t *tsf )
   pthread_mutex_unlock(&timeshift_reaper_lock);
 }
 
+/* **************************************************************************
+ * RAM segments
+ * *************************************************************************/
+
+/*
+ * Check whether len more bytes of RAM can be used by this buffer
+ */
+static int
+timeshift_filemgr_ram_fits ( timeshift_t *ts, size_t len )
+{
+  if (timeshift_ram_client_size &&
+      ts->ram_size + len > timeshift_ram_client_size)
+    return 0;
+  return atomic_pre_add_u64(&timeshift_ram_usage, 0) + len <= timeshift_ram_size;
+}
+
+/*
+ * Release RAM segment memory
+ */
+static void
+timeshift_filemgr_ram_free ( timeshift_file_t *tsf )
+{
+  if (!tsf->ram)
+    return;
+  tsf->ts->ram_size -= tsf->ram_alloc;
+  atomic_add_u64(&timeshift_ram_usage, -tsf->ram_alloc);
+  free(tsf->ram);
+  tsf->ram       = NULL;
+  tsf->ram_len   = 0;
+  tsf->ram_alloc = 0;
+}
+
+/*
+ * Wait for an unlocked spill to finish (rdwr_mutex held)
+ *
+ * Anything that adds, removes or spills segments must wait, readers of
+ * the RAM segments don't have to.
+ */
+static void
+timeshift_filemgr_spill_wait ( timeshift_t *ts )
+{
+  while (ts->spilling)
+    pthread_cond_wait(&ts->spill_cond, &ts->rdwr_mutex);
+}
+
+/*
+ * Move a RAM segment to disk (rdwr_mutex held)
+ *
+ * The layout is identical, so reader offsets stay valid. The segment
+ * being written keeps the descriptor and continues on disk. Finished
+ * segments don't change any more, so these are written without the
+ * lock and the RAM copy is only released once they are on disk.
+ */
+static int
+timeshift_filemgr_spill ( timeshift_file_t *tsf )
+{
+  timeshift_t *ts = tsf->ts;
+  int fd, err = 0, unlocked = tsf->fd != TIMESHIFT_FD_RAM;
+
+  if (unlocked) {
+    ts->spilling = 1;
+    pthread_mutex_unlock(&ts->rdwr_mutex);
+  }
+  if ((fd = open(tsf->path, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0) {
+    err = errno;
+  } else if (tvh_write(fd, tsf->ram, tsf->ram_len)) {
+    err = errno;
+    close(fd);
+    fd = -2;
+  }
+  if (unlocked) {
+    pthread_mutex_lock(&ts->rdwr_mutex);
+    ts->spilling = 0;
+    pthread_cond_broadcast(&ts->spill_cond);
+  }
+  if (fd < 0) {
+    tvhlog(LOG_ERR, "timeshift", "ts %d failed to %s %s [e=%s]",
+           ts->id, fd == -1 ? "create" : "write", tsf->path,
+           strerror(err));
+    return -1;
+  }
+  tvhdebug("timeshift", "ts %d spill %s to disk (%"PRIsize_t" bytes)",
+           tsf->ts->id, tsf->path, tsf->ram_len);
+  if (tsf->fd == TIMESHIFT_FD_RAM)
+    tsf->fd = fd;
+  else
+    close(fd);
+  timeshift_filemgr_ram_free(tsf);
+  return 0;
+}
+
+/*
+ * Make room for len more bytes in a RAM segment
+ *
+ * The oldest RAM segments of this buffer are moved to disk while either
+ * the per client or the global limit would be exceeded. This can be tsf
+ * itself, which then carries on as a file (tsf->ram == NULL). rdwr_mutex
+ * is dropped while older segments are written, other threads wait in
+ * timeshift_filemgr_spill_wait() before touching the file list.
+ */
+int timeshift_filemgr_ram_reserve ( timeshift_file_t *tsf, size_t len )
+{
+  timeshift_t *ts = tsf->ts;
+  timeshift_file_t *old;
+  uint8_t *ram;
+  size_t alloc;
+
+  if (tsf->ram_len + len <= tsf->ram_alloc)
+    return 0;
+
+  alloc = tsf->ram_alloc +
+          MAX(MAX(tsf->ram_alloc / 4, TIMESHIFT_RAM_CHUNK), len);
+  while (!timeshift_filemgr_ram_fits(ts, alloc - tsf->ram_alloc)) {
+    TAILQ_FOREACH(old, &ts->files, link)
+      if (old->ram)
+        break;
+    if (!old || timeshift_filemgr_spill(old))
+      return -1;
+    if (old == tsf)
+      return 0;
+  }
+
+  if (!(ram = realloc(tsf->ram, alloc)))
+    return -1;
+  ts->ram_size += alloc - tsf->ram_alloc;
+  atomic_add_u64(&timeshift_ram_usage, alloc - tsf->ram_alloc);
+  tsf->ram       = ram;
+  tsf->ram_alloc = alloc;
+  return 0;
+}
+
 /* **************************************************************************
  * File Handling
  * *************************************************************************/
@@ -140,14 +273,20 @@ int timeshift_filemgr_makedirs ( int index, char *buf, size_t len )
  */
 void timeshift_filemgr_close ( timeshift_file_t *tsf )
 {
-  ssize_t r = timeshift_write_eof(tsf->fd);
+  ssize_t r = timeshift_write_eof(tsf);
   if (r > 0)
   {
     tsf->size += r;
     atomic_add_u64(&timeshift_total_size, r);
   }
-  close(tsf->fd);
+  tvhtrace("timeshift", "close file %s (%"PRIsize_t" bytes, %u writes)",
+           tsf->path, tsf->size, tsf->writes);
+  if (tsf->fd >= 0)
+    close(tsf->fd);
   tsf->fd = -1;
+  free(tsf->wbuf);
+  tsf->wbuf = NULL;
+  tsf->wbuf_len = 0;
 }
 
 /*
@@ -156,8 +295,9 @@ void timeshift_filemgr_close ( timeshift_file_t *tsf )
 void timeshift_filemgr_remove
   ( timeshift_t *ts, timeshift_file_t *tsf, int force )
 {
-  if (tsf->fd != -1)
+  if (tsf->fd >= 0)
     close(tsf->fd);
+  timeshift_filemgr_ram_free(tsf);
   tvhlog(LOG_DEBUG, "timeshift", "ts %d remove %s", ts->id, tsf->path);
   TAILQ_REMOVE(&ts->files, tsf, link);
   atomic_add_u64(&timeshift_total_size, -tsf->size);
@@ -170,6 +310,7 @@ void timeshift_filemgr_remove
 void timeshift_filemgr_flush ( timeshift_t *ts, timeshift_file_t *end )
 {
   timeshift_file_t *tsf;
+  timeshift_filemgr_spill_wait(ts);
   while ((tsf = TAILQ_FIRST(&ts->files))) {
     if (tsf == end) break;
     timeshift_filemgr_remove(ts, tsf, 1);
@@ -182,6 +323,7 @@ void timeshift_filemgr_flush ( timeshift_t *ts, timeshift_file_t *end )
 timeshift_file_t *timeshift_filemgr_get ( timeshift_t *ts, int create )
 {
   int fd;
+  uint8_t *ram;
   struct timespec tp;
   timeshift_file_t *tsf_tl, *tsf_hd, *tsf_tmp;
   timeshift_index_data_t *ti;
@@ -193,6 +335,7 @@ timeshift_file_t *timeshift_filemgr_get ( timeshift_t *ts, int create )
     return timeshift_filemgr_newest(ts);
 
   /* No space */
+  timeshift_filemgr_spill_wait(ts);
   if (ts->full)
     return NULL;
 
@@ -207,6 +350,15 @@ timeshift_file_t *timeshift_filemgr_get ( timeshift_t *ts, int create )
     if (tsf_tl && tsf_tl->fd != -1)
       timeshift_filemgr_close(tsf_tl);
 
+    /* Make room for a RAM segment by spilling our oldest ones */
+    while (!timeshift_filemgr_ram_fits(ts, TIMESHIFT_RAM_CHUNK)) {
+      TAILQ_FOREACH(tsf_tmp, &ts->files, link)
+        if (tsf_tmp->ram)
+          break;
+      if (!tsf_tmp || timeshift_filemgr_spill(tsf_tmp))
+        break;
+    }
+
     /* Check period */
     if (ts->max_time && tsf_hd && tsf_tl) {
       time_t d = (tsf_tl->time - tsf_hd->time) * TIMESHIFT_FILE_PERIOD;
@@ -247,14 +399,29 @@ timeshift_file_t *timeshift_filemgr_get ( timeshift_t *ts, int create )
         ts->path = strdup(path);
       }
 
-      /* Create File */
+      /* Create File (RAM segment if there's room) */
       snprintf(path, sizeof(path), "%s/tvh-%"PRItime_t, ts->path, time);
-      tvhtrace("timeshift", "ts %d create file %s", ts->id, path);
-      if ((fd = open(path, O_WRONLY | O_CREAT, 0600)) > 0) {
+      ram = NULL;
+      if (timeshift_filemgr_ram_fits(ts, TIMESHIFT_RAM_CHUNK) &&
+          (ram = malloc(TIMESHIFT_RAM_CHUNK))) {
+        tvhtrace("timeshift", "ts %d create RAM segment %s", ts->id, path);
+        fd = TIMESHIFT_FD_RAM;
+      } else {
+        tvhtrace("timeshift", "ts %d create file %s", ts->id, path);
+        fd = open(path, O_WRONLY | O_CREAT, 0600);
+      }
+      if (fd > 0 || ram) {
         tsf_tmp = calloc(1, sizeof(timeshift_file_t));
+        tsf_tmp->ts       = ts;
         tsf_tmp->time     = time;
         tsf_tmp->fd       = fd;
         tsf_tmp->path     = strdup(path);
+        if (ram) {
+          tsf_tmp->ram       = ram;
+          tsf_tmp->ram_alloc = TIMESHIFT_RAM_CHUNK;
+          ts->ram_size      += TIMESHIFT_RAM_CHUNK;
+          atomic_add_u64(&timeshift_ram_usage, TIMESHIFT_RAM_CHUNK);
+        }
         tsf_tmp->refcount = 0;
         tsf_tmp->last     = getmonoclock();
         TAILQ_INIT(&tsf_tmp->iframes);
@@ -342,6 +509,7 @@ void timeshift_filemgr_init ( void )
 
   /* Size processing */
   timeshift_total_size = 0;
+  timeshift_ram_usage  = 0;
 
   /* Start the reaper thread */
   timeshift_reaper_run = 1;
@@ -41,13 +41,37 @@
  * File Reading
  * *************************************************************************/
 
-static ssize_t _read_pktbuf ( int fd, pktbuf_t **pktbuf )
+/*
+ * Read source, either a descriptor or a RAM segment
+ */
+typedef struct timeshift_rd
+{
+  int            fd;    ///< Descriptor (-1 for RAM)
+  const uint8_t *ram;   ///< RAM segment data
+  size_t         len;   ///< RAM data available
+  size_t         off;   ///< RAM read position
+} timeshift_rd_t;
+
+static ssize_t _read ( timeshift_rd_t *rd, void *buf, size_t count )
+{
+  if (rd->fd != -1)
+    return read(rd->fd, buf, count);
+  if (rd->off >= rd->len)
+    return 0;
+  if (count > rd->len - rd->off)
+    count = rd->len - rd->off;
+  memcpy(buf, rd->ram + rd->off, count);
+  rd->off += count;
+  return count;
+}
+
+static ssize_t _read_pktbuf ( timeshift_rd_t *rd, pktbuf_t **pktbuf )
 {
   ssize_t r, cnt = 0;
   size_t sz;
 
   /* Size */
-  r = read(fd, &sz, sizeof(sz));
+  r = _read(rd, &sz, sizeof(sz));
   if (r < 0) return -1;
   if (r != sizeof(sz)) return 0;
   cnt += r;
@@ -60,7 +84,7 @@ static ssize_t _read_pktbuf ( int fd, pktbuf_t **pktbuf )
 
   /* Data */
   *pktbuf = pktbuf_alloc(NULL, sz);
-  r = read(fd, (*pktbuf)->pb_data, sz);
+  r = _read(rd, (*pktbuf)->pb_data, sz);
   if (r != sz) {
     free((*pktbuf)->pb_data);
     free(*pktbuf);
@@ -72,7 +96,7 @@ static ssize_t _read_pktbuf ( int fd, pktbuf_t **pktbuf )
 }
 
 
-static ssize_t _read_msg ( int fd, streaming_message_t **sm )
+static ssize_t _read_msg ( timeshift_rd_t *rd, streaming_message_t **sm )
 {
   ssize_t r, cnt = 0;
   size_t sz;
@@ -85,7 +109,7 @@ static ssize_t _read_msg ( int fd, streaming_message_t **sm )
   *sm = NULL;
 
   /* Size */
-  r = read(fd, &sz, sizeof(sz));
+  r = _read(rd, &sz, sizeof(sz));
   if (r < 0) return -1;
   if (r != sizeof(sz)) return 0;
   cnt += r;
@@ -94,13 +118,13 @@ static ssize_t _read_msg ( int fd, streaming_message_t **sm )
   if (sz == 0) return cnt;
 
   /* Type */
-  r = read(fd, &type, sizeof(type));
+  r = _read(rd, &type, sizeof(type));
   if (r < 0) return -1;
   if (r != sizeof(type)) return 0;
   cnt += r;
 
   /* Time */
-  r = read(fd, &time, sizeof(time));
+  r = _read(rd, &time, sizeof(time));
   if (r < 0) return -1;
   if (r != sizeof(time)) return 0;
   cnt += r;
@@ -124,7 +148,7 @@ static ssize_t _read_msg ( int fd, streaming_message_t **sm )
     case SMT_EXIT:
     case SMT_SPEED:
       if (sz != sizeof(code)) return -1;
-      r = read(fd, &code, sz);
+      r = _read(rd, &code, sz);
       if (r != sz) {
         if (r < 0) return -1;
         return 0;
@@ -138,7 +162,7 @@ static ssize_t _read_msg ( int fd, streaming_message_t **sm )
     case SMT_MPEGTS:
     case SMT_PACKET:
       data = malloc(sz);
-      r = read(fd, data, sz);
+      r = _read(rd, data, sz);
       if (r != sz) {
         free(data);
         if (r < 0) return -1;
@@ -149,13 +173,13 @@ static ssize_t _read_msg ( int fd, streaming_message_t **sm )
         pkt->pkt_payload  = pkt->pkt_header = NULL;
         pkt->pkt_refcount = 0;
         *sm = streaming_msg_create_pkt(pkt);
-        r   = _read_pktbuf(fd, &pkt->pkt_header);
+        r   = _read_pktbuf(rd, &pkt->pkt_header);
         if (r < 0) {
           streaming_msg_free(*sm);
           return r;
         }
         cnt += r;
-        r   = _read_pktbuf(fd, &pkt->pkt_payload);
+        r   = _read_pktbuf(rd, &pkt->pkt_payload);
         if (r < 0) {
           streaming_msg_free(*sm);
           return r;
@@ -319,17 +343,31 @@ static int _timeshift_read
 {
   if (*cur_file) {
 
-    /* Open file */
-    if (*fd == -1) {
-      tvhtrace("timeshift", "ts %d open file %s",
-               ts->id, (*cur_file)->path);
-      *fd = open((*cur_file)->path, O_RDONLY);
-    }
-    tvhtrace("timeshift", "ts %d seek to %"PRIoff_t, ts->id, *cur_off);
-    lseek(*fd, *cur_off, SEEK_SET);
+    ssize_t r;
+    timeshift_rd_t rd = { .fd = -1 };
 
-    /* Read msg */
-    ssize_t r = _read_msg(*fd, sm);
+    /* Read msg from RAM (the writer may spill or grow it meanwhile) */
+    pthread_mutex_lock(&ts->rdwr_mutex);
+    if ((*cur_file)->ram) {
+      rd.ram = (*cur_file)->ram;
+      rd.len = (*cur_file)->size;
+      rd.off = *cur_off;
+      r = _read_msg(&rd, sm);
+      pthread_mutex_unlock(&ts->rdwr_mutex);
+
+    /* Read msg from file */
+    } else {
+      pthread_mutex_unlock(&ts->rdwr_mutex);
+      if (*fd == -1) {
+        tvhtrace("timeshift", "ts %d open file %s",
+                 ts->id, (*cur_file)->path);
+        *fd = open((*cur_file)->path, O_RDONLY);
+      }
+      tvhtrace("timeshift", "ts %d seek to %"PRIoff_t, ts->id, *cur_off);
+      lseek(*fd, *cur_off, SEEK_SET);
+      rd.fd = *fd;
+      r = _read_msg(&rd, sm);
+    }
     if (r < 0) {
       streaming_message_t *e = streaming_msg_create_code(SMT_STOP, SM_CODE_UNDEFINED_ERROR);
       streaming_target_deliver2(ts->output, e);
@@ -341,7 +379,8 @@ static int _timeshift_read
 
     /* Incomplete */
     if (r == 0) {
-      lseek(*fd, *cur_off, SEEK_SET);
+      if (*fd != -1)
+        lseek(*fd, *cur_off, SEEK_SET);
       return 0;
     }
 
@@ -350,7 +389,8 @@ static int _timeshift_read
 
     /* Special case - EOF */
     if (r == sizeof(size_t) || *cur_off > (*cur_file)->size) {
-      close(*fd);
+      if (*fd != -1)
+        close(*fd);
       *fd       = -1;
       pthread_mutex_lock(&ts->rdwr_mutex);
       *cur_file = timeshift_filemgr_next(*cur_file, NULL, 0);
@@ -446,7 +486,8 @@ void *timeshift_reader ( void *p )
     /* Control */
     pthread_mutex_lock(&ts->state_mutex);
     if (nfds == 1) {
-      if (_read_msg(ts->rd_pipe.rd, &ctrl) > 0) {
+      timeshift_rd_t rd = { .fd = ts->rd_pipe.rd };
+      if (_read_msg(&rd, &ctrl) > 0) {
 
         /* Exit */
         if (ctrl->sm_type == SMT_EXIT) {
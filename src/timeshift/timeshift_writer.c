@@ -24,6 +24,7 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
@@ -80,20 +81,135 @@ static ssize_t _write_msg
 }
 
 /*
- * Write packet buffer
+ * Write vector (retry on EAGAIN)
  */
-static int _write_pktbuf ( int fd, pktbuf_t *pktbuf )
+static ssize_t _writev
+  ( int fd, struct iovec *iov, int iovcnt )
+{
+  ssize_t r, n = 0;
+  while (iovcnt > 0) {
+    r = writev(fd, iov, iovcnt);
+    if (r == -1) {
+      if (ERRNO_AGAIN(errno))
+        continue;
+      else
+        return -1;
+    }
+    n += r;
+    while (iovcnt > 0 && r >= iov->iov_len) {
+      r -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base += r;
+      iov->iov_len  -= r;
+    }
+  }
+  return n;
+}
+
+/*
+ * Flush the staging buffer to disk
+ */
+ssize_t timeshift_write_flush ( timeshift_file_t *tsf )
+{
+  ssize_t r = 0;
+  if (tsf->wbuf_len) {
+    r = _write(tsf->fd, tsf->wbuf, tsf->wbuf_len);
+    tsf->writes++;
+    tsf->wbuf_len = 0;
+  }
+  return r < 0 ? r : 0;
+}
+
+/*
+ * Stage data in the write buffer
+ *
+ * RAM segments are appended to directly, large blocks are written
+ * together with the staged data in one writev
+ */
+static ssize_t _stage
+  ( timeshift_file_t *tsf, const void *buf, size_t len )
+{
+  struct iovec iov[2];
+
+  if (tsf->ram) {
+    if (timeshift_filemgr_ram_reserve(tsf, len) < 0)
+      return -1;
+    if (tsf->ram) {
+      memcpy(tsf->ram + tsf->ram_len, buf, len);
+      tsf->ram_len += len;
+      return len;
+    }
+    /* spilled to disk, carry on there */
+  }
+
+  if (tsf->wbuf_len + len > TIMESHIFT_WBUF_SIZE) {
+    if (len >= TIMESHIFT_WBUF_SIZE / 2) {
+      iov[0].iov_base = tsf->wbuf;
+      iov[0].iov_len  = tsf->wbuf_len;
+      iov[1].iov_base = (void *)buf;
+      iov[1].iov_len  = len;
+      tsf->writes++;
+      tsf->wbuf_len = 0;
+      if (_writev(tsf->fd, iov[0].iov_len ? iov : iov + 1,
+                  iov[0].iov_len ? 2 : 1) < 0)
+        return -1;
+      return len;
+    }
+    if (timeshift_write_flush(tsf) < 0)
+      return -1;
+  }
+  if (!tsf->wbuf)
+    tsf->wbuf = malloc(TIMESHIFT_WBUF_SIZE);
+  if (!tsf->wbuf_len)
+    tsf->wbuf_time = getmonoclock();
+  memcpy(tsf->wbuf + tsf->wbuf_len, buf, len);
+  tsf->wbuf_len += len;
+  return len;
+}
+
+/*
+ * Stage message (same layout as _write_msg)
+ */
+static ssize_t _stage_msg
+  ( timeshift_file_t *tsf, streaming_message_type_t type, int64_t time,
+    const void *buf, size_t len )
+{
+  size_t len2 = len + sizeof(type) + sizeof(time);
+  ssize_t err, ret;
+  ret = err = _stage(tsf, &len2, sizeof(len2));
+  if (err < 0) return err;
+  err = _stage(tsf, &type, sizeof(type));
+  if (err < 0) return err;
+  ret += err;
+  err = _stage(tsf, &time, sizeof(time));
+  if (err < 0) return err;
+  ret += err;
+  if (len) {
+    err = _stage(tsf, buf, len);
+    if (err < 0) return err;
+    ret += err;
+  }
+  return ret;
+}
+
+/*
+ * Stage packet buffer
+ */
+static int _stage_pktbuf ( timeshift_file_t *tsf, pktbuf_t *pktbuf )
 {
   ssize_t ret, err;
   if (pktbuf) {
-    ret = err = _write(fd, &pktbuf->pb_size, sizeof(pktbuf->pb_size));
+    ret = err = _stage(tsf, &pktbuf->pb_size, sizeof(pktbuf->pb_size));
     if (err < 0) return err;
-    err = _write(fd, pktbuf->pb_data, pktbuf->pb_size);
+    err = _stage(tsf, pktbuf->pb_data, pktbuf->pb_size);
     if (err < 0) return err;
     ret += err;
   } else {
     size_t sz = 0;
-    ret = _write(fd, &sz, sizeof(sz));
+    ret = _stage(tsf, &sz, sizeof(sz));
   }
   return ret;
 }
@@ -102,24 +218,25 @@ static int _write_pktbuf ( int fd, pktbuf_t *pktbuf )
  * Write signal status
  */
 ssize_t timeshift_write_sigstat
-  ( int fd, int64_t time, signal_status_t *sigstat )
+  ( timeshift_file_t *tsf, int64_t time, signal_status_t *sigstat )
 {
-  return _write_msg(fd, SMT_SIGNAL_STATUS, time, sigstat,
+  return _stage_msg(tsf, SMT_SIGNAL_STATUS, time, sigstat,
                     sizeof(signal_status_t));
 }
 
 /*
  * Write packet
  */
-ssize_t timeshift_write_packet ( int fd, int64_t time, th_pkt_t *pkt )
+ssize_t timeshift_write_packet
+  ( timeshift_file_t *tsf, int64_t time, th_pkt_t *pkt )
 {
   ssize_t ret = 0, err;
-  ret = err = _write_msg(fd, SMT_PACKET, time, pkt, sizeof(th_pkt_t));
+  ret = err = _stage_msg(tsf, SMT_PACKET, time, pkt, sizeof(th_pkt_t));
   if (err <= 0) return err;
-  err = _write_pktbuf(fd, pkt->pkt_header);
+  err = _stage_pktbuf(tsf, pkt->pkt_header);
   if (err <= 0) return err;
   ret += err;
-  err = _write_pktbuf(fd, pkt->pkt_payload);
+  err = _stage_pktbuf(tsf, pkt->pkt_payload);
   if (err <= 0) return err;
   ret += err;
   return ret;
@@ -128,9 +245,10 @@ ssize_t timeshift_write_packet ( int fd, int64_t time, th_pkt_t *pkt )
 /*
  * Write MPEGTS data
  */
-ssize_t timeshift_write_mpegts ( int fd, int64_t time, void *data )
+ssize_t timeshift_write_mpegts
+  ( timeshift_file_t *tsf, int64_t time, void *data )
 {
-  return _write_msg(fd, SMT_MPEGTS, time, data, 188);
+  return _stage_msg(tsf, SMT_MPEGTS, time, data, 188);
 }
 
 /*
@@ -169,10 +287,13 @@ ssize_t timeshift_write_exit ( int fd )
 /*
  * Write end of file (special internal message)
  */
-ssize_t timeshift_write_eof ( int fd )
+ssize_t timeshift_write_eof ( timeshift_file_t *tsf )
 {
   size_t sz = 0;
-  return _write(fd, &sz, sizeof(sz));
+  ssize_t r = _stage(tsf, &sz, sizeof(sz));
+  if (r > 0 && timeshift_write_flush(tsf) < 0)
+    return -1;
+  return r;
 }
 
 /* **************************************************************************
@@ -200,9 +321,9 @@ static inline ssize_t _process_msg0
       if (SCT_ISVIDEO(ss->ss_components[i].ssc_type))
         ts->vididx = ss->ss_components[i].ssc_index;
   } else if (sm->sm_type == SMT_SIGNAL_STATUS)
-    err = timeshift_write_sigstat(tsf->fd, sm->sm_time, sm->sm_data);
+    err = timeshift_write_sigstat(tsf, sm->sm_time, sm->sm_data);
   else if (sm->sm_type == SMT_PACKET) {
-    err = timeshift_write_packet(tsf->fd, sm->sm_time, sm->sm_data);
+    err = timeshift_write_packet(tsf, sm->sm_time, sm->sm_data);
     if (err > 0) {
       th_pkt_t *pkt = sm->sm_data;
 
@@ -216,10 +337,20 @@ static inline ssize_t _process_msg0
       }
     }
   } else if (sm->sm_type == SMT_MPEGTS)
-    err = timeshift_write_mpegts(tsf->fd, sm->sm_time, sm->sm_data);
+    err = timeshift_write_mpegts(tsf, sm->sm_time, sm->sm_data);
   else
     err = 0;
 
+  /* Flush staged data after a while */
+  if (err >= 0 && tsf->wbuf_len) {
+    if (getmonoclock() - tsf->wbuf_time >= TIMESHIFT_WBUF_PERIOD) {
+      if (timeshift_write_flush(tsf) < 0)
+        return -1;
+      ts->wr_flush = 0;
+    } else if (!ts->wr_flush)
+      ts->wr_flush = tsf->wbuf_time + TIMESHIFT_WBUF_PERIOD;
+  }
+
   /* OK */
   if (err > 0) {
     tsf->last  = sm->sm_time;
@@ -281,12 +412,34 @@ static void _process_msg
     streaming_msg_free(sm);
 }
 
+/*
+ * Write out staged data of the current file
+ */
+static void _flush_staged ( timeshift_t *ts )
+{
+  timeshift_file_t *tsf;
+
+  pthread_mutex_lock(&ts->rdwr_mutex);
+  if ((tsf = timeshift_filemgr_newest(ts))) {
+    if (tsf->fd != -1 && timeshift_write_flush(tsf) < 0) {
+      timeshift_filemgr_close(tsf);
+      tsf->bad = 1;
+      ts->full = 1; ///< Stop any more writing
+    }
+    tsf->refcount--;
+  }
+  ts->wr_flush = 0;
+  pthread_mutex_unlock(&ts->rdwr_mutex);
+}
+
 void *timeshift_writer ( void *aux )
 {
   int run = 1;
   timeshift_t *ts = aux;
   streaming_queue_t *sq = &ts->wr_queue;
   streaming_message_t *sm;
+  struct timespec abstime;
+  int64_t delta;
 
   pthread_mutex_lock(&sq->sq_mutex);
 
@@ -295,10 +448,28 @@ void *timeshift_writer ( void *aux )
     /* Get message */
     sm = TAILQ_FIRST(&sq->sq_queue);
     if (sm == NULL) {
+      if (ts->wr_flush) {
+        delta = ts->wr_flush - getmonoclock();
+        if (delta > 0) {
+          clock_gettime(CLOCK_REALTIME, &abstime);
+          abstime.tv_sec  += delta / 1000000;
+          abstime.tv_nsec += (delta % 1000000) * 1000;
+          if (abstime.tv_nsec >= 1000000000) {
+            abstime.tv_sec++;
+            abstime.tv_nsec -= 1000000000;
+          }
+          pthread_cond_timedwait(&sq->sq_cond, &sq->sq_mutex, &abstime);
+          continue;
+        }
+        pthread_mutex_unlock(&sq->sq_mutex);
+        _flush_staged(ts);
+        pthread_mutex_lock(&sq->sq_mutex);
+        continue;
+      }
       pthread_cond_wait(&sq->sq_cond, &sq->sq_mutex);
       continue;
     }
-    TAILQ_REMOVE(&sq->sq_queue, sm, sm_link);
+    streaming_queue_remove(sq, sm);
     pthread_mutex_unlock(&sq->sq_mutex);
 
     _process_msg(ts, sm, &run);
@@ -322,9 +493,12 @@ void timeshift_writer_flush ( timeshift_t *ts )
 
   pthread_mutex_lock(&sq->sq_mutex);
   while ((sm = TAILQ_FIRST(&sq->sq_queue))) {
-    TAILQ_REMOVE(&sq->sq_queue, sm, sm_link);
+    streaming_queue_remove(sq, sm);
     _process_msg(ts, sm, NULL);
   }
   pthread_mutex_unlock(&sq->sq_mutex);
+
+  /* Make everything visible to the reader */
+  _flush_staged(ts);
 }
 
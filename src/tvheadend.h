@@ -136,7 +136,8 @@ typedef enum {
 typedef void (gti_callback_t)(void *opaque);
 
 typedef struct gtimer {
-  LIST_ENTRY(gtimer) gti_link;
+  int gti_slot;                ///< Index in the timer heap
+  uint32_t gti_seq;            ///< Arm order (ties on gti_expire)
   gti_callback_t *gti_callback;
   void *gti_opaque;
   struct timespec gti_expire;
@@ -156,6 +157,8 @@ void gtimer_arm_abs2(gtimer_t *gti, gti_callback_t *callback, void *opaque,
 
 void gtimer_disarm(gtimer_t *gti);
 
+htsmsg_t *gtimer_stats(void);
+
 
 /*
  * List / Queue header declarations
@@ -462,6 +465,17 @@ typedef struct streaming_queue {
   pthread_cond_t  sq_cond;     /* Condvar for signalling new packets */
 
   size_t          sq_maxsize;  /* Max queue size (bytes) */
+  size_t          sq_hiwater;  /* Start dropping B/P frames (bytes) */
+  size_t          sq_lowater;  /* Stop dropping frames (bytes) */
+
+  size_t          sq_size;     /* Queued payload (bytes) */
+  uint32_t        sq_count;    /* Queued messages */
+  int             sq_congested;/* Above high watermark (until low) */
+  int             sq_drop_ref; /* Reference frame dropped, wait for I */
+  uint32_t        sq_dropstats[4]; /* Drops per frame type (PKT_NTYPES) */
+
+  char           *sq_name;     /* Name in the status list */
+  LIST_ENTRY(streaming_queue) sq_link;
   
   struct streaming_message_queue sq_queue;
 
@@ -590,9 +604,19 @@ void tvh_pipe_close(th_pipe_t *pipe);
 
 int tvh_write(int fd, const void *buf, size_t len);
 
+struct iovec;
+int tvh_writev(int fd, struct iovec *iov, int iovcnt);
+
 void hexdump(const char *pfx, const uint8_t *data, int len);
 
 uint32_t tvh_crc32(const uint8_t *data, size_t datalen, uint32_t crc);
+uint32_t tvh_crc32_sb8(const uint8_t *data, size_t datalen, uint32_t crc);
+#if ENABLE_PCLMUL
+uint32_t tvh_crc32_pclmul(const uint8_t *data, size_t datalen, uint32_t crc);
+int tvh_crc32_pclmul_init(void);
+#endif
+void tvh_crc32_init(void);
+void tvh_crc32_benchmark(void);
 
 int base64_decode(uint8_t *out, const char *in, int out_size);
 
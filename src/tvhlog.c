@@ -24,6 +24,64 @@
 #include <sys/time.h>
 
 #include "webui/webui.h"
+#include "atomic.h"
+
+#define TVHLOG_MSG_MAX   1024
+#define TVHLOG_RING_SIZE (128*1024) /* per thread, must be a power of 2 */
+
+/*
+ * The subsystem config compiled for the lock-free check, a new filter
+ * is built on every change. The masks have a hash bit set for each
+ * enabled subsystem, a clear bit rejects the message without the map
+ * lookups. Replaced filters are never freed as the other threads may
+ * still read them (config changes are rare).
+ */
+typedef struct tvhlog_filter
+{
+  struct tvhlog_filter    *next;
+  uint64_t                 debug_mask;
+  uint64_t                 trace_mask;
+  htsmsg_t                *debug;
+  htsmsg_t                *trace;
+} tvhlog_filter_t;
+
+/*
+ * Each logging thread writes to its own ring, drained by tvhlog_thread.
+ * The records are never split at the ring end, the rest of the buffer
+ * is skipped instead.
+ */
+typedef struct tvhlog_rec
+{
+  uint32_t                 seq;
+  uint16_t                 len;       /* TVHLOG_REC_WRAP = skip to start */
+  uint8_t                  severity;
+  uint8_t                  notify;
+  struct timeval           time;
+} tvhlog_rec_t;
+
+#define TVHLOG_REC_WRAP    0xffff
+#define TVHLOG_REC_SIZE(l) ((sizeof(tvhlog_rec_t) + (l) + 1 + 7) & ~7)
+
+typedef struct tvhlog_ring
+{
+  LIST_ENTRY(tvhlog_ring)  link;
+  volatile uint32_t        head;      /* written by the owner thread */
+  volatile uint32_t        tail;      /* written by tvhlog_thread */
+  volatile int             dropped;
+  int                      full;      /* drop until half empty */
+  int                      reported;
+  volatile int             dead;
+  long                     tid;
+  uint8_t                  data[TVHLOG_RING_SIZE];
+} tvhlog_ring_t;
+
+typedef struct tvhlog_msg
+{
+  char                     msg[TVHLOG_MSG_MAX];
+  int                      severity;
+  int                      notify;
+  struct timeval           time;
+} tvhlog_msg_t;
 
 int                      tvhlog_run;
 int                      tvhlog_level;
@@ -34,21 +92,15 @@ htsmsg_t                *tvhlog_trace;
 pthread_t                tvhlog_tid;
 pthread_mutex_t          tvhlog_mutex;
 pthread_cond_t           tvhlog_cond;
-TAILQ_HEAD(,tvhlog_msg)  tvhlog_queue;
-int                      tvhlog_queue_size;
-int                      tvhlog_queue_full;
 
-#define TVHLOG_QUEUE_MAXSIZE 10000
-#define TVHLOG_THREAD 1
+static tvhlog_filter_t * volatile tvhlog_filter;
+static tvhlog_filter_t  *tvhlog_filter_old;
 
-typedef struct tvhlog_msg
-{
-  TAILQ_ENTRY(tvhlog_msg)  link;
-  char                    *msg;
-  int                      severity;
-  int                      notify;
-  struct timeval           time;
-} tvhlog_msg_t;
+static LIST_HEAD(,tvhlog_ring) tvhlog_rings;
+static pthread_key_t     tvhlog_ring_key;
+static __thread tvhlog_ring_t *tvhlog_ring_self;
+static volatile int      tvhlog_seq;
+static volatile int      tvhlog_signalled;
 
 static const char *logtxtmeta[9][2] = {
   {"EMERGENCY", "\033[31m"},
@@ -119,16 +171,92 @@ next:
   free(s);
 }
 
+/* Subsystem hash bit */
+static inline uint64_t
+tvhlog_subsys_bit ( const char *subsys )
+{
+  uint32_t h = 2166136261U;
+  while (*subsys)
+    h = (h ^ (uint8_t)*subsys++) * 16777619U;
+  return 1ULL << (h & 63);
+}
+
+static uint64_t
+tvhlog_subsys_mask ( htsmsg_t *ss )
+{
+  uint64_t mask = 0;
+  htsmsg_field_t *f;
+  if (ss) {
+    HTSMSG_FOREACH(f, ss) {
+      if (f->hmf_type != HMF_S64 || !f->hmf_s64) continue;
+      if (!strcmp(f->hmf_name, "all"))
+        return ~0ULL;
+      mask |= tvhlog_subsys_bit(f->hmf_name);
+    }
+  }
+  return mask;
+}
+
+/* Publish the current config (single writer, under tvhlog_mutex) */
+static void
+tvhlog_filter_update ( void )
+{
+  tvhlog_filter_t *f = calloc(1, sizeof(tvhlog_filter_t));
+
+  if (tvhlog_debug) {
+    f->debug      = htsmsg_copy(tvhlog_debug);
+    f->debug_mask = tvhlog_subsys_mask(tvhlog_debug);
+  }
+  if (tvhlog_trace) {
+    f->trace      = htsmsg_copy(tvhlog_trace);
+    f->trace_mask = tvhlog_subsys_mask(tvhlog_trace);
+  }
+  if (tvhlog_filter) {
+    tvhlog_filter->next = tvhlog_filter_old;
+    tvhlog_filter_old   = tvhlog_filter;
+  }
+  atomic_barrier();
+  tvhlog_filter = f;
+}
+
+/* Check if enabled, no locking */
+static inline int
+tvhlog_filter_check ( int severity, const char *subsys )
+{
+  tvhlog_filter_t *f;
+  uint64_t bit;
+  int ok = 0;
+
+  if (severity < LOG_DEBUG)
+    return 1;
+  if (severity > tvhlog_level || !(f = tvhlog_filter))
+    return 0;
+  if (!(f->trace_mask | f->debug_mask))
+    return 0;
+  bit = tvhlog_subsys_bit(subsys);
+  if (f->trace_mask & bit) {
+    ok = htsmsg_get_u32_or_default(f->trace, "all", 0);
+    ok = htsmsg_get_u32_or_default(f->trace, subsys, ok);
+  }
+  if (!ok && severity == LOG_DEBUG && (f->debug_mask & bit)) {
+    ok = htsmsg_get_u32_or_default(f->debug, "all", 0);
+    ok = htsmsg_get_u32_or_default(f->debug, subsys, ok);
+  }
+  return ok;
+}
+
 void
 tvhlog_set_debug ( const char *subsys )
 {
   tvhlog_set_subsys(&tvhlog_debug, subsys);
+  tvhlog_filter_update();
 }
 
 void
 tvhlog_set_trace ( const char *subsys )
 {
   tvhlog_set_subsys(&tvhlog_trace, subsys);
+  tvhlog_filter_update();
 }
 
 void
@@ -205,9 +333,137 @@ tvhlog_process
         fprintf(*fp, "%s [%7s]:%s\n", t, ltxt, msg->msg);
     }
   }
-  
-  free(msg->msg);
-  free(msg);
+}
+
+/*
+ * Thread rings
+ */
+static void
+tvhlog_ring_release ( void *aux )
+{
+  tvhlog_ring_t *r = aux;
+
+  /* A later message (other key destructors) gets a new ring */
+  tvhlog_ring_self = NULL;
+  atomic_barrier();
+  r->dead = 1;
+}
+
+static tvhlog_ring_t *
+tvhlog_ring_get ( void )
+{
+  tvhlog_ring_t *r = tvhlog_ring_self;
+
+  if (r)
+    return r;
+  r = calloc(1, sizeof(tvhlog_ring_t));
+  r->tid = (long)pthread_self();
+  pthread_mutex_lock(&tvhlog_mutex);
+  LIST_INSERT_HEAD(&tvhlog_rings, r, link);
+  pthread_mutex_unlock(&tvhlog_mutex);
+  pthread_setspecific(tvhlog_ring_key, r);
+  return tvhlog_ring_self = r;
+}
+
+/* Writer side, owner thread only */
+static int
+tvhlog_ring_put ( tvhlog_ring_t *r, tvhlog_rec_t *rec, const char *txt )
+{
+  uint32_t head = r->head, off, gap, need, skip = 0;
+  tvhlog_rec_t wrap;
+
+  need = TVHLOG_REC_SIZE(rec->len);
+  off  = head & (TVHLOG_RING_SIZE - 1);
+  gap  = TVHLOG_RING_SIZE - off;
+  if (gap < need)
+    skip = gap;
+  if (TVHLOG_RING_SIZE - (head - r->tail) < skip + need)
+    return -1;
+  if (skip) {
+    if (gap >= sizeof(tvhlog_rec_t)) {
+      memset(&wrap, 0, sizeof(wrap));
+      wrap.len = TVHLOG_REC_WRAP;
+      memcpy(r->data + off, &wrap, sizeof(wrap));
+    }
+    off = 0;
+  }
+  memcpy(r->data + off, rec, sizeof(tvhlog_rec_t));
+  memcpy(r->data + off + sizeof(tvhlog_rec_t), txt, rec->len);
+  r->data[off + sizeof(tvhlog_rec_t) + rec->len] = '\0';
+  atomic_barrier();
+  r->head = head + skip + need;
+  return 0;
+}
+
+/* Reader side, the header of the next record */
+static int
+tvhlog_ring_peek ( tvhlog_ring_t *r, tvhlog_rec_t *rec )
+{
+  uint32_t head = r->head, off, gap;
+
+  atomic_barrier();
+  while (r->tail != head) {
+    off = r->tail & (TVHLOG_RING_SIZE - 1);
+    gap = TVHLOG_RING_SIZE - off;
+    if (gap >= sizeof(tvhlog_rec_t)) {
+      memcpy(rec, r->data + off, sizeof(tvhlog_rec_t));
+      if (rec->len != TVHLOG_REC_WRAP)
+        return 1;
+    }
+    r->tail += gap;
+  }
+  return 0;
+}
+
+/*
+ * Get the next message in the log order, called with tvhlog_mutex
+ */
+static int
+tvhlog_next ( tvhlog_msg_t *msg )
+{
+  tvhlog_ring_t *r, *n, *best = NULL;
+  tvhlog_rec_t rec, brec;
+  int dead, d;
+
+  for (r = LIST_FIRST(&tvhlog_rings); r; r = n) {
+    n = LIST_NEXT(r, link);
+
+    /* Report the lost messages first */
+    if ((d = r->dropped - r->reported) != 0) {
+      r->reported += d;
+      snprintf(msg->msg, sizeof(msg->msg),
+               "tvhlog: %d messages dropped (tid %ld)", d, r->tid);
+      msg->severity = LOG_ERR;
+      msg->notify   = 1;
+      gettimeofday(&msg->time, NULL);
+      return 1;
+    }
+
+    dead = r->dead;
+    atomic_barrier();
+    if (!tvhlog_ring_peek(r, &rec)) {
+      if (dead) {
+        LIST_REMOVE(r, link);
+        free(r);
+      }
+      continue;
+    }
+    if (!best || (int32_t)(rec.seq - brec.seq) < 0) {
+      best = r;
+      brec = rec;
+    }
+  }
+  if (!best)
+    return 0;
+
+  memcpy(msg->msg, best->data + (best->tail & (TVHLOG_RING_SIZE - 1)) +
+                   sizeof(tvhlog_rec_t), brec.len + 1);
+  msg->severity = brec.severity;
+  msg->notify   = brec.notify;
+  msg->time     = brec.time;
+  atomic_barrier();
+  best->tail += TVHLOG_REC_SIZE(brec.len);
+  return 1;
 }
 
 /* Log */
@@ -217,14 +473,17 @@ tvhlog_thread ( void *p )
   int options;
   char *path = NULL, buf[512];
   FILE *fp = NULL;
-  tvhlog_msg_t *msg;
+  tvhlog_msg_t msg;
 
   pthread_mutex_lock(&tvhlog_mutex);
   while (1) {
 
     /* Wait */
-    if (!(msg = TAILQ_FIRST(&tvhlog_queue))) {
+    if (!tvhlog_next(&msg)) {
       if (!tvhlog_run) break;
+      /* Writers signal only when the flag was cleared, check again */
+      if (atomic_exchange(&tvhlog_signalled, 0))
+        continue;
       if (fp) {
         fclose(fp); // only issue here is we close with mutex!
                     // but overall performance will be higher
@@ -233,11 +492,6 @@ tvhlog_thread ( void *p )
       pthread_cond_wait(&tvhlog_cond, &tvhlog_mutex);
       continue;
     }
-    if (!msg) break;
-    TAILQ_REMOVE(&tvhlog_queue, msg, link);
-    tvhlog_queue_size--;
-    if (tvhlog_queue_size < (TVHLOG_QUEUE_MAXSIZE / 2))
-      tvhlog_queue_full = 0;
 
     /* Copy options and path */
     if (!fp) {
@@ -250,7 +504,7 @@ tvhlog_thread ( void *p )
     }
     options  = tvhlog_options; 
     pthread_mutex_unlock(&tvhlog_mutex);
-    tvhlog_process(msg, options, &fp, path);
+    tvhlog_process(&msg, options, &fp, path);
     pthread_mutex_lock(&tvhlog_mutex);
   }
   if (fp)
@@ -263,48 +517,26 @@ void tvhlogv ( const char *file, int line,
                int notify, int severity,
                const char *subsys, const char *fmt, va_list *args )
 {
-  int ok, options;
+  int options;
   size_t l;
-  char buf[1024];
-
-  pthread_mutex_lock(&tvhlog_mutex);
+  char buf[TVHLOG_MSG_MAX];
+  tvhlog_ring_t *r;
+  tvhlog_rec_t rec;
 
-  /* Check for full */
-  if (tvhlog_queue_full || !tvhlog_run) {
-    pthread_mutex_unlock(&tvhlog_mutex);
+  /* Check enabled, before anything else */
+  if (!tvhlog_run || !tvhlog_filter_check(severity, subsys))
     return;
-  }
 
-  /* Check debug enabled (and cache config) */
+  r       = tvhlog_ring_get();
   options = tvhlog_options;
-  if (severity >= LOG_DEBUG) {
-    ok = 0;
-    if (severity <= tvhlog_level) {
-      if (tvhlog_trace) {
-        ok = htsmsg_get_u32_or_default(tvhlog_trace, "all", 0);
-        ok = htsmsg_get_u32_or_default(tvhlog_trace, subsys, ok);
-      }
-      if (!ok && severity == LOG_DEBUG && tvhlog_debug) {
-        ok = htsmsg_get_u32_or_default(tvhlog_debug, "all", 0);
-        ok = htsmsg_get_u32_or_default(tvhlog_debug, subsys, ok);
-      }
-    }
-  } else {
-    ok = 1;
-  }
 
-  /* Ignore */
-  if (!ok) {
-    pthread_mutex_unlock(&tvhlog_mutex);
-    return;
-  }
-
-  /* FULL */
-  if (tvhlog_queue_size == TVHLOG_QUEUE_MAXSIZE) {
-    tvhlog_queue_full = 1;
-    fmt      = "log buffer full";
-    args     = NULL;
-    severity = LOG_ERR;
+  /* Full, don't bother formatting */
+  if (r->full) {
+    if (r->head - r->tail > TVHLOG_RING_SIZE / 2) {
+      r->dropped++;
+      return;
+    }
+    r->full = 0;
   }
 
   /* Basic message */
@@ -321,25 +553,23 @@ void tvhlogv ( const char *file, int line,
     l += snprintf(buf + l, sizeof(buf) - l, "%s", fmt);
 
   /* Store */
-  tvhlog_msg_t *msg = calloc(1, sizeof(tvhlog_msg_t));
-  gettimeofday(&msg->time, NULL);
-  msg->msg      = strdup(buf);
-  msg->severity = severity;
-  msg->notify   = notify;
-#if TVHLOG_THREAD
-  if (tvhlog_run) {
-    TAILQ_INSERT_TAIL(&tvhlog_queue, msg, link);
-    tvhlog_queue_size++;
+  gettimeofday(&rec.time, NULL);
+  rec.seq      = atomic_add(&tvhlog_seq, 1);
+  rec.len      = MIN(l, sizeof(buf) - 1);
+  rec.severity = severity;
+  rec.notify   = notify;
+  if (tvhlog_ring_put(r, &rec, buf)) {
+    r->full = 1;
+    r->dropped++;
+    return;
+  }
+
+  /* Wake up the log thread (once until it runs out of messages) */
+  if (!atomic_exchange(&tvhlog_signalled, 1)) {
+    pthread_mutex_lock(&tvhlog_mutex);
     pthread_cond_signal(&tvhlog_cond);
-  } else {
-#endif
-    FILE *fp = NULL;
-    tvhlog_process(msg, tvhlog_options, &fp, tvhlog_path);
-    if (fp) fclose(fp);
-#if TVHLOG_THREAD
+    pthread_mutex_unlock(&tvhlog_mutex);
   }
-#endif
-  pthread_mutex_unlock(&tvhlog_mutex);
 }
 
 
@@ -366,14 +596,11 @@ _tvhlog_hexdump(const char *file, int line,
                 const char *subsys,
                 const uint8_t *data, ssize_t len )
 {
-  int i, c, skip;
+  int i, c;
   char str[1024];
 
   /* Don't process if trace is OFF */
-  pthread_mutex_lock(&tvhlog_mutex);
-  skip = (severity > tvhlog_level);
-  pthread_mutex_unlock(&tvhlog_mutex);
-  if (skip) return;
+  if (!tvhlog_filter_check(severity, subsys)) return;
  
   /* Build and log output */
   while (len > 0) {
@@ -416,7 +643,9 @@ tvhlog_init ( int level, int options, const char *path )
   openlog("tvheadend", LOG_PID, LOG_DAEMON);
   pthread_mutex_init(&tvhlog_mutex, NULL);
   pthread_cond_init(&tvhlog_cond, NULL);
-  TAILQ_INIT(&tvhlog_queue);
+  pthread_key_create(&tvhlog_ring_key, tvhlog_ring_release);
+  LIST_INIT(&tvhlog_rings);
+  tvhlog_filter_update();
 }
 
 void
@@ -437,4 +666,6 @@ tvhlog_end ( void )
   free(tvhlog_path);
   htsmsg_destroy(tvhlog_debug);
   htsmsg_destroy(tvhlog_trace);
+  /* The rings and filters are left alone, threads still running may
+     be inside tvhlogv() (or hold their ring) */
 }
@@ -99,8 +99,8 @@ static uint32_t crc_tab[256] = {
   0xbcb4666d, 0xb8757bda, 0xb5365d03, 0xb1f740b4
 };
 
-uint32_t
-tvh_crc32(const uint8_t *data, size_t datalen, uint32_t crc)
+static uint32_t
+tvh_crc32_byte(const uint8_t *data, size_t datalen, uint32_t crc)
 {
   while(datalen--)
     crc = (crc << 8) ^ crc_tab[((crc >> 24) ^ *data++) & 0xff];
@@ -108,6 +108,158 @@ tvh_crc32(const uint8_t *data, size_t datalen, uint32_t crc)
   return crc;
 }
 
+/*
+ * Slicing-by-8, crc_sb8[n][b] is the CRC of byte b followed by n zeros
+ */
+static uint32_t crc_sb8[8][256];
+
+uint32_t
+tvh_crc32_sb8(const uint8_t *data, size_t datalen, uint32_t crc)
+{
+  uint32_t one;
+
+  for ( ; datalen >= 8; datalen -= 8, data += 8) {
+    one = crc ^ (((uint32_t)data[0] << 24) | (data[1] << 16) |
+                 (data[2] << 8) | data[3]);
+    crc = crc_sb8[7][one >> 24] ^ crc_sb8[6][(one >> 16) & 0xff] ^
+          crc_sb8[5][(one >> 8) & 0xff] ^ crc_sb8[4][one & 0xff] ^
+          crc_sb8[3][data[4]] ^ crc_sb8[2][data[5]] ^
+          crc_sb8[1][data[6]] ^ crc_sb8[0][data[7]];
+  }
+  return tvh_crc32_byte(data, datalen, crc);
+}
+
+/*
+ * Implementations, fastest first
+ */
+typedef uint32_t (*tvh_crc32_fn_t)(const uint8_t *, size_t, uint32_t);
+
+typedef struct {
+  const char    *name;
+  tvh_crc32_fn_t fn;
+  int            usable;
+} tvh_crc32_impl_t;
+
+static tvh_crc32_impl_t crc32_impls[] = {
+#if ENABLE_PCLMUL
+  { "pclmul",    tvh_crc32_pclmul },
+#endif
+  { "slicing-8", tvh_crc32_sb8    },
+  { "bytewise",  tvh_crc32_byte, 1 },
+};
+
+#define CRC32_IMPLS (sizeof(crc32_impls) / sizeof(crc32_impls[0]))
+#define CRC32_TEST_LEN 1100
+
+// Note: usable before tvh_crc32_init()
+static tvh_crc32_fn_t crc32_fn = tvh_crc32_byte;
+
+uint32_t
+tvh_crc32(const uint8_t *data, size_t datalen, uint32_t crc)
+{
+  return crc32_fn(data, datalen, crc);
+}
+
+/*
+ * Compare against the byte table for every length up to (and past)
+ * the largest PSI section, at every alignment of a 16 byte block
+ */
+static int
+tvh_crc32_selftest(tvh_crc32_fn_t fn)
+{
+  static const uint32_t init[] = { 0xffffffff, 0, 0x12345678 };
+  uint8_t *buf = malloc(CRC32_TEST_LEN + 16);
+  uint32_t seed = 0x87654321;
+  size_t i, len, off;
+  int ret = 1;
+
+  for (i = 0; i < CRC32_TEST_LEN + 16; i++) {
+    seed = seed * 1103515245 + 12345;
+    buf[i] = seed >> 16;
+  }
+  for (len = 0; len <= CRC32_TEST_LEN && ret; len++)
+    for (off = 0; off < 16 && ret; off++)
+      for (i = 0; i < ARRAY_SIZE(init); i++)
+        if (fn(buf + off, len, init[i]) !=
+            tvh_crc32_byte(buf + off, len, init[i])) {
+          ret = 0;
+          break;
+        }
+  free(buf);
+  return ret;
+}
+
+void
+tvh_crc32_init(void)
+{
+  tvh_crc32_impl_t *ci;
+  int i, j;
+
+  for (i = 0; i < 256; i++)
+    crc_sb8[0][i] = crc_tab[i];
+  for (j = 1; j < 8; j++)
+    for (i = 0; i < 256; i++)
+      crc_sb8[j][i] = (crc_sb8[j-1][i] << 8) ^
+                      crc_tab[crc_sb8[j-1][i] >> 24];
+
+  for (ci = crc32_impls; ci != crc32_impls + CRC32_IMPLS - 1; ci++) {
+#if ENABLE_PCLMUL
+    if (ci->fn == tvh_crc32_pclmul && !tvh_crc32_pclmul_init())
+      continue;
+#endif
+    ci->usable = tvh_crc32_selftest(ci->fn);
+    if (!ci->usable)
+      tvhlog(LOG_ERR, "crc32", "%s failed self-test, disabled", ci->name);
+  }
+
+  for (ci = crc32_impls; !ci->usable; ci++);
+  crc32_fn = ci->fn;
+  tvhlog(LOG_DEBUG, "crc32", "using %s implementation", ci->name);
+}
+
+/*
+ * Microbenchmark all usable implementations
+ */
+void
+tvh_crc32_benchmark(void)
+{
+  static const size_t sizes[] = { 188, 1024, 4096 };
+  tvh_crc32_impl_t *ci;
+  struct timespec ts;
+  int64_t start, now, bytes;
+  volatile uint32_t crc = 0;
+  uint8_t *buf;
+  size_t i;
+
+  buf = malloc(4096);
+  for (i = 0; i < 4096; i++)
+    buf[i] = i * 7;
+
+  for (ci = crc32_impls; ci != crc32_impls + CRC32_IMPLS; ci++) {
+    if (!ci->usable) {
+      tvhlog(LOG_INFO, "crc32", "benchmark %-10s: not supported", ci->name);
+      continue;
+    }
+    for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+      bytes = 0;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      start = now = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+      while (now - start < 100000000) {
+        int n;
+        for (n = 0; n < 64; n++)
+          crc ^= ci->fn(buf, sizes[i], 0xffffffff);
+        bytes += 64 * sizes[i];
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        now = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+      }
+      tvhlog(LOG_INFO, "crc32", "benchmark %-10s %4zu bytes: %.2f GB/s%s",
+             ci->name, sizes[i], (double)bytes / (now - start),
+             ci->fn == crc32_fn ? " (selected)" : "");
+    }
+  }
+  free(buf);
+}
+
 
 /**
  *
@@ -0,0 +1 @@
+const char *tvheadend_version = "-unknown";
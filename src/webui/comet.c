@@ -34,6 +34,7 @@
 #include "webui/webui.h"
 #include "access.h"
 #include "tcp.h"
+#include "atomic.h"
 
 static pthread_mutex_t comet_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t comet_cond = PTHREAD_COND_INITIALIZER;
@@ -41,6 +42,8 @@ static pthread_cond_t comet_cond = PTHREAD_COND_INITIALIZER;
 #define MAILBOX_UNUSED_TIMEOUT      20
 #define MAILBOX_EMPTY_REPLY_TIMEOUT 10
 
+#define COMET_LOG_SIZE 2048 // must be a power of 2
+
 //#define mbdebug(fmt...) printf(fmt);
 #define mbdebug(fmt...)
 
@@ -50,15 +53,46 @@ static LIST_HEAD(, comet_mailbox) mailboxes;
 int mailbox_tally;
 int comet_running;
 
+/*
+ * Notifications are serialized once into a shared ring, the mailboxes
+ * only keep a cursor into it. Messages for a single mailbox (access,
+ * server address, debug toggle) are still queued in the mailbox and
+ * are delivered ahead of the ring events of the same poll, so they are
+ * not ordered against the broadcasts. Debug log events only go to the
+ * ring while some mailbox has debug enabled.
+ */
+typedef struct comet_event {
+  int    ce_refcount;
+  int    ce_debug;
+  size_t ce_len;
+  char   ce_json[0];
+} comet_event_t;
+
+static comet_event_t *comet_log[COMET_LOG_SIZE];
+static uint64_t comet_log_head; /* Sequence of the next event */
+static int comet_debug; /* Mailboxes with debug enabled */
+
 typedef struct comet_mailbox {
   char *cmb_boxid; /* SHA-1 hash */
   htsmsg_t *cmb_messages; /* A vector */
+  uint64_t cmb_seq; /* Next event from the log */
   time_t cmb_last_used;
   LIST_ENTRY(comet_mailbox) cmb_link;
   int cmb_debug;
 } comet_mailbox_t;
 
 
+/**
+ *
+ */
+static void
+comet_event_unref(comet_event_t *ce)
+{
+  if(atomic_add(&ce->ce_refcount, -1) == 1)
+    free(ce);
+}
+
+
 /**
  *
  */
@@ -70,6 +104,8 @@ cmb_destroy(comet_mailbox_t *cmb)
   if(cmb->cmb_messages != NULL)
     htsmsg_destroy(cmb->cmb_messages);
 
+  if(cmb->cmb_debug)
+    comet_debug--;
   LIST_REMOVE(cmb, cmb_link);
 
   free(cmb->cmb_boxid);
@@ -125,6 +161,7 @@ comet_mailbox_create(void)
   id[40] = 0;
 
   cmb->cmb_boxid = strdup(id);
+  cmb->cmb_seq = comet_log_head;
   time(&cmb->cmb_last_used);
   mailbox_tally++;
 
@@ -181,6 +218,28 @@ comet_serverIpPort(http_connection_t *hc, comet_mailbox_t *cmb)
 }
 
 
+/**
+ * Check for something to deliver, the debug events are skipped
+ * for mailboxes without debug
+ */
+static int
+comet_mailbox_pending(comet_mailbox_t *cmb)
+{
+  comet_event_t *ce;
+
+  if(cmb->cmb_messages != NULL)
+    return 1;
+  if(comet_log_head - cmb->cmb_seq > COMET_LOG_SIZE)
+    return 1;
+  for( ; cmb->cmb_seq != comet_log_head; cmb->cmb_seq++) {
+    ce = comet_log[cmb->cmb_seq & (COMET_LOG_SIZE - 1)];
+    if(!ce->ce_debug || cmb->cmb_debug)
+      return 1;
+  }
+  return 0;
+}
+
+
 /**
  * Poll callback
  */
@@ -194,6 +253,10 @@ comet_mailbox_poll(http_connection_t *hc, const char *remain, void *opaque)
   time_t reqtime;
   struct timespec ts;
   htsmsg_t *m;
+  htsmsg_field_t *f;
+  comet_event_t *ce, **evs;
+  char boxid[41];
+  int i, n = 0, lost = 0, first = 1;
 
   if(!im)
     usleep(100000); /* Always sleep 0.1 sec to avoid comet storms */
@@ -221,7 +284,7 @@ comet_mailbox_poll(http_connection_t *hc, const char *remain, void *opaque)
 
   cmb->cmb_last_used = 0; /* Make sure we're not flushed out */
 
-  if(!im && cmb->cmb_messages == NULL) {
+  if(!im && !comet_mailbox_pending(cmb)) {
     pthread_cond_timedwait(&comet_cond, &comet_mutex, &ts);
     if (!comet_running) {
       pthread_mutex_unlock(&comet_mutex);
@@ -229,17 +292,55 @@ comet_mailbox_poll(http_connection_t *hc, const char *remain, void *opaque)
     }
   }
 
-  m = htsmsg_create_map();
-  htsmsg_add_str(m, "boxid", cmb->cmb_boxid);
-  htsmsg_add_msg(m, "messages", cmb->cmb_messages ?: htsmsg_create_list());
+  m = cmb->cmb_messages;
   cmb->cmb_messages = NULL;
-  
+
+  /* Events were overwritten before the client got them */
+  if(comet_log_head - cmb->cmb_seq > COMET_LOG_SIZE) {
+    cmb->cmb_seq = comet_log_head;
+    lost = 1;
+  }
+
+  /* Reference the events, the copy is done without the lock */
+  evs = malloc(MAX(comet_log_head - cmb->cmb_seq, 1) * sizeof(*evs));
+  for( ; cmb->cmb_seq != comet_log_head; cmb->cmb_seq++) {
+    ce = comet_log[cmb->cmb_seq & (COMET_LOG_SIZE - 1)];
+    if(ce->ce_debug && !cmb->cmb_debug)
+      continue;
+    atomic_add(&ce->ce_refcount, 1);
+    evs[n++] = ce;
+  }
+
+  strcpy(boxid, cmb->cmb_boxid);
   cmb->cmb_last_used = dispatch_clock;
 
   pthread_mutex_unlock(&comet_mutex);
 
-  htsmsg_json_serialize(m, &hc->hc_reply, 0);
-  htsmsg_destroy(m);
+  /* Same as the serialized map {"boxid": .., "messages": [..]} */
+  htsbuf_qprintf(&hc->hc_reply, "{\"boxid\": \"%s\",\"messages\": [", boxid);
+  if(lost) {
+    htsbuf_qprintf(&hc->hc_reply, "{\"notificationClass\": \"reload\"}");
+    first = 0;
+  }
+  if(m) {
+    HTSMSG_FOREACH(f, m) {
+      if(!first)
+        htsbuf_append(&hc->hc_reply, ",", 1);
+      htsmsg_json_serialize(htsmsg_get_map_by_field(f), &hc->hc_reply, 0);
+      first = 0;
+    }
+    htsmsg_destroy(m);
+  }
+  for(i = 0; i < n; i++) {
+    if(!first)
+      htsbuf_append(&hc->hc_reply, ",", 1);
+    htsbuf_append(&hc->hc_reply, evs[i]->ce_json, evs[i]->ce_len);
+    comet_event_unref(evs[i]);
+    first = 0;
+  }
+  htsbuf_append(&hc->hc_reply, "]}", 2);
+  free(evs);
+
   http_output_content(hc, "text/x-json; charset=UTF-8");
   return 0;
 }
@@ -263,6 +364,7 @@ comet_mailbox_dbg(http_connection_t *hc, const char *remain, void *opaque)
     if(!strcmp(cmb->cmb_boxid, cometid)) {
       char buf[64];
       cmb->cmb_debug = !cmb->cmb_debug;
+      comet_debug += cmb->cmb_debug ? 1 : -1;
  
       if(cmb->cmb_messages == NULL)
 	cmb->cmb_messages = htsmsg_create_list();
@@ -301,10 +403,17 @@ comet_done(void)
 {
   comet_mailbox_t *cmb;
 
+  int i;
+
   pthread_mutex_lock(&comet_mutex);
   comet_running = 0;
   while ((cmb = LIST_FIRST(&mailboxes)) != NULL)
     cmb_destroy(cmb);
+  for (i = 0; i < COMET_LOG_SIZE; i++) {
+    if (comet_log[i])
+      comet_event_unref(comet_log[i]);
+    comet_log[i] = NULL;
+  }
   pthread_mutex_unlock(&comet_mutex);
 }
 
@@ -314,20 +423,45 @@ comet_done(void)
 void
 comet_mailbox_add_message(htsmsg_t *m, int isdebug)
 {
-  comet_mailbox_t *cmb;
+  comet_event_t *ce, **slot;
+  htsbuf_queue_t hq;
+  int skip;
 
+  /* Nobody listening (the new mailboxes start at the log head), or
+     debug nobody asked for that would just push the others out */
   pthread_mutex_lock(&comet_mutex);
+  skip = LIST_EMPTY(&mailboxes) || (isdebug && !comet_debug);
+  pthread_mutex_unlock(&comet_mutex);
+  if (skip)
+    return;
+
+  /* Serialize once, outside of the lock */
+  htsbuf_queue_init(&hq, 0);
+  htsmsg_json_serialize(m, &hq, 0);
+  ce = malloc(sizeof(comet_event_t) + hq.hq_size);
+  ce->ce_refcount = 1;
+  ce->ce_debug    = isdebug;
+  ce->ce_len      = hq.hq_size;
+  htsbuf_read(&hq, ce->ce_json, ce->ce_len);
+  htsbuf_queue_flush(&hq);
 
-  if (comet_running) {
-    LIST_FOREACH(cmb, &mailboxes, cmb_link) {
+  pthread_mutex_lock(&comet_mutex);
 
-      if(isdebug && !cmb->cmb_debug)
-        continue;
+  /* Check again, things may have changed meanwhile */
+  if (LIST_EMPTY(&mailboxes) || (isdebug && !comet_debug)) {
+    pthread_mutex_unlock(&comet_mutex);
+    free(ce);
+    return;
+  }
 
-      if(cmb->cmb_messages == NULL)
-        cmb->cmb_messages = htsmsg_create_list();
-      htsmsg_add_msg(cmb->cmb_messages, NULL, htsmsg_copy(m));
-    }
+  if (comet_running) {
+    slot = &comet_log[comet_log_head & (COMET_LOG_SIZE - 1)];
+    if (*slot)
+      comet_event_unref(*slot);
+    *slot = ce;
+    comet_log_head++;
+  } else {
+    free(ce);
   }
 
   pthread_cond_broadcast(&comet_cond);
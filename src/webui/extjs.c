@@ -48,6 +48,7 @@
 #include "timeshift.h"
 #include "tvhtime.h"
 #include "input.h"
+#include "descrambler/tvhcsa.h"
 
 #if ENABLE_LIBAV
 #include "plumbing/transcoding.h"
@@ -751,7 +752,7 @@ extjs_epg(http_connection_t *hc, const char *remain, void *opaque)
   epg_episode_t *ee = NULL;
   epg_genre_t *eg = NULL, genre;
   channel_t *ch;
-  int start = 0, end, limit, i;
+  int start = 0, limit, i;
   const char *s;
   char buf[100];
   const char *channel = http_arg_get(&hc->hc_req_args, "channel");
@@ -793,17 +794,12 @@ extjs_epg(http_connection_t *hc, const char *remain, void *opaque)
 
   pthread_mutex_lock(&global_lock);
 
-  epg_query(&eqr, channel, tag, eg, title, lang, min_duration, max_duration);
-
-  epg_query_sort(&eqr);
-
-  htsmsg_add_u32(out, "totalCount", eqr.eqr_entries);
+  epg_query_paged(&eqr, channel, tag, eg, title, lang,
+                  min_duration, max_duration, start, limit);
 
+  htsmsg_add_u32(out, "totalCount", eqr.eqr_total);
 
-  start = MIN(start, eqr.eqr_entries);
-  end = MIN(start + limit, eqr.eqr_entries);
-
-  for(i = start; i < end; i++) {
+  for(i = 0; i < eqr.eqr_entries; i++) {
     e  = eqr.eqr_array[i];
     ee = e->episode;
     ch = e->channel;
@@ -1535,8 +1531,13 @@ extjs_config(http_connection_t *hc, const char *remain, void *opaque)
       save |= config_set_muxconfpath(str);
     if ((str = http_arg_get(&hc->hc_req_args, "language")))
       save |= config_set_language(str);
+    if ((str = http_arg_get(&hc->hc_req_args, "descrambler_threads")))
+      save |= config_set_descrambler_threads(atoi(str));
     if (save)
       config_save();
+#if ENABLE_TVHCSA
+    tvhcsa_pool_threads(config_get_descrambler_threads());
+#endif
 
     /* Time */
     str = http_arg_get(&hc->hc_req_args, "tvhtime_update_enabled");
@@ -1706,6 +1707,8 @@ extjs_timeshift(http_connection_t *hc, const char *remain, void *opaque)
     htsmsg_add_u32(m, "timeshift_max_period", timeshift_max_period / 60);
     htsmsg_add_u32(m, "timeshift_unlimited_size", timeshift_unlimited_size);
     htsmsg_add_u32(m, "timeshift_max_size", timeshift_max_size / 1048576);
+    htsmsg_add_u32(m, "timeshift_ram_size", timeshift_ram_size / 1048576);
+    htsmsg_add_u32(m, "timeshift_ram_client_size", timeshift_ram_client_size / 1048576);
     pthread_mutex_unlock(&global_lock);
     out = json_single_record(m, "config");
 
@@ -1725,6 +1728,10 @@ extjs_timeshift(http_connection_t *hc, const char *remain, void *opaque)
     timeshift_unlimited_size = http_arg_get(&hc->hc_req_args, "timeshift_unlimited_size") ? 1 : 0;
     if ((str = http_arg_get(&hc->hc_req_args, "timeshift_max_size")))
       timeshift_max_size   = atol(str) * 1048576LL;
+    if ((str = http_arg_get(&hc->hc_req_args, "timeshift_ram_size")))
+      timeshift_ram_size   = atol(str) * 1048576LL;
+    if ((str = http_arg_get(&hc->hc_req_args, "timeshift_ram_client_size")))
+      timeshift_ram_client_size = atol(str) * 1048576LL;
     timeshift_save();
     pthread_mutex_unlock(&global_lock);
 
@@ -13,11 +13,17 @@ Ext.extend(tvheadend.Comet = function() {
         autorec: true,
         dvrdb: true,
         dvrconfig: true,
-        channels: true
+        channels: true,
+        reload: true
     });
 }, Ext.util.Observable);
 
 tvheadend.comet = new tvheadend.Comet();
+
+/* Notifications were lost, the page is out of date */
+tvheadend.comet.on('reload', function() {
+    window.location.reload();
+});
 tvheadend.boxid = null;
 
 tvheadend.cometPoller = function() {
@@ -43,7 +43,8 @@ tvheadend.miscconf = function() {
     [
         'muxconfpath', 'language',
         'tvhtime_update_enabled', 'tvhtime_ntp_enabled',
-        'tvhtime_tolerance', 'transcoding_enabled'
+        'tvhtime_tolerance', 'transcoding_enabled',
+        'descrambler_threads'
     ]);
 
     /* ****************************************************************
@@ -204,6 +205,26 @@ tvheadend.miscconf = function() {
     if (tvheadend.capabilities.indexOf('transcoding') === -1)
         transcodingPanel.hide();
 
+    /*
+    * Descrambler
+    */
+
+    var descramblerThreads = new Ext.form.NumberField({
+        name: 'descrambler_threads',
+        fieldLabel: 'Worker threads (0 = inline)',
+        allowDecimals: false,
+        allowNegative: false,
+        maxValue: 64
+    });
+
+    var descramblerPanel = new Ext.form.FieldSet({
+        title: 'Descrambler',
+        width: 700,
+        autoHeight: true,
+        collapsible: true,
+        animCollapse: true,
+        items: [descramblerThreads]
+    });
 
     /* ****************************************************************
     * Form
@@ -232,7 +253,8 @@ tvheadend.miscconf = function() {
         layout: 'form',
         defaultType: 'textfield',
         autoHeight: true,
-        items: [languageWrap, dvbscanWrap, tvhtimePanel, transcodingPanel]
+        items: [languageWrap, dvbscanWrap, tvhtimePanel, transcodingPanel,
+                descramblerPanel]
     });
 
     var _items = [confpanel];
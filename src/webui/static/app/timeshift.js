@@ -12,7 +12,8 @@ tvheadend.timeshift = function() {
         'timeshift_enabled', 'timeshift_ondemand',
         'timeshift_path',
         'timeshift_unlimited_period', 'timeshift_max_period',
-        'timeshift_unlimited_size', 'timeshift_max_size'
+        'timeshift_unlimited_size', 'timeshift_max_size',
+        'timeshift_ram_size', 'timeshift_ram_client_size'
     ]
             );
 
@@ -65,6 +66,20 @@ tvheadend.timeshift = function() {
         width: 300
     });
 
+    var timeshiftRamSize = new Ext.form.NumberField({
+        fieldLabel: 'Max. RAM Size (MB)',
+        name: 'timeshift_ram_size',
+        allowBlank: false,
+        width: 300
+    });
+
+    var timeshiftRamClientSize = new Ext.form.NumberField({
+        fieldLabel: 'Max. RAM per Client (MB)',
+        name: 'timeshift_ram_client_size',
+        allowBlank: false,
+        width: 300
+    });
+
     /* ****************************************************************
      * Events
      * ***************************************************************/
@@ -123,7 +138,9 @@ tvheadend.timeshift = function() {
                 layout: 'column', 
                 border: false,
                 items: [timeshiftPanelA, timeshiftPanelB]
-            }	
+            },
+            timeshiftRamSize,
+            timeshiftRamClientSize
         ]
     });
 
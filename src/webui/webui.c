@@ -269,7 +269,7 @@ http_stream_run(http_connection_t *hc, streaming_queue_t *sq,
     }
 
     timeouts = 0; //Reset timeout counter
-    TAILQ_REMOVE(&sq->sq_queue, sm, sm_link);
+    streaming_queue_remove(sq, sm);
     pthread_mutex_unlock(&sq->sq_mutex);
 
     switch(sm->sm_type) {
@@ -694,9 +694,9 @@ http_stream_service(http_connection_t *hc, service_t *service, int weight)
   muxer_container_type_t mc;
   int flags;
   const char *str;
-  size_t qsize;
+  size_t qsize, qlow, qhigh;
   const char *name;
-  char addrbuf[50];
+  char addrbuf[50], sqname[256];
 
   cfg = dvr_config_find_by_name_default("");
 
@@ -710,6 +710,8 @@ http_stream_service(http_connection_t *hc, service_t *service, int weight)
     qsize = atoll(str);
   else
     qsize = 1500000;
+  qlow  = (str = http_arg_get(&hc->hc_req_args, "qlow"))  ? atoll(str) : 0;
+  qhigh = (str = http_arg_get(&hc->hc_req_args, "qhigh")) ? atoll(str) : 0;
 
   if(mc == MC_PASS || mc == MC_RAW) {
     streaming_queue_init2(&sq, SMT_PACKET, qsize);
@@ -726,12 +728,15 @@ http_stream_service(http_connection_t *hc, service_t *service, int weight)
   }
 
   tcp_get_ip_str((struct sockaddr*)hc->hc_peer, addrbuf, 50);
+  streaming_queue_set_watermarks(&sq, qlow, qhigh);
 
   s = subscription_create_from_service(service, weight ?: 100, "HTTP", st, flags,
 				       addrbuf,
 				       hc->hc_username,
 				       http_arg_get(&hc->hc_args, "User-Agent"));
   if(s) {
+    snprintf(sqname, sizeof(sqname), "HTTP: %s %s", addrbuf, hc->hc_url_orig);
+    streaming_queue_register(&sq, sqname);
     name = tvh_strdupa(service->s_nicename);
     pthread_mutex_unlock(&global_lock);
     http_stream_run(hc, &sq, name, mc, s, &cfg->dvr_muxcnf);
@@ -763,7 +768,7 @@ http_stream_mux(http_connection_t *hc, mpegts_mux_t *mm, int weight)
   th_subscription_t *s;
   streaming_queue_t sq;
   const char *name;
-  char addrbuf[50];
+  char addrbuf[50], sqname[256];
   muxer_config_t muxcfg = { 0 };
 
   streaming_queue_init(&sq, SMT_PACKET);
@@ -774,8 +779,12 @@ http_stream_mux(http_connection_t *hc, mpegts_mux_t *mm, int weight)
                                    SUBSCRIPTION_FULLMUX,
                                    addrbuf, hc->hc_username,
                                    http_arg_get(&hc->hc_args, "User-Agent"), NULL);
-  if (!s)
+  if (!s) {
+    streaming_queue_deinit(&sq);
     return HTTP_STATUS_BAD_REQUEST;
+  }
+  snprintf(sqname, sizeof(sqname), "HTTP: %s %s", addrbuf, hc->hc_url_orig);
+  streaming_queue_register(&sq, sqname);
   name = tvh_strdupa(s->ths_title);
   pthread_mutex_unlock(&global_lock);
   http_stream_run(hc, &sq, name, MC_RAW, s, &muxcfg);
@@ -788,6 +797,486 @@ http_stream_mux(http_connection_t *hc, mpegts_mux_t *mm, int weight)
 }
 #endif
 
+/**
+ * Shared channel streams
+ *
+ * Identical channel requests (same container, no transcoding) share one
+ * subscription and muxer. The muxer output of each packet becomes a
+ * refcounted chunk in a ring which every connection sends at its own
+ * pace. New clients get the container header and join at the next chunk,
+ * clients falling too far behind are disconnected.
+ */
+#define HTTP_SHARE_SLOTS     2048             // chunks kept in the ring
+#define HTTP_SHARE_RING_SIZE (8 * 1024 * 1024) // bytes kept in the ring
+#define HTTP_SHARE_LAG       (4 * 1024 * 1024) // default client lag limit
+
+typedef struct http_share_chunk {
+  int      hsc_refcount;
+  uint64_t hsc_pos;     // stream offset
+  size_t   hsc_len;
+  size_t   hsc_size;
+  uint8_t  hsc_data[0];
+} http_share_chunk_t;
+
+typedef struct http_share_client {
+  LIST_ENTRY(http_share_client) hscl_link;
+  int                     hscl_weight;
+  const char             *hscl_hostname;
+  const char             *hscl_username;
+  const char             *hscl_agent;
+} http_share_client_t;
+
+typedef struct http_share {
+  LIST_ENTRY(http_share)  hs_link;
+  channel_t              *hs_channel;
+  muxer_container_type_t  hs_mc;
+  char                   *hs_name;
+  int                     hs_clients;   // protected by global_lock
+  LIST_HEAD(, http_share_client) hs_client_list; // global_lock
+
+  streaming_queue_t       hs_sq;
+  streaming_target_t     *hs_gh;
+  streaming_target_t     *hs_tsfix;
+  th_subscription_t      *hs_s;
+  muxer_t                *hs_mux;
+  pthread_t               hs_thread;
+  http_share_chunk_t     *hs_cur;       // being muxed (share thread only)
+
+  pthread_mutex_t         hs_mutex;     // protects the fields below
+  pthread_cond_t          hs_cond;
+  int                     hs_started;
+  int                     hs_eos;
+  const char             *hs_mime;
+  http_share_chunk_t     *hs_header;
+  http_share_chunk_t     *hs_ring[HTTP_SHARE_SLOTS];
+  uint64_t                hs_head;      // oldest chunk in the ring
+  uint64_t                hs_tail;      // next chunk
+  uint64_t                hs_pos;       // bytes muxed
+  size_t                  hs_ring_bytes;
+} http_share_t;
+
+static LIST_HEAD(, http_share) http_shares;
+
+static void
+http_share_chunk_unref(http_share_chunk_t *c)
+{
+  if (c && atomic_add(&c->hsc_refcount, -1) == 1)
+    free(c);
+}
+
+/**
+ * Muxer output
+ */
+static int
+http_share_sink(void *opaque, const void *data, size_t len)
+{
+  http_share_t *hs = opaque;
+  http_share_chunk_t *c = hs->hs_cur;
+  size_t used = c ? c->hsc_len : 0, size;
+
+  if (!c || used + len > c->hsc_size) {
+    size = MAX(MAX(used + len, 2 * used), 4096);
+    if (!(c = realloc(c, sizeof(*c) + size)))
+      return -1;
+    c->hsc_len  = used;
+    c->hsc_size = size;
+    hs->hs_cur  = c;
+  }
+  memcpy(c->hsc_data + c->hsc_len, data, len);
+  c->hsc_len += len;
+  return 0;
+}
+
+/**
+ * Append the muxed data to the ring
+ */
+static void
+http_share_commit(http_share_t *hs)
+{
+  http_share_chunk_t *c = hs->hs_cur, *o;
+
+  if (!c)
+    return;
+  hs->hs_cur = NULL;
+  c->hsc_refcount = 1;
+
+  pthread_mutex_lock(&hs->hs_mutex);
+  c->hsc_pos = hs->hs_pos;
+  hs->hs_pos += c->hsc_len;
+  while (hs->hs_head < hs->hs_tail &&
+         (hs->hs_tail - hs->hs_head >= HTTP_SHARE_SLOTS ||
+          hs->hs_ring_bytes + c->hsc_len > HTTP_SHARE_RING_SIZE)) {
+    o = hs->hs_ring[hs->hs_head++ % HTTP_SHARE_SLOTS];
+    hs->hs_ring_bytes -= o->hsc_len;
+    http_share_chunk_unref(o);
+  }
+  hs->hs_ring[hs->hs_tail++ % HTTP_SHARE_SLOTS] = c;
+  hs->hs_ring_bytes += c->hsc_len;
+  pthread_cond_broadcast(&hs->hs_cond);
+  pthread_mutex_unlock(&hs->hs_mutex);
+}
+
+static void
+http_share_set_eos(http_share_t *hs)
+{
+  pthread_mutex_lock(&hs->hs_mutex);
+  hs->hs_eos = 1;
+  pthread_cond_broadcast(&hs->hs_cond);
+  pthread_mutex_unlock(&hs->hs_mutex);
+}
+
+/**
+ * Mux the subscription output (one thread per shared stream)
+ */
+static void *
+http_share_thread(void *aux)
+{
+  http_share_t *hs = aux;
+  streaming_queue_t *sq = &hs->hs_sq;
+  streaming_message_t *sm;
+  int run = 1;
+
+  pthread_mutex_lock(&sq->sq_mutex);
+  while (run) {
+    sm = TAILQ_FIRST(&sq->sq_queue);
+    if (sm == NULL) {
+      pthread_cond_wait(&sq->sq_cond, &sq->sq_mutex);
+      continue;
+    }
+    streaming_queue_remove(sq, sm);
+    pthread_mutex_unlock(&sq->sq_mutex);
+
+    switch(sm->sm_type) {
+    case SMT_MPEGTS:
+    case SMT_PACKET:
+      if (hs->hs_started && !hs->hs_eos) {
+        muxer_write_pkt(hs->hs_mux, sm->sm_type, sm->sm_data);
+        sm->sm_data = NULL;
+        http_share_commit(hs);
+      }
+      break;
+
+    case SMT_START:
+      if (!hs->hs_started) {
+        tvhlog(LOG_DEBUG, "webui", "Start shared stream %s", hs->hs_name);
+        if (muxer_init(hs->hs_mux, sm->sm_data, hs->hs_name) < 0) {
+          http_share_set_eos(hs);
+          break;
+        }
+        pthread_mutex_lock(&hs->hs_mutex);
+        hs->hs_mime    = muxer_mime(hs->hs_mux, sm->sm_data);
+        hs->hs_header  = hs->hs_cur;
+        if (hs->hs_header)
+          hs->hs_header->hsc_refcount = 1;
+        hs->hs_cur     = NULL;
+        hs->hs_started = 1;
+        pthread_cond_broadcast(&hs->hs_cond);
+        pthread_mutex_unlock(&hs->hs_mutex);
+      } else if (muxer_reconfigure(hs->hs_mux, sm->sm_data) < 0) {
+        tvhlog(LOG_WARNING, "webui", "Unable to reconfigure shared stream %s",
+               hs->hs_name);
+      } else {
+        http_share_commit(hs);
+      }
+      break;
+
+    case SMT_STOP:
+      if (sm->sm_code == SM_CODE_SOURCE_RECONFIGURED)
+        break;
+      /* fall through */
+    case SMT_NOSTART:
+      tvhlog(LOG_WARNING, "webui", "Stop shared stream %s, %s", hs->hs_name,
+             streaming_code2txt(sm->sm_code));
+      http_share_set_eos(hs);
+      break;
+
+    case SMT_EXIT:
+      run = 0;
+      break;
+
+    default:
+      break;
+    }
+
+    streaming_msg_free(sm);
+    pthread_mutex_lock(&sq->sq_mutex);
+  }
+  pthread_mutex_unlock(&sq->sq_mutex);
+  return NULL;
+}
+
+/**
+ * Tear down a shared stream (global_lock held, no clients left)
+ */
+static void
+http_share_destroy(http_share_t *hs)
+{
+  LIST_REMOVE(hs, hs_link);
+
+  if (hs->hs_s)
+    subscription_unsubscribe(hs->hs_s);
+  streaming_target_deliver(&hs->hs_sq.sq_st, streaming_msg_create(SMT_EXIT));
+  pthread_join(hs->hs_thread, NULL);
+
+  if (hs->hs_tsfix)
+    tsfix_destroy(hs->hs_tsfix);
+  if (hs->hs_gh)
+    globalheaders_destroy(hs->hs_gh);
+  muxer_close(hs->hs_mux);
+  muxer_destroy(hs->hs_mux);
+  streaming_queue_deinit(&hs->hs_sq);
+
+  while (hs->hs_head < hs->hs_tail)
+    http_share_chunk_unref(hs->hs_ring[hs->hs_head++ % HTTP_SHARE_SLOTS]);
+  http_share_chunk_unref(hs->hs_header);
+  free(hs->hs_cur);
+  free(hs->hs_name);
+  pthread_cond_destroy(&hs->hs_cond);
+  pthread_mutex_destroy(&hs->hs_mutex);
+  free(hs);
+}
+
+/**
+ * Subscribe for a new shared stream (global_lock held)
+ */
+static http_share_t *
+http_share_create(http_connection_t *hc, channel_t *ch, int weight,
+                  muxer_container_type_t mc, muxer_config_t *mcfg)
+{
+  http_share_t *hs = calloc(1, sizeof(http_share_t));
+  streaming_target_t *st;
+  char addrbuf[50], sqname[256];
+  int flags;
+
+  hs->hs_channel = ch;
+  hs->hs_mc      = mc;
+  hs->hs_name    = strdup(channel_get_name(ch));
+  pthread_mutex_init(&hs->hs_mutex, NULL);
+  pthread_cond_init(&hs->hs_cond, NULL);
+
+  if(mc == MC_PASS || mc == MC_RAW) {
+    streaming_queue_init(&hs->hs_sq, SMT_PACKET);
+    st = &hs->hs_sq.sq_st;
+    flags = SUBSCRIPTION_RAW_MPEGTS;
+  } else {
+    streaming_queue_init(&hs->hs_sq, 0);
+    hs->hs_gh = globalheaders_create(&hs->hs_sq.sq_st);
+    st = hs->hs_tsfix = tsfix_create(hs->hs_gh);
+    flags = 0;
+  }
+  snprintf(sqname, sizeof(sqname), "HTTP shared: %s (%s)",
+           hs->hs_name, muxer_container_type2txt(mc));
+  streaming_queue_register(&hs->hs_sq, sqname);
+
+  hs->hs_mux = muxer_create(mc, mcfg);
+  muxer_open_sink(hs->hs_mux, http_share_sink, hs);
+  tvhthread_create(&hs->hs_thread, NULL, http_share_thread, hs);
+  LIST_INSERT_HEAD(&http_shares, hs, hs_link);
+
+  tcp_get_ip_str((struct sockaddr*)hc->hc_peer, addrbuf, 50);
+  hs->hs_s = subscription_create_from_channel(ch, weight ?: 100, "HTTP", st,
+               flags, addrbuf, hc->hc_username,
+               http_arg_get(&hc->hc_args, "User-Agent"));
+  if (!hs->hs_s) {
+    http_share_destroy(hs);
+    return NULL;
+  }
+  return hs;
+}
+
+/**
+ * Write a chunk, a send timeout means the client stalled
+ */
+static int
+http_share_write(int fd, const uint8_t *data, size_t len)
+{
+  ssize_t r;
+
+  while (len) {
+    r = write(fd, data, len);
+    if (r < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    data += r;
+    len  -= r;
+  }
+  return 0;
+}
+
+/**
+ * Send the shared stream to one client
+ */
+static void
+http_share_run(http_connection_t *hc, http_share_t *hs, uint64_t lag_max)
+{
+  http_share_chunk_t *c;
+  uint64_t seq = 0, pos = 0;
+  int started = 0, timeouts = 0, r;
+  struct timespec ts;
+  struct timeval  tp;
+  int err = 0;
+  socklen_t errlen = sizeof(err);
+
+  /* reduce timeout on write() for streaming */
+  tp.tv_sec  = 5;
+  tp.tv_usec = 0;
+  setsockopt(hc->hc_fd, SOL_SOCKET, SO_SNDTIMEO, &tp, sizeof(tp));
+
+  pthread_mutex_lock(&hs->hs_mutex);
+  while (tvheadend_running) {
+
+    if (hs->hs_eos) {
+      tvhlog(LOG_DEBUG, "webui", "Stop streaming %s, shared stream ended",
+             hc->hc_url_orig);
+      break;
+    }
+
+    /* Wait for data */
+    if (!hs->hs_started || (started && seq >= hs->hs_tail)) {
+      gettimeofday(&tp, NULL);
+      ts.tv_sec  = tp.tv_sec + 1;
+      ts.tv_nsec = tp.tv_usec * 1000;
+      if (pthread_cond_timedwait(&hs->hs_cond, &hs->hs_mutex, &ts) == ETIMEDOUT) {
+        timeouts++;
+        getsockopt(hc->hc_fd, SOL_SOCKET, SO_ERROR, (char *)&err, &errlen);
+        if (err) {
+          tvhlog(LOG_DEBUG, "webui", "Stop streaming %s, client hung up",
+                 hc->hc_url_orig);
+          break;
+        } else if (timeouts >= 20) {
+          tvhlog(LOG_WARNING, "webui", "Stop streaming %s, timeout waiting for packets",
+                 hc->hc_url_orig);
+          break;
+        }
+      }
+      continue;
+    }
+    timeouts = 0;
+
+    /* Join: container header, then the next chunk */
+    if (!started) {
+      c = hs->hs_header;
+      if (c)
+        atomic_add(&c->hsc_refcount, 1);
+      seq = hs->hs_tail;
+      pos = hs->hs_pos;
+      started = 1;
+      pthread_mutex_unlock(&hs->hs_mutex);
+      tvhlog(LOG_DEBUG, "webui", "Start streaming %s (shared)", hc->hc_url_orig);
+      http_output_content(hc, hs->hs_mime);
+      r = c ? http_share_write(hc->hc_fd, c->hsc_data, c->hsc_len) : 0;
+      http_share_chunk_unref(c);
+      pthread_mutex_lock(&hs->hs_mutex);
+      if (r)
+        break;
+      continue;
+    }
+
+    /* Slow client */
+    if (seq < hs->hs_head || hs->hs_pos - pos > lag_max) {
+      tvhlog(LOG_WARNING, "webui", "Stop streaming %s, client too slow "
+             "(%"PRIu64" bytes behind)", hc->hc_url_orig, hs->hs_pos - pos);
+      break;
+    }
+
+    c = hs->hs_ring[seq++ % HTTP_SHARE_SLOTS];
+    atomic_add(&c->hsc_refcount, 1);
+    pthread_mutex_unlock(&hs->hs_mutex);
+    r = http_share_write(hc->hc_fd, c->hsc_data, c->hsc_len);
+    if (!r)
+      atomic_add(&hs->hs_s->ths_bytes_out, c->hsc_len);
+    pos = c->hsc_pos + c->hsc_len;
+    http_share_chunk_unref(c);
+    pthread_mutex_lock(&hs->hs_mutex);
+    if (r) {
+      tvhlog(LOG_DEBUG, "webui", "Stop streaming %s, %s", hc->hc_url_orig,
+             ERRNO_AGAIN(errno) ? "client stalled" : "client hung up");
+      break;
+    }
+  }
+  pthread_mutex_unlock(&hs->hs_mutex);
+}
+
+/**
+ * The subscription gets the highest weight of the attached clients and
+ * only names a client while it is the only one (global_lock held)
+ */
+static void
+http_share_clients_update(http_share_t *hs)
+{
+  http_share_client_t *hscl;
+  char buf[32];
+  int weight = 0;
+
+  LIST_FOREACH(hscl, &hs->hs_client_list, hscl_link)
+    weight = MAX(weight, hscl->hscl_weight);
+  subscription_change_weight(hs->hs_s, weight);
+
+  hscl = LIST_FIRST(&hs->hs_client_list);
+  if (hs->hs_clients == 1) {
+    subscription_set_client(hs->hs_s, hscl->hscl_hostname,
+                            hscl->hscl_username, hscl->hscl_agent);
+  } else {
+    snprintf(buf, sizeof(buf), "%d shared clients", hs->hs_clients);
+    subscription_set_client(hs->hs_s, NULL, NULL, buf);
+  }
+}
+
+/**
+ * Join (or start) the shared stream of a channel
+ */
+static int
+http_stream_channel_shared(http_connection_t *hc, channel_t *ch, int weight,
+                           muxer_container_type_t mc, muxer_config_t *mcfg)
+{
+  http_share_t *hs;
+  http_share_client_t hscl;
+  const char *str;
+  char addrbuf[50];
+  uint64_t lag_max;
+  int eos;
+
+  LIST_FOREACH(hs, &http_shares, hs_link) {
+    if (hs->hs_channel != ch || hs->hs_mc != mc)
+      continue;
+    pthread_mutex_lock(&hs->hs_mutex);
+    eos = hs->hs_eos;
+    pthread_mutex_unlock(&hs->hs_mutex);
+    if (!eos)
+      break;
+  }
+  if (!hs && !(hs = http_share_create(hc, ch, weight, mc, mcfg)))
+    return HTTP_STATUS_BAD_REQUEST;
+
+  if ((str = http_arg_get(&hc->hc_req_args, "qsize")))
+    lag_max = atoll(str);
+  else
+    lag_max = HTTP_SHARE_LAG;
+
+  tcp_get_ip_str((struct sockaddr*)hc->hc_peer, addrbuf, 50);
+  hscl.hscl_weight   = weight ?: 100;
+  hscl.hscl_hostname = addrbuf;
+  hscl.hscl_username = hc->hc_username;
+  hscl.hscl_agent    = http_arg_get(&hc->hc_args, "User-Agent");
+  LIST_INSERT_HEAD(&hs->hs_client_list, &hscl, hscl_link);
+  hs->hs_clients++;
+  http_share_clients_update(hs);
+  tvhlog(LOG_DEBUG, "webui", "Shared stream %s, %d client(s)",
+         hs->hs_name, hs->hs_clients);
+  pthread_mutex_unlock(&global_lock);
+  http_share_run(hc, hs, lag_max);
+  pthread_mutex_lock(&global_lock);
+  LIST_REMOVE(&hscl, hscl_link);
+  if (--hs->hs_clients == 0)
+    http_share_destroy(hs);
+  else
+    http_share_clients_update(hs);
+
+  return 0;
+}
+
 /**
  * Subscribes to a channel and starts the streaming loop
  */
@@ -806,9 +1295,9 @@ http_stream_channel(http_connection_t *hc, channel_t *ch, int weight)
   int flags;
   muxer_container_type_t mc;
   char *str;
-  size_t qsize;
+  size_t qsize, qlow, qhigh;
   const char *name;
-  char addrbuf[50];
+  char addrbuf[50], sqname[256];
 
   cfg = dvr_config_find_by_name_default("");
 
@@ -818,10 +1307,20 @@ http_stream_channel(http_connection_t *hc, channel_t *ch, int weight)
     mc = cfg->dvr_mc;
   }
 
+  /* Share the muxer with identical requests */
+  if((mc == MC_PASS || mc == MC_RAW || mc == MC_MATROSKA || mc == MC_WEBM) &&
+#if ENABLE_LIBAV
+     ((str = http_arg_get(&hc->hc_req_args, "transcode")) == NULL || !atoi(str)) &&
+#endif
+     ((str = http_arg_get(&hc->hc_req_args, "share")) == NULL || atoi(str)))
+    return http_stream_channel_shared(hc, ch, weight, mc, &cfg->dvr_muxcnf);
+
   if ((str = http_arg_get(&hc->hc_req_args, "qsize")))
     qsize = atoll(str);
   else
     qsize = 1500000;
+  qlow  = (str = http_arg_get(&hc->hc_req_args, "qlow"))  ? atoll(str) : 0;
+  qhigh = (str = http_arg_get(&hc->hc_req_args, "qhigh")) ? atoll(str) : 0;
 
   if(mc == MC_PASS || mc == MC_RAW) {
     streaming_queue_init2(&sq, SMT_PACKET, qsize);
@@ -846,12 +1345,15 @@ http_stream_channel(http_connection_t *hc, channel_t *ch, int weight)
   }
 
   tcp_get_ip_str((struct sockaddr*)hc->hc_peer, addrbuf, 50);
+  streaming_queue_set_watermarks(&sq, qlow, qhigh);
   s = subscription_create_from_channel(ch, weight ?: 100, "HTTP", st, flags,
                addrbuf,
                hc->hc_username,
                http_arg_get(&hc->hc_args, "User-Agent"));
 
   if(s) {
+    snprintf(sqname, sizeof(sqname), "HTTP: %s %s", addrbuf, hc->hc_url_orig);
+    streaming_queue_register(&sq, sqname);
     name = tvh_strdupa(channel_get_name(ch));
     pthread_mutex_unlock(&global_lock);
     http_stream_run(hc, &sq, name, mc, s, &cfg->dvr_muxcnf);
@@ -4,6 +4,7 @@
 #include <sys/types.h>          /* See NOTES */
 #include <sys/socket.h>
 #include <unistd.h>
+#include <sys/uio.h>
 #include <signal.h>
 #include <pthread.h>
 
@@ -90,6 +91,37 @@ tvh_write(int fd, const void *buf, size_t len)
   return len ? 1 : 0;
 }
 
+/*
+ * Note: iov is modified in place on short writes
+ */
+int
+tvh_writev(int fd, struct iovec *iov, int iovcnt)
+{
+  ssize_t c;
+
+  while (iovcnt > 0) {
+    c = writev(fd, iov, iovcnt > IOV_MAX ? IOV_MAX : iovcnt);
+    if (c < 0) {
+      if (ERRNO_AGAIN(errno)) {
+        usleep(100);
+        continue;
+      }
+      break;
+    }
+    while (iovcnt > 0 && (size_t)c >= iov->iov_len) {
+      c -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (c) {
+      iov->iov_base += c;
+      iov->iov_len  -= c;
+    }
+  }
+
+  return iovcnt > 0 ? 1 : 0;
+}
+
 struct
 thread_state {
   void *(*run)(void*);